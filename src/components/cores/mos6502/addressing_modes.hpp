@@ -11,6 +11,9 @@ enum MemoryAction {
 //instead you get whatever is in $0000 and do your business.
 //This leads to an awkward situation where STA $0000 you want to *actually* take $0000, so the MemoryAction
 //lets us pass addresses for store-based instructions and actual data for all other instructions.
+//
+//The operand access is the last cycle of the addressing mode, cpu.busCycle() moves the clock there first
+//so the memory side sees it happen on the right cycle.
 
 struct Implied {
     template <MemoryAction m, typename CPU, typename Input>
@@ -31,6 +34,7 @@ struct ZPX {
     template <MemoryAction m,typename CPU, typename Input>
     static auto execute(CPU& cpu, uint64_t(CPU::*instruction)(Input)) -> uint64_t {
       uint16_t mem = static_cast<uint16_t>(cpu.getX() + cpu.load(cpu.nextByte()))&0xFF;
+      cpu.busCycle(3);
       if constexpr(m == IsLoad) {
         uint8_t data = cpu.load(mem);
         return 4 + (cpu.*instruction)(data);
@@ -44,6 +48,7 @@ struct ZPY {
     template <MemoryAction m,typename CPU, typename Input>
     static auto execute(CPU& cpu, uint64_t(CPU::*instruction)(Input)) -> uint64_t {
       uint16_t mem = static_cast<uint16_t>(cpu.getY() + cpu.load(cpu.nextByte()))&0xFF;
+      cpu.busCycle(3);
       if constexpr(m == IsLoad) {
         uint8_t data = cpu.load(mem);
         return 4 + (cpu.*instruction)(data);
@@ -58,6 +63,7 @@ struct ZP {
     template <MemoryAction m,typename CPU, typename Input>
     static auto execute(CPU& cpu, uint64_t(CPU::*instruction)(Input)) -> uint64_t {
       auto page = cpu.load(cpu.nextByte());
+      cpu.busCycle(2);
       if constexpr(m == IsLoad) {
         return 3 + (cpu.*instruction)(cpu.load(page));
       } else {
@@ -71,6 +77,7 @@ struct AbsAddress {
     static auto execute(CPU& cpu, uint64_t(CPU::*instruction)(Input)) -> uint64_t {
       auto lowByte = cpu.load(cpu.nextByte());
       auto highByte = cpu.load(cpu.nextByte());
+      cpu.busCycle(3);
       if constexpr(m == IsLoad) {
         auto data = cpu.load((highByte << 8) | lowByte);
         return 4 + (cpu.*instruction)(data);
@@ -89,9 +96,11 @@ struct AbsX {
       auto addr = baseAddr + cpu.getX();
       bool pageCrossed = (baseAddr & 0xFF00) != (addr & 0xFF00);
       if constexpr(m == IsLoad){
+        cpu.busCycle(3 + pageCrossed);
         auto data = cpu.load(addr);
         return 4 + pageCrossed + (cpu.*instruction)(data);
       } else {
+        cpu.busCycle(4);
         return 5 + (cpu.*instruction)(addr);
       }
     }
@@ -106,9 +115,11 @@ struct AbsY {
       auto addr = baseAddr + cpu.getY();
       bool pageCrossed = (baseAddr & 0xFF00) != (addr & 0xFF00);
       if constexpr(m == IsLoad) {
+        cpu.busCycle(3 + pageCrossed);
         auto data = cpu.load(addr);
         return 4 + pageCrossed + (cpu.*instruction)(data);
       } else {
+        cpu.busCycle(4);
         return 5 + (cpu.*instruction)(addr);
       }
     }
@@ -122,6 +133,7 @@ struct IndX {
       auto lowByte = cpu.load(wrappedLow);
       auto highByte = cpu.load(wrappedLow+1);
       auto addr = (highByte << 8) | lowByte;
+      cpu.busCycle(5);
       if constexpr(m == IsLoad) {
         auto data = cpu.load(addr);
         return 6 + (cpu.*instruction)(data);
@@ -141,9 +153,11 @@ struct IndY {
       auto addr = baseAddr + cpu.getY();
       bool pageCrossed = (baseAddr & 0xFF00) != (addr & 0xFF00);
       if constexpr(m == IsLoad) {
+        cpu.busCycle(4 + pageCrossed);
         auto data = cpu.load(addr);
         return 5 + pageCrossed + (cpu.*instruction)(data);
       } else {
+        cpu.busCycle(5);
         return 6 + (cpu.*instruction)(addr);
       }
     }
@@ -27,18 +27,20 @@ struct mos6502 {
 
 #ifdef NDEBUG
   // Release build: no validation
-  #define DEFINE_VALUE_INST(OpCode, AddrMode, Operation) case(OpCode) : { INST(AddrMode, MemoryAction::IsLoad, Operation) break ;};
-  #define DEFINE_ADDRESS_INST(OpCode, AddrMode, Operation) case(OpCode) : { INST(AddrMode, MemoryAction::IsStore, Operation) break ;};
+  #define DEFINE_VALUE_INST(OpCode, AddrMode, Operation) case(OpCode) : { R.Cycles = instruction_start_ + INST(AddrMode, MemoryAction::IsLoad, Operation) break ;};
+  #define DEFINE_ADDRESS_INST(OpCode, AddrMode, Operation) case(OpCode) : { R.Cycles = instruction_start_ + INST(AddrMode, MemoryAction::IsStore, Operation) break ;};
 #else
   // Debug build: validate cycle counts
   #define DEFINE_VALUE_INST(OpCode, AddrMode, Operation) case(OpCode) : { \
     auto cycles = INST(AddrMode, MemoryAction::IsLoad, Operation) \
     validateCycles(OpCode, cycles); \
+    R.Cycles = instruction_start_ + cycles; \
     break; \
   };
   #define DEFINE_ADDRESS_INST(OpCode, AddrMode, Operation) case(OpCode) : { \
     auto cycles = INST(AddrMode, MemoryAction::IsStore, Operation) \
     validateCycles(OpCode, cycles); \
+    R.Cycles = instruction_start_ + cycles; \
     break; \
   };
 #endif
@@ -47,6 +49,14 @@ struct mos6502 {
     mos6502(Memory& mem) : mem_component(mem) {
       static_assert(std::is_same_v<MemType, Memory&>, "We're good");
     };
+    // Registers live in storage owned by someone else (e.g. a system arena),
+    // so the whole machine state can be reset or restored with one memcpy.
+    mos6502(Memory& mem, Registers& regs) : mem_component(mem), R(regs) {
+      static_assert(std::is_same_v<MemType, Memory&>, "We're good");
+    };
+    // R may point into our own storage, a copy would alias the original
+    mos6502(const mos6502&) = delete;
+    auto operator=(const mos6502&) -> mos6502& = delete;
 
     auto setPC(uint16_t pc) -> void {
       R.PC = pc;
@@ -105,10 +115,82 @@ struct mos6502 {
       return R.Status.D;
     }
 
+    auto getCycles() const -> uint64_t {
+      return R.Cycles;
+    }
+
+    // Non-maskable interrupt, taken between instructions. PC already points
+    // at the next opcode so it is pushed as is.
+    auto nmi() -> void {
+      pushStack((R.PC >> 8) & 0xFF);
+      pushStack(R.PC & 0xFF);
+      pushStack(getStatusByte() & ~0x10);
+      R.Status.I = 1;
+      uint8_t low = mem_component.load(0xFFFA);
+      uint8_t high = mem_component.load(0xFFFB);
+      R.PC = (high << 8) | low;
+      R.Cycles += 7;
+    }
+
+    // Maskable interrupt, level triggered: the caller keeps asserting it and
+    // it is only taken while I is clear. Returns whether it was taken.
+    auto irq() -> bool {
+      if(R.Status.I) {
+        return false;
+      }
+      pushStack((R.PC >> 8) & 0xFF);
+      pushStack(R.PC & 0xFF);
+      pushStack(getStatusByte() & ~0x10);
+      R.Status.I = 1;
+      uint8_t low = mem_component.load(0xFFFE);
+      uint8_t high = mem_component.load(0xFFFF);
+      R.PC = (high << 8) | low;
+      R.Cycles += 7;
+      return true;
+    }
+
+    // Moves the clock to the bus cycle offset cycles into the current
+    // instruction, before the access made on it. Memory reads the clock, so
+    // register reads and writes land on the cycle they happen on rather than
+    // the instruction's first; the instruction still ends on its full count.
+    auto busCycle(uint64_t offset) -> void {
+      R.Cycles = instruction_start_ + offset;
+    }
+
+    // DMA halted the CPU for cycles after the current instruction
+    auto stall(uint64_t cycles) -> void {
+      R.Cycles += cycles;
+    }
+
+    // Runs instructions until the clock reaches deadline, at least one, and
+    // returns how many. The deadline is reread after every instruction, so
+    // the memory side can end the batch early by pulling it in. The batch
+    // also ends when an instruction (CLI, PLP, RTI) clears I, so an IRQ
+    // that was held off by it can be taken straight away.
+    auto runUntil(const uint64_t& deadline) -> uint64_t {
+      uint64_t count = 0;
+      do {
+        const bool masked = R.Status.I;
+        runCycle();
+        count++;
+        if(masked && !R.Status.I) {
+          break;
+        }
+      } while(R.Cycles < deadline);
+      return count;
+    }
+
     auto load(uint16_t address) -> uint8_t {
       return mem_component.load(address);
     }
 
+    // Read-modify-write instructions store the result two cycles after the
+    // read, the cycle between rewrites the old value
+    auto writeBack(uint16_t address, uint8_t value) -> void {
+      R.Cycles += 2;
+      mem_component.store(address, value);
+    }
+
     auto pushStack(uint8_t value) -> void {
       mem_component.store(0x0100 + R.SP, value);
       R.SP--;
@@ -160,7 +242,10 @@ private:
     using MemType = std::conditional_t<std::is_same_v<Memory, cores::testMem>, Memory, Memory&>;
     MemType& mem_component;
 
-    Registers R;
+    Registers own_regs_{};
+    Registers& R = own_regs_;
+    // Clock at the start of the instruction being run
+    uint64_t instruction_start_ = 0;
 
     auto willOverflow(uint8_t acc, uint8_t mem, uint16_t res) -> bool {
       return ((acc^res) & (mem^res) & 0x80) != 0x00;
@@ -317,7 +402,7 @@ public:
   auto inc(uint16_t addr) -> uint64_t {
      uint8_t value = mem_component.load(addr);
      value++;
-     mem_component.store(addr, value);
+     writeBack(addr, value);
      R.Status.Z = value == 0;
      R.Status.N = value & 0x80;
      return 2;
@@ -340,7 +425,7 @@ public:
   auto dec(uint16_t addr) -> uint64_t {
      uint8_t value = mem_component.load(addr);
      value--;
-     mem_component.store(addr, value);
+     writeBack(addr, value);
      R.Status.Z = value == 0;
      R.Status.N = value & 0x80;
      return 2;
@@ -373,7 +458,7 @@ public:
      uint8_t value = mem_component.load(addr);
      R.Status.C = (value & 0x80) != 0;
      value <<= 1;
-     mem_component.store(addr, value);
+     writeBack(addr, value);
      R.Status.Z = value == 0;
      R.Status.N = value & 0x80;
      return 2;
@@ -391,7 +476,7 @@ public:
      uint8_t value = mem_component.load(addr);
      R.Status.C = value & 0x01;
      value >>= 1;
-     mem_component.store(addr, value);
+     writeBack(addr, value);
      R.Status.Z = value == 0;
      R.Status.N = 0;
      return 2;
@@ -411,7 +496,7 @@ public:
      uint8_t oldCarry = R.Status.C;
      R.Status.C = (value & 0x80) != 0;
      value = (value << 1) | oldCarry;
-     mem_component.store(addr, value);
+     writeBack(addr, value);
      R.Status.Z = value == 0;
      R.Status.N = value & 0x80;
      return 2;
@@ -431,7 +516,7 @@ public:
      uint8_t oldCarry = R.Status.C;
      R.Status.C = value & 0x01;
      value = (value >> 1) | (oldCarry << 7);
-     mem_component.store(addr, value);
+     writeBack(addr, value);
      R.Status.Z = value == 0;
      R.Status.N = value & 0x80;
      return 2;
@@ -637,6 +722,7 @@ public:
 
 public:
     auto runCycle() -> void {
+      instruction_start_ = R.Cycles;
       switch(mem_component.load(R.PC)) {
         //memory
         DEFINE_VALUE_INST(0xA9, ImmediateMode, lda)
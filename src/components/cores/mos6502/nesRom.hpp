@@ -7,6 +7,8 @@
 #include <stdexcept>
 #include <string>
 #include <span>
+#include <optional>
+#include <utils/hash.hpp>
 
 namespace cores {
 namespace mos6502 {
@@ -26,7 +28,10 @@ enum class INesVersion {
 enum class Mirroring {
     HORIZONTAL = 0,
     VERTICAL = 1,
-    FOUR_SCREEN = 2
+    FOUR_SCREEN = 2,
+    // Only selected at runtime by mappers (e.g. MMC1), never found in a header
+    SINGLE_SCREEN_LOWER = 3,
+    SINGLE_SCREEN_UPPER = 4
 };
 
 enum class ConsoleType {
@@ -141,6 +146,19 @@ struct INesHeader {
     }
 };
 
+// Corrected header values for a known dump. Field widths are fixed because
+// this is also the on-disk record format of the RomDatabase.
+struct HeaderOverride {
+    uint32_t prg_ram_size;
+    uint32_t chr_ram_size;
+    uint16_t mapper;
+    uint8_t submapper;
+    uint8_t mirroring;  // Mirroring value
+    uint8_t battery;
+    uint8_t reserved[3];
+};
+static_assert(sizeof(HeaderOverride) == 16);
+
 class NesRom {
 public:
     NesRom() = default;
@@ -199,6 +217,12 @@ public:
         prg_rom_offset_ = trainer_size;
         chr_rom_offset_ = trainer_size + prg_rom_size;
 
+        // PRG and CHR are contiguous, hash them in one go
+        std::span<const uint8_t> contents(data_.data() + prg_rom_offset_, prg_rom_size + chr_rom_size);
+        crc32_ = Components::crc32(contents);
+        sha1_ = Components::sha1(contents);
+        override_.reset();
+
         return true;
     }
 
@@ -254,18 +278,30 @@ public:
     }
 
     auto getMapperNumber() const -> uint16_t {
+        if (override_) {
+            return override_->mapper;
+        }
         return header_.getMapperNumber();
     }
 
     auto getSubmapperNumber() const -> uint8_t {
+        if (override_) {
+            return override_->submapper;
+        }
         return header_.getSubmapperNumber();
     }
 
     auto getMirroring() const -> Mirroring {
+        if (override_) {
+            return static_cast<Mirroring>(override_->mirroring);
+        }
         return header_.getMirroring();
     }
 
     auto hasBatteryBackedRAM() const -> bool {
+        if (override_) {
+            return override_->battery != 0;
+        }
         return header_.hasBatteryBackedRAM();
     }
 
@@ -278,10 +314,16 @@ public:
     }
 
     auto getPrgRamSize() const -> size_t {
+        if (override_) {
+            return override_->prg_ram_size;
+        }
         return header_.getPrgRamSize();
     }
 
     auto getChrRamSize() const -> size_t {
+        if (override_) {
+            return override_->chr_ram_size;
+        }
         return header_.getChrRamSize();
     }
 
@@ -293,6 +335,28 @@ public:
         return header_.isValid() && version_ != INesVersion::UNKNOWN;
     }
 
+    // Hashes of PRG+CHR (trainer and header excluded), computed at load
+    auto getCrc32() const -> uint32_t {
+        return crc32_;
+    }
+
+    auto getSha1() const -> const Components::Sha1Digest& {
+        return sha1_;
+    }
+
+    // Replaces the header's mapper, mirroring and RAM fields, e.g. with values
+    // from a RomDatabase for dumps known to carry a bad header
+    auto applyOverride(const HeaderOverride& fix) -> void {
+        if (fix.mirroring > static_cast<uint8_t>(Mirroring::SINGLE_SCREEN_UPPER)) {
+            throw NesRomException("Invalid mirroring in header override: " + std::to_string(fix.mirroring));
+        }
+        override_ = fix;
+    }
+
+    auto hasOverride() const -> bool {
+        return override_.has_value();
+    }
+
     auto getRawData() const -> const std::vector<uint8_t>& {
         return data_;
     }
@@ -314,6 +378,9 @@ private:
     size_t trainer_offset_{0};
     size_t prg_rom_offset_{0};
     size_t chr_rom_offset_{0};
+    uint32_t crc32_{0};
+    Components::Sha1Digest sha1_{};
+    std::optional<HeaderOverride> override_;
 };
 
 }
@@ -1,4 +1,6 @@
 #pragma once
+#include <cstdint>
+#include <type_traits>
 #if __cpp_lib_print >= 202207L
 #include <print>
 #else
@@ -24,6 +26,7 @@ namespace mos6502 {
 		uint8_t X = 0;
 		uint8_t Y = 0;
 		PStat Status;
+		uint64_t Cycles = 0;  // CPU cycles executed since power on
 
     auto setZ(uint8_t val) -> void {
       Status.Z = val == 0 ? 0x1: 0x0; 
@@ -44,8 +47,11 @@ namespace mos6502 {
 			 Status.B = 0;
 			 Status.O = 0;
 			 Status.N = 0;
+       Cycles = 0;
     }
 	};
+	// Registers are copied around as raw bytes (arena reset, checkpoints)
+	static_assert(std::is_trivially_copyable_v<Registers>);
 }
 }
 
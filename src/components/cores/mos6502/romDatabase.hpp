@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <vector>
+#include <utils/mapped_file.hpp>
+#include "nesRom.hpp"
+
+namespace cores {
+namespace mos6502 {
+
+// One known dump. Records are stored sorted by (crc32, sha1) so the database
+// file can be used in place, straight out of mmap.
+struct RomDatabaseEntry {
+    uint32_t crc32;
+    uint8_t sha1[20];
+    HeaderOverride fix;
+};
+static_assert(sizeof(RomDatabaseEntry) == 40);
+
+struct RomDatabaseHeader {
+    char magic[8];  // "TWIXNDB\0"
+    uint32_t version;
+    uint32_t count;
+};
+
+// Header-correction database. Lookup is a binary search over the mapped
+// records, there is no parse step when opening the file.
+class RomDatabase {
+public:
+    static constexpr char MAGIC[8] = {'T', 'W', 'I', 'X', 'N', 'D', 'B', '\0'};
+    static constexpr uint32_t VERSION = 1;
+
+    RomDatabase() = default;
+
+    explicit RomDatabase(const std::filesystem::path& path)
+        : file_(Components::MappedFile::openReadOnly(path)) {
+        if (file_.size() < sizeof(RomDatabaseHeader)) {
+            throw NesRomException("ROM database too small: " + path.string());
+        }
+        RomDatabaseHeader header;
+        std::memcpy(&header, file_.data(), sizeof(header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION) {
+            throw NesRomException("Not a ROM database: " + path.string());
+        }
+        if (file_.size() < sizeof(RomDatabaseHeader) + header.count * sizeof(RomDatabaseEntry)) {
+            throw NesRomException("Truncated ROM database: " + path.string());
+        }
+        // mmap is page aligned and the header is 16 bytes, so records are aligned
+        entries_ = std::span<const RomDatabaseEntry>(
+            reinterpret_cast<const RomDatabaseEntry*>(file_.data() + sizeof(RomDatabaseHeader)), header.count);
+    }
+
+    auto find(uint32_t crc32, const Components::Sha1Digest& sha1) const -> const RomDatabaseEntry* {
+        Key key{crc32, sha1.data()};
+        auto it = std::lower_bound(entries_.begin(), entries_.end(), key,
+            [](const RomDatabaseEntry& entry, const Key& k) { return less(entry, k); });
+        if (it != entries_.end() && !less(key, *it)) {
+            return &*it;
+        }
+        return nullptr;
+    }
+
+    // Applies the stored fix if the ROM is known, returns whether it was
+    auto correct(NesRom& rom) const -> bool {
+        if (auto* entry = find(rom.getCrc32(), rom.getSha1())) {
+            rom.applyOverride(entry->fix);
+            return true;
+        }
+        return false;
+    }
+
+    auto size() const -> size_t {
+        return entries_.size();
+    }
+
+    // Builds a database file from unsorted records
+    static auto write(const std::filesystem::path& path, std::vector<RomDatabaseEntry> entries) -> void {
+        std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+            return less(Key{a.crc32, a.sha1}, b);
+        });
+        RomDatabaseHeader header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.count = static_cast<uint32_t>(entries.size());
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(RomDatabaseEntry));
+        if (!out) {
+            throw NesRomException("Failed to write ROM database: " + path.string());
+        }
+    }
+
+private:
+    struct Key {
+        uint32_t crc32;
+        const uint8_t* sha1;
+    };
+
+    static auto less(const RomDatabaseEntry& entry, const Key& key) -> bool {
+        if (entry.crc32 != key.crc32) {
+            return entry.crc32 < key.crc32;
+        }
+        return std::memcmp(entry.sha1, key.sha1, 20) < 0;
+    }
+
+    static auto less(const Key& key, const RomDatabaseEntry& entry) -> bool {
+        if (key.crc32 != entry.crc32) {
+            return key.crc32 < entry.crc32;
+        }
+        return std::memcmp(key.sha1, entry.sha1, 20) < 0;
+    }
+
+    Components::MappedFile file_;
+    std::span<const RomDatabaseEntry> entries_;
+};
+
+}
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <utility>
+#include <vector>
+
+namespace Components {
+	/**
+	* Body of a cooperative thread: a C++20 coroutine that starts suspended
+	* and only runs when a CoScheduler resumes it. Stackless, so it can only
+	* yield from its own body, never from a function it calls.
+	**/
+	class CoThread {
+	public:
+	  struct promise_type {
+		std::exception_ptr exception;
+
+		auto get_return_object() -> CoThread {
+		  return CoThread{std::coroutine_handle<promise_type>::from_promise(*this)};
+		}
+		auto initial_suspend() noexcept -> std::suspend_always { return {}; }
+		auto final_suspend() noexcept -> std::suspend_always { return {}; }
+		auto return_void() -> void {}
+		auto unhandled_exception() -> void { exception = std::current_exception(); }
+	  };
+
+	  CoThread(CoThread&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+	  CoThread(const CoThread&) = delete;
+	  auto operator=(const CoThread&) -> CoThread& = delete;
+	  auto operator=(CoThread&&) -> CoThread& = delete;
+
+	  ~CoThread() {
+		if (handle_) {
+		  handle_.destroy();
+		}
+	  }
+
+	  // Runs until the next yield or the end, rethrowing whatever escaped
+	  auto resume() -> void {
+		handle_.resume();
+		if (handle_.promise().exception) {
+		  std::rethrow_exception(std::exchange(handle_.promise().exception, {}));
+		}
+	  }
+
+	  auto done() const -> bool { return handle_.done(); }
+
+	private:
+	  explicit CoThread(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+	  std::coroutine_handle<promise_type> handle_;
+	};
+
+	/**
+	* Clocked cooperative threads, scheduled the way higan does it with libco:
+	* every thread has a clock, runs ahead until it has to sync with the
+	* others and then yields, and the thread furthest behind always goes
+	* next. Ties go to the thread added first. A thread that is still behind
+	* everyone after a step() keeps running without a switch, so a switch
+	* only costs when the order actually changes.
+	**/
+	class CoScheduler {
+	public:
+	  static constexpr uint64_t NEVER = ~0ull;
+
+	  // The thread's clock starts at clock. Returns its id.
+	  auto add(CoThread thread, uint64_t clock = 0) -> size_t {
+		threads_.push_back({std::move(thread), clock});
+		return threads_.size() - 1;
+	  }
+
+	  auto clock(size_t id) const -> uint64_t {
+		return threads_[id].clock;
+	  }
+
+	  // co_await from inside thread id: advances its clock by ticks and
+	  // yields if another thread is now behind it or the run is over
+	  auto step(size_t id, uint64_t ticks) {
+		struct Step {
+		  CoScheduler& scheduler;
+		  size_t id;
+
+		  auto await_ready() const noexcept -> bool { return !scheduler.mustYield(id); }
+		  auto await_suspend(std::coroutine_handle<>) const noexcept -> void {}
+		  auto await_resume() const noexcept -> void {}
+		};
+		threads_[id].clock += ticks;
+		return Step{*this, id};
+	  }
+
+	  // Resumes the thread furthest behind until every clock has reached
+	  // until. Threads that finish stop taking part.
+	  auto runUntil(uint64_t until) -> void {
+		until_ = until;
+		for (;;) {
+		  const size_t id = earliest();
+		  if (id == threads_.size() || threads_[id].clock >= until) {
+			break;
+		  }
+		  threads_[id].body.resume();
+		  if (threads_[id].body.done()) {
+			threads_[id].clock = NEVER;
+		  }
+		  switches_++;
+		}
+	  }
+
+	  // Resumes so far, the cost the step() fast path avoids
+	  auto switches() const -> uint64_t { return switches_; }
+
+	private:
+	  struct Thread {
+		CoThread body;
+		uint64_t clock;
+	  };
+
+	  auto earliest() const -> size_t {
+		size_t best = threads_.size();
+		for (size_t i = 0; i < threads_.size(); i++) {
+		  if (threads_[i].clock != NEVER && (best == threads_.size() || threads_[i].clock < threads_[best].clock)) {
+			best = i;
+		  }
+		}
+		return best;
+	  }
+
+	  auto mustYield(size_t id) const -> bool {
+		const uint64_t clock = threads_[id].clock;
+		if (clock >= until_) {
+		  return true;
+		}
+		for (size_t i = 0; i < threads_.size(); i++) {
+		  if (i != id && (threads_[i].clock < clock || (threads_[i].clock == clock && i < id))) {
+			return true;
+		  }
+		}
+		return false;
+	  }
+
+	  std::vector<Thread> threads_;
+	  uint64_t until_ = 0;
+	  uint64_t switches_ = 0;
+	};
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define TWIX_CPU_FEATURES_X86 1
+#endif
+
+namespace Components {
+	/**
+	* Instruction set extensions the SIMD kernels are written for. Modules pick
+	* their widest usable kernel set from this once, everything reads false off
+	* x86.
+	**/
+	struct CpuFeatures {
+	  bool sse2 = false;
+	  bool sse41 = false;
+	  bool avx2 = false;
+	  bool fma = false;
+	  bool sha = false;  // SHA extensions
+	};
+
+	inline auto cpuFeatures() -> const CpuFeatures& {
+	  static const CpuFeatures features = [] {
+		CpuFeatures found;
+#ifdef TWIX_CPU_FEATURES_X86
+		__builtin_cpu_init();
+		found.sse2 = __builtin_cpu_supports("sse2");
+		found.sse41 = __builtin_cpu_supports("sse4.1");
+		found.avx2 = __builtin_cpu_supports("avx2");
+		found.fma = __builtin_cpu_supports("fma");
+		unsigned a, b, c, d;
+		found.sha = __get_cpuid_count(7, 0, &a, &b, &c, &d) && ((b >> 29) & 1);
+#endif
+		return found;
+	  }();
+	  return features;
+	}
+};
@@ -0,0 +1,249 @@
+#pragma once
+
+#include "cpu_features.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TWIX_HASH_X86 1
+#endif
+
+namespace Components {
+	namespace detail {
+	  // Eight 256 entry tables for the reflected 0xEDB88320 polynomial, table[k][b]
+	  // is the CRC of byte b followed by k zero bytes.
+	  constexpr auto makeCrc32Tables() -> std::array<std::array<uint32_t, 256>, 8> {
+		std::array<std::array<uint32_t, 256>, 8> tables{};
+		for (uint32_t i = 0; i < 256; i++) {
+		  uint32_t crc = i;
+		  for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+		  }
+		  tables[0][i] = crc;
+		}
+		for (uint32_t i = 0; i < 256; i++) {
+		  for (size_t k = 1; k < 8; k++) {
+			tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xFF];
+		  }
+		}
+		return tables;
+	  }
+
+	  inline constexpr auto CRC32_TABLES = makeCrc32Tables();
+	}
+
+	/**
+	* CRC-32 (zlib/PNG flavour) using slice-by-8, eight bytes per iteration
+	* with independent table lookups. Pass the previous result as crc to hash
+	* data in pieces.
+	**/
+	inline auto crc32(std::span<const uint8_t> data, uint32_t crc = 0) -> uint32_t {
+	  const auto& t = detail::CRC32_TABLES;
+	  crc = ~crc;
+	  const uint8_t* p = data.data();
+	  size_t n = data.size();
+	  while (n >= 8) {
+		uint32_t lo;
+		uint32_t hi;
+		std::memcpy(&lo, p, 4);
+		std::memcpy(&hi, p + 4, 4);
+		if constexpr (std::endian::native == std::endian::big) {
+		  lo = std::byteswap(lo);
+		  hi = std::byteswap(hi);
+		}
+		lo ^= crc;
+		crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+			  t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+		p += 8;
+		n -= 8;
+	  }
+	  while (n--) {
+		crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+	  }
+	  return ~crc;
+	}
+
+	using Sha1Digest = std::array<uint8_t, 20>;
+
+#ifdef TWIX_HASH_X86
+	namespace detail {
+	  // Four SHA-1 rounds with the SHA extensions. G is the group index (rounds
+	  // 4G..4G+3); message schedule work for later groups is interleaved the
+	  // same way Intel's reference code does it.
+	  template<int G>
+	  __attribute__((target("sha,sse4.1")))
+	  inline auto sha1NiGroup(__m128i& abcd, __m128i (&e)[2], __m128i (&msg)[4]) -> void {
+		constexpr int cur = G % 4;
+		__m128i& next_e = e[G & 1];
+		if constexpr (G == 0) {
+		  next_e = _mm_add_epi32(next_e, msg[cur]);
+		} else {
+		  next_e = _mm_sha1nexte_epu32(next_e, msg[cur]);
+		}
+		e[(G + 1) & 1] = abcd;
+		if constexpr (G >= 3 && G <= 18) {
+		  msg[(G + 1) % 4] = _mm_sha1msg2_epu32(msg[(G + 1) % 4], msg[cur]);
+		}
+		abcd = _mm_sha1rnds4_epu32(abcd, next_e, G / 5);
+		if constexpr (G >= 1 && G <= 16) {
+		  msg[(G + 3) % 4] = _mm_sha1msg1_epu32(msg[(G + 3) % 4], msg[cur]);
+		}
+		if constexpr (G >= 2 && G <= 17) {
+		  msg[(G + 2) % 4] = _mm_xor_si128(msg[(G + 2) % 4], msg[cur]);
+		}
+		if constexpr (G < 19) {
+		  sha1NiGroup<G + 1>(abcd, e, msg);
+		}
+	  }
+
+	  __attribute__((target("sha,sse4.1")))
+	  inline auto sha1NiCompress(uint32_t* h, const uint8_t* data, size_t blocks) -> void {
+		const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+		__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(h)), 0x1B);
+		__m128i e0 = _mm_set_epi32(static_cast<int>(h[4]), 0, 0, 0);
+		for (; blocks > 0; blocks--, data += 64) {
+		  __m128i abcd_save = abcd;
+		  __m128i e_save = e0;
+		  __m128i msg[4];
+		  for (int i = 0; i < 4; i++) {
+			msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i)), mask);
+		  }
+		  __m128i e[2] = {e0, _mm_setzero_si128()};
+		  sha1NiGroup<0>(abcd, e, msg);
+		  e0 = _mm_sha1nexte_epu32(e[0], e_save);
+		  abcd = _mm_add_epi32(abcd, abcd_save);
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(h), _mm_shuffle_epi32(abcd, 0x1B));
+		h[4] = static_cast<uint32_t>(_mm_extract_epi32(e0, 3));
+	  }
+	}
+#endif
+
+	/**
+	* Incremental SHA-1, only used to fingerprint ROM contents so no effort is
+	* made to be constant time.
+	**/
+	class Sha1 {
+	public:
+	  auto update(std::span<const uint8_t> data) -> void {
+		// An empty span may have no storage, memcpy must not see its null pointer
+		if (data.empty()) {
+		  return;
+		}
+		const uint8_t* p = data.data();
+		size_t n = data.size();
+		total_ += n;
+		if (buffered_ > 0) {
+		  size_t take = std::min(n, block_.size() - buffered_);
+		  std::memcpy(block_.data() + buffered_, p, take);
+		  buffered_ += take;
+		  p += take;
+		  n -= take;
+		  if (buffered_ < block_.size()) {
+			return;
+		  }
+		  compressBlocks(block_.data(), 1);
+		  buffered_ = 0;
+		}
+		if (n >= 64) {
+		  size_t blocks = n / 64;
+		  compressBlocks(p, blocks);
+		  p += blocks * 64;
+		  n -= blocks * 64;
+		}
+		std::memcpy(block_.data(), p, n);
+		buffered_ = n;
+	  }
+
+	  auto finish() -> Sha1Digest {
+		uint64_t bits = total_ * 8;
+		uint8_t pad = 0x80;
+		update({&pad, 1});
+		uint8_t zero = 0;
+		while (buffered_ != 56) {
+		  update({&zero, 1});
+		}
+		uint8_t length[8];
+		for (int i = 0; i < 8; i++) {
+		  length[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+		}
+		update(length);
+		Sha1Digest digest{};
+		for (int i = 0; i < 5; i++) {
+		  for (int b = 0; b < 4; b++) {
+			digest[i * 4 + b] = static_cast<uint8_t>(h_[i] >> (24 - 8 * b));
+		  }
+		}
+		return digest;
+	  }
+
+	private:
+	  auto compressBlocks(const uint8_t* data, size_t blocks) -> void {
+#ifdef TWIX_HASH_X86
+		if (cpuFeatures().sha && cpuFeatures().sse41) {
+		  detail::sha1NiCompress(h_.data(), data, blocks);
+		  return;
+		}
+#endif
+		for (; blocks > 0; blocks--, data += 64) {
+		  compress(data);
+		}
+	  }
+
+	  auto compress(const uint8_t* block) -> void {
+		uint32_t w[80];
+		for (int i = 0; i < 16; i++) {
+		  w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) |
+				 (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+		}
+		for (int i = 16; i < 80; i++) {
+		  w[i] = std::rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+		}
+		uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3], e = h_[4];
+		for (int i = 0; i < 80; i++) {
+		  uint32_t f;
+		  uint32_t k;
+		  if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		  } else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		  } else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		  } else {
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		  }
+		  uint32_t temp = std::rotl(a, 5) + f + e + k + w[i];
+		  e = d;
+		  d = c;
+		  c = std::rotl(b, 30);
+		  b = a;
+		  a = temp;
+		}
+		h_[0] += a;
+		h_[1] += b;
+		h_[2] += c;
+		h_[3] += d;
+		h_[4] += e;
+	  }
+
+	  std::array<uint32_t, 5> h_{0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+	  std::array<uint8_t, 64> block_{};
+	  size_t buffered_ = 0;
+	  uint64_t total_ = 0;
+	};
+
+	inline auto sha1(std::span<const uint8_t> data) -> Sha1Digest {
+	  Sha1 hasher;
+	  hasher.update(data);
+	  return hasher.finish();
+	}
+};
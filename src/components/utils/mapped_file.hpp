@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Components {
+	class MappedFileException : public std::runtime_error {
+	public:
+	  explicit MappedFileException(const std::string& message) : std::runtime_error(message) {}
+	};
+
+	/**
+	* MappedFile is a RAII wrapper around mmap. Read-only mappings are used to
+	* look at files without copying them, writable ones are MAP_SHARED so stores
+	* land in the page cache and reach the disk on flush() or unmap.
+	**/
+	class MappedFile {
+	public:
+	  MappedFile() = default;
+
+	  static auto openReadOnly(const std::filesystem::path& path) -> MappedFile {
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+		  throw MappedFileException("Could not open " + path.string());
+		}
+		struct stat st{};
+		if (::fstat(fd, &st) != 0) {
+		  ::close(fd);
+		  throw MappedFileException("Could not stat " + path.string());
+		}
+		MappedFile file;
+		file.size_ = static_cast<size_t>(st.st_size);
+		if (file.size_ > 0) {
+		  void* data = ::mmap(nullptr, file.size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		  if (data == MAP_FAILED) {
+			::close(fd);
+			throw MappedFileException("Could not map " + path.string());
+		  }
+		  file.data_ = static_cast<uint8_t*>(data);
+		}
+		::close(fd);
+		return file;
+	  }
+
+	  // Creates the file if needed and grows it to size, existing contents are kept
+	  static auto openWritable(const std::filesystem::path& path, size_t size) -> MappedFile {
+		int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (fd < 0) {
+		  throw MappedFileException("Could not open " + path.string());
+		}
+		struct stat st{};
+		if (::fstat(fd, &st) != 0 ||
+			(static_cast<size_t>(st.st_size) < size && ::ftruncate(fd, static_cast<off_t>(size)) != 0)) {
+		  ::close(fd);
+		  throw MappedFileException("Could not size " + path.string());
+		}
+		void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED) {
+		  throw MappedFileException("Could not map " + path.string());
+		}
+		MappedFile file;
+		file.data_ = static_cast<uint8_t*>(data);
+		file.size_ = size;
+		file.writable_ = true;
+		return file;
+	  }
+
+	  MappedFile(MappedFile&& other) noexcept
+		: data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)),
+		  writable_(std::exchange(other.writable_, false)) {}
+
+	  auto operator=(MappedFile&& other) noexcept -> MappedFile& {
+		if (this != &other) {
+		  unmap();
+		  data_ = std::exchange(other.data_, nullptr);
+		  size_ = std::exchange(other.size_, 0);
+		  writable_ = std::exchange(other.writable_, false);
+		}
+		return *this;
+	  }
+
+	  MappedFile(const MappedFile&) = delete;
+	  auto operator=(const MappedFile&) -> MappedFile& = delete;
+
+	  ~MappedFile() { unmap(); }
+
+	  // Async flush only schedules the write back, it doesn't wait on the disk
+	  auto flush(bool wait = false) -> void {
+		if (data_ && writable_) {
+		  ::msync(data_, size_, wait ? MS_SYNC : MS_ASYNC);
+		}
+	  }
+
+	  auto isOpen() const -> bool { return data_ != nullptr; }
+	  auto size() const -> size_t { return size_; }
+	  auto data() -> uint8_t* { return data_; }
+	  auto data() const -> const uint8_t* { return data_; }
+	  auto bytes() -> std::span<uint8_t> { return {data_, size_}; }
+	  auto bytes() const -> std::span<const uint8_t> { return {data_, size_}; }
+
+	private:
+	  auto unmap() -> void {
+		if (data_) {
+		  flush(true);
+		  ::munmap(data_, size_);
+		  data_ = nullptr;
+		}
+	  }
+
+	  uint8_t* data_ = nullptr;
+	  size_t size_ = 0;
+	  bool writable_ = false;
+	};
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Components {
+	/**
+	* ThreadPool with one task deque per worker. Workers pop their own deque
+	* from the back (LIFO, cache friendly for recursive work) and steal from
+	* the front of the others when they run dry. Tasks submitted from a worker
+	* go to that worker's deque, so recursive fan-out stays local until
+	* someone is idle.
+	**/
+	class ThreadPool {
+	public:
+	  using Task = std::function<void()>;
+
+	  explicit ThreadPool(size_t threads = std::thread::hardware_concurrency()) {
+		threads = std::max<size_t>(threads, 1);
+		queues_.reserve(threads);
+		for (size_t i = 0; i < threads; i++) {
+		  queues_.push_back(std::make_unique<Queue>());
+		}
+		workers_.reserve(threads);
+		for (size_t i = 0; i < threads; i++) {
+		  workers_.emplace_back([this, i] { workerLoop(i); });
+		}
+	  }
+
+	  ThreadPool(const ThreadPool&) = delete;
+	  auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+	  ~ThreadPool() {
+		{
+		  std::lock_guard lock(sleep_mutex_);
+		  stopping_ = true;
+		}
+		wake_.notify_all();
+		for (auto& worker : workers_) {
+		  worker.join();
+		}
+	  }
+
+	  auto submit(Task task) -> void {
+		pending_.fetch_add(1, std::memory_order_relaxed);
+		size_t index = current_pool_ == this ? current_worker_
+											  : next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+		{
+		  std::lock_guard lock(queues_[index]->mutex);
+		  queues_[index]->tasks.push_back(std::move(task));
+		}
+		{
+		  std::lock_guard lock(sleep_mutex_);
+		  queued_++;
+		}
+		wake_.notify_one();
+	  }
+
+	  // Blocks until every submitted task, including ones submitted by tasks,
+	  // has finished. Must not be called from inside a task.
+	  auto wait() -> void {
+		std::unique_lock lock(sleep_mutex_);
+		done_.wait(lock, [this] { return pending_.load(std::memory_order_acquire) == 0; });
+	  }
+
+	  auto size() const -> size_t { return workers_.size(); }
+
+	private:
+	  struct Queue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	  };
+
+	  auto popOwn(size_t index, Task& task) -> bool {
+		auto& queue = *queues_[index];
+		std::lock_guard lock(queue.mutex);
+		if (queue.tasks.empty()) {
+		  return false;
+		}
+		task = std::move(queue.tasks.back());
+		queue.tasks.pop_back();
+		return true;
+	  }
+
+	  auto steal(size_t thief, Task& task) -> bool {
+		for (size_t offset = 1; offset < queues_.size(); offset++) {
+		  auto& queue = *queues_[(thief + offset) % queues_.size()];
+		  std::lock_guard lock(queue.mutex);
+		  if (!queue.tasks.empty()) {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+			return true;
+		  }
+		}
+		return false;
+	  }
+
+	  auto workerLoop(size_t index) -> void {
+		current_pool_ = this;
+		current_worker_ = index;
+		Task task;
+		while (true) {
+		  {
+			// Claim one queued task before looking for it, claims never exceed
+			// the number of tasks in the deques so the search below succeeds
+			std::unique_lock lock(sleep_mutex_);
+			wake_.wait(lock, [this] { return queued_ > 0 || stopping_; });
+			if (queued_ == 0) {
+			  return;
+			}
+			queued_--;
+		  }
+		  while (!popOwn(index, task) && !steal(index, task)) {
+			std::this_thread::yield();
+		  }
+		  task();
+		  task = nullptr;
+		  if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			std::lock_guard lock(sleep_mutex_);
+			done_.notify_all();
+		  }
+		}
+	  }
+
+	  std::vector<std::unique_ptr<Queue>> queues_;
+	  std::vector<std::thread> workers_;
+	  std::atomic<size_t> next_queue_{0};
+	  std::atomic<size_t> pending_{0};
+
+	  // queued_ counts tasks sitting in a deque, it's what idle workers sleep on
+	  std::mutex sleep_mutex_;
+	  std::condition_variable wake_;
+	  std::condition_variable done_;
+	  size_t queued_ = 0;
+	  bool stopping_ = false;
+
+	  static inline thread_local ThreadPool* current_pool_ = nullptr;
+	  static inline thread_local size_t current_worker_ = 0;
+	};
+};
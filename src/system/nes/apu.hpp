@@ -0,0 +1,754 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include "blip_buffer.hpp"
+
+// 2A03 timing, in CPU cycles (NTSC)
+namespace apu_timing {
+  constexpr double CPU_CLOCK = 1789773.0;
+  constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+  // Frame sequencer steps from its last reset. Every step clocks envelopes and
+  // the triangle's linear counter, steps 1 and 3 also clock length counters
+  // and sweeps. The last 4-step step raises the frame IRQ.
+  constexpr std::array<uint32_t, 4> STEPS_4 = {7457, 14913, 22371, 29829};
+  constexpr std::array<uint32_t, 4> STEPS_5 = {7457, 14913, 22371, 37281};
+  constexpr uint32_t PERIOD_4 = 29830;
+  constexpr uint32_t PERIOD_5 = 37282;
+  // CPU cycles a DMC sample fetch halts the CPU for
+  constexpr uint32_t DMC_DMA_CYCLES = 4;
+
+  constexpr std::array<uint8_t, 32> LENGTHS = {
+    10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+    12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+  };
+  constexpr std::array<std::array<uint8_t, 8>, 4> DUTIES = {{
+    {0, 1, 0, 0, 0, 0, 0, 0},
+    {0, 1, 1, 0, 0, 0, 0, 0},
+    {0, 1, 1, 1, 1, 0, 0, 0},
+    {1, 0, 0, 1, 1, 1, 1, 1},
+  }};
+  constexpr std::array<uint8_t, 32> TRIANGLE = {
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+  };
+  constexpr std::array<uint16_t, 16> NOISE_PERIODS = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+  };
+  constexpr std::array<uint16_t, 16> DMC_RATES = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54,
+  };
+}
+
+// Everything the APU mutates. Lives in the NesArena next to the PPU.
+struct ApuState {
+  struct Envelope {
+    uint8_t start;
+    uint8_t divider;
+    uint8_t decay;
+    uint8_t period;    // Also the volume when constant is set
+    uint8_t constant;
+    uint8_t loop;      // Doubles as the length counter halt flag
+  };
+
+  struct Pulse {
+    uint64_t timer_at;  // Next sequencer step
+    uint16_t period;
+    uint8_t duty;
+    uint8_t step;
+    uint8_t length;
+    uint8_t sweep_enabled;
+    uint8_t sweep_period;
+    uint8_t sweep_negate;
+    uint8_t sweep_shift;
+    uint8_t sweep_divider;
+    uint8_t sweep_reload;
+    Envelope envelope;
+  };
+
+  struct Triangle {
+    uint64_t timer_at;
+    uint16_t period;
+    uint8_t step;
+    uint8_t length;
+    uint8_t control;  // Length halt and linear counter control
+    uint8_t linear;
+    uint8_t linear_reload_value;
+    uint8_t linear_reload;
+  };
+
+  struct Noise {
+    uint64_t timer_at;
+    uint16_t lfsr;
+    uint8_t period;  // Index into NOISE_PERIODS
+    uint8_t mode;
+    uint8_t length;
+    Envelope envelope;
+  };
+
+  struct Dmc {
+    uint64_t timer_at;  // Next output unit clock
+    uint16_t address;
+    uint16_t bytes_left;
+    uint16_t sample_address;
+    uint16_t sample_length;
+    uint8_t rate;  // Index into DMC_RATES
+    uint8_t loop;
+    uint8_t irq_enabled;
+    uint8_t level;
+    uint8_t shift;
+    uint8_t bits_left;
+    uint8_t silence;
+    uint8_t buffer;
+    uint8_t buffer_full;
+  };
+
+  uint64_t cycle;              // CPU cycle the APU has run up to
+  uint64_t next_event_cycle;   // Frame IRQ or DMC fetch, the system must catch up then
+  uint64_t sequencer_origin;   // Cycle of the last sequencer reset
+  uint64_t sequencer_at;       // Cycle of the next sequencer step
+  uint8_t sequencer_step;
+  uint8_t five_step;
+  uint8_t irq_inhibit;
+  uint8_t frame_irq;
+  uint8_t dmc_irq;
+  uint8_t enabled;             // $4015 channel enables
+  uint32_t dma_cycles;         // Stolen by DMC fetches, not yet charged to the CPU
+
+  std::array<Pulse, 2> pulse;
+  Triangle triangle;
+  Noise noise;
+  Dmc dmc;
+  std::array<uint8_t, 5> levels;  // Channel outputs as last sent to the mixer
+};
+static_assert(std::is_trivially_copyable_v<ApuState>);
+
+// What the APU does with its output. BandLimitedAudio synthesises every
+// channel; TimingOnlyAudio is for runs nobody listens to and keeps only what
+// the CPU can observe: length counters for $4015, the frame IRQ and the DMC's
+// fetches and IRQ. Channel timers, envelopes, sweeps and output levels are
+// left alone, so ApuState from one isn't meant to be loaded into the other.
+struct BandLimitedAudio {
+  static constexpr bool SYNTHESIS = true;
+};
+
+struct TimingOnlyAudio {
+  static constexpr bool SYNTHESIS = false;
+};
+
+// Catch-up APU, in the same spirit as the PPU: it keeps the CPU cycle it has
+// run to and only runs forward on a register access, when the system reaches
+// next_event_cycle (a frame IRQ or DMC sample fetch that the CPU can see) and
+// at frame end. Running forward goes from one channel step to the next and
+// hands every output change to a BlipBuffer, so a frame costs a few hundred
+// steps per channel rather than 30000 clocks.
+//
+// Mixing is the usual linear approximation of the 2A03's resistor network,
+// which lets each channel add its own steps to the one buffer.
+//
+// Memory is anything with read(address) for $8000-$FFFF, where DMC samples
+// are fetched from. Audio is one of the policies above.
+template<typename Memory, typename Audio = BandLimitedAudio>
+struct Apu {
+  enum Channel : uint32_t { PULSE_1, PULSE_2, TRIANGLE, NOISE, DMC };
+
+  // Output units per level step, a full mix peaks around 28000
+  static constexpr std::array<int32_t, 5> LEVEL_SCALE = {246, 246, 279, 162, 110};
+
+  Apu(ApuState& state, Memory& memory, const uint64_t& cpu_clock, uint32_t sample_rate = 48000)
+    : state_(state), memory_(memory), cpu_clock_(cpu_clock), blip_(makeBuffer(sample_rate)) {
+    state_.noise.lfsr = 1;
+    state_.dmc.bits_left = 8;
+    state_.dmc.silence = 1;
+    state_.dmc.address = 0xC000;
+    state_.dmc.sample_address = 0xC000;
+    state_.dmc.sample_length = 1;
+    state_.sequencer_at = state_.sequencer_origin + apu_timing::STEPS_4[0];
+    predictEvents();
+  }
+
+  // $4015: length counters, DMC activity and both IRQ flags. Clears the
+  // frame IRQ.
+  auto readStatus() -> uint8_t {
+    catchUp(cpu_clock_);
+    uint8_t status = 0;
+    status |= state_.pulse[0].length > 0 ? 0x01 : 0;
+    status |= state_.pulse[1].length > 0 ? 0x02 : 0;
+    status |= state_.triangle.length > 0 ? 0x04 : 0;
+    status |= state_.noise.length > 0 ? 0x08 : 0;
+    status |= state_.dmc.bytes_left > 0 ? 0x10 : 0;
+    status |= state_.frame_irq ? 0x40 : 0;
+    status |= state_.dmc_irq ? 0x80 : 0;
+    state_.frame_irq = 0;
+    predictEvents();
+    return status;
+  }
+
+  // $4000-$4013, $4015 and $4017
+  auto writeRegister(uint16_t address, uint8_t data) -> void {
+    using namespace apu_timing;
+    catchUp(cpu_clock_);
+    switch(address) {
+      case 0x4000:
+      case 0x4004: {
+        auto& p = state_.pulse[(address >> 2) & 1];
+        p.duty = data >> 6;
+        writeEnvelope(p.envelope, data);
+        break;
+      }
+      case 0x4001:
+      case 0x4005: {
+        auto& p = state_.pulse[(address >> 2) & 1];
+        p.sweep_enabled = (data >> 7) & 1;
+        p.sweep_period = (data >> 4) & 0x07;
+        p.sweep_negate = (data >> 3) & 1;
+        p.sweep_shift = data & 0x07;
+        p.sweep_reload = 1;
+        break;
+      }
+      case 0x4002:
+      case 0x4006: {
+        auto& p = state_.pulse[(address >> 2) & 1];
+        p.period = (p.period & 0x700) | data;
+        break;
+      }
+      case 0x4003:
+      case 0x4007: {
+        const uint32_t n = (address >> 2) & 1;
+        auto& p = state_.pulse[n];
+        p.period = (p.period & 0xFF) | uint16_t(data & 0x07) << 8;
+        if(state_.enabled & (1 << n)) {
+          p.length = LENGTHS[data >> 3];
+        }
+        p.step = 0;
+        p.envelope.start = 1;
+        break;
+      }
+      case 0x4008:
+        state_.triangle.control = data >> 7;
+        state_.triangle.linear_reload_value = data & 0x7F;
+        break;
+      case 0x400A:
+        state_.triangle.period = (state_.triangle.period & 0x700) | data;
+        break;
+      case 0x400B:
+        state_.triangle.period = (state_.triangle.period & 0xFF) | uint16_t(data & 0x07) << 8;
+        if(state_.enabled & 0x04) {
+          state_.triangle.length = LENGTHS[data >> 3];
+        }
+        state_.triangle.linear_reload = 1;
+        break;
+      case 0x400C:
+        writeEnvelope(state_.noise.envelope, data);
+        break;
+      case 0x400E:
+        state_.noise.mode = data >> 7;
+        state_.noise.period = data & 0x0F;
+        break;
+      case 0x400F:
+        if(state_.enabled & 0x08) {
+          state_.noise.length = LENGTHS[data >> 3];
+        }
+        state_.noise.envelope.start = 1;
+        break;
+      case 0x4010:
+        state_.dmc.irq_enabled = data >> 7;
+        state_.dmc.loop = (data >> 6) & 1;
+        state_.dmc.rate = data & 0x0F;
+        if(!state_.dmc.irq_enabled) {
+          state_.dmc_irq = 0;
+        }
+        break;
+      case 0x4011:
+        state_.dmc.level = data & 0x7F;
+        break;
+      case 0x4012:
+        state_.dmc.sample_address = static_cast<uint16_t>(0xC000 + data * 64);
+        break;
+      case 0x4013:
+        state_.dmc.sample_length = static_cast<uint16_t>(data * 16 + 1);
+        break;
+      case 0x4015:
+        writeEnables(data);
+        break;
+      case 0x4017:
+        writeFrameCounter(data);
+        break;
+      default:
+        break;
+    }
+    predictEvents();
+  }
+
+  auto sync() -> void {
+    catchUp(cpu_clock_);
+  }
+
+  // Run forward until the APU has seen cpu_cycle, including what happens on it
+  auto catchUp(uint64_t cpu_cycle) -> void {
+    while(state_.sequencer_at <= cpu_cycle) {
+      runChannels(state_.sequencer_at);
+      clockSequencer();
+      if(state_.cycle - frame_start_ >= apu_timing::PERIOD_4) {
+        commitFrame();
+      }
+    }
+    runChannels(cpu_cycle);
+    predictEvents();
+  }
+
+  // Catches up and makes everything synthesised so far readable
+  auto endFrame() -> void {
+    catchUp(cpu_clock_);
+    commitFrame();
+  }
+
+  // IRQ line as the CPU sees it
+  auto irq() const -> bool {
+    return state_.frame_irq | state_.dmc_irq;
+  }
+
+  auto nextEventCycle() const -> uint64_t { return state_.next_event_cycle; }
+
+  auto dmaCycles() const -> uint32_t { return state_.dma_cycles; }
+
+  // Cycles DMC fetches have halted the CPU for since the last call
+  auto takeDmaCycles() -> uint32_t {
+    return std::exchange(state_.dma_cycles, 0);
+  }
+
+  // Mono samples at the buffer's rate, 250ms worth are kept when unread.
+  // Without synthesis there never are any.
+  auto samplesAvailable() const -> size_t {
+    if constexpr(Audio::SYNTHESIS) {
+      return blip_.samplesAvailable();
+    }
+    return 0;
+  }
+
+  auto readSamples(std::span<int16_t> out) -> size_t {
+    if constexpr(Audio::SYNTHESIS) {
+      return blip_.readSamples(out);
+    }
+    return 0;
+  }
+
+  auto sampleRate() const -> uint32_t {
+    if constexpr(Audio::SYNTHESIS) {
+      return blip_.sampleRate();
+    }
+    return 0;
+  }
+
+  auto setSampleRate(uint32_t sample_rate) -> void {
+    blip_ = makeBuffer(sample_rate);
+    frame_start_ = state_.cycle;
+  }
+
+  // The arena was overwritten: the sample buffer belongs to another timeline
+  auto stateRestored() -> void {
+    if constexpr(Audio::SYNTHESIS) {
+      blip_.clear();
+    }
+    frame_start_ = state_.cycle;
+  }
+
+private:
+  struct NoBuffer {};
+  using Buffer = std::conditional_t<Audio::SYNTHESIS, BlipBuffer, NoBuffer>;
+
+  static auto makeBuffer(uint32_t sample_rate) -> Buffer {
+    if constexpr(Audio::SYNTHESIS) {
+      return BlipBuffer(apu_timing::CPU_CLOCK, sample_rate);
+    } else {
+      return {};
+    }
+  }
+
+  static auto writeEnvelope(ApuState::Envelope& envelope, uint8_t data) -> void {
+    envelope.loop = (data >> 5) & 1;
+    envelope.constant = (data >> 4) & 1;
+    envelope.period = data & 0x0F;
+  }
+
+  static auto volume(const ApuState::Envelope& envelope) -> uint8_t {
+    return envelope.constant ? envelope.period : envelope.decay;
+  }
+
+  auto writeEnables(uint8_t data) -> void {
+    state_.enabled = data & 0x1F;
+    if(!(data & 0x01)) {
+      state_.pulse[0].length = 0;
+    }
+    if(!(data & 0x02)) {
+      state_.pulse[1].length = 0;
+    }
+    if(!(data & 0x04)) {
+      state_.triangle.length = 0;
+    }
+    if(!(data & 0x08)) {
+      state_.noise.length = 0;
+    }
+    auto& dmc = state_.dmc;
+    state_.dmc_irq = 0;
+    if(!(data & 0x10)) {
+      dmc.bytes_left = 0;
+    } else if(dmc.bytes_left == 0) {
+      dmc.address = dmc.sample_address;
+      dmc.bytes_left = dmc.sample_length;
+      fetchSample();
+    }
+  }
+
+  // The reset lands 3 or 4 cycles after the write depending on where it falls
+  // in the APU's 2-cycle clock
+  auto writeFrameCounter(uint8_t data) -> void {
+    state_.five_step = data >> 7;
+    state_.irq_inhibit = (data >> 6) & 1;
+    if(state_.irq_inhibit) {
+      state_.frame_irq = 0;
+    }
+    state_.sequencer_origin = state_.cycle + ((state_.cycle & 1) ? 4 : 3);
+    state_.sequencer_step = 0;
+    if(state_.five_step) {
+      // Switching to 5-step clocks everything straight away
+      clockQuarterFrame();
+      clockHalfFrame();
+    }
+    state_.sequencer_at = state_.sequencer_origin + apu_timing::STEPS_5[0];
+  }
+
+  auto clockSequencer() -> void {
+    using namespace apu_timing;
+    const uint8_t step = state_.sequencer_step;
+    clockQuarterFrame();
+    if(step == 1 || step == 3) {
+      clockHalfFrame();
+    }
+    if(step == 3 && !state_.five_step && !state_.irq_inhibit) {
+      state_.frame_irq = 1;
+    }
+    if(step == 3) {
+      state_.sequencer_origin += state_.five_step ? PERIOD_5 : PERIOD_4;
+      state_.sequencer_step = 0;
+    } else {
+      state_.sequencer_step++;
+    }
+    const auto& steps = state_.five_step ? STEPS_5 : STEPS_4;
+    state_.sequencer_at = state_.sequencer_origin + steps[state_.sequencer_step];
+  }
+
+  auto clockEnvelope(ApuState::Envelope& envelope) -> void {
+    if(envelope.start) {
+      envelope.start = 0;
+      envelope.decay = 15;
+      envelope.divider = envelope.period;
+    } else if(envelope.divider == 0) {
+      envelope.divider = envelope.period;
+      if(envelope.decay > 0) {
+        envelope.decay--;
+      } else if(envelope.loop) {
+        envelope.decay = 15;
+      }
+    } else {
+      envelope.divider--;
+    }
+  }
+
+  // Envelopes and the linear counter only change what is heard
+  auto clockQuarterFrame() -> void {
+    if constexpr(!Audio::SYNTHESIS) {
+      return;
+    }
+    clockEnvelope(state_.pulse[0].envelope);
+    clockEnvelope(state_.pulse[1].envelope);
+    clockEnvelope(state_.noise.envelope);
+    auto& triangle = state_.triangle;
+    if(triangle.linear_reload) {
+      triangle.linear = triangle.linear_reload_value;
+    } else if(triangle.linear > 0) {
+      triangle.linear--;
+    }
+    if(!triangle.control) {
+      triangle.linear_reload = 0;
+    }
+  }
+
+  auto clockHalfFrame() -> void {
+    for(uint32_t n = 0; n < 2; n++) {
+      auto& p = state_.pulse[n];
+      if(p.length > 0 && !p.envelope.loop) {
+        p.length--;
+      }
+      if constexpr(!Audio::SYNTHESIS) {
+        continue;
+      }
+      if(p.sweep_divider == 0 && p.sweep_enabled && p.sweep_shift > 0 && !sweepMuted(p, n)) {
+        p.period = sweepTarget(p, n);
+      }
+      if(p.sweep_divider == 0 || p.sweep_reload) {
+        p.sweep_divider = p.sweep_period;
+        p.sweep_reload = 0;
+      } else {
+        p.sweep_divider--;
+      }
+    }
+    if(state_.triangle.length > 0 && !state_.triangle.control) {
+      state_.triangle.length--;
+    }
+    if(state_.noise.length > 0 && !state_.noise.envelope.loop) {
+      state_.noise.length--;
+    }
+  }
+
+  // Pulse 1 negates with one's complement, pulse 2 with two's complement
+  static auto sweepTarget(const ApuState::Pulse& p, uint32_t n) -> uint16_t {
+    const int32_t change = p.period >> p.sweep_shift;
+    const int32_t target = p.sweep_negate ? p.period - change - (n == 0 ? 1 : 0) : p.period + change;
+    return static_cast<uint16_t>(std::max(target, 0));
+  }
+
+  static auto sweepMuted(const ApuState::Pulse& p, uint32_t n) -> bool {
+    return p.period < 8 || (!p.sweep_negate && sweepTarget(p, n) > 0x7FF);
+  }
+
+  // A channel's output while a run loop works on it. The loops keep their
+  // state in locals and write it back at the end: ApuState is all bytes, and
+  // byte stores may alias anything, so working on state_ directly would
+  // reload every field after each delta written.
+  struct Output {
+    BlipBuffer& blip;
+    uint64_t frame_start;
+    int32_t scale;
+    int32_t level;
+
+    auto set(uint64_t cycle, int32_t next) -> void {
+      if(next != level) {
+        blip.addDelta(static_cast<uint32_t>(cycle - frame_start), (next - level) * scale);
+        level = next;
+      }
+    }
+  };
+
+  auto output(Channel channel) -> Output {
+    return {blip_, frame_start_, LEVEL_SCALE[channel], state_.levels[channel]};
+  }
+
+  // Skips a silent timer past end, returns how many clocks that was
+  static auto skipTimer(uint64_t& timer_at, uint64_t end, uint32_t period) -> uint64_t {
+    if(timer_at > end) {
+      return 0;
+    }
+    const uint64_t count = (end - timer_at) / period + 1;
+    timer_at += count * period;
+    return count;
+  }
+
+  auto runChannels(uint64_t end) -> void {
+    if(end <= state_.cycle) {
+      return;
+    }
+    const uint64_t from = state_.cycle;
+    if constexpr(Audio::SYNTHESIS) {
+      runPulse(0, from, end);
+      runPulse(1, from, end);
+      runTriangle(from, end);
+      runNoise(from, end);
+      runDmc(from, end);
+    } else {
+      runDmcTiming(end);
+    }
+    state_.cycle = end;
+  }
+
+  auto runPulse(uint32_t n, uint64_t from, uint64_t end) -> void {
+    using namespace apu_timing;
+    auto& p = state_.pulse[n];
+    const Channel channel = n == 0 ? PULSE_1 : PULSE_2;
+    const uint32_t period = 2 * (uint32_t(p.period) + 1);
+    const int32_t level = (p.length == 0 || sweepMuted(p, n)) ? 0 : volume(p.envelope);
+    const auto& duty = DUTIES[p.duty];
+    Output out = output(channel);
+    out.set(from, duty[p.step] ? level : 0);
+    if(level == 0) {
+      p.step = static_cast<uint8_t>((p.step + skipTimer(p.timer_at, end, period)) & 7);
+    } else {
+      uint64_t at = p.timer_at;
+      uint32_t step = p.step;
+      for(; at <= end; at += period) {
+        step = (step + 1) & 7;
+        out.set(at, duty[step] ? level : 0);
+      }
+      p.timer_at = at;
+      p.step = static_cast<uint8_t>(step);
+    }
+    state_.levels[channel] = static_cast<uint8_t>(out.level);
+  }
+
+  // The sequencer holds its position while either counter is zero. Periods
+  // below 2 are ultrasonic and only produce pops, they hold too.
+  auto runTriangle(uint64_t from, uint64_t end) -> void {
+    auto& t = state_.triangle;
+    const uint32_t period = uint32_t(t.period) + 1;
+    Output out = output(TRIANGLE);
+    out.set(from, apu_timing::TRIANGLE[t.step]);
+    if(t.length == 0 || t.linear == 0 || t.period < 2) {
+      skipTimer(t.timer_at, end, period);
+    } else {
+      uint64_t at = t.timer_at;
+      uint32_t step = t.step;
+      for(; at <= end; at += period) {
+        step = (step + 1) & 31;
+        out.set(at, apu_timing::TRIANGLE[step]);
+      }
+      t.timer_at = at;
+      t.step = static_cast<uint8_t>(step);
+    }
+    state_.levels[TRIANGLE] = static_cast<uint8_t>(out.level);
+  }
+
+  // While silent the shift register isn't stepped, its exact state can't be
+  // heard
+  auto runNoise(uint64_t from, uint64_t end) -> void {
+    auto& noise = state_.noise;
+    const uint32_t period = apu_timing::NOISE_PERIODS[noise.period];
+    const int32_t level = noise.length == 0 ? 0 : volume(noise.envelope);
+    Output out = output(NOISE);
+    out.set(from, (noise.lfsr & 1) ? 0 : level);
+    if(level == 0) {
+      skipTimer(noise.timer_at, end, period);
+    } else {
+      const uint32_t tap = noise.mode ? 6 : 1;
+      uint64_t at = noise.timer_at;
+      uint32_t lfsr = noise.lfsr;
+      for(; at <= end; at += period) {
+        lfsr = (lfsr >> 1) | (((lfsr ^ (lfsr >> tap)) & 1) << 14);
+        out.set(at, (lfsr & 1) ? 0 : level);
+      }
+      noise.timer_at = at;
+      noise.lfsr = static_cast<uint16_t>(lfsr);
+    }
+    state_.levels[NOISE] = static_cast<uint8_t>(out.level);
+  }
+
+  auto runDmc(uint64_t from, uint64_t end) -> void {
+    auto& dmc = state_.dmc;
+    const uint32_t period = apu_timing::DMC_RATES[dmc.rate];
+    Output out = output(DMC);
+    out.set(from, dmc.level);
+    if(dmc.silence && !dmc.buffer_full && dmc.bytes_left == 0) {
+      // Nothing to play or fetch, only the bit counter moves
+      const uint64_t clocks = skipTimer(dmc.timer_at, end, period);
+      dmc.bits_left = static_cast<uint8_t>(8 - (8 - dmc.bits_left + clocks) % 8);
+    } else {
+      uint64_t at = dmc.timer_at;
+      int32_t level = dmc.level;
+      uint32_t shift = dmc.shift;
+      uint32_t bits_left = dmc.bits_left;
+      bool silence = dmc.silence;
+      for(; at <= end; at += period) {
+        if(!silence) {
+          // Up or down by 2 for a 1 or 0 bit, unless that leaves 0-127
+          const int32_t next = level + int32_t(shift & 1) * 4 - 2;
+          level = (next & ~0x7F) ? level : next;
+          shift >>= 1;
+          out.set(at, level);
+        }
+        if(--bits_left == 0) {
+          bits_left = 8;
+          silence = !dmc.buffer_full;
+          if(dmc.buffer_full) {
+            shift = dmc.buffer;
+            dmc.buffer_full = 0;
+            fetchSample();
+          }
+        }
+      }
+      dmc.timer_at = at;
+      dmc.level = static_cast<uint8_t>(level);
+      dmc.shift = static_cast<uint8_t>(shift);
+      dmc.bits_left = static_cast<uint8_t>(bits_left);
+      dmc.silence = silence;
+    }
+    state_.levels[DMC] = static_cast<uint8_t>(out.level);
+  }
+
+  // runDmc() without the output unit: goes from one emptied sample buffer to
+  // the next, which is all the fetches and the IRQ depend on
+  auto runDmcTiming(uint64_t end) -> void {
+    auto& dmc = state_.dmc;
+    const uint32_t period = apu_timing::DMC_RATES[dmc.rate];
+    while(dmc.buffer_full) {
+      // The clock that finishes the current byte and takes the buffer
+      const uint64_t reload = dmc.timer_at + uint64_t(dmc.bits_left - 1) * period;
+      if(reload > end) {
+        break;
+      }
+      dmc.timer_at = reload + period;
+      dmc.bits_left = 8;
+      dmc.silence = 0;
+      dmc.buffer_full = 0;
+      fetchSample();
+    }
+    // Past the end of the byte with nothing buffered, the output unit goes quiet
+    const uint64_t clocks = skipTimer(dmc.timer_at, end, period);
+    if(clocks >= dmc.bits_left) {
+      dmc.silence = 1;
+    }
+    dmc.bits_left = static_cast<uint8_t>(8 - (8 - dmc.bits_left + clocks) % 8);
+  }
+
+  // The DMC's memory reader refills the sample buffer as soon as it empties
+  auto fetchSample() -> void {
+    auto& dmc = state_.dmc;
+    if(dmc.buffer_full || dmc.bytes_left == 0) {
+      return;
+    }
+    dmc.buffer = memory_.read(dmc.address);
+    dmc.buffer_full = 1;
+    state_.dma_cycles += apu_timing::DMC_DMA_CYCLES;
+    dmc.address = dmc.address == 0xFFFF ? 0x8000 : dmc.address + 1;
+    if(--dmc.bytes_left == 0) {
+      if(dmc.loop) {
+        dmc.address = dmc.sample_address;
+        dmc.bytes_left = dmc.sample_length;
+      } else if(dmc.irq_enabled) {
+        state_.dmc_irq = 1;
+      }
+    }
+  }
+
+  // The CPU can see two things happen without touching a register: the frame
+  // IRQ and DMC fetches (the IRQ at the end of a sample, and the cycles they
+  // steal)
+  auto predictEvents() -> void {
+    using namespace apu_timing;
+    uint64_t next = NEVER;
+    if(!state_.five_step && !state_.irq_inhibit && !state_.frame_irq) {
+      next = state_.sequencer_origin + STEPS_4[3];
+    }
+    const auto& dmc = state_.dmc;
+    if(dmc.buffer_full && dmc.bytes_left > 0) {
+      next = std::min(next, dmc.timer_at + uint64_t(dmc.bits_left - 1) * DMC_RATES[dmc.rate]);
+    }
+    state_.next_event_cycle = next;
+  }
+
+  auto commitFrame() -> void {
+    if constexpr(Audio::SYNTHESIS) {
+      blip_.endFrame(static_cast<uint32_t>(state_.cycle - frame_start_));
+    }
+    frame_start_ = state_.cycle;
+  }
+
+  ApuState& state_;
+  Memory& memory_;
+  const uint64_t& cpu_clock_;
+  [[no_unique_address]] Buffer blip_;
+  uint64_t frame_start_ = 0;  // CPU cycle the blip buffer's frame starts at
+};
@@ -0,0 +1,102 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+// Single-producer, single-consumer ring of mono samples. Neither side ever
+// blocks or takes a lock: the producer only stores tail_ and the consumer
+// only stores head_, each publishing with release after touching the
+// samples. Both keep a copy of the other side's index and only reload it
+// when the copy says the ring is full (or empty), so in steady state each
+// side stays on its own cache line.
+class AudioRing {
+public:
+  // Rounded up to a power of two
+  explicit AudioRing(size_t capacity)
+    : samples_(std::bit_ceil(std::max<size_t>(capacity, 2))), mask_(samples_.size() - 1) {
+  }
+
+  AudioRing(const AudioRing&) = delete;
+  auto operator=(const AudioRing&) -> AudioRing& = delete;
+
+  auto capacity() const -> size_t { return samples_.size(); }
+
+  // Samples queued right now, either side may change that straight after
+  auto size() const -> size_t {
+    // head first: it can only catch up with a tail loaded after it
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    return static_cast<size_t>(tail_.load(std::memory_order_acquire) - head);
+  }
+
+  // Producer. Returns how many samples fitted, the rest are not queued.
+  auto write(std::span<const int16_t> in) -> size_t {
+    const uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if(samples_.size() - (tail - producer_head_) < in.size()) {
+      producer_head_ = head_.load(std::memory_order_acquire);
+    }
+    const size_t count = std::min<size_t>(in.size(), samples_.size() - (tail - producer_head_));
+    const size_t start = tail & mask_;
+    const size_t first = std::min(count, samples_.size() - start);
+    // An empty span may carry a null pointer, and most writes don't wrap
+    if(first > 0) {
+      std::memcpy(&samples_[start], in.data(), first * sizeof(int16_t));
+    }
+    if(count > first) {
+      std::memcpy(&samples_[0], in.data() + first, (count - first) * sizeof(int16_t));
+    }
+    tail_.store(tail + count, std::memory_order_release);
+    return count;
+  }
+
+  // Consumer. Returns how many samples were read.
+  auto read(std::span<int16_t> out) -> size_t {
+    size_t done = 0;
+    while(done < out.size()) {
+      const auto chunk = readable();
+      if(chunk.empty()) {
+        break;
+      }
+      const size_t count = std::min(chunk.size(), out.size() - done);
+      std::memcpy(out.data() + done, chunk.data(), count * sizeof(int16_t));
+      consume(count);
+      done += count;
+    }
+    return done;
+  }
+
+  // Consumer, for writing straight out of the ring: the queued samples up
+  // to the end of the buffer. Call consume() once they are used.
+  auto readable() -> std::span<const int16_t> {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    if(consumer_tail_ == head) {
+      consumer_tail_ = tail_.load(std::memory_order_acquire);
+    }
+    const size_t start = head & mask_;
+    const size_t count = std::min<size_t>(consumer_tail_ - head, samples_.size() - start);
+    return {&samples_[start], count};
+  }
+
+  auto consume(size_t count) -> void {
+    head_.store(head_.load(std::memory_order_relaxed) + count, std::memory_order_release);
+  }
+
+  // Consumer. Drops everything queued and returns how much that was.
+  auto discard() -> size_t {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    consumer_tail_ = tail_.load(std::memory_order_acquire);
+    head_.store(consumer_tail_, std::memory_order_release);
+    return static_cast<size_t>(consumer_tail_ - head);
+  }
+
+private:
+  std::vector<int16_t> samples_;
+  const size_t mask_;
+  alignas(64) std::atomic<uint64_t> head_{0};  // Next sample to read
+  uint64_t consumer_tail_ = 0;                 // The consumer's copy of tail_
+  alignas(64) std::atomic<uint64_t> tail_{0};  // Next sample to write
+  uint64_t producer_head_ = 0;                 // The producer's copy of head_
+};
@@ -0,0 +1,161 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define TWIX_BLIP_SSE2 1
+#endif
+
+// Band-limited step synthesis. Sound chips only ever change their output in
+// steps, so instead of sampling them every clock each step is added once, as
+// a windowed-sinc impulse at its exact sub-sample position, into a buffer of
+// deltas. Reading integrates the deltas back into a waveform that has no
+// content above the output's Nyquist frequency, so there is no aliasing and
+// the cost is proportional to the number of steps rather than the clock rate.
+//
+// Times are in source clocks relative to the start of the current frame;
+// endFrame() makes the frame's samples readable and starts the next one.
+class BlipBuffer {
+public:
+  static constexpr uint32_t PHASE_BITS = 5;
+  static constexpr uint32_t PHASES = 1 << PHASE_BITS;
+  static constexpr uint32_t TAPS = 16;
+  // Kernel fixed point: each phase sums to exactly 1 << UNIT_BITS, so steps
+  // integrate back to exact levels
+  static constexpr uint32_t UNIT_BITS = 12;
+  // The integrator leaks 1/512 per sample: a ~15Hz high-pass that removes the
+  // DC offset all-positive chip outputs have
+  static constexpr uint32_t BASS_SHIFT = 9;
+  // Longest frame addDelta() accepts
+  static constexpr uint32_t MAX_FRAME_CLOCKS = 1 << 16;
+
+  // Keeps at most capacity_ms of unread samples, older ones are dropped at
+  // endFrame() when nobody reads them
+  BlipBuffer(double clock_rate, uint32_t sample_rate, uint32_t capacity_ms = 250)
+    : clock_rate_(clock_rate), sample_rate_(sample_rate),
+      factor_(static_cast<uint64_t>(std::llround(sample_rate / clock_rate * 4294967296.0))),
+      capacity_(std::max<size_t>(sample_rate * uint64_t(capacity_ms) / 1000, 1)),
+      frame_samples_((uint64_t(MAX_FRAME_CLOCKS) * factor_ >> 32) + 1),
+      deltas_(capacity_ + frame_samples_ + TAPS + 1) {
+  }
+
+  auto sampleRate() const -> uint32_t { return sample_rate_; }
+  auto clockRate() const -> double { return clock_rate_; }
+
+  // delta is in output units, a sample of 32767 is full scale. It has to
+  // fit in 16 bits.
+  auto addDelta(uint32_t clock_time, int32_t delta) -> void {
+    const uint64_t position = offset_ + clock_time * factor_;
+    const int16_t* kernel = kernels_[(position >> (32 - PHASE_BITS)) & (PHASES - 1)].data();
+    int32_t* out = deltas_.data() + (position >> 32);
+#ifdef TWIX_BLIP_SSE2
+    // Widening 16x16 bit multiplies, SSE2 is always there on x86-64
+    const __m128i d = _mm_set1_epi16(static_cast<int16_t>(delta));
+    for(uint32_t i = 0; i < TAPS; i += 8) {
+      const __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(kernel + i));
+      const __m128i lo = _mm_mullo_epi16(k, d);
+      const __m128i hi = _mm_mulhi_epi16(k, d);
+      auto* o = reinterpret_cast<__m128i*>(out + i);
+      _mm_storeu_si128(o, _mm_add_epi32(_mm_loadu_si128(o), _mm_unpacklo_epi16(lo, hi)));
+      _mm_storeu_si128(o + 1, _mm_add_epi32(_mm_loadu_si128(o + 1), _mm_unpackhi_epi16(lo, hi)));
+    }
+#else
+    for(uint32_t i = 0; i < TAPS; i++) {
+      out[i] += kernel[i] * delta;
+    }
+#endif
+  }
+
+  auto endFrame(uint32_t clocks) -> void {
+    offset_ += clocks * factor_;
+    const size_t available = samplesAvailable();
+    if(available > capacity_) {
+      consume({}, available - capacity_);
+    }
+  }
+
+  auto samplesAvailable() const -> size_t {
+    return static_cast<size_t>(offset_ >> 32);
+  }
+
+  // Returns how many samples were written to out
+  auto readSamples(std::span<int16_t> out) -> size_t {
+    return consume(out, out.size());
+  }
+
+  auto clear() -> void {
+    std::fill(deltas_.begin(), deltas_.end(), 0);
+    offset_ = 0;
+    accumulator_ = 0;
+  }
+
+private:
+  using Kernel = std::array<int16_t, TAPS>;
+
+  // Lowpass at 45% of the sample rate, Blackman window. An impulse at
+  // fraction f of a sample lands on taps i - TAPS/2 - f away from its centre,
+  // so output is delayed by TAPS/2 samples.
+  static auto kernels() -> const std::array<Kernel, PHASES>& {
+    static const std::array<Kernel, PHASES> table = [] {
+      constexpr double pi = 3.14159265358979323846;
+      constexpr double cutoff = 0.45;
+      std::array<Kernel, PHASES> kernels{};
+      for(uint32_t phase = 0; phase < PHASES; phase++) {
+        std::array<double, TAPS> taps{};
+        double sum = 0;
+        for(uint32_t i = 0; i < TAPS; i++) {
+          const double x = i - double(TAPS / 2) - double(phase) / PHASES;
+          const double sinc = x == 0 ? 2 * cutoff : std::sin(2 * pi * cutoff * x) / (pi * x);
+          const double w = (x + TAPS / 2.0) / TAPS;
+          const double window = 0.42 - 0.5 * std::cos(2 * pi * w) + 0.08 * std::cos(4 * pi * w);
+          taps[i] = sinc * window;
+          sum += taps[i];
+        }
+        int32_t total = 0;
+        for(uint32_t i = 0; i < TAPS; i++) {
+          kernels[phase][i] = static_cast<int16_t>(std::lround(taps[i] / sum * (1 << UNIT_BITS)));
+          total += kernels[phase][i];
+        }
+        // Rounding leftovers go to the centre tap
+        kernels[phase][TAPS / 2] += static_cast<int16_t>((1 << UNIT_BITS) - total);
+      }
+      return kernels;
+    }();
+    return table;
+  }
+
+  // out may be empty to drop samples
+  auto consume(std::span<int16_t> out, size_t count) -> size_t {
+    const size_t available = samplesAvailable();
+    count = std::min(count, available);
+    for(size_t i = 0; i < count; i++) {
+      accumulator_ += deltas_[i];
+      if(!out.empty()) {
+        out[i] = static_cast<int16_t>(std::clamp(accumulator_ >> UNIT_BITS, -32768, 32767));
+      }
+      accumulator_ -= accumulator_ >> BASS_SHIFT;
+    }
+    // Deltas of the frame in progress can already be there, past the end
+    // of the readable samples
+    const size_t end = std::min(deltas_.size(), available + frame_samples_ + TAPS);
+    std::memmove(deltas_.data(), deltas_.data() + count, (end - count) * sizeof(int32_t));
+    std::fill(deltas_.begin() + (end - count), deltas_.begin() + end, 0);
+    offset_ -= uint64_t(count) << 32;
+    return count;
+  }
+
+  const Kernel* kernels_ = kernels().data();
+  double clock_rate_;
+  uint32_t sample_rate_;
+  uint64_t factor_;  // Samples per clock, 32.32 fixed point
+  size_t capacity_;
+  size_t frame_samples_;
+  std::vector<int32_t> deltas_;
+  uint64_t offset_ = 0;  // Start of the current frame in samples, 32.32
+  int32_t accumulator_ = 0;
+};
@@ -0,0 +1,113 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+namespace chr_decode {
+  // SPREAD[b] puts bit 7 - i of b into byte i, so one plane is a single lookup
+  constexpr auto makeSpread(bool reversed) -> std::array<uint64_t, 256> {
+    std::array<uint64_t, 256> table{};
+    for(uint32_t b = 0; b < 256; b++) {
+      uint64_t value = 0;
+      for(uint32_t i = 0; i < 8; i++) {
+        const uint32_t bit = reversed ? i : 7 - i;
+        value |= uint64_t((b >> bit) & 1) << (i * 8);
+      }
+      table[b] = value;
+    }
+    return table;
+  }
+
+  inline constexpr auto SPREAD = makeSpread(false);
+  inline constexpr auto SPREAD_FLIPPED = makeSpread(true);
+}
+
+// 2C02 pattern data decoded ahead of time. Each 16-byte tile (two bit planes)
+// becomes 64 bytes of 2-bit pixel values, row by row, followed by the same 64
+// bytes mirrored horizontally. Tiles are keyed by their physical offset in
+// CHR ROM/RAM, so a mapper bank switch only changes which tile a pattern
+// address resolves to and never causes a re-decode.
+class ChrCache {
+public:
+  static constexpr size_t TILE_BYTES = 16;
+  static constexpr size_t DECODED_BYTES = 128;
+
+  // chr is CHR ROM or the CHR RAM array; writable says whether it can change
+  ChrCache(std::span<const uint8_t> chr, bool writable)
+    : chr_(chr), decoded_(chr.size() / TILE_BYTES * DECODED_BYTES),
+      dirty_(writable ? chr.size() / TILE_BYTES : 0, 1) {
+    if(!writable) {
+      for(size_t tile = 0; tile < chr.size() / TILE_BYTES; tile++) {
+        decode(tile);
+      }
+    }
+  }
+
+  // 8 pixel values of one tile row. offset is the physical CHR offset of the
+  // row's low plane byte (tile * 16 + fine y), as returned by Mapper::chrOffset.
+  auto row(uint32_t offset, bool flip) -> const uint8_t* {
+    const size_t tile = offset / TILE_BYTES;
+    if(!dirty_.empty() && dirty_[tile]) {
+      decode(tile);
+    }
+    return &decoded_[tile * DECODED_BYTES + (flip ? 64 : 0) + (offset & 0x7) * 8];
+  }
+
+  // row() for a cache with nothing left to decode (CHR ROM, or after
+  // decodeAll()). It doesn't write, so any number of threads can share one.
+  auto decodedRow(uint32_t offset, bool flip) const -> const uint8_t* {
+    return &decoded_[offset / TILE_BYTES * DECODED_BYTES + (flip ? 64 : 0) + (offset & 0x7) * 8];
+  }
+
+  // Decodes every stale tile up front
+  auto decodeAll() -> void {
+    for(size_t tile = 0; tile < dirty_.size(); tile++) {
+      if(dirty_[tile]) {
+        decode(tile);
+      }
+    }
+  }
+
+  // CHR RAM write at a physical offset
+  auto invalidate(uint32_t offset) -> void {
+    dirty_[offset / TILE_BYTES] = 1;
+  }
+
+  // CHR RAM replaced wholesale, e.g. by restoring a checkpoint
+  auto invalidateAll() -> void {
+    std::fill(dirty_.begin(), dirty_.end(), 1);
+  }
+
+private:
+  // Byte i of the uint64 is pixel i on little endian hosts
+  auto decode(size_t tile) -> void {
+    const uint8_t* planes = chr_.data() + tile * TILE_BYTES;
+    uint8_t* out = &decoded_[tile * DECODED_BYTES];
+    for(size_t y = 0; y < 8; y++) {
+      const uint8_t lo = planes[y];
+      const uint8_t hi = planes[y + 8];
+      const uint64_t normal = chr_decode::SPREAD[lo] | (chr_decode::SPREAD[hi] << 1);
+      const uint64_t flipped = chr_decode::SPREAD_FLIPPED[lo] | (chr_decode::SPREAD_FLIPPED[hi] << 1);
+      store(out + y * 8, normal);
+      store(out + 64 + y * 8, flipped);
+    }
+    if(!dirty_.empty()) {
+      dirty_[tile] = 0;
+    }
+  }
+
+  static auto store(uint8_t* out, uint64_t pixels) -> void {
+    if constexpr (std::endian::native == std::endian::big) {
+      pixels = std::byteswap(pixels);
+    }
+    std::memcpy(out, &pixels, 8);
+  }
+
+  std::span<const uint8_t> chr_;
+  std::vector<uint8_t> decoded_;
+  std::vector<uint8_t> dirty_;  // One flag per tile, empty for CHR ROM
+};
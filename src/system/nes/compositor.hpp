@@ -0,0 +1,151 @@
+#pragma once
+#include <utils/cpu_features.hpp>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TWIX_COMPOSITOR_X86 1
+#endif
+
+// One scanline worth of layer data, filled by the PPU before compositing.
+// Pixel values are 5-bit palette addresses: bits 0-1 are the pattern value
+// (0 = transparent), bits 2-3 the palette, bit 4 set for sprites.
+struct ScanlineLayers {
+  static constexpr size_t WIDTH = 256;
+  // 33 tiles so fine x scroll can start anywhere in the first one
+  alignas(32) std::array<uint8_t, WIDTH + 16> background;
+  alignas(32) std::array<uint8_t, WIDTH> sprites;
+  alignas(32) std::array<uint8_t, WIDTH> behind;   // 0xFF where the sprite pixel is behind the background
+  alignas(32) std::array<uint8_t, WIDTH> sprite0;  // 0xFF where the sprite pixel comes from sprite 0
+};
+
+namespace compositor {
+  // Inputs of one compose call. background points into ScanlineLayers::background
+  // at the fine x offset and may be unaligned.
+  struct Line {
+    const uint8_t* background;
+    const uint8_t* sprites;
+    const uint8_t* behind;
+    const uint8_t* sprite0;
+    const uint8_t* palette;  // 32 entries, a clear pixel always uses entry 0
+    uint8_t color_mask;      // 0x30 in greyscale mode, 0x3F otherwise
+  };
+
+  // Reference version, also the fallback. Writes 256 palette colors to out and
+  // returns the first x with an opaque sprite 0 pixel over an opaque background
+  // pixel, or -1. x = 255 never hits.
+  inline auto composeScalar(const Line& line, uint8_t* out) -> int32_t {
+    int32_t hit = -1;
+    for(uint32_t x = 0; x < ScanlineLayers::WIDTH; x++) {
+      const uint8_t bg = line.background[x];
+      const uint8_t spr = line.sprites[x];
+      const bool bg_opaque = bg & 0x03;
+      const bool spr_opaque = spr & 0x03;
+      if(hit < 0 && bg_opaque && spr_opaque && line.sprite0[x] && x != 255) {
+        hit = static_cast<int32_t>(x);
+      }
+      uint8_t index = bg_opaque ? bg : 0;
+      if(spr_opaque && (!bg_opaque || !line.behind[x])) {
+        index = spr;
+      }
+      out[x] = line.palette[index] & line.color_mask;
+    }
+    return hit;
+  }
+
+#ifdef TWIX_COMPOSITOR_X86
+  // 16 pixels per step. Layer selection is mask logic and one blend, the
+  // palette lookup is a pshufb into each half of the palette.
+  __attribute__((target("sse4.1")))
+  inline auto composeSse41(const Line& line, uint8_t* out) -> int32_t {
+    const __m128i three = _mm_set1_epi8(0x03);
+    const __m128i high = _mm_set1_epi8(0x10);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_cmpeq_epi8(zero, zero);
+    const __m128i pal_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line.palette));
+    const __m128i pal_hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line.palette + 16));
+    const __m128i color_mask = _mm_set1_epi8(static_cast<char>(line.color_mask));
+    int32_t hit = -1;
+    for(uint32_t x = 0; x < ScanlineLayers::WIDTH; x += 16) {
+      const __m128i bg = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line.background + x));
+      const __m128i spr = _mm_load_si128(reinterpret_cast<const __m128i*>(line.sprites + x));
+      const __m128i behind = _mm_load_si128(reinterpret_cast<const __m128i*>(line.behind + x));
+      const __m128i bg_clear = _mm_cmpeq_epi8(_mm_and_si128(bg, three), zero);
+      const __m128i spr_clear = _mm_cmpeq_epi8(_mm_and_si128(spr, three), zero);
+      // Sprite shows where it's opaque and either in front or over a clear background
+      const __m128i use_spr = _mm_andnot_si128(spr_clear, _mm_or_si128(bg_clear, _mm_xor_si128(behind, ones)));
+      const __m128i index = _mm_blendv_epi8(_mm_andnot_si128(bg_clear, bg), spr, use_spr);
+      // pshufb only looks at the low 4 bits, bit 4 picks the palette half
+      const __m128i color = _mm_blendv_epi8(_mm_shuffle_epi8(pal_lo, index), _mm_shuffle_epi8(pal_hi, index),
+                                            _mm_cmpeq_epi8(_mm_and_si128(index, high), high));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_and_si128(color, color_mask));
+      if(hit < 0) {
+        const __m128i s0 = _mm_load_si128(reinterpret_cast<const __m128i*>(line.sprite0 + x));
+        uint32_t both = _mm_movemask_epi8(_mm_andnot_si128(_mm_or_si128(bg_clear, spr_clear), s0));
+        if(x == ScanlineLayers::WIDTH - 16) {
+          both &= 0x7FFF;
+        }
+        if(both) {
+          hit = static_cast<int32_t>(x + std::countr_zero(both));
+        }
+      }
+    }
+    return hit;
+  }
+
+  // Same steps as composeSse41 on 32 pixels
+  __attribute__((target("avx2")))
+  inline auto composeAvx2(const Line& line, uint8_t* out) -> int32_t {
+    const __m256i three = _mm256_set1_epi8(0x03);
+    const __m256i high = _mm256_set1_epi8(0x10);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_cmpeq_epi8(zero, zero);
+    // vpshufb works per 128-bit lane, so each lane gets its own copy of the palette
+    const __m256i pal_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(line.palette)));
+    const __m256i pal_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(line.palette + 16)));
+    const __m256i color_mask = _mm256_set1_epi8(static_cast<char>(line.color_mask));
+    int32_t hit = -1;
+    for(uint32_t x = 0; x < ScanlineLayers::WIDTH; x += 32) {
+      const __m256i bg = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(line.background + x));
+      const __m256i spr = _mm256_load_si256(reinterpret_cast<const __m256i*>(line.sprites + x));
+      const __m256i behind = _mm256_load_si256(reinterpret_cast<const __m256i*>(line.behind + x));
+      const __m256i bg_clear = _mm256_cmpeq_epi8(_mm256_and_si256(bg, three), zero);
+      const __m256i spr_clear = _mm256_cmpeq_epi8(_mm256_and_si256(spr, three), zero);
+      const __m256i use_spr = _mm256_andnot_si256(spr_clear, _mm256_or_si256(bg_clear, _mm256_xor_si256(behind, ones)));
+      const __m256i index = _mm256_blendv_epi8(_mm256_andnot_si256(bg_clear, bg), spr, use_spr);
+      const __m256i color = _mm256_blendv_epi8(_mm256_shuffle_epi8(pal_lo, index), _mm256_shuffle_epi8(pal_hi, index),
+                                               _mm256_cmpeq_epi8(_mm256_and_si256(index, high), high));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), _mm256_and_si256(color, color_mask));
+      if(hit < 0) {
+        const __m256i s0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(line.sprite0 + x));
+        uint32_t both = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_andnot_si256(_mm256_or_si256(bg_clear, spr_clear), s0)));
+        if(x == ScanlineLayers::WIDTH - 32) {
+          both &= 0x7FFFFFFF;
+        }
+        if(both) {
+          hit = static_cast<int32_t>(x + std::countr_zero(both));
+        }
+      }
+    }
+    return hit;
+  }
+#endif
+
+  using ComposeFn = int32_t (*)(const Line&, uint8_t*);
+
+  inline auto bestCompose() -> ComposeFn {
+#ifdef TWIX_COMPOSITOR_X86
+    const auto& cpu = Components::cpuFeatures();
+    static const ComposeFn best = cpu.avx2 ? composeAvx2 : cpu.sse41 ? composeSse41 : composeScalar;
+    return best;
+#else
+    return composeScalar;
+#endif
+  }
+
+  inline auto compose(const Line& line, uint8_t* out) -> int32_t {
+    return bestCompose()(line, out);
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <utils/cothread.hpp>
+#include <cstdint>
+#include <filesystem>
+#include "nes.hpp"
+
+// Accuracy-validation mode: the CPU, PPU and APU as cooperative threads on
+// one clock in CPU cycles. The PPU and APU step one cycle at a time and stay
+// behind the CPU, which runs ahead an instruction at a time until one of
+// them is behind it, then yields to it. Register accesses still catch the
+// other side up to the exact cycle, so the results are the batched model's,
+// only with every component visiting every cycle; a divergence between the
+// two points at a catch-up or prediction bug.
+//
+// The CPU core executes whole instructions, so that is as fine as the CPU
+// side interleaves.
+template<typename Mapper, typename Audio = BandLimitedAudio>
+class CooperativeNes {
+public:
+  enum Thread : size_t { CPU, PPU, APU };
+
+  explicit CooperativeNes(cores::mos6502::NesRom& rom, const std::filesystem::path& save_path = {})
+    : nes_(rom, save_path) {
+    const uint64_t now = nes_.arena().cpu.Cycles;
+    // Added in Thread order, ties go to the CPU
+    scheduler_.add(cpuThread(), now);
+    scheduler_.add(ppuThread(), now);
+    scheduler_.add(apuThread(), now);
+  }
+
+  CooperativeNes(const CooperativeNes&) = delete;
+  auto operator=(const CooperativeNes&) -> CooperativeNes& = delete;
+
+  // Runs until every component has reached cycle
+  auto runUntil(uint64_t cycle) -> void {
+    scheduler_.runUntil(cycle);
+  }
+
+  // For setup and inspection. Moving the clock under the threads (reset(),
+  // restore()) is not supported.
+  auto nes() -> Nes<Mapper, Audio>& { return nes_; }
+  auto scheduler() const -> const Components::CoScheduler& { return scheduler_; }
+
+private:
+  auto cpuThread() -> Components::CoThread {
+    const uint64_t& cycles = nes_.arena().cpu.Cycles;
+    for(;;) {
+      const uint64_t before = cycles;
+      nes_.runCycle();
+      co_await scheduler_.step(CPU, cycles - before);
+    }
+  }
+
+  auto ppuThread() -> Components::CoThread {
+    for(;;) {
+      nes_.ppu().catchUp(scheduler_.clock(PPU));
+      co_await scheduler_.step(PPU, 1);
+    }
+  }
+
+  auto apuThread() -> Components::CoThread {
+    for(;;) {
+      nes_.apu().catchUp(scheduler_.clock(APU));
+      co_await scheduler_.step(APU, 1);
+    }
+  }
+
+  Nes<Mapper, Audio> nes_;
+  Components::CoScheduler scheduler_;
+};
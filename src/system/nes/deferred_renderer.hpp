@@ -0,0 +1,245 @@
+#pragma once
+#include <cores/mos6502/nesRom.hpp>
+#include <utils/thread_pool.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <vector>
+#include "ppu.hpp"
+
+// Renders frames off the emulation thread. The emulation-side PPU stops
+// drawing and only keeps timing state; this listener snapshots the PPU and
+// mapper state when a frame starts and logs every rendering-relevant access
+// until VBlank. The finished frame is then split into bands of scanlines and
+// each band is rebuilt on the thread pool by replaying the log through a
+// private PPU, which gives exactly the pixels the serial renderer would. The
+// bands read tiles from one shared decoded CHR cache: the emulation PPU's for
+// CHR ROM, a snapshot decoded once per frame for CHR RAM.
+//
+// Only one frame renders at a time. If the previous one is still busy when
+// the next is captured, the new one is dropped instead of waiting.
+template<typename Mapper>
+struct DeferredRenderer final : PpuFrameListener {
+  DeferredRenderer(cores::mos6502::NesRom& rom, Ppu<Mapper>& ppu, const PpuState& ppu_state,
+                   const typename Mapper::State& mapper_state, Components::ThreadPool& pool, size_t bands)
+    : ppu_(ppu), ppu_state_(ppu_state), mapper_state_(mapper_state), pool_(pool),
+      frame_(ppu_timing::SCREEN_WIDTH * ppu_timing::VISIBLE_LINES),
+      latest_(ppu_timing::SCREEN_WIDTH * ppu_timing::VISIBLE_LINES) {
+    // CHR ROM never changes, the emulation PPU's cache is read only
+    if(rom.getChrRomSize() > 0) {
+      shared_chr_ = ppu.chrCache();
+    } else {
+      chr_snapshot_.emplace(job_.ppu.chr_ram, true);
+      shared_chr_ = &*chr_snapshot_;
+    }
+    bands = std::clamp<size_t>(bands, 1, ppu_timing::VISIBLE_LINES);
+    for(size_t band = 0; band < bands; band++) {
+      const uint32_t first = static_cast<uint32_t>(ppu_timing::VISIBLE_LINES * band / bands);
+      const uint32_t last = static_cast<uint32_t>(ppu_timing::VISIBLE_LINES * (band + 1) / bands);
+      contexts_.push_back(std::make_unique<Context>(rom, first, last, shared_chr_));
+    }
+    ppu_.renderLines(0, 0);
+    ppu_.setListener(this);
+  }
+
+  ~DeferredRenderer() override {
+    ppu_.setListener(nullptr);
+    ppu_.renderLines(0, ppu_timing::VISIBLE_LINES);
+    waitIdle();
+  }
+
+  DeferredRenderer(const DeferredRenderer&) = delete;
+  auto operator=(const DeferredRenderer&) -> DeferredRenderer& = delete;
+
+  auto frameStart(uint64_t dot_clock) -> void override {
+    capture_.ppu = ppu_state_;
+    capture_.mapper = mapper_state_;
+    capture_.start = dot_clock;
+    capture_.log.clear();
+    capture_.oam_pages.clear();
+    capturing_ = true;
+  }
+
+  auto access(Access kind, uint16_t address, uint8_t data, uint64_t dot_clock) -> void override {
+    if(capturing_) {
+      capture_.log.push_back({dot_clock, address, data, kind});
+    }
+  }
+
+  // The page is copied, the log entry's address says which one
+  auto oamDma(const uint8_t* page, uint64_t dot_clock) -> void override {
+    if(capturing_) {
+      const auto index = static_cast<uint16_t>(capture_.oam_pages.size());
+      capture_.oam_pages.emplace_back();
+      std::memcpy(capture_.oam_pages.back().data(), page, 256);
+      capture_.log.push_back({dot_clock, index, 0, Access::OAM_DMA});
+    }
+  }
+
+  auto frameEnd() -> void override {
+    if(!capturing_) {
+      return;
+    }
+    capturing_ = false;
+    if(busy_.load(std::memory_order_acquire)) {
+      dropped_++;
+      return;
+    }
+    // The workers own job_ until the last band is done, the capture buffers
+    // are swapped in so the log doesn't reallocate every frame
+    std::swap(job_, capture_);
+    if(chr_snapshot_) {
+      // CHR RAM as the frame starts, every band reads it until it replays a write
+      chr_snapshot_->invalidateAll();
+      chr_snapshot_->decodeAll();
+    }
+    busy_.store(true, std::memory_order_release);
+    bands_left_.store(contexts_.size(), std::memory_order_relaxed);
+    for(auto& context : contexts_) {
+      pool_.submit([this, context = context.get()] { renderBand(*context); });
+    }
+  }
+
+  // Copies the newest finished frame (256x240 color indices, and optionally
+  // the 240 per-line emphasis values) and returns its PPU frame number, 0 if
+  // nothing has been rendered yet
+  auto latestFrame(std::span<uint8_t> out, std::span<uint8_t> emphasis = {}) const -> uint64_t {
+    std::lock_guard lock(latest_mutex_);
+    std::memcpy(out.data(), latest_.data(), std::min(out.size(), latest_.size()));
+    if(!emphasis.empty()) {
+      std::memcpy(emphasis.data(), latest_emphasis_.data(), std::min(emphasis.size(), latest_emphasis_.size()));
+    }
+    return latest_number_;
+  }
+
+  // Frames that were skipped because the previous one was still rendering
+  auto droppedFrames() const -> uint64_t {
+    return dropped_;
+  }
+
+  auto waitIdle() -> void {
+    std::unique_lock lock(latest_mutex_);
+    idle_.wait(lock, [this] { return !busy_.load(std::memory_order_acquire); });
+  }
+
+private:
+  struct LogEntry {
+    uint64_t dot_clock;
+    uint16_t address;
+    uint8_t data;
+    Access kind;
+  };
+
+  struct Capture {
+    PpuState ppu;
+    typename Mapper::State mapper;
+    uint64_t start = 0;
+    std::vector<LogEntry> log;
+    std::vector<std::array<uint8_t, 256>> oam_pages;
+  };
+
+  // A private PPU and mapper per band, decoded tiles come from the shared cache
+  struct Context {
+    Context(cores::mos6502::NesRom& rom, uint32_t first_line, uint32_t last_line, const ChrCache* shared_chr)
+      : first(first_line), last(last_line), mapper(rom, mapper_state, prg_ram),
+        ppu(rom, ppu_state, mapper, clock, shared_chr) {
+      ppu.renderLines(first, last);
+    }
+
+    uint32_t first;
+    uint32_t last;
+    PpuState ppu_state{};
+    typename Mapper::State mapper_state{};
+    std::array<uint8_t, 0x2000> prg_ram{};
+    uint64_t clock = 0;
+    Mapper mapper;
+    Ppu<Mapper> ppu;
+  };
+
+  auto renderBand(Context& context) -> void {
+    using namespace ppu_timing;
+    context.ppu_state = job_.ppu;
+    context.mapper_state = job_.mapper;
+    context.ppu.stateRestored();
+    // Line l is drawn when the PPU passes dot 256, lines 0-239 are all full length
+    const uint64_t done = job_.start + uint64_t(context.last - 1) * DOTS_PER_LINE + 257;
+    for(const LogEntry& entry : job_.log) {
+      if(entry.dot_clock >= done) {
+        break;
+      }
+      // Accesses always land on a CPU cycle, the PPU catches up to it first
+      context.clock = entry.dot_clock / DOTS_PER_CPU_CYCLE;
+      switch(entry.kind) {
+        case Access::REGISTER_WRITE:
+          context.ppu.writeRegister(entry.address, entry.data);
+          break;
+        case Access::REGISTER_READ:
+          context.ppu.readRegister(entry.address);
+          break;
+        case Access::MAPPER_WRITE:
+          context.ppu.sync();
+          context.mapper.write(entry.address, entry.data);
+          context.ppu.mapperWritten(entry.address, entry.data);
+          break;
+        case Access::OAM_DMA:
+          context.ppu.oamDma(job_.oam_pages[entry.address].data());
+          break;
+      }
+    }
+    context.ppu.catchUp((done + DOTS_PER_CPU_CYCLE - 1) / DOTS_PER_CPU_CYCLE);
+
+    const size_t offset = size_t(context.first) * SCREEN_WIDTH;
+    const size_t length = size_t(context.last - context.first) * SCREEN_WIDTH;
+    std::memcpy(frame_.data() + offset, context.ppu.frameBuffer().data() + offset, length);
+    const FrameView view = context.ppu.frameView();
+    std::copy(view.emphasis.begin() + context.first, view.emphasis.begin() + context.last,
+              emphasis_.begin() + context.first);
+    if(bands_left_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      publish();
+    }
+  }
+
+  // Notified under the lock, the renderer may be destroyed as soon as a
+  // waitIdle() sees busy_ drop
+  auto publish() -> void {
+    std::lock_guard lock(latest_mutex_);
+    std::swap(latest_, frame_);
+    latest_emphasis_ = emphasis_;
+    latest_number_ = job_.ppu.frame;
+    busy_.store(false, std::memory_order_release);
+    idle_.notify_all();
+  }
+
+  Ppu<Mapper>& ppu_;
+  const PpuState& ppu_state_;
+  const typename Mapper::State& mapper_state_;
+  Components::ThreadPool& pool_;
+  std::vector<std::unique_ptr<Context>> contexts_;
+  const ChrCache* shared_chr_ = nullptr;
+  // CHR RAM boards: job_'s CHR RAM decoded, rebuilt when a frame is handed out
+  std::optional<ChrCache> chr_snapshot_;
+
+  // Emulation thread only
+  Capture capture_;
+  bool capturing_ = false;
+  uint64_t dropped_ = 0;
+
+  // Handed to the workers while busy_
+  Capture job_;
+  std::atomic<bool> busy_{false};
+  std::atomic<size_t> bands_left_{0};
+  std::vector<uint8_t> frame_;
+  std::array<uint8_t, ppu_timing::VISIBLE_LINES> emphasis_{};
+
+  mutable std::mutex latest_mutex_;
+  std::condition_variable idle_;
+  std::vector<uint8_t> latest_;
+  std::array<uint8_t, ppu_timing::VISIBLE_LINES> latest_emphasis_{};
+  uint64_t latest_number_ = 0;
+};
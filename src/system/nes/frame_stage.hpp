@@ -0,0 +1,157 @@
+#pragma once
+#include <utils/thread_pool.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <vector>
+#include "pixel_format.hpp"
+
+// Takes finished index frames off the emulation thread and turns them into
+// an output image on the thread pool, one band of source lines per task.
+// submit() copies the frame and returns straight away, the emulation thread
+// never waits. While a frame is being processed the next one waits in a
+// single pending slot; if another arrives first the older pending frame is
+// dropped and counted. Output images are triple buffered, the reader copies
+// its own buffer without holding the lock submit() takes. All buffers are
+// allocated up front.
+class FrameStage {
+public:
+  // Runs on a worker for source lines [first, last) and writes the matching
+  // part of the output image. band is 0 to bands() - 1, for per-band scratch.
+  using BandFn = std::function<void(size_t band, const FrameView& frame, uint64_t frame_number,
+                                    uint32_t first, uint32_t last, uint8_t* out)>;
+
+  FrameStage(Components::ThreadPool& pool, size_t bands, size_t output_bytes, BandFn band)
+    : pool_(pool), bands_(std::clamp<size_t>(bands, 1, FrameView::HEIGHT)), band_(std::move(band)),
+      images_{std::vector<uint8_t>(output_bytes), std::vector<uint8_t>(output_bytes),
+              std::vector<uint8_t>(output_bytes)} {
+  }
+
+  ~FrameStage() {
+    waitIdle();
+  }
+
+  FrameStage(const FrameStage&) = delete;
+  auto operator=(const FrameStage&) -> FrameStage& = delete;
+
+  auto bands() const -> size_t { return bands_; }
+
+  auto submit(const FrameView& frame, uint64_t frame_number) -> void {
+    std::lock_guard lock(mutex_);
+    if(pending_full_) {
+      dropped_++;
+    }
+    std::memcpy(pending_.indices.data(), frame.indices.data(), pending_.indices.size());
+    std::memcpy(pending_.emphasis.data(), frame.emphasis.data(), pending_.emphasis.size());
+    pending_.number = frame_number;
+    pending_full_ = true;
+    if(!busy_) {
+      start();
+    }
+  }
+
+  // Copies the newest finished image and returns its frame number, 0 if
+  // nothing has been processed yet
+  auto latestFrame(std::span<uint8_t> out) const -> uint64_t {
+    std::lock_guard read(read_mutex_);
+    {
+      // Only the buffer indices change hands under mutex_
+      std::lock_guard lock(mutex_);
+      if(latest_fresh_) {
+        std::swap(reading_, latest_);
+        reading_number_ = latest_number_;
+        latest_fresh_ = false;
+      }
+    }
+    const std::vector<uint8_t>& image = images_[reading_];
+    std::memcpy(out.data(), image.data(), std::min(out.size(), image.size()));
+    return reading_number_;
+  }
+
+  // Frames replaced in the pending slot before they were processed
+  auto droppedFrames() const -> uint64_t {
+    std::lock_guard lock(mutex_);
+    return dropped_;
+  }
+
+  // Waits until the pending frame, if any, has been processed too
+  auto waitIdle() -> void {
+    std::unique_lock lock(mutex_);
+    idle_.wait(lock, [this] { return !busy_; });
+  }
+
+private:
+  struct Input {
+    std::array<uint8_t, FrameView::WIDTH * FrameView::HEIGHT> indices{};
+    std::array<uint8_t, FrameView::HEIGHT> emphasis{};
+    uint64_t number = 0;
+  };
+
+  // Called with mutex_ held
+  auto start() -> void {
+    std::swap(job_, pending_);
+    pending_full_ = false;
+    busy_ = true;
+    bands_left_.store(bands_, std::memory_order_relaxed);
+    for(size_t band = 0; band < bands_; band++) {
+      pool_.submit([this, band] { runBand(band); });
+    }
+  }
+
+  auto runBand(size_t band) -> void {
+    const uint32_t first = static_cast<uint32_t>(FrameView::HEIGHT * band / bands_);
+    const uint32_t last = static_cast<uint32_t>(FrameView::HEIGHT * (band + 1) / bands_);
+    band_(band, FrameView{job_.indices, job_.emphasis}, job_.number, first, last, images_[working_].data());
+    if(bands_left_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+      return;
+    }
+    // Notified under the lock: once busy_ drops, waitIdle() may return and
+    // the stage may be destroyed
+    std::lock_guard lock(mutex_);
+    std::swap(latest_, working_);
+    latest_number_ = job_.number;
+    latest_fresh_ = true;
+    if(pending_full_) {
+      start();
+      return;
+    }
+    busy_ = false;
+    idle_.notify_all();
+  }
+
+  Components::ThreadPool& pool_;
+  size_t bands_;
+  BandFn band_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable idle_;
+  Input pending_;
+  bool pending_full_ = false;
+  bool busy_ = false;
+  uint64_t dropped_ = 0;
+
+  // Owned by the band tasks while busy_
+  Input job_;
+  std::atomic<size_t> bands_left_{0};
+
+  // Indices into images_: working_ belongs to the band tasks, latest_ is the
+  // newest finished image and reading_ belongs to latestFrame(). Finishing a
+  // frame swaps working_ and latest_, a read that finds latest_fresh_ swaps
+  // reading_ and latest_, both under mutex_. The const reader moves them too.
+  std::array<std::vector<uint8_t>, 3> images_;
+  size_t working_ = 0;
+  mutable size_t latest_ = 1;
+  uint64_t latest_number_ = 0;
+  mutable bool latest_fresh_ = false;
+
+  // Keeps concurrent readers off each other's copy
+  mutable std::mutex read_mutex_;
+  mutable size_t reading_ = 2;
+  mutable uint64_t reading_number_ = 0;
+};
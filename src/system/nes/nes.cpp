@@ -1,15 +1,273 @@
 #include <cores/mos6502/cpu.hpp>
+#include <cores/mos6502/romDatabase.hpp>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
 #include "nes.hpp"
+#include "recorder.hpp"
 
-int main(int argc, char** argv) {
-  std::string rom_path = argv[1];
-  cores::mos6502::NesRom rom{rom_path};
-  NesRAM<Mapper0> ram{rom};
-  cores::mos6502::mos6502<NesRAM<Mapper0>> core{ram};
-  core.setPC(0xC000);
-  while(true) {
-    cores::mos6502::printInstruction(core);
-    core.runCycle();
+namespace {
+volatile std::sig_atomic_t interrupted = 0;
+
+enum class Trace { OFF, TEXT, BINARY };
+
+struct Options {
+  std::string rom;
+  std::string database;  // Header corrections, looked up by PRG+CHR hash
+  Recorder::Options record;
+  uint64_t frames = 0;  // 0 runs until Ctrl-C
+  bool video = true;
+  bool audio = true;
+  Trace trace = Trace::OFF;
+  bool bench = false;
+};
+
+// --trace binary writes one of these per instruction, before it runs, to
+// <rom>.trace. Little-endian, no header.
+struct TraceRecord {
+  uint64_t cycles;
+  uint16_t pc;
+  uint8_t a;
+  uint8_t x;
+  uint8_t y;
+  uint8_t sp;
+  uint8_t p;
+  uint8_t opcode;
+};
+static_assert(sizeof(TraceRecord) == 16);
+
+auto usage() -> int {
+  std::cerr << "usage: nes <rom> [--frames <n>] [--no-video] [--no-audio] [--trace off|text|binary] [--bench]\n"
+               "           [--db <rom database>]\n"
+               "           [--record <file|-> [--record-format y4m|rgba|indices]] [--record-audio <wav>]"
+               " [--direct-io]\n";
+  return 1;
+}
+
+auto parseFormat(const std::string& name) -> std::optional<VideoFormat> {
+  if(name == "y4m") {
+    return VideoFormat::Y4M;
+  }
+  if(name == "rgba") {
+    return VideoFormat::RGBA;
+  }
+  if(name == "indices") {
+    return VideoFormat::INDICES;
+  }
+  return std::nullopt;
+}
+
+auto parseTrace(const std::string& name) -> std::optional<Trace> {
+  if(name == "off") {
+    return Trace::OFF;
+  }
+  if(name == "text") {
+    return Trace::TEXT;
+  }
+  if(name == "binary") {
+    return Trace::BINARY;
+  }
+  return std::nullopt;
+}
+
+auto parseArgs(int argc, char** argv, Options& options) -> bool {
+  if(argc < 2) {
+    return false;
+  }
+  options.rom = argv[1];
+  for(int i = 2; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if(arg == "--direct-io") {
+      options.record.direct_io = true;
+    } else if(arg == "--no-video") {
+      options.video = false;
+    } else if(arg == "--no-audio") {
+      options.audio = false;
+    } else if(arg == "--bench") {
+      options.bench = true;
+    } else if(!has_value) {
+      return false;
+    } else if(arg == "--db") {
+      options.database = argv[++i];
+    } else if(arg == "--record") {
+      options.record.video = argv[++i];
+    } else if(arg == "--record-format") {
+      auto format = parseFormat(argv[++i]);
+      if(!format) {
+        return false;
+      }
+      options.record.format = *format;
+    } else if(arg == "--record-audio") {
+      options.record.audio = argv[++i];
+    } else if(arg == "--frames") {
+      options.frames = std::strtoull(argv[++i], nullptr, 10);
+    } else if(arg == "--trace") {
+      auto trace = parseTrace(argv[++i]);
+      if(!trace) {
+        return false;
+      }
+      options.trace = *trace;
+    } else {
+      return false;
+    }
+  }
+  // Nothing to record without the output it needs
+  return (options.video || options.record.video.empty()) && (options.audio || options.record.audio.empty());
+}
+
+// Peak resident set in KB, as the kernel counts it
+auto peakRssKb() -> long {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+auto percentile(std::vector<double> values, double p) -> double {
+  if(values.empty()) {
+    return 0;
+  }
+  const size_t index = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+auto jsonString(const std::string& text) -> std::string {
+  std::string out = "\"";
+  for(char c : text) {
+    if(c == '"' || c == '\\') {
+      out += '\\';
+    }
+    out += c;
+  }
+  return out + "\"";
+}
+
+auto printBench(const Options& options, uint64_t frames, uint64_t instructions, uint64_t cycles, double seconds,
+                const std::vector<double>& frame_ms) -> void {
+  const double max = frame_ms.empty() ? 0 : *std::max_element(frame_ms.begin(), frame_ms.end());
+  std::cout << "{\n"
+            << "  \"rom\": " << jsonString(options.rom) << ",\n"
+            << "  \"video\": " << (options.video ? "true" : "false") << ",\n"
+            << "  \"audio\": " << (options.audio ? "true" : "false") << ",\n"
+            << "  \"frames\": " << frames << ",\n"
+            << "  \"seconds\": " << seconds << ",\n"
+            << "  \"fps\": " << frames / seconds << ",\n"
+            << "  \"mips\": " << instructions / seconds / 1e6 << ",\n"
+            << "  \"instructions\": " << instructions << ",\n"
+            << "  \"cpu_cycles\": " << cycles << ",\n"
+            << "  \"frame_ms\": {\"p50\": " << percentile(frame_ms, 0.50) << ", \"p90\": "
+            << percentile(frame_ms, 0.90) << ", \"p99\": " << percentile(frame_ms, 0.99) << ", \"max\": " << max
+            << "},\n"
+            << "  \"peak_rss_kb\": " << peakRssKb() << "\n"
+            << "}\n";
+}
+
+template<typename Mapper, typename Audio>
+auto run(const Options& options, cores::mos6502::NesRom& rom) -> int {
+  auto save_path = std::filesystem::path(options.rom).replace_extension(".sav");
+  Nes<Mapper, Audio> nes{rom, save_path};
+  // The reset vector, as the CPU does at power on
+  nes.cpu().setPC(nes.bus().peek(0xFFFC) | nes.bus().peek(0xFFFD) << 8);
+  if(!options.video) {
+    // Timing and sprite 0 still run, no line is ever drawn
+    nes.ppu().setFrameSkip(0);
+  }
+
+  // Stops after --frames or on Ctrl-C so recordings are closed properly
+  std::signal(SIGINT, [](int) { interrupted = 1; });
+  std::optional<Recorder> recorder;
+  std::vector<int16_t> samples;
+  if(!options.record.video.empty() || !options.record.audio.empty()) {
+    Recorder::Options record = options.record;
+    record.sample_rate = nes.apu().sampleRate();
+    recorder.emplace(record);
+  }
+  std::optional<recording::BlockFile> trace_file;
+  if(options.trace == Trace::BINARY) {
+    trace_file.emplace(std::filesystem::path(options.rom).replace_extension(".trace"), false);
+  }
+  auto trace = [&](auto& cpu) {
+    if(options.trace == Trace::TEXT) {
+      cores::mos6502::printInstruction(cpu);
+      return;
+    }
+    const auto& regs = nes.arena().cpu;
+    const TraceRecord record{regs.Cycles, regs.PC, regs.ACC, regs.X, regs.Y, regs.SP,
+                             static_cast<uint8_t>(cpu.getStatusByte()), nes.bus().peek(regs.PC)};
+    trace_file->append(&record, sizeof(record));
+  };
+
+  std::vector<double> frame_ms;
+  uint64_t frames = 0;
+  const auto start = std::chrono::steady_clock::now();
+  while(!interrupted && (options.frames == 0 || frames < options.frames)) {
+    const auto frame_start = std::chrono::steady_clock::now();
+    if(options.trace == Trace::OFF) {
+      nes.runFrame();
+    } else {
+      nes.runFrame(trace);
+    }
+    if(options.bench) {
+      const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - frame_start;
+      frame_ms.push_back(elapsed.count());
+    }
+    frames++;
+    if(recorder) {
+      recorder->pushFrame(nes.ppu().frameView());
+      samples.resize(nes.apu().samplesAvailable());
+      recorder->pushAudio(std::span(samples.data(), nes.apu().readSamples(samples)));
+    }
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  nes.flushSaveRam();
+  if(trace_file) {
+    trace_file->flush();
+  }
+  if(recorder) {
+    recorder->finish();
+    std::cerr << "recorded " << recorder->framesWritten() << " frames, " << recorder->droppedFrames()
+              << " dropped, " << recorder->droppedSamples() << " audio samples dropped\n";
+  }
+  if(options.bench) {
+    printBench(options, frames, nes.instructions(), nes.arena().cpu.Cycles, elapsed.count(), frame_ms);
   }
   return 0;
 }
+
+// Without audio the APU keeps its timing (IRQs, DMC fetches and their
+// stalls) and skips synthesis
+template<typename Mapper>
+auto run(const Options& options, cores::mos6502::NesRom& rom) -> int {
+  return options.audio ? run<Mapper, BandLimitedAudio>(options, rom) : run<Mapper, TimingOnlyAudio>(options, rom);
+}
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if(!parseArgs(argc, argv, options)) {
+    return usage();
+  }
+  cores::mos6502::NesRom rom{options.rom};
+  if(!options.database.empty()) {
+    // Known bad dumps get the mapper and mirroring they actually need
+    cores::mos6502::RomDatabase database{options.database};
+    if(database.correct(rom)) {
+      std::cerr << options.rom << ": header corrected from " << options.database << "\n";
+    }
+  }
+  switch(rom.getMapperNumber()) {
+    case 0: return run<Mapper0>(options, rom);
+    case 1: return run<Mapper1>(options, rom);
+    default:
+      std::cerr << options.rom << ": mapper " << rom.getMapperNumber() << " is not supported\n";
+      return 1;
+  }
+}
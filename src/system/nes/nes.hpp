@@ -1,29 +1,116 @@
 #pragma once
 #include <cores/mos6502/cpu.hpp>
+#include <utils/mapped_file.hpp>
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include "apu.hpp"
+#include "deferred_renderer.hpp"
+#include "ppu.hpp"
+#include "save_state.hpp"
+#include "scheduler.hpp"
 
 template<typename Mapper>
+struct NesArena;
+
+// Mutable bus state. It is owned by the NesArena, NesRAM only holds a reference to it
+struct NesRAMState {
+  std::array<uint8_t, 0x800> internal_ram;  // 2KB internal RAM
+  std::array<uint8_t, 0x2000> prg_ram;      // 8KB PRG RAM (for cartridge)
+};
+
+// Audio is the APU's output policy, TimingOnlyAudio for runs without sound
+template<typename Mapper, typename Audio = BandLimitedAudio>
 struct NesRAM {
-  NesRAM(cores::mos6502::NesRom& rom) : rom_(rom), mapper_(rom) {
+  // The same whatever the policy, so the arena is too
+  using State = NesRAMState;
+
+  // When the cartridge has a battery and a save path is given, PRG RAM is the
+  // mmap'd save file instead of the arena copy. Stores then cost nothing extra
+  // and survive reset() the same way they survive a power cycle on hardware.
+  NesRAM(cores::mos6502::NesRom& rom, NesArena<Mapper>& arena, const std::filesystem::path& save_path = {})
+    : state_(arena.ram), rom_(rom), save_file_(openSaveFile(rom, save_path)),
+      prg_ram_(save_file_.isOpen() ? save_file_.bytes() : std::span<uint8_t>(state_.prg_ram)),
+      mapper_(rom, arena.mapper, prg_ram_), ppu_(rom, arena.ppu, mapper_, arena.cpu.Cycles),
+      apu_(arena.apu, mapper_, arena.cpu.Cycles), cpu_clock_(arena.cpu.Cycles) {
     // 2KB internal RAM
-    internal_ram_.fill(0);
+    state_.internal_ram.fill(0);
     // 8KB PRG RAM for cartridge (used by some mappers)
-    prg_ram_.fill(0);
+    state_.prg_ram.fill(0);
+  }
+
+  // Schedule write back of battery RAM, wait = true blocks until it's on disk
+  auto flushSaveRam(bool wait = false) -> void {
+    save_file_.flush(wait);
+  }
+
+  auto hasSaveFile() const -> bool {
+    return save_file_.isOpen();
+  }
+
+  // PRG RAM when it is the save file rather than the arena's copy, empty
+  // otherwise
+  auto batteryRam() const -> std::span<uint8_t> {
+    return save_file_.isOpen() ? prg_ram_ : std::span<uint8_t>{};
+  }
+
+  auto ppu() -> Ppu<Mapper>& {
+    return ppu_;
+  }
+
+  auto apu() -> Apu<Mapper, Audio>& {
+    return apu_;
+  }
+
+  auto scheduler() -> Scheduler& {
+    return scheduler_;
+  }
+
+  // IRQ line as the CPU sees it: the APU's, or'd with the mapper's when the
+  // board has one
+  auto irq() const -> bool {
+    if constexpr(requires { mapper_.irq(); }) {
+      if(mapper_.irq()) {
+        return true;
+      }
+    }
+    return apu_.irq();
+  }
+
+  // Puts every component's next event in the calendar. Register accesses
+  // keep it current as they go, this is for after the state was replaced or
+  // the events were handled.
+  auto reschedule() -> void {
+    schedulePpu();
+    scheduleApu();
+    scheduleMapper();
+    if(!oam_dma_pending_ && apu_.dmaCycles() == 0) {
+      scheduler_.cancel(SystemEvent::DMA);
+    }
   }
 
   auto load(uint16_t address) -> uint8_t {
     // $0000-$1FFF: 2KB internal RAM (mirrored 4 times)
     if(address <= 0x1FFF) {
-      return internal_ram_[address & 0x7FF];
+      return state_.internal_ram[address & 0x7FF];
     }
     // $2000-$3FFF: PPU registers (mirrored every 8 bytes)
-    // TODO: Implement PPU register reads
     else if(address <= 0x3FFF) {
-      // For now, return 0 (PPU not implemented yet)
-      return 0;
+      return ppu_.readRegister(address);
     }
-    // $4000-$4017: APU and I/O registers
-    // TODO: Implement APU/IO register reads
+    // $4015: APU status
+    else if(address == 0x4015) {
+      // Clearing the frame IRQ re-arms it
+      const uint8_t status = apu_.readStatus();
+      scheduleApu();
+      return status;
+    }
+    // $4016-$4017: Controllers
+    // TODO: Implement controller reads
     else if(address <= 0x4017) {
       return 0;
     }
@@ -37,35 +124,150 @@ struct NesRAM {
     }
   }
 
+  // load() without side effects, for tracing and debuggers: memory reads
+  // as load() would, the PPU, APU and I/O registers read as 0 and are left
+  // alone
+  auto peek(uint16_t address) -> uint8_t {
+    if(address <= 0x1FFF) {
+      return state_.internal_ram[address & 0x7FF];
+    }
+    if(address <= 0x401F) {
+      return 0;
+    }
+    return mapper_.read(address);
+  }
+
   auto store(uint16_t address, uint8_t data) -> void {
     // $0000-$1FFF: 2KB internal RAM (mirrored 4 times)
     if(address <= 0x1FFF) {
-      internal_ram_[address & 0x7FF] = data;
+      state_.internal_ram[address & 0x7FF] = data;
     }
     // $2000-$3FFF: PPU registers (mirrored every 8 bytes)
-    // TODO: Implement PPU register writes
     else if(address <= 0x3FFF) {
-      // PPU not implemented yet
+      ppu_.writeRegister(address, data);
+      schedulePpu();
+    }
+    // $4000-$4013, $4015, $4017: APU
+    else if(address <= 0x4013 || address == 0x4015 || address == 0x4017) {
+      apu_.writeRegister(address, data);
+      scheduleApu();
+    }
+    // $4014: OAM DMA, run once the instruction is done
+    else if(address == 0x4014) {
+      oam_dma_page_ = data;
+      oam_dma_pending_ = true;
+      scheduler_.schedule(SystemEvent::DMA, cpu_clock_);
     }
-    // $4000-$4017: APU and I/O registers
-    // TODO: Implement APU/IO register writes
+    // $4016: controller strobe
     else if(address <= 0x4017) {
-      // APU/IO not implemented yet
+      // TODO: Implement controllers
     }
     // $4018-$401F: APU and I/O functionality (normally disabled)
     else if(address <= 0x401F) {
       // Normally disabled
     }
-    // $4020-$FFFF: Cartridge space (handled by mapper)
+    // $4020-$7FFF: Cartridge RAM and expansion (handled by mapper)
+    else if(address <= 0x7FFF) {
+      mapper_.write(address, data);
+    }
+    // $8000-$FFFF: Mapper registers. Bank switches change what the PPU fetches
+    // from here on, so it has to catch up first.
     else {
+      ppu_.sync();
+      apu_.sync();
       mapper_.write(address, data);
+      ppu_.mapperWritten(address, data);
+      schedulePpu();
+      scheduleApu();
+      scheduleMapper();
+    }
+  }
+
+  auto dmaPending() const -> bool {
+    return oam_dma_pending_ || apu_.dmaCycles() != 0;
+  }
+
+  // Runs the DMA the last instruction started and returns how many cycles
+  // the CPU is halted for. cycle is where the CPU stands after the
+  // instruction.
+  auto runDma(uint64_t cycle) -> uint64_t {
+    uint64_t stall = apu_.takeDmaCycles();
+    if(oam_dma_pending_) {
+      oam_dma_pending_ = false;
+      ppu_.oamDma(dmaSource(oam_dma_page_));
+      // A cycle for the write to finish, another on odd cycles to line up
+      // with a read, then 256 reads and 256 writes
+      stall += 513 + ((cycle + stall) & 1);
     }
+    return stall;
   }
 
-  std::array<uint8_t, 0x800> internal_ram_;  // 2KB internal RAM
-  std::array<uint8_t, 0x2000> prg_ram_;      // 8KB PRG RAM (for cartridge)
+  // The page OAM DMA copies from. RAM and cartridge pages are read in
+  // place, anything else goes through load() a byte at a time, side effects
+  // included.
+  auto dmaSource(uint8_t page) -> const uint8_t* {
+    const uint16_t address = static_cast<uint16_t>(page << 8);
+    if(address <= 0x1FFF) {
+      return &state_.internal_ram[address & 0x7FF];
+    }
+    if constexpr(requires { mapper_.prgPage(address); }) {
+      if(address >= 0x6000) {
+        if(const uint8_t* source = mapper_.prgPage(address)) {
+          return source;
+        }
+      }
+    }
+    for(uint32_t i = 0; i < 256; i++) {
+      dma_buffer_[i] = load(static_cast<uint16_t>(address | i));
+    }
+    return dma_buffer_.data();
+  }
+
+  auto schedulePpu() -> void {
+    scheduler_.schedule(SystemEvent::PPU_SYNC, ppu_.nextSyncCycle());
+    if(ppu_.nmiPending()) {
+      scheduler_.schedule(SystemEvent::NMI, cpu_clock_);
+    } else {
+      scheduler_.cancel(SystemEvent::NMI);
+    }
+  }
+
+  // Catch-up on a register access can fetch DMC samples as well
+  auto scheduleApu() -> void {
+    scheduler_.schedule(SystemEvent::APU, apu_.nextEventCycle());
+    if(apu_.dmaCycles() != 0) {
+      scheduler_.schedule(SystemEvent::DMA, cpu_clock_);
+    }
+  }
+
+  // Boards with a counter IRQ give its next firing as nextIrqCycle()
+  auto scheduleMapper() -> void {
+    if constexpr(requires { mapper_.nextIrqCycle(); }) {
+      scheduler_.schedule(SystemEvent::MAPPER_IRQ, mapper_.nextIrqCycle());
+    }
+  }
+
+  static auto openSaveFile(cores::mos6502::NesRom& rom, const std::filesystem::path& save_path)
+      -> Components::MappedFile {
+    if(save_path.empty() || !rom.hasBatteryBackedRAM()) {
+      return {};
+    }
+    return Components::MappedFile::openWritable(save_path, sizeof(State::prg_ram));
+  }
+
+  State& state_;
   cores::mos6502::NesRom& rom_;
+  Components::MappedFile save_file_;
+  std::span<uint8_t> prg_ram_;  // Either state_.prg_ram or the save file
   Mapper mapper_;
+  Ppu<Mapper> ppu_;
+  Apu<Mapper, Audio> apu_;
+  const uint64_t& cpu_clock_;
+  Scheduler scheduler_;
+  // Only set between an instruction and runDma(), never in a checkpoint
+  bool oam_dma_pending_ = false;
+  uint8_t oam_dma_page_ = 0;
+  std::array<uint8_t, 256> dma_buffer_{};
 };
 
 // Mapper 0 (NROM) - No bank switching
@@ -73,17 +275,30 @@ struct NesRAM {
 // $8000-$BFFF: First 16 KB of ROM
 // $C000-$FFFF: Last 16 KB of ROM (or mirror of $8000-$BFFF if only 16KB)
 struct Mapper0 {
-  explicit Mapper0(cores::mos6502::NesRom& rom) : rom_(rom) {
+  // NROM has no registers
+  struct State {};
+
+  Mapper0(cores::mos6502::NesRom& rom, State&, std::span<uint8_t> prg_ram) : rom_(rom), prg_ram_(prg_ram) {
     prg_rom_size_ = rom.getPrgRomSize();
     // NROM has either 16KB or 32KB PRG ROM
     is_16kb_ = (prg_rom_size_ == 16384);
+    mirroring_ = rom.getMirroring();
+  }
+
+  // PPU $0000-$1FFF: 8KB of CHR, no banking
+  auto chrOffset(uint16_t address) const -> uint32_t {
+    return address & 0x1FFF;
+  }
+
+  // Fixed by the board, taken from the header
+  auto mirroring() const -> cores::mos6502::Mirroring {
+    return mirroring_;
   }
 
   auto read(uint16_t address) -> uint8_t {
     // $6000-$7FFF: Family Basic PRG RAM (optional, not commonly used)
     if(address >= 0x6000 && address <= 0x7FFF) {
-      // Not implemented for now
-      return 0;
+      return prg_ram_[address - 0x6000];
     }
     // $8000-$FFFF: PRG ROM
     else if(address >= 0x8000) {
@@ -97,18 +312,31 @@ struct Mapper0 {
     return 0;
   }
 
+  // $6000-$FFFF: the 256-byte page at address for OAM DMA, null if it isn't
+  // plain memory
+  auto prgPage(uint16_t address) const -> const uint8_t* {
+    if(address <= 0x7FFF) {
+      return prg_ram_.data() + (address - 0x6000);
+    }
+    const size_t offset = is_16kb_ ? (address & 0x3FFF) : (address & 0x7FFF);
+    const auto prg = rom_.getPrgRom();
+    return offset < prg.size() ? prg.data() + offset : nullptr;
+  }
+
   auto write(uint16_t address, uint8_t data) -> void {
     // $6000-$7FFF: Family Basic PRG RAM (optional)
     if(address >= 0x6000 && address <= 0x7FFF) {
-      // Not implemented for now
+      prg_ram_[address - 0x6000] = data;
     }
     // $8000-$FFFF: PRG ROM is read-only, writes are ignored
   }
 
 private:
   cores::mos6502::NesRom& rom_;
+  std::span<uint8_t> prg_ram_;  // 8KB, owned by NesRAM
   size_t prg_rom_size_;
   bool is_16kb_;
+  cores::mos6502::Mirroring mirroring_;
 };
 
 // Mapper 1 (MMC1) - Bank switching with shift register
@@ -119,19 +347,58 @@ private:
 // CHR bank 1 at $C000-$DFFF
 // PRG bank at $E000-$FFFF
 struct Mapper1 {
-  explicit Mapper1(cores::mos6502::NesRom& rom) : rom_(rom) {
+  struct State {
+    // MMC1 state
+    uint8_t shift_register;
+    uint8_t write_count;
+    uint8_t control;
+    uint8_t chr_bank_0;
+    uint8_t chr_bank_1;
+    uint8_t prg_bank;
+
+    // Current bank mappings
+    uint32_t prg_bank_low;
+    uint32_t prg_bank_high;
+  };
+
+  Mapper1(cores::mos6502::NesRom& rom, State& state, std::span<uint8_t> prg_ram)
+    : rom_(rom), state_(state), prg_ram_(prg_ram) {
     prg_rom_size_ = rom.getPrgRomSize();
     prg_bank_count_ = prg_rom_size_ / 16384;  // Number of 16KB banks
+    // Without CHR ROM the board has 8KB of CHR RAM
+    chr_size_ = rom.getChrRomSize() > 0 ? rom.getChrRomSize() : 0x2000;
     reset();
   }
 
+  // PPU $0000-$1FFF: two switchable 4KB banks or one 8KB bank
+  auto chrOffset(uint16_t address) const -> uint32_t {
+    uint32_t offset;
+    if(state_.control & 0x10) {
+      uint8_t bank = address < 0x1000 ? state_.chr_bank_0 : state_.chr_bank_1;
+      offset = bank * 0x1000 + (address & 0x0FFF);
+    } else {
+      offset = (state_.chr_bank_0 & 0x1E) * 0x1000 + (address & 0x1FFF);
+    }
+    return offset % chr_size_;
+  }
+
+  // Control bits 0-1 pick the nametable arrangement
+  auto mirroring() const -> cores::mos6502::Mirroring {
+    switch(state_.control & 0x03) {
+      case 0: return cores::mos6502::Mirroring::SINGLE_SCREEN_LOWER;
+      case 1: return cores::mos6502::Mirroring::SINGLE_SCREEN_UPPER;
+      case 2: return cores::mos6502::Mirroring::VERTICAL;
+      default: return cores::mos6502::Mirroring::HORIZONTAL;
+    }
+  }
+
   auto reset() -> void {
-    shift_register_ = 0x10;  // Bit 4 set indicates empty
-    write_count_ = 0;
-    control_ = 0x0C;  // Default: $8000 and $C000 swappable, $C000 fixed to last bank
-    chr_bank_0_ = 0;
-    chr_bank_1_ = 0;
-    prg_bank_ = 0;
+    state_.shift_register = 0x10;  // Bit 4 set indicates empty
+    state_.write_count = 0;
+    state_.control = 0x0C;  // Default: $8000 and $C000 swappable, $C000 fixed to last bank
+    state_.chr_bank_0 = 0;
+    state_.chr_bank_1 = 0;
+    state_.prg_bank = 0;
     updateBanks();
   }
 
@@ -143,16 +410,28 @@ struct Mapper1 {
     // $8000-$BFFF: 16 KB PRG ROM bank (switchable or fixed)
     else if(address >= 0x8000 && address <= 0xBFFF) {
       uint16_t offset = address - 0x8000;
-      return rom_.loadFromPrg(prg_bank_low_ * 16384 + offset);
+      return rom_.loadFromPrg(state_.prg_bank_low * 16384 + offset);
     }
     // $C000-$FFFF: 16 KB PRG ROM bank (switchable or fixed)
     else if(address >= 0xC000) {
       uint16_t offset = address - 0xC000;
-      return rom_.loadFromPrg(prg_bank_high_ * 16384 + offset);
+      return rom_.loadFromPrg(state_.prg_bank_high * 16384 + offset);
     }
     return 0;
   }
 
+  // $6000-$FFFF: the 256-byte page at address for OAM DMA, null if it isn't
+  // plain memory
+  auto prgPage(uint16_t address) const -> const uint8_t* {
+    if(address <= 0x7FFF) {
+      return prg_ram_.data() + (address - 0x6000);
+    }
+    const uint32_t bank = address <= 0xBFFF ? state_.prg_bank_low : state_.prg_bank_high;
+    const size_t offset = bank * 16384 + (address & 0x3FFF);
+    const auto prg = rom_.getPrgRom();
+    return offset < prg.size() ? prg.data() + offset : nullptr;
+  }
+
   auto write(uint16_t address, uint8_t data) -> void {
     // $6000-$7FFF: 8 KB PRG RAM
     if(address >= 0x6000 && address <= 0x7FFF) {
@@ -162,86 +441,321 @@ struct Mapper1 {
     else if(address >= 0x8000) {
       // Bit 7 set = reset shift register
       if(data & 0x80) {
-        shift_register_ = 0x10;
-        write_count_ = 0;
-        control_ |= 0x0C;  // Set bits 2-3
+        state_.shift_register = 0x10;
+        state_.write_count = 0;
+        state_.control |= 0x0C;  // Set bits 2-3
         updateBanks();
         return;
       }
 
       // Write bit 0 to shift register
-      shift_register_ >>= 1;
-      shift_register_ |= (data & 1) << 4;
-      write_count_++;
+      state_.shift_register >>= 1;
+      state_.shift_register |= (data & 1) << 4;
+      state_.write_count++;
 
       // After 5 writes, update the appropriate register
-      if(write_count_ == 5) {
-        uint8_t register_value = shift_register_ & 0x1F;
+      if(state_.write_count == 5) {
+        uint8_t register_value = state_.shift_register & 0x1F;
         
         // Determine which register to write to based on address
         if(address >= 0x8000 && address <= 0x9FFF) {
           // Control register
-          control_ = register_value;
+          state_.control = register_value;
         }
         else if(address >= 0xA000 && address <= 0xBFFF) {
           // CHR bank 0
-          chr_bank_0_ = register_value;
+          state_.chr_bank_0 = register_value;
         }
         else if(address >= 0xC000 && address <= 0xDFFF) {
           // CHR bank 1
-          chr_bank_1_ = register_value;
+          state_.chr_bank_1 = register_value;
         }
         else if(address >= 0xE000) {
           // PRG bank
-          prg_bank_ = register_value & 0x0F;  // Only lower 4 bits used
+          state_.prg_bank = register_value & 0x0F;  // Only lower 4 bits used
         }
 
         updateBanks();
-        shift_register_ = 0x10;
-        write_count_ = 0;
+        state_.shift_register = 0x10;
+        state_.write_count = 0;
       }
     }
   }
 
 private:
   auto updateBanks() -> void {
-    uint8_t prg_mode = (control_ >> 2) & 0x03;
+    uint8_t prg_mode = (state_.control >> 2) & 0x03;
     
     switch(prg_mode) {
       case 0:
       case 1:
         // 32 KB mode: switch 32 KB at $8000, ignoring low bit of bank number
-        prg_bank_low_ = (prg_bank_ & 0x0E) % prg_bank_count_;
-        prg_bank_high_ = ((prg_bank_ & 0x0E) + 1) % prg_bank_count_;
+        state_.prg_bank_low = (state_.prg_bank & 0x0E) % prg_bank_count_;
+        state_.prg_bank_high = ((state_.prg_bank & 0x0E) + 1) % prg_bank_count_;
         break;
       case 2:
         // Fix first bank at $8000, switch 16 KB bank at $C000
-        prg_bank_low_ = 0;
-        prg_bank_high_ = prg_bank_ % prg_bank_count_;
+        state_.prg_bank_low = 0;
+        state_.prg_bank_high = state_.prg_bank % prg_bank_count_;
         break;
       case 3:
         // Fix last bank at $C000, switch 16 KB bank at $8000
-        prg_bank_low_ = prg_bank_ % prg_bank_count_;
-        prg_bank_high_ = (prg_bank_count_ - 1);
+        state_.prg_bank_low = state_.prg_bank % prg_bank_count_;
+        state_.prg_bank_high = (prg_bank_count_ - 1);
         break;
     }
   }
 
   cores::mos6502::NesRom& rom_;
-  std::array<uint8_t, 0x2000> prg_ram_;  // 8KB PRG RAM
-  
+  State& state_;
+  std::span<uint8_t> prg_ram_;  // 8KB PRG RAM, owned by NesRAM
+
   size_t prg_rom_size_;
   size_t prg_bank_count_;
-  
-  // MMC1 state
-  uint8_t shift_register_;
-  uint8_t write_count_;
-  uint8_t control_;
-  uint8_t chr_bank_0_;
-  uint8_t chr_bank_1_;
-  uint8_t prg_bank_;
-  
-  // Current bank mappings
-  size_t prg_bank_low_;
-  size_t prg_bank_high_;
+  size_t chr_size_;
+};
+
+// All mutable per-instance state, laid out as one contiguous block.
+// Every member is trivially copyable, so power-on reset or going back to a
+// checkpoint is a single memcpy instead of rebuilding the components.
+template<typename Mapper>
+struct alignas(64) NesArena {
+  alignas(64) cores::mos6502::Registers cpu;
+  alignas(64) NesRAMState ram;
+  alignas(64) typename Mapper::State mapper;
+  alignas(64) PpuState ppu;
+  alignas(64) ApuState apu;
+};
+
+template<typename Mapper, typename Audio = BandLimitedAudio>
+struct Nes {
+  using Arena = NesArena<Mapper>;
+  using Bus = NesRAM<Mapper, Audio>;
+  using Cpu = cores::mos6502::mos6502<Bus>;
+  static_assert(std::is_trivially_copyable_v<Arena>, "Arena must be resettable with memcpy");
+
+  // save_path is only used when the cartridge has battery-backed RAM
+  explicit Nes(cores::mos6502::NesRom& rom, const std::filesystem::path& save_path = {})
+    : rom_(rom), ram_(rom, arena_, save_path), cpu_(ram_, arena_.cpu) {
+    // The 6502 comes out of reset with interrupts masked
+    arena_.cpu.Status.I = 1;
+    savePowerOnState();
+  }
+
+  // Components hold references into arena_
+  Nes(const Nes&) = delete;
+  auto operator=(const Nes&) -> Nes& = delete;
+
+  // Use the current state as the template reset() goes back to
+  auto savePowerOnState() -> void {
+    checkpoint(power_on_);
+  }
+
+  auto reset() -> void {
+    restore(power_on_);
+  }
+
+  auto checkpoint(Arena& out) const -> void {
+    std::memcpy(&out, &arena_, sizeof(Arena));
+  }
+
+  auto restore(const Arena& in) -> void {
+    std::memcpy(&arena_, &in, sizeof(Arena));
+    ram_.ppu().stateRestored();
+    ram_.apu().stateRestored();
+    // The calendar still holds the old timeline's events
+    ram_.reschedule();
+  }
+
+  // Bytes saveState() writes, the same for the life of the system
+  auto stateSize() const -> size_t {
+    const auto blocks = stateBlocks();
+    return save_state::totalSize(std::span(blocks.data(), blockCount()));
+  }
+
+  // Writes the whole machine state to out in the save_state layout: every
+  // arena block, and battery RAM when it lives in the save file. Returns
+  // the bytes written, stateSize().
+  auto saveState(std::span<uint8_t> out) const -> size_t {
+    const auto blocks = stateBlocks();
+    return save_state::write(out, std::span(blocks.data(), blockCount()), romId());
+  }
+
+  // Replaces the machine state with one saveState() wrote for the same ROM.
+  // Every block is checked before anything is copied, so a state that
+  // doesn't fit throws SaveStateException and changes nothing. Battery RAM
+  // must be in the state exactly when this system keeps it in a save file.
+  auto loadState(std::span<const uint8_t> in) -> void {
+    using namespace save_state;
+    const Header header = readHeader(in);
+    requireRom(header, romId());
+    const Block& cpu = require(header, CPU, sizeof(arena_.cpu));
+    const Block& ram = require(header, RAM, sizeof(arena_.ram));
+    const Block& mapper = require(header, MAPPER, sizeof(arena_.mapper));
+    const Block& ppu = require(header, PPU, sizeof(arena_.ppu));
+    const Block& apu = require(header, APU, sizeof(arena_.apu));
+    const std::span<uint8_t> battery_ram = ram_.batteryRam();
+    const Block* battery = nullptr;
+    if(!battery_ram.empty()) {
+      battery = &require(header, BATTERY, battery_ram.size());
+    } else if(find(header, BATTERY)) {
+      throw SaveStateException("save state has battery RAM but this system has no save file");
+    }
+    std::memcpy(&arena_.cpu, in.data() + cpu.offset, cpu.size);
+    std::memcpy(&arena_.ram, in.data() + ram.offset, ram.size);
+    std::memcpy(&arena_.mapper, in.data() + mapper.offset, mapper.size);
+    std::memcpy(&arena_.ppu, in.data() + ppu.offset, ppu.size);
+    std::memcpy(&arena_.apu, in.data() + apu.offset, apu.size);
+    // Without a save file battery RAM is the arena's, already restored
+    if(battery) {
+      std::memcpy(battery_ram.data(), in.data() + battery->offset, battery->size);
+    }
+    ram_.ppu().stateRestored();
+    ram_.apu().stateRestored();
+    ram_.reschedule();
+  }
+
+  // Runs one instruction, and any DMA it set off
+  auto runCycle() -> void {
+    cpu_.runCycle();
+    instructions_++;
+    dispatch();
+  }
+
+  // Runs until the clock reaches cycle, in batches: the CPU goes straight
+  // to the next scheduled event and only then is anything synchronised. A
+  // frame takes a few batches, plus one for each register write that pulls
+  // an event in. While the IRQ line is up and I is clear it is polled after
+  // every instruction instead, like runCycle() does; a masked IRQ only
+  // matters once I is cleared, which ends the batch.
+  auto runUntil(uint64_t cycle) -> void {
+    Scheduler& scheduler = ram_.scheduler();
+    ram_.reschedule();
+    scheduler.schedule(SystemEvent::RUN_END, cycle);
+    while(arena_.cpu.Cycles < cycle) {
+      if(ram_.irq() && !arena_.cpu.Status.I) {
+        runCycle();
+      } else {
+        instructions_ += cpu_.runUntil(scheduler.next());
+        dispatch();
+      }
+      ram_.reschedule();
+      batches_++;
+    }
+    scheduler.cancel(SystemEvent::RUN_END);
+  }
+
+  // Runs until the PPU reaches the VBlank that ends the frame, when its
+  // frame buffer is complete, in batches from sync point to sync point
+  auto runFrame() -> void {
+    const uint64_t frame = endingFrame();
+    while(!frameEnded(frame)) {
+      runUntil(std::max(arena_.ppu.next_sync_cycle, arena_.cpu.Cycles + 1));
+    }
+  }
+
+  // runFrame() an instruction at a time, calling before(cpu()) ahead of
+  // each one, for tracing
+  template<typename Fn>
+  auto runFrame(Fn&& before) -> void {
+    const uint64_t frame = endingFrame();
+    while(!frameEnded(frame)) {
+      before(cpu_);
+      runCycle();
+    }
+  }
+
+  // CPU batches runUntil() has run since construction
+  auto batches() const -> uint64_t { return batches_; }
+  // Instructions executed since construction, interrupts not included
+  auto instructions() const -> uint64_t { return instructions_; }
+
+  auto flushSaveRam() -> void {
+    ram_.flushSaveRam();
+  }
+
+  // For headless runs: frames are rendered in bands on the pool and the
+  // emulation thread only keeps PPU timing. Results come from the renderer's
+  // latestFrame(), ppu().frameBuffer() stops updating.
+  auto renderDeferred(Components::ThreadPool& pool, size_t bands = 4) -> DeferredRenderer<Mapper>& {
+    deferred_.reset();
+    deferred_ = std::make_unique<DeferredRenderer<Mapper>>(rom_, ram_.ppu(), arena_.ppu, arena_.mapper, pool, bands);
+    return *deferred_;
+  }
+
+  auto cpu() -> Cpu& { return cpu_; }
+  auto bus() -> Bus& { return ram_; }
+  auto ppu() -> Ppu<Mapper>& { return ram_.ppu(); }
+  auto apu() -> Apu<Mapper, Audio>& { return ram_.apu(); }
+  auto arena() const -> const Arena& { return arena_; }
+
+private:
+  auto romId() const -> save_state::RomId {
+    return {rom_.getCrc32(), rom_.getMapperNumber()};
+  }
+
+  auto blockCount() const -> size_t {
+    return ram_.batteryRam().empty() ? 5 : 6;
+  }
+
+  auto stateBlocks() const -> std::array<save_state::Source, 6> {
+    using namespace save_state;
+    const std::span<uint8_t> battery = ram_.batteryRam();
+    return {{
+      {CPU, &arena_.cpu, sizeof(arena_.cpu)},
+      {RAM, &arena_.ram, sizeof(arena_.ram)},
+      {MAPPER, &arena_.mapper, sizeof(arena_.mapper)},
+      {PPU, &arena_.ppu, sizeof(arena_.ppu)},
+      {APU, &arena_.apu, sizeof(arena_.apu)},
+      {BATTERY, battery.data(), static_cast<uint32_t>(battery.size())},
+    }};
+  }
+
+  // The frame whose VBlank the next runFrame() stops at: this one's unless
+  // the PPU is already past it
+  auto endingFrame() const -> uint64_t {
+    return arena_.ppu.frame + (arena_.ppu.scanline >= ppu_timing::VBLANK_LINE ? 1 : 0);
+  }
+
+  auto frameEnded(uint64_t frame) const -> bool {
+    return arena_.ppu.frame > frame || (arena_.ppu.frame == frame && arena_.ppu.scanline >= ppu_timing::VBLANK_LINE);
+  }
+
+  // What is due after the CPU stops. The PPU is only synchronised here when
+  // the CPU has reached the start of VBlank, the APU when a frame IRQ or DMC
+  // fetch is due, everything else happens on register access.
+  auto dispatch() -> void {
+    if(arena_.cpu.Cycles >= arena_.ppu.next_sync_cycle) {
+      // The sync is either VBlank or the pre-render clear, VBlank ends the frame
+      const bool frame_end = arena_.ppu.vblank_at > arena_.ppu.dot_clock;
+      ram_.ppu().catchUp(arena_.cpu.Cycles);
+      // Audio is handed over at both points, twice a frame
+      ram_.apu().endFrame();
+      // Once per frame, a crash then loses at most one frame of saves
+      if(frame_end) {
+        flushSaveRam();
+      }
+    }
+    if(arena_.cpu.Cycles >= arena_.apu.next_event_cycle) {
+      ram_.apu().sync();
+    }
+    // DMA halts the CPU once the instruction that started it is done
+    if(ram_.dmaPending()) {
+      cpu_.stall(ram_.runDma(arena_.cpu.Cycles));
+    }
+    if(ram_.ppu().takeNmi()) {
+      cpu_.nmi();
+    } else if(ram_.irq()) {
+      cpu_.irq();
+    }
+  }
+
+  cores::mos6502::NesRom& rom_;
+  Arena arena_{};
+  Arena power_on_{};
+  Bus ram_;
+  Cpu cpu_;
+  std::unique_ptr<DeferredRenderer<Mapper>> deferred_;
+  uint64_t batches_ = 0;
+  uint64_t instructions_ = 0;
 };
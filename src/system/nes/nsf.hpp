@@ -0,0 +1,261 @@
+#pragma once
+#include <cores/mos6502/cpu.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "apu.hpp"
+
+class NsfException : public std::runtime_error {
+public:
+  explicit NsfException(const std::string& message) : std::runtime_error(message) {}
+};
+
+// An NSF tune: a 128-byte header, then 6502 code and data loaded at
+// load_address. Bankswitched tunes split the data into 4KB banks that
+// $5FF8-$5FFF map into $8000-$FFFF, with the first bank padded so the data
+// starts at load_address's offset within it.
+struct NsfFile {
+  static constexpr size_t HEADER_SIZE = 0x80;
+  static constexpr size_t BANK_SIZE = 0x1000;
+  // Used when the header gives no PLAY rate, the NTSC frame rate
+  static constexpr uint16_t DEFAULT_PERIOD_US = 16639;
+
+  std::string name;
+  std::string artist;
+  std::string copyright;
+  uint8_t songs = 0;
+  uint8_t first_song = 0;  // 0-based, the header's is 1-based
+  uint16_t load_address = 0;
+  uint16_t init_address = 0;
+  uint16_t play_address = 0;
+  uint16_t play_period_us = DEFAULT_PERIOD_US;  // NTSC
+  std::array<uint8_t, 8> initial_banks{};
+  bool bankswitched = false;
+  uint8_t expansion = 0;  // Extra sound chips, not emulated
+  std::vector<uint8_t> data;
+
+  static auto parse(std::span<const uint8_t> bytes) -> NsfFile {
+    if(bytes.size() <= HEADER_SIZE || std::memcmp(bytes.data(), "NESM\x1A", 5) != 0) {
+      throw NsfException("not an NSF file");
+    }
+    auto le16 = [&](size_t offset) { return static_cast<uint16_t>(bytes[offset] | bytes[offset + 1] << 8); };
+    auto text = [&](size_t offset) {
+      const char* start = reinterpret_cast<const char*>(&bytes[offset]);
+      return std::string(start, strnlen(start, 32));
+    };
+    NsfFile file;
+    file.songs = bytes[0x06];
+    file.first_song = static_cast<uint8_t>(std::max(bytes[0x07], uint8_t(1)) - 1);
+    file.load_address = le16(0x08);
+    file.init_address = le16(0x0A);
+    file.play_address = le16(0x0C);
+    file.name = text(0x0E);
+    file.artist = text(0x2E);
+    file.copyright = text(0x4E);
+    if(le16(0x6E) != 0) {
+      file.play_period_us = le16(0x6E);
+    }
+    std::copy(&bytes[0x70], &bytes[0x78], file.initial_banks.begin());
+    file.bankswitched = std::any_of(file.initial_banks.begin(), file.initial_banks.end(),
+                                    [](uint8_t bank) { return bank != 0; });
+    file.expansion = bytes[0x7B];
+    file.data.assign(bytes.begin() + HEADER_SIZE, bytes.end());
+    if(file.songs == 0) {
+      throw NsfException("NSF has no songs");
+    }
+    if(file.load_address < 0x8000 && !file.bankswitched) {
+      throw NsfException("NSF loads below $8000");
+    }
+    return file;
+  }
+
+  static auto load(const std::filesystem::path& path) -> NsfFile {
+    std::ifstream in(path, std::ios::binary);
+    if(!in) {
+      throw NsfException("can't open " + path.string());
+    }
+    const std::vector<uint8_t> bytes{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    return parse(bytes);
+  }
+};
+
+// What an NSF sees: 2KB of RAM, the APU, 8KB of RAM at $6000, the bank
+// registers and 4KB banks of tune data. No PPU, no controllers, and the DMC
+// fetches through read() like it does from a cartridge.
+template<typename Audio>
+struct NsfBus {
+  std::array<uint8_t, 0x800> ram{};
+  std::array<uint8_t, 0x2000> prg_ram{};
+  std::array<const uint8_t*, 8> banks{};
+  std::span<const uint8_t> image;  // Tune data, whole banks
+  Apu<NsfBus, Audio>* apu = nullptr;
+
+  auto load(uint16_t address) -> uint8_t {
+    if(address >= 0x8000) {
+      return banks[(address >> 12) & 7][address & 0xFFF];
+    }
+    if(address <= 0x1FFF) {
+      return ram[address & 0x7FF];
+    }
+    if(address == 0x4015) {
+      return apu->readStatus();
+    }
+    if(address >= 0x6000) {
+      return prg_ram[address - 0x6000];
+    }
+    return 0;
+  }
+
+  auto store(uint16_t address, uint8_t data) -> void {
+    if(address <= 0x1FFF) {
+      ram[address & 0x7FF] = data;
+    } else if(address <= 0x4013 || address == 0x4015 || address == 0x4017) {
+      if(address >= 0x4000) {
+        apu->writeRegister(address, data);
+      }
+    } else if(address >= 0x5FF8 && address <= 0x5FFF) {
+      mapBank(address - 0x5FF8, data);
+    } else if(address >= 0x6000 && address <= 0x7FFF) {
+      prg_ram[address - 0x6000] = data;
+    }
+  }
+
+  auto read(uint16_t address) -> uint8_t {
+    return load(address);
+  }
+
+  // Banks past the end of the data read as the last one, like a short ROM
+  auto mapBank(uint32_t slot, uint8_t bank) -> void {
+    const size_t count = image.size() / NsfFile::BANK_SIZE;
+    banks[slot] = image.data() + std::min<size_t>(bank, count - 1) * NsfFile::BANK_SIZE;
+  }
+};
+
+// Plays an NSF headless: INIT once per track, then PLAY on a timer. Between
+// PLAY calls the CPU is idle and nothing runs at all, the clock just jumps to
+// the next call and the APU catches up over it, so rendering costs what the
+// driver's code and the APU's output changes cost and no more.
+template<typename Audio = BandLimitedAudio>
+class NsfPlayer {
+public:
+  using Bus = NsfBus<Audio>;
+
+  // INIT may take its time setting up, PLAY gets one period
+  static constexpr uint64_t INIT_BUDGET = 1 << 21;
+  // Where JSRs from outside return to. Nothing is mapped there, so no tune
+  // can run into it by accident.
+  static constexpr uint16_t RETURN_TRAP = 0x5FF6;
+
+  explicit NsfPlayer(const NsfFile& file, uint32_t sample_rate = 48000)
+    : file_(file), sample_rate_(sample_rate), cpu_(bus_, regs_) {
+    // Bankswitched data starts at load_address's offset in its first bank,
+    // plain data at its address above $8000
+    const size_t offset = file.bankswitched ? (file.load_address & 0xFFF) : (file.load_address - 0x8000);
+    const size_t size = std::max<size_t>(offset + file.data.size(), file.bankswitched ? 0 : 0x8000);
+    image_.assign((size + NsfFile::BANK_SIZE - 1) / NsfFile::BANK_SIZE * NsfFile::BANK_SIZE, 0);
+    std::copy(file.data.begin(), file.data.end(), image_.begin() + offset);
+    bus_.image = image_;
+    play_period_ = file.play_period_us * apu_timing::CPU_CLOCK / 1e6;
+  }
+
+  NsfPlayer(const NsfPlayer&) = delete;
+  auto operator=(const NsfPlayer&) -> NsfPlayer& = delete;
+
+  // Resets everything and runs INIT for track, 0-based
+  auto startTrack(uint32_t track) -> void {
+    bus_.ram.fill(0);
+    bus_.prg_ram.fill(0);
+    for(uint32_t slot = 0; slot < 8; slot++) {
+      bus_.mapBank(slot, file_.bankswitched ? file_.initial_banks[slot] : slot);
+    }
+    // Every track starts from power on, clock included
+    regs_ = cores::mos6502::Registers{};
+    apu_state_ = ApuState{};
+    apu_.emplace(apu_state_, bus_, regs_.Cycles, sample_rate_);
+    bus_.apu = &*apu_;
+    for(uint16_t address = 0x4000; address <= 0x4013; address++) {
+      bus_.store(address, 0);
+    }
+    bus_.store(0x4015, 0x00);
+    bus_.store(0x4015, 0x0F);
+    bus_.store(0x4017, 0x40);
+
+    regs_.SP = 0xFD;
+    regs_.Status.I = 1;
+    regs_.ACC = static_cast<uint8_t>(track);
+    regs_.X = 0;  // NTSC
+    call(file_.init_address);
+    finish(regs_.Cycles + INIT_BUDGET);
+    next_play_ = static_cast<double>(regs_.Cycles);
+  }
+
+  // One PLAY call and the idle time up to the next. A PLAY that is still
+  // running when the next one is due carries on instead.
+  auto runFrame() -> void {
+    next_play_ += play_period_;
+    const auto until = static_cast<uint64_t>(next_play_);
+    if(!busy_) {
+      call(file_.play_address);
+    }
+    finish(until);
+    regs_.Cycles = std::max(regs_.Cycles, until);
+    apu_->endFrame();
+  }
+
+  // Renders until out is full and returns it
+  auto render(std::span<int16_t> out) -> size_t {
+    static_assert(Audio::SYNTHESIS, "nothing to render without synthesis");
+    size_t done = 0;
+    while(done < out.size()) {
+      runFrame();
+      done += apu_->readSamples(out.subspan(done));
+    }
+    return done;
+  }
+
+  auto sampleRate() const -> uint32_t { return sample_rate_; }
+  auto bus() -> Bus& { return bus_; }
+  auto cycles() const -> uint64_t { return regs_.Cycles; }
+
+private:
+  // JSR from RETURN_TRAP
+  auto call(uint16_t address) -> void {
+    const uint16_t ret = RETURN_TRAP - 1;
+    cpu_.pushStack(ret >> 8);
+    cpu_.pushStack(ret & 0xFF);
+    regs_.PC = address;
+    busy_ = true;
+  }
+
+  // Runs the routine in progress until it returns or the clock reaches until
+  auto finish(uint64_t until) -> void {
+    while(busy_ && regs_.Cycles < until) {
+      cpu_.runCycle();
+      if(apu_state_.dma_cycles != 0) {
+        cpu_.stall(apu_->takeDmaCycles());
+      }
+      busy_ = regs_.PC != RETURN_TRAP;
+    }
+  }
+
+  const NsfFile& file_;
+  uint32_t sample_rate_;
+  std::vector<uint8_t> image_;
+  cores::mos6502::Registers regs_{};
+  ApuState apu_state_{};
+  Bus bus_;
+  std::optional<Apu<Bus, Audio>> apu_;  // Made afresh by startTrack
+  cores::mos6502::mos6502<Bus> cpu_;
+  double play_period_ = 0;  // CPU cycles between PLAY calls
+  double next_play_ = 0;
+  bool busy_ = false;       // In INIT or PLAY
+};
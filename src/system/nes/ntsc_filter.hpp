@@ -0,0 +1,279 @@
+#pragma once
+#include <utils/cpu_features.hpp>
+#include <utils/thread_pool.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numbers>
+#include <span>
+#include "frame_stage.hpp"
+#include "pixel_format.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TWIX_NTSC_X86 1
+#endif
+
+// NTSC composite video in the style of blargg's nes_ntsc. The 2C02 emits 8
+// signal samples per pixel against a 12-sample color subcarrier. A TV
+// separates luma with a one-cycle box and demodulates I/Q over two cycles,
+// which is what bleeds color across edges.
+//
+// All of that is linear, so each pixel's contribution to the output is a
+// fixed kernel. The kernel depends on the color, the emphasis bits, where the
+// pixel sits in its group of 3 and the line's burst phase. The filter adds up
+// precomputed kernels: every 3 input pixels become 7 output pixels, so a
+// 256-pixel line becomes 602.
+namespace ntsc {
+  constexpr size_t IN_WIDTH = 256;
+  constexpr size_t OUT_WIDTH = 602;  // (256 - 1) / 3 + 1 groups of 7
+  constexpr size_t HEIGHT = 240;
+  constexpr size_t GROUPS = 86;
+  constexpr size_t SAMPLES_PER_PIXEL = 8;
+  constexpr size_t SAMPLES_PER_GROUP = 24;
+  constexpr size_t PHASES = 12;
+  constexpr size_t BURSTS = 3;          // Each line starts 4 samples later in the subcarrier
+  constexpr size_t KERNEL_TAPS = 16;    // Output pixels a kernel covers, starting...
+  constexpr size_t KERNEL_LEAD = 4;     // ...this many pixels before the group's first output
+  constexpr size_t CHANNELS = 4;        // R, G, B and an unused lane, as int16
+  constexpr int32_t SCALE_BITS = 5;     // Kernel values are 8-bit levels * 32
+  constexpr size_t ACC_TAPS = GROUPS * 7 + KERNEL_TAPS;
+  constexpr size_t ACC_STRIDE = (ACC_TAPS * CHANNELS + 15) / 16 * 16;  // Whole 32-byte rows
+
+  // One burst phase and emphasis: [color][position in group][tap][channel]
+  using KernelSet = std::array<int16_t, 64 * 3 * KERNEL_TAPS * CHANNELS>;
+
+  // Composite voltage of one sample, 0 at black and 1 at white
+  inline auto signal(uint32_t color, uint32_t emphasis, uint32_t phase) -> double {
+    constexpr double levels[8] = {0.350, 0.518, 0.962, 1.550, 1.094, 1.506, 1.962, 1.962};
+    constexpr double black = 0.518;
+    constexpr double white = 1.962;
+    uint32_t level = (color >> 4) & 3;
+    const uint32_t hue = color & 0x0F;
+    if(hue > 0x0D) {
+      level = 1;
+    }
+    double low = levels[level];
+    double high = levels[4 + level];
+    if(hue == 0) {
+      low = high;
+    }
+    if(hue > 0x0C) {
+      high = low;
+    }
+    auto inPhase = [phase](uint32_t h) { return (h + phase) % PHASES < 6; };
+    double value = inPhase(hue) ? high : low;
+    // Emphasis bits 0-2 (red, green, blue) attenuate the opposite phases
+    if(hue < 0x0E && (((emphasis & 1) && inPhase(0x0C)) || ((emphasis & 2) && inPhase(0x04)) ||
+                      ((emphasis & 4) && inPhase(0x08)))) {
+      value *= 0.746;
+    }
+    return (value - black) / (white - black);
+  }
+
+  // Decoded RGB of one isolated pixel at position j of a group, for the taps
+  // starting KERNEL_LEAD before the group. Demodulating 4 samples after the
+  // burst with a saturation of 0.78 reproduces pixel_format::NTSC_PALETTE on
+  // flat fields.
+  inline auto buildKernels(uint32_t emphasis, uint32_t burst, KernelSet& kernels) -> void {
+    constexpr double saturation = 0.78;
+    constexpr double hue_shift = 4.0;
+    for(uint32_t color = 0; color < 64; color++) {
+      for(uint32_t j = 0; j < 3; j++) {
+        const int32_t first = static_cast<int32_t>(j * SAMPLES_PER_PIXEL);
+        auto sample = [&](int32_t n) -> double {
+          if(n < first || n >= first + static_cast<int32_t>(SAMPLES_PER_PIXEL)) {
+            return 0.0;
+          }
+          return signal(color, emphasis, static_cast<uint32_t>(n + 4 * burst) % PHASES);
+        };
+        for(uint32_t tap = 0; tap < KERNEL_TAPS; tap++) {
+          const int32_t out = static_cast<int32_t>(tap) - static_cast<int32_t>(KERNEL_LEAD);
+          const int32_t center = static_cast<int32_t>(std::floor((out + 0.5) * SAMPLES_PER_GROUP / 7.0 + 0.5));
+          double y = 0, i = 0, q = 0;
+          for(int32_t n = center - 12; n < center + 12; n++) {
+            const double s = sample(n);
+            if(n >= center - 6 && n < center + 6) {
+              y += s;
+            }
+            const double angle = std::numbers::pi * ((((n + 4 * static_cast<int32_t>(burst)) % 12 + 12) % 12) + hue_shift) / 6.0;
+            i += s * std::cos(angle);
+            q += s * std::sin(angle);
+          }
+          y /= 12.0;
+          i *= 2.0 * saturation / 24.0;
+          q *= 2.0 * saturation / 24.0;
+          const double rgb[3] = {y + 0.946882 * i + 0.623557 * q, y - 0.274788 * i - 0.635691 * q,
+                                 y - 1.108545 * i + 1.709007 * q};
+          int16_t* entry = &kernels[((color * 3 + j) * KERNEL_TAPS + tap) * CHANNELS];
+          for(uint32_t c = 0; c < 3; c++) {
+            entry[c] = static_cast<int16_t>(std::lround(rgb[c] * 255.0 * (1 << SCALE_BITS)));
+          }
+          entry[3] = 0;
+        }
+      }
+    }
+  }
+
+  // Every emphasis and burst phase, about 600KB, built once on first use
+  inline auto kernels(uint32_t emphasis, uint32_t burst) -> const KernelSet& {
+    static const std::unique_ptr<KernelSet[]> all = [] {
+      auto sets = std::make_unique<KernelSet[]>(8 * BURSTS);
+      for(uint32_t e = 0; e < 8; e++) {
+        for(uint32_t b = 0; b < BURSTS; b++) {
+          buildKernels(e, b, sets[e * BURSTS + b]);
+        }
+      }
+      return sets;
+    }();
+    return all[(emphasis & 7) * BURSTS + burst % BURSTS];
+  }
+
+  inline auto toByte(int32_t value) -> uint8_t {
+    return static_cast<uint8_t>(std::clamp((value + (1 << (SCALE_BITS - 1))) >> SCALE_BITS, 0, 255));
+  }
+
+  // Filters one line of IN_WIDTH indices into OUT_WIDTH RGBA8888 pixels
+  using FilterFn = void (*)(const uint8_t*, const KernelSet&, uint8_t*);
+
+  // Reference version. Sums wrap like the 16-bit SIMD adds so the results
+  // are identical.
+  inline auto filterLineScalar(const uint8_t* in, const KernelSet& set, uint8_t* out) -> void {
+    std::array<uint16_t, ACC_TAPS * CHANNELS> acc{};
+    for(size_t x = 0; x < IN_WIDTH; x++) {
+      const int16_t* kernel = &set[((in[x] & 0x3F) * 3 + x % 3) * KERNEL_TAPS * CHANNELS];
+      uint16_t* dst = &acc[(x / 3) * 7 * CHANNELS];
+      for(size_t i = 0; i < KERNEL_TAPS * CHANNELS; i++) {
+        dst[i] = static_cast<uint16_t>(dst[i] + static_cast<uint16_t>(kernel[i]));
+      }
+    }
+    for(size_t o = 0; o < OUT_WIDTH; o++) {
+      const uint16_t* src = &acc[(o + KERNEL_LEAD) * CHANNELS];
+      for(size_t c = 0; c < 3; c++) {
+        out[o * 4 + c] = toByte(static_cast<int16_t>(src[c]));
+      }
+      out[o * 4 + 3] = 0xFF;
+    }
+  }
+
+#ifdef TWIX_NTSC_X86
+  __attribute__((target("avx2")))
+  inline auto summed(const int16_t (*acc)[ACC_STRIDE], size_t offset) -> __m256i {
+    const __m256i a = _mm256_load_si256(reinterpret_cast<const __m256i*>(&acc[0][offset]));
+    const __m256i b = _mm256_load_si256(reinterpret_cast<const __m256i*>(&acc[1][offset]));
+    const __m256i c = _mm256_load_si256(reinterpret_cast<const __m256i*>(&acc[2][offset]));
+    return _mm256_add_epi16(_mm256_add_epi16(a, b), c);
+  }
+
+  // A group's 3 kernels are summed in registers (16 taps are 4 registers)
+  // and added to the line once. Groups cycle through 3 accumulators: windows
+  // 21 taps apart never overlap, so no load waits on a partly overlapping
+  // store from the previous group.
+  __attribute__((target("avx2")))
+  inline auto filterLineAvx2(const uint8_t* in, const KernelSet& set, uint8_t* out) -> void {
+    alignas(32) static thread_local int16_t acc[3][ACC_STRIDE];
+    std::memset(acc, 0, sizeof(acc));
+    for(size_t group = 0; group < GROUPS; group++) {
+      __m256i sum[4];
+      for(size_t i = 0; i < 4; i++) {
+        sum[i] = _mm256_setzero_si256();
+      }
+      for(size_t j = 0; j < 3 && group * 3 + j < IN_WIDTH; j++) {
+        const int16_t* kernel = &set[((in[group * 3 + j] & 0x3F) * 3 + j) * KERNEL_TAPS * CHANNELS];
+        for(size_t i = 0; i < 4; i++) {
+          sum[i] = _mm256_add_epi16(sum[i], _mm256_loadu_si256(reinterpret_cast<const __m256i*>(kernel + i * 16)));
+        }
+      }
+      int16_t* dst = &acc[group % 3][group * 7 * CHANNELS];
+      for(size_t i = 0; i < 4; i++) {
+        __m256i* p = reinterpret_cast<__m256i*>(dst + i * 16);
+        _mm256_storeu_si256(p, _mm256_add_epi16(_mm256_loadu_si256(p), sum[i]));
+      }
+    }
+    // 8 outputs per step: sum the accumulators, round, shift and saturate to bytes
+    const __m256i round = _mm256_set1_epi16(1 << (SCALE_BITS - 1));
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int32_t>(0xFF000000u));
+    size_t o = 0;
+    for(; o + 8 <= OUT_WIDTH; o += 8) {
+      const size_t offset = (o + KERNEL_LEAD) * CHANNELS;
+      const __m256i lo = _mm256_srai_epi16(_mm256_add_epi16(summed(acc, offset), round), SCALE_BITS);
+      const __m256i hi = _mm256_srai_epi16(_mm256_add_epi16(summed(acc, offset + 16), round), SCALE_BITS);
+      // packus interleaves the 128-bit lanes of its inputs, the permute undoes that
+      const __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + o * 4), _mm256_or_si256(bytes, alpha));
+    }
+    for(; o < OUT_WIDTH; o++) {
+      const size_t offset = (o + KERNEL_LEAD) * CHANNELS;
+      for(size_t c = 0; c < 3; c++) {
+        out[o * 4 + c] = toByte(static_cast<int16_t>(acc[0][offset + c] + acc[1][offset + c] + acc[2][offset + c]));
+      }
+      out[o * 4 + 3] = 0xFF;
+    }
+  }
+#endif
+
+  inline auto bestFilterLine() -> FilterFn {
+#ifdef TWIX_NTSC_X86
+    static const FilterFn best = Components::cpuFeatures().avx2 ? filterLineAvx2 : filterLineScalar;
+    return best;
+#else
+    return filterLineScalar;
+#endif
+  }
+
+  // Burst phase of a line. It advances by one every line and, approximately,
+  // every frame; only its value mod 3 matters.
+  inline auto burstPhase(uint64_t frame, uint32_t line) -> uint32_t {
+    return static_cast<uint32_t>((frame + line) % BURSTS);
+  }
+
+  // Filters lines [first, last) of a frame into 602-wide RGBA8888 rows
+  inline auto filterLines(const FrameView& frame, uint64_t frame_number, uint32_t first, uint32_t last,
+                          uint8_t* out, size_t pitch, FilterFn line = bestFilterLine()) -> void {
+    for(uint32_t y = first; y < last; y++) {
+      line(frame.indices.data() + y * IN_WIDTH, kernels(frame.emphasis[y], burstPhase(frame_number, y)),
+           out + y * pitch);
+    }
+  }
+}
+
+// Runs the NTSC filter on the thread pool through a FrameStage, so the
+// emulation thread only pays for copying the index frame
+class NtscFilter {
+public:
+  static constexpr size_t WIDTH = ntsc::OUT_WIDTH;
+  static constexpr size_t HEIGHT = ntsc::HEIGHT;
+  static constexpr size_t PITCH = WIDTH * 4;
+
+  NtscFilter(Components::ThreadPool& pool, size_t bands)
+    : stage_(pool, bands, PITCH * HEIGHT,
+             [](size_t, const FrameView& frame, uint64_t number, uint32_t first, uint32_t last, uint8_t* out) {
+               ntsc::filterLines(frame, number, first, last, out, PITCH);
+             }) {
+    // Build the kernels now rather than in the first band task
+    static_cast<void>(ntsc::kernels(0, 0));
+  }
+
+  auto submit(const FrameView& frame, uint64_t frame_number) -> void {
+    stage_.submit(frame, frame_number);
+  }
+
+  // Copies the newest filtered frame (602x240 RGBA8888, PITCH bytes per row)
+  // and returns its frame number, 0 if nothing has been filtered yet
+  auto latestFrame(std::span<uint8_t> out) const -> uint64_t {
+    return stage_.latestFrame(out);
+  }
+
+  auto droppedFrames() const -> uint64_t {
+    return stage_.droppedFrames();
+  }
+
+  auto waitIdle() -> void {
+    stage_.waitIdle();
+  }
+
+private:
+  FrameStage stage_;
+};
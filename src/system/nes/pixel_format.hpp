@@ -0,0 +1,355 @@
+#pragma once
+#include <utils/cpu_features.hpp>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TWIX_PIXEL_FORMAT_X86 1
+#endif
+
+// What the PPU produces: 256x240 NES color indices (0-63) and, per line, the
+// color emphasis bits of $2001 at the time the line was drawn (bits 5-7
+// shifted down to 0-2: red, green, blue). Both spans point straight at the
+// PPU's buffers, conversion happens only when a consumer asks for it.
+struct FrameView {
+  static constexpr size_t WIDTH = 256;
+  static constexpr size_t HEIGHT = 240;
+  std::span<const uint8_t> indices;
+  std::span<const uint8_t> emphasis;
+};
+
+enum class PixelFormat : uint8_t {
+  INDICES,   // The color indices as they are, 1 byte
+  RGBA8888,  // Bytes R, G, B, A
+  BGRA8888,  // Bytes B, G, R, A
+  RGB565,    // Native endian uint16, red in the top 5 bits
+  GRAY8,     // Luma, 1 byte
+};
+
+constexpr auto bytesPerPixel(PixelFormat format) -> size_t {
+  switch(format) {
+    case PixelFormat::RGBA8888:
+    case PixelFormat::BGRA8888:
+      return 4;
+    case PixelFormat::RGB565:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+namespace pixel_format {
+  struct Rgb {
+    uint8_t r, g, b;
+  };
+
+  // 2C02 colors as 0xRRGGBB
+  inline constexpr std::array<uint32_t, 64> NTSC_PALETTE = {
+    0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600, 0x561D00,
+    0x333500, 0x0B4800, 0x005200, 0x004F08, 0x00404D, 0x000000, 0x000000, 0x000000,
+    0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC, 0xB71E7B, 0xB53120, 0x994E00,
+    0x6B6D00, 0x388700, 0x0C9300, 0x008F32, 0x007C8D, 0x000000, 0x000000, 0x000000,
+    0xFFFEFF, 0x64B0FF, 0x9290FF, 0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22,
+    0xBCBE00, 0x88D800, 0x5CE430, 0x45E082, 0x48CDDE, 0x4F4F4F, 0x000000, 0x000000,
+    0xFFFEFF, 0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5, 0xF7D8A5,
+    0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000, 0x000000,
+  };
+
+  // Emphasis darkens the channels that aren't emphasized, by about 18%
+  constexpr auto makeColors() -> std::array<std::array<Rgb, 64>, 8> {
+    std::array<std::array<Rgb, 64>, 8> colors{};
+    for(uint32_t emphasis = 0; emphasis < 8; emphasis++) {
+      for(uint32_t index = 0; index < 64; index++) {
+        uint32_t channel[3] = {NTSC_PALETTE[index] >> 16 & 0xFF, NTSC_PALETTE[index] >> 8 & 0xFF, NTSC_PALETTE[index] & 0xFF};
+        for(uint32_t c = 0; c < 3; c++) {
+          if(emphasis != 0 && !(emphasis & (1u << c))) {
+            channel[c] = channel[c] * 209 / 256;
+          }
+        }
+        colors[emphasis][index] = {static_cast<uint8_t>(channel[0]), static_cast<uint8_t>(channel[1]),
+                                   static_cast<uint8_t>(channel[2])};
+      }
+    }
+    return colors;
+  }
+
+  inline constexpr auto COLORS = makeColors();
+
+  // One byte per color and emphasis, laid out so 16 consecutive entries load
+  // straight into a pshufb table
+  using BytePlane = std::array<std::array<uint8_t, 64>, 8>;
+
+  // Y, U and V are BT.601 limited range, as Y4M players expect
+  enum Plane : uint32_t { RED, GREEN, BLUE, LUMA, RGB565_LO, RGB565_HI, Y, U, V, PLANE_COUNT };
+
+  constexpr auto makePlanes() -> std::array<BytePlane, PLANE_COUNT> {
+    std::array<BytePlane, PLANE_COUNT> planes{};
+    for(uint32_t emphasis = 0; emphasis < 8; emphasis++) {
+      for(uint32_t index = 0; index < 64; index++) {
+        const Rgb c = COLORS[emphasis][index];
+        const uint32_t rgb565 = uint32_t(c.r >> 3) << 11 | uint32_t(c.g >> 2) << 5 | (c.b >> 3);
+        planes[RED][emphasis][index] = c.r;
+        planes[GREEN][emphasis][index] = c.g;
+        planes[BLUE][emphasis][index] = c.b;
+        planes[LUMA][emphasis][index] = static_cast<uint8_t>((77 * c.r + 150 * c.g + 29 * c.b) >> 8);
+        planes[RGB565_LO][emphasis][index] = static_cast<uint8_t>(rgb565);
+        planes[RGB565_HI][emphasis][index] = static_cast<uint8_t>(rgb565 >> 8);
+        planes[Y][emphasis][index] = static_cast<uint8_t>(16 + ((66 * c.r + 129 * c.g + 25 * c.b + 128) >> 8));
+        planes[U][emphasis][index] = static_cast<uint8_t>(128 + ((-38 * c.r - 74 * c.g + 112 * c.b + 128) >> 8));
+        planes[V][emphasis][index] = static_cast<uint8_t>(128 + ((112 * c.r - 94 * c.g - 18 * c.b + 128) >> 8));
+      }
+    }
+    return planes;
+  }
+
+  inline constexpr auto PLANES = makePlanes();
+
+  // Whole pixels for the 32-bit formats, bytes in memory order on little endian
+  constexpr auto makeWords(bool bgr) -> std::array<std::array<uint32_t, 64>, 8> {
+    std::array<std::array<uint32_t, 64>, 8> words{};
+    for(uint32_t emphasis = 0; emphasis < 8; emphasis++) {
+      for(uint32_t index = 0; index < 64; index++) {
+        const Rgb c = COLORS[emphasis][index];
+        const uint32_t first = bgr ? c.b : c.r;
+        const uint32_t third = bgr ? c.r : c.b;
+        words[emphasis][index] = 0xFF000000u | third << 16 | uint32_t(c.g) << 8 | first;
+      }
+    }
+    return words;
+  }
+
+  inline constexpr auto RGBA_WORDS = makeWords(false);
+  inline constexpr auto BGRA_WORDS = makeWords(true);
+
+  // Converts one line of WIDTH indices. emphasis is 0-7.
+  using ConvertFn = void (*)(PixelFormat, const uint8_t*, uint8_t, uint8_t*);
+
+  inline auto convertLineScalar(PixelFormat format, const uint8_t* in, uint8_t emphasis, uint8_t* out) -> void {
+    constexpr size_t width = FrameView::WIDTH;
+    switch(format) {
+      case PixelFormat::INDICES:
+        std::memcpy(out, in, width);
+        break;
+      case PixelFormat::RGBA8888:
+      case PixelFormat::BGRA8888: {
+        const bool rgba = format == PixelFormat::RGBA8888;
+        for(size_t x = 0; x < width; x++) {
+          const Rgb c = COLORS[emphasis][in[x] & 0x3F];
+          const uint8_t pixel[4] = {rgba ? c.r : c.b, c.g, rgba ? c.b : c.r, 0xFF};
+          std::memcpy(out + x * 4, pixel, 4);
+        }
+        break;
+      }
+      case PixelFormat::RGB565:
+        for(size_t x = 0; x < width; x++) {
+          const uint8_t index = in[x] & 0x3F;
+          const uint16_t pixel = static_cast<uint16_t>(PLANES[RGB565_HI][emphasis][index] << 8 |
+                                                       PLANES[RGB565_LO][emphasis][index]);
+          std::memcpy(out + x * 2, &pixel, 2);
+        }
+        break;
+      case PixelFormat::GRAY8:
+        for(size_t x = 0; x < width; x++) {
+          out[x] = PLANES[LUMA][emphasis][in[x] & 0x3F];
+        }
+        break;
+    }
+  }
+
+#ifdef TWIX_PIXEL_FORMAT_X86
+  // A 64-entry byte lookup as four 16-entry pshufb tables. Bits 4 and 5 of
+  // the index pick the table, shifted up into the sign bit blendv tests.
+  struct Lookup128 {
+    __m128i table[4];
+  };
+
+  __attribute__((target("sse4.1")))
+  inline auto loadLookup(const std::array<uint8_t, 64>& plane) -> Lookup128 {
+    Lookup128 lookup;
+    for(uint32_t i = 0; i < 4; i++) {
+      lookup.table[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(plane.data() + i * 16));
+    }
+    return lookup;
+  }
+
+  __attribute__((target("sse4.1")))
+  inline auto lookup(const Lookup128& lookup, __m128i index) -> __m128i {
+    const __m128i bit4 = _mm_slli_epi16(index, 3);
+    const __m128i bit5 = _mm_slli_epi16(index, 2);
+    const __m128i low = _mm_blendv_epi8(_mm_shuffle_epi8(lookup.table[0], index), _mm_shuffle_epi8(lookup.table[1], index), bit4);
+    const __m128i high = _mm_blendv_epi8(_mm_shuffle_epi8(lookup.table[2], index), _mm_shuffle_epi8(lookup.table[3], index), bit4);
+    return _mm_blendv_epi8(low, high, bit5);
+  }
+
+  // 16 indices with anything above bit 5 cleared
+  __attribute__((target("sse4.1")))
+  inline auto loadIndices(const uint8_t* in) -> __m128i {
+    return _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), _mm_set1_epi8(0x3F));
+  }
+
+  __attribute__((target("sse4.1")))
+  inline auto storePixels(uint8_t* out, __m128i pixels) -> void {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), pixels);
+  }
+
+  // 16 pixels per step. The 32-bit formats look up each channel as its own
+  // byte plane and interleave them with unpacks.
+  __attribute__((target("sse4.1")))
+  inline auto convertLineSse41(PixelFormat format, const uint8_t* in, uint8_t emphasis, uint8_t* out) -> void {
+    constexpr size_t width = FrameView::WIDTH;
+    switch(format) {
+      case PixelFormat::INDICES:
+        std::memcpy(out, in, width);
+        break;
+      case PixelFormat::RGBA8888:
+      case PixelFormat::BGRA8888: {
+        const bool rgba = format == PixelFormat::RGBA8888;
+        const Lookup128 first = loadLookup(PLANES[rgba ? RED : BLUE][emphasis]);
+        const Lookup128 green = loadLookup(PLANES[GREEN][emphasis]);
+        const Lookup128 third = loadLookup(PLANES[rgba ? BLUE : RED][emphasis]);
+        const __m128i alpha = _mm_set1_epi8(static_cast<char>(0xFF));
+        for(size_t x = 0; x < width; x += 16) {
+          const __m128i index = loadIndices(in + x);
+          const __m128i c0 = lookup(first, index);
+          const __m128i c1 = lookup(green, index);
+          const __m128i c2 = lookup(third, index);
+          const __m128i pairs_lo = _mm_unpacklo_epi8(c0, c1);
+          const __m128i pairs_hi = _mm_unpackhi_epi8(c0, c1);
+          const __m128i rest_lo = _mm_unpacklo_epi8(c2, alpha);
+          const __m128i rest_hi = _mm_unpackhi_epi8(c2, alpha);
+          storePixels(out + x * 4, _mm_unpacklo_epi16(pairs_lo, rest_lo));
+          storePixels(out + x * 4 + 16, _mm_unpackhi_epi16(pairs_lo, rest_lo));
+          storePixels(out + x * 4 + 32, _mm_unpacklo_epi16(pairs_hi, rest_hi));
+          storePixels(out + x * 4 + 48, _mm_unpackhi_epi16(pairs_hi, rest_hi));
+        }
+        break;
+      }
+      case PixelFormat::RGB565: {
+        const Lookup128 low = loadLookup(PLANES[RGB565_LO][emphasis]);
+        const Lookup128 high = loadLookup(PLANES[RGB565_HI][emphasis]);
+        for(size_t x = 0; x < width; x += 16) {
+          const __m128i index = loadIndices(in + x);
+          const __m128i lo = lookup(low, index);
+          const __m128i hi = lookup(high, index);
+          storePixels(out + x * 2, _mm_unpacklo_epi8(lo, hi));
+          storePixels(out + x * 2 + 16, _mm_unpackhi_epi8(lo, hi));
+        }
+        break;
+      }
+      case PixelFormat::GRAY8: {
+        const Lookup128 luma = loadLookup(PLANES[LUMA][emphasis]);
+        for(size_t x = 0; x < width; x += 16) {
+          storePixels(out + x, lookup(luma, loadIndices(in + x)));
+        }
+        break;
+      }
+    }
+  }
+
+  // The byte formats as in convertLineSse41 on 32 pixels, the 32-bit formats
+  // gather whole pixels from a 64-word table, 8 at a time
+  struct Lookup256 {
+    __m256i table[4];
+  };
+
+  __attribute__((target("avx2")))
+  inline auto loadLookup256(const std::array<uint8_t, 64>& plane) -> Lookup256 {
+    Lookup256 lookup;
+    for(uint32_t i = 0; i < 4; i++) {
+      lookup.table[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(plane.data() + i * 16)));
+    }
+    return lookup;
+  }
+
+  __attribute__((target("avx2")))
+  inline auto lookup256(const Lookup256& lookup, __m256i index) -> __m256i {
+    const __m256i bit4 = _mm256_slli_epi16(index, 3);
+    const __m256i bit5 = _mm256_slli_epi16(index, 2);
+    const __m256i low = _mm256_blendv_epi8(_mm256_shuffle_epi8(lookup.table[0], index),
+                                           _mm256_shuffle_epi8(lookup.table[1], index), bit4);
+    const __m256i high = _mm256_blendv_epi8(_mm256_shuffle_epi8(lookup.table[2], index),
+                                            _mm256_shuffle_epi8(lookup.table[3], index), bit4);
+    return _mm256_blendv_epi8(low, high, bit5);
+  }
+
+  __attribute__((target("avx2")))
+  inline auto loadIndices256(const uint8_t* in) -> __m256i {
+    return _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in)), _mm256_set1_epi8(0x3F));
+  }
+
+  __attribute__((target("avx2")))
+  inline auto storePixels256(uint8_t* out, __m256i pixels) -> void {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), pixels);
+  }
+
+  __attribute__((target("avx2")))
+  inline auto convertLineAvx2(PixelFormat format, const uint8_t* in, uint8_t emphasis, uint8_t* out) -> void {
+    constexpr size_t width = FrameView::WIDTH;
+    switch(format) {
+      case PixelFormat::INDICES:
+        std::memcpy(out, in, width);
+        break;
+      case PixelFormat::RGBA8888:
+      case PixelFormat::BGRA8888: {
+        const auto& words = (format == PixelFormat::RGBA8888 ? RGBA_WORDS : BGRA_WORDS)[emphasis];
+        const int* table = reinterpret_cast<const int*>(words.data());
+        const __m128i index_mask8 = _mm_set1_epi8(0x3F);
+        for(size_t x = 0; x < width; x += 8) {
+          const __m128i bytes = _mm_and_si128(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + x)), index_mask8);
+          storePixels256(out + x * 4, _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(bytes), 4));
+        }
+        break;
+      }
+      case PixelFormat::RGB565: {
+        const Lookup256 low = loadLookup256(PLANES[RGB565_LO][emphasis]);
+        const Lookup256 high = loadLookup256(PLANES[RGB565_HI][emphasis]);
+        for(size_t x = 0; x < width; x += 32) {
+          const __m256i index = loadIndices256(in + x);
+          const __m256i lo = lookup256(low, index);
+          const __m256i hi = lookup256(high, index);
+          // Unpacks stay inside 128-bit lanes, the permutes put the halves back in order
+          const __m256i first = _mm256_unpacklo_epi8(lo, hi);
+          const __m256i second = _mm256_unpackhi_epi8(lo, hi);
+          storePixels256(out + x * 2, _mm256_permute2x128_si256(first, second, 0x20));
+          storePixels256(out + x * 2 + 32, _mm256_permute2x128_si256(first, second, 0x31));
+        }
+        break;
+      }
+      case PixelFormat::GRAY8: {
+        const Lookup256 luma = loadLookup256(PLANES[LUMA][emphasis]);
+        for(size_t x = 0; x < width; x += 32) {
+          storePixels256(out + x, lookup256(luma, loadIndices256(in + x)));
+        }
+        break;
+      }
+    }
+  }
+#endif
+
+  inline auto bestConvertLine() -> ConvertFn {
+#ifdef TWIX_PIXEL_FORMAT_X86
+    const auto& cpu = Components::cpuFeatures();
+    static const ConvertFn best = cpu.avx2 ? convertLineAvx2 : cpu.sse41 ? convertLineSse41 : convertLineScalar;
+    return best;
+#else
+    return convertLineScalar;
+#endif
+  }
+
+  // Writes the frame to out in format, one line every pitch bytes (0 means
+  // lines are packed). Throws std::length_error if out is too small.
+  inline auto convert(const FrameView& frame, PixelFormat format, std::span<uint8_t> out, size_t pitch = 0,
+                      ConvertFn line = bestConvertLine()) -> void {
+    const size_t row = FrameView::WIDTH * bytesPerPixel(format);
+    pitch = pitch ? pitch : row;
+    if(pitch < row || out.size() < pitch * (FrameView::HEIGHT - 1) + row) {
+      throw std::length_error("Frame doesn't fit the output buffer");
+    }
+    for(size_t y = 0; y < FrameView::HEIGHT; y++) {
+      line(format, frame.indices.data() + y * FrameView::WIDTH, frame.emphasis[y] & 0x07, out.data() + y * pitch);
+    }
+  }
+}
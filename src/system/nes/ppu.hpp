@@ -0,0 +1,813 @@
+#pragma once
+#include <cores/mos6502/nesRom.hpp>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <vector>
+#include "chr_cache.hpp"
+#include "compositor.hpp"
+#include "pixel_format.hpp"
+#include "sprite_eval.hpp"
+
+// 2C02 timing, in PPU dots. There are 3 dots per CPU cycle on NTSC.
+namespace ppu_timing {
+  constexpr uint32_t DOTS_PER_CPU_CYCLE = 3;
+  constexpr uint32_t DOTS_PER_LINE = 341;
+  constexpr uint32_t LINES_PER_FRAME = 262;
+  constexpr uint32_t VISIBLE_LINES = 240;
+  constexpr uint32_t SCREEN_WIDTH = 256;
+  constexpr uint32_t VBLANK_LINE = 241;
+  constexpr uint32_t PRERENDER_LINE = 261;
+  constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+}
+
+// Everything the PPU mutates. Lives in the NesArena next to the CPU registers.
+struct PpuState {
+  std::array<uint8_t, 0x1000> vram;     // Four 1KB nametables, only two are used unless four-screen
+  std::array<uint8_t, 0x2000> chr_ram;  // Pattern tables when the cartridge has no CHR ROM
+  std::array<uint8_t, 256> oam;
+  std::array<uint8_t, 32> palette;
+
+  // Status flags are timestamps in dot_clock units, a flag reads as set when
+  // now >= *_at. They are predicted ahead of the catch-up so $2002 reads don't
+  // have to run the PPU.
+  uint64_t dot_clock;         // Dots since power on, cpu cycles * 3 right after a sync
+  uint64_t frame;
+  uint64_t next_sync_cycle;   // CPU cycle of the next VBlank or pre-render clear
+  uint64_t vblank_at;         // Latest or upcoming VBlank flag set
+  uint64_t vblank_clear_at;   // When that flag drops, at pre-render or by a $2002 read
+  uint64_t prerender_at;      // Next pre-render flag clear, predictions don't reach past it
+  uint64_t sprite0_hit_at;    // When the flag goes up this frame, NEVER if it doesn't
+  uint64_t overflow_at;       // Same for sprite overflow
+
+  uint16_t scanline;
+  uint16_t dot;
+
+  // Loopy scroll registers
+  uint16_t v;
+  uint16_t t;
+  uint8_t x;
+  uint8_t w;
+
+  uint8_t ctrl;
+  uint8_t mask;
+  uint8_t oam_addr;
+  uint8_t read_buffer;
+  uint8_t open_bus;
+  uint8_t nmi_pending;
+  uint8_t sprites_dirty;      // OAM, scroll, pattern or mask changed since sprite flags were predicted
+};
+static_assert(std::is_trivially_copyable_v<PpuState>);
+
+// Receives what a renderer on another thread needs to rebuild a frame: the
+// frame boundaries and every access that changes rendering state, stamped
+// with the dot clock it happened at.
+struct PpuFrameListener {
+  enum class Access : uint8_t { REGISTER_WRITE, REGISTER_READ, MAPPER_WRITE, OAM_DMA };
+
+  virtual ~PpuFrameListener() = default;
+  // The PPU just entered line 0, state is exactly the start of the frame
+  virtual auto frameStart(uint64_t dot_clock) -> void = 0;
+  virtual auto access(Access kind, uint16_t address, uint8_t data, uint64_t dot_clock) -> void = 0;
+  // A whole page went to OAM through $4014
+  virtual auto oamDma(const uint8_t* page, uint64_t dot_clock) -> void = 0;
+  // VBlank started, all visible lines are done
+  virtual auto frameEnd() -> void = 0;
+};
+
+// Catch-up PPU. It never ticks alongside the CPU: it remembers how far it has
+// run (dot_clock) and only runs forward to the CPU's cycle counter when one of
+// its registers is touched or when the system reaches next_sync_cycle (VBlank
+// and the pre-render line). Running forward is done a scanline at a time, only
+// the handful of dots where something happens (VBlank, scroll copies) do any
+// work, visible lines are rendered whole when the PPU passes their dot 256.
+// $2002 is the exception: games poll it in tight loops, so it is answered
+// from predicted flag timestamps and doesn't catch up at all.
+template<typename Mapper>
+struct Ppu {
+  // shared_chr is an already decoded cache of the same CHR to read tiles
+  // from instead of decoding them again (for CHR RAM, of the CHR RAM as it
+  // is at the next stateRestored()). A CHR RAM write switches to a cache of
+  // the PPU's own until the next stateRestored().
+  Ppu(cores::mos6502::NesRom& rom, PpuState& state, Mapper& mapper, const uint64_t& cpu_clock,
+      const ChrCache* shared_chr = nullptr)
+    : state_(state), mapper_(mapper), cpu_clock_(cpu_clock),
+      chr_(rom.getChrRomSize() > 0 ? rom.getChrRom().data() : state.chr_ram.data()),
+      chr_ram_(rom.getChrRomSize() > 0 ? nullptr : state.chr_ram.data()),
+      chr_size_(rom.getChrRomSize() > 0 ? rom.getChrRomSize() : state.chr_ram.size()),
+      shared_chr_(shared_chr), frame_buffer_(ppu_timing::SCREEN_WIDTH * ppu_timing::VISIBLE_LINES) {
+    if(!shared_chr_) {
+      chr_cache_.emplace(std::span<const uint8_t>(chr_, chr_size_), chr_ram_ != nullptr);
+    }
+    state_.sprite0_hit_at = ppu_timing::NEVER;
+    state_.overflow_at = ppu_timing::NEVER;
+    state_.sprites_dirty = 1;
+    updateNametables();
+    predictVblank();
+  }
+
+  // $2000-$3FFF, mirrored every 8 bytes
+  auto readRegister(uint16_t address) -> uint8_t {
+    if(listener_ && ((address & 0x7) == 2 || (address & 0x7) == 7)) {
+      // $2002 resets the write toggle and $2007 moves v, a replay needs both
+      listener_->access(PpuFrameListener::Access::REGISTER_READ, address, 0,
+                        cpu_clock_ * ppu_timing::DOTS_PER_CPU_CYCLE);
+    }
+    if((address & 0x7) == 2) {
+      return readStatus();
+    }
+    catchUp(cpu_clock_);
+    switch(address & 0x7) {
+      case 4:
+        state_.open_bus = state_.oam[state_.oam_addr];
+        break;
+      case 7: {
+        uint16_t addr = state_.v & 0x3FFF;
+        if(addr >= 0x3F00) {
+          // Palette reads are immediate, the buffer gets the nametable byte underneath
+          state_.open_bus = readPalette(addr);
+          state_.read_buffer = ppuRead(addr - 0x1000);
+        } else {
+          state_.open_bus = state_.read_buffer;
+          state_.read_buffer = ppuRead(addr);
+        }
+        state_.v += (state_.ctrl & 0x04) ? 32 : 1;
+        break;
+      }
+      default:
+        // Write-only registers return the last value on the bus
+        break;
+    }
+    return state_.open_bus;
+  }
+
+  auto writeRegister(uint16_t address, uint8_t data) -> void {
+    catchUp(cpu_clock_);
+    if(listener_) {
+      listener_->access(PpuFrameListener::Access::REGISTER_WRITE, address, data, state_.dot_clock);
+    }
+    state_.open_bus = data;
+    switch(address & 0x7) {
+      case 0:
+        // Enabling NMI during VBlank fires one straight away
+        if(!(state_.ctrl & 0x80) && (data & 0x80) && vblankFlag(state_.dot_clock)) {
+          state_.nmi_pending = 1;
+        }
+        if((state_.ctrl ^ data) & 0x20) {
+          sprite_table_dirty_ = true;
+        }
+        state_.ctrl = data;
+        state_.t = (state_.t & ~0x0C00) | ((data & 0x03) << 10);
+        break;
+      case 1:
+        state_.mask = data;
+        // Rendering decides whether the odd-frame pre-render line is short
+        predictVblank();
+        break;
+      case 3:
+        state_.oam_addr = data;
+        break;
+      case 4:
+        state_.oam[state_.oam_addr++] = data;
+        sprite_table_dirty_ = true;
+        break;
+      case 5:
+        if(state_.w == 0) {
+          state_.t = (state_.t & ~0x001F) | (data >> 3);
+          state_.x = data & 0x07;
+        } else {
+          state_.t = (state_.t & ~0x73E0) | ((data & 0x07) << 12) | ((data & 0xF8) << 2);
+        }
+        state_.w ^= 1;
+        break;
+      case 6:
+        if(state_.w == 0) {
+          state_.t = (state_.t & 0x00FF) | ((data & 0x3F) << 8);
+        } else {
+          state_.t = (state_.t & 0xFF00) | data;
+          state_.v = state_.t;
+        }
+        state_.w ^= 1;
+        break;
+      case 7:
+        ppuWrite(state_.v & 0x3FFF, data);
+        state_.v += (state_.ctrl & 0x04) ? 32 : 1;
+        break;
+      default:
+        break;
+    }
+    state_.sprites_dirty = 1;
+  }
+
+  auto sync() -> void {
+    catchUp(cpu_clock_);
+  }
+
+  // Bank or mirroring switches change what the PPU fetches, call after sync()
+  // and the mapper write
+  auto mapperWritten(uint16_t address, uint8_t data) -> void {
+    state_.sprites_dirty = 1;
+    updateNametables();
+    if(listener_) {
+      listener_->access(PpuFrameListener::Access::MAPPER_WRITE, address, data, state_.dot_clock);
+    }
+  }
+
+  // The arena was overwritten, CHR RAM and OAM may not match what was derived from them
+  auto stateRestored() -> void {
+    if(chr_ram_ && chr_cache_) {
+      chr_cache_->invalidateAll();
+    }
+    use_shared_chr_ = shared_chr_ != nullptr;
+    sprite_table_dirty_ = true;
+    updateNametables();
+  }
+
+  // OAM DMA: the 256 bytes go through $2004, so from OAMADDR on and wrapping
+  // round to it. They all land at the cycle the DMA starts.
+  auto oamDma(const uint8_t* page) -> void {
+    catchUp(cpu_clock_);
+    if(listener_) {
+      listener_->oamDma(page, state_.dot_clock);
+    }
+    const size_t first = 256 - state_.oam_addr;
+    std::memcpy(&state_.oam[state_.oam_addr], page, first);
+    std::memcpy(&state_.oam[0], page + first, 256 - first);
+    state_.open_bus = page[255];
+    oamChanged();
+  }
+
+  // Call after changing OAM without going through $2004
+  auto oamChanged() -> void {
+    sprite_table_dirty_ = true;
+    state_.sprites_dirty = 1;
+  }
+
+  // Hooks up a deferred renderer. The listener is called from the emulation
+  // thread and must not block.
+  auto setListener(PpuFrameListener* listener) -> void {
+    listener_ = listener;
+  }
+
+  // Frame-skip policy: render every interval-th frame, 0 for none. Skipped
+  // frames run the same timing events and predictions, they just never
+  // build a line, so emulation state is identical either way.
+  auto setFrameSkip(uint32_t interval) -> void {
+    skip_interval_ = interval;
+  }
+
+  // Render the next frame whatever the policy says
+  auto renderNextFrame() -> void {
+    render_next_ = true;
+  }
+
+  // Whether the frame in progress is being drawn
+  auto renderingFrame() const -> bool {
+    return render_frame_;
+  }
+
+  // Only lines in [first, last) go to the frame buffer, the others still run
+  // their timing events. Deferred rendering sets an empty range on the
+  // emulation side and a band per worker.
+  auto renderLines(uint32_t first, uint32_t last) -> void {
+    render_first_ = first;
+    render_last_ = last;
+  }
+
+  // With the table, sprite evaluation is done for the whole frame whenever OAM
+  // changes. Without it every line is evaluated on its own, which is cheaper
+  // for games that rewrite OAM mid-frame.
+  auto useSpriteTable(bool enabled) -> void {
+    use_sprite_table_ = enabled;
+    sprite_table_dirty_ = true;
+  }
+
+  // Run forward until the PPU has seen cpu_cycle * 3 dots
+  auto catchUp(uint64_t cpu_cycle) -> void {
+    using namespace ppu_timing;
+    const uint64_t target = cpu_cycle * DOTS_PER_CPU_CYCLE;
+    while(state_.dot_clock < target) {
+      const uint32_t length = lineLength();
+      const uint64_t left = length - state_.dot;
+      const uint32_t to = (target - state_.dot_clock >= left) ? length
+                          : state_.dot + static_cast<uint32_t>(target - state_.dot_clock);
+      runEvents(state_.dot, to);
+      state_.dot_clock += to - state_.dot;
+      state_.dot = to;
+      if(state_.dot == length) {
+        state_.dot = 0;
+        if(++state_.scanline == LINES_PER_FRAME) {
+          state_.scanline = 0;
+          state_.frame++;
+          render_frame_ = render_next_ || (skip_interval_ != 0 && state_.frame % skip_interval_ == 0);
+          render_next_ = false;
+          if(listener_ && render_frame_) {
+            listener_->frameStart(state_.dot_clock);
+          }
+        }
+      }
+    }
+    predictVblank();
+  }
+
+  auto takeNmi() -> bool {
+    bool nmi = state_.nmi_pending;
+    state_.nmi_pending = 0;
+    return nmi;
+  }
+
+  auto nmiPending() const -> bool { return state_.nmi_pending; }
+  auto nextSyncCycle() const -> uint64_t { return state_.next_sync_cycle; }
+  auto frame() const -> uint64_t { return state_.frame; }
+  auto scanline() const -> uint16_t { return state_.scanline; }
+  auto dot() const -> uint16_t { return state_.dot; }
+  auto state() const -> const PpuState& { return state_; }
+
+  // 256x240 NES color indices (0-63), each line written as the PPU passes it
+  auto frameBuffer() const -> std::span<const uint8_t> { return frame_buffer_; }
+
+  // The frame buffer and each line's emphasis bits, without copying. Pass it
+  // to pixel_format::convert for RGB output.
+  auto frameView() const -> FrameView { return {frame_buffer_, emphasis_}; }
+  // The PPU's own decoded tiles, null if it was built to read shared ones
+  auto chrCache() const -> const ChrCache* { return chr_cache_ ? &*chr_cache_ : nullptr; }
+
+  // PPU address space, $0000-$3FFF
+  auto ppuRead(uint16_t address) const -> uint8_t {
+    address &= 0x3FFF;
+    if(address < 0x2000) {
+      return chr_[mapper_.chrOffset(address)];
+    }
+    if(address < 0x3F00) {
+      return nametables_[(address >> 10) & 0x03][address & 0x03FF];
+    }
+    return readPalette(address);
+  }
+
+  auto ppuWrite(uint16_t address, uint8_t data) -> void {
+    address &= 0x3FFF;
+    if(address < 0x2000) {
+      if(chr_ram_) {
+        const uint32_t offset = mapper_.chrOffset(address);
+        chr_ram_[offset] = data;
+        if(use_shared_chr_) {
+          // The shared cache no longer matches, decode from here on
+          use_shared_chr_ = false;
+          if(!chr_cache_) {
+            chr_cache_.emplace(std::span<const uint8_t>(chr_, chr_size_), true);
+          }
+          chr_cache_->invalidateAll();
+        }
+        chr_cache_->invalidate(offset);
+      }
+    }
+    else if(address < 0x3F00) {
+      nametables_[(address >> 10) & 0x03][address & 0x03FF] = data;
+    }
+    else {
+      state_.palette[paletteIndex(address)] = data & 0x3F;
+    }
+  }
+
+private:
+  auto renderingEnabled() const -> bool {
+    return (state_.mask & 0x18) != 0;
+  }
+
+  auto vblankFlag(uint64_t now) const -> bool {
+    return now >= state_.vblank_at && now < state_.vblank_clear_at;
+  }
+
+  // $2002 without catching up. Everything since the last sync is known ahead
+  // of time as long as no register was written, and writes always sync, so
+  // only crossing the pre-render line (where the predictions end) needs a
+  // real catch-up.
+  auto readStatus() -> uint8_t {
+    const uint64_t now = cpu_clock_ * ppu_timing::DOTS_PER_CPU_CYCLE;
+    if(now >= state_.prerender_at) {
+      catchUp(cpu_clock_);
+    }
+    if(state_.sprites_dirty) {
+      predictSprites();
+    }
+    const uint8_t status = (vblankFlag(now) << 7) |
+                           ((now >= state_.sprite0_hit_at) << 6) |
+                           ((now >= state_.overflow_at) << 5) |
+                           (state_.open_bus & 0x1F);
+    if(status & 0x80) {
+      state_.vblank_clear_at = now;
+    }
+    else if(state_.vblank_at > now && state_.vblank_at - now < ppu_timing::DOTS_PER_CPU_CYCLE) {
+      // Reading as the flag is about to go up, within the dots of this CPU
+      // cycle, suppresses it and its NMI
+      state_.vblank_clear_at = state_.vblank_at;
+    }
+    state_.w = 0;
+    state_.open_bus = status;
+    return status;
+  }
+
+  // The pre-render line of odd frames is one dot short while rendering
+  auto lineLength() const -> uint32_t {
+    using namespace ppu_timing;
+    if(state_.scanline == PRERENDER_LINE && (state_.frame & 1) && renderingEnabled()) {
+      return DOTS_PER_LINE - 1;
+    }
+    return DOTS_PER_LINE;
+  }
+
+  // Handle every event of the current scanline with from <= dot < to
+  auto runEvents(uint32_t from, uint32_t to) -> void {
+    using namespace ppu_timing;
+    const uint32_t line = state_.scanline;
+    auto hits = [&](uint32_t event_dot) { return from <= event_dot && event_dot < to; };
+
+    if(hits(1)) {
+      if(line == VBLANK_LINE) {
+        // The flag itself is a timestamp, a suppressing read leaves it empty
+        if((state_.ctrl & 0x80) && state_.vblank_clear_at > state_.vblank_at) {
+          state_.nmi_pending = 1;
+        }
+        if(listener_) {
+          listener_->frameEnd();
+        }
+      }
+      else if(line == PRERENDER_LINE) {
+        state_.sprite0_hit_at = NEVER;
+        state_.overflow_at = NEVER;
+        state_.sprites_dirty = 1;
+      }
+    }
+    if(render_frame_ && line >= render_first_ && line < render_last_ && hits(256)) {
+      renderLine(line);
+    }
+    if(renderingEnabled() && (line < VISIBLE_LINES || line == PRERENDER_LINE)) {
+      if(hits(256)) {
+        incrementY(state_.v);
+      }
+      if(hits(257)) {
+        // Horizontal scroll bits t -> v
+        state_.v = (state_.v & ~0x041F) | (state_.t & 0x041F);
+      }
+      if(line == PRERENDER_LINE && hits(280)) {
+        // Vertical scroll bits t -> v (the hardware repeats this up to dot 304)
+        state_.v = (state_.v & ~0x7BE0) | (state_.t & 0x7BE0);
+      }
+    }
+  }
+
+  auto lineSprites(uint32_t line) -> SpriteLine {
+    const uint32_t height = (state_.ctrl & 0x20) ? 16 : 8;
+    if(!use_sprite_table_) {
+      return SpriteLine::fromMask(sprite_eval::inRange(state_.oam.data(), line, height));
+    }
+    if(sprite_table_dirty_) {
+      sprite_table_.build(state_.oam.data(), height);
+      sprite_table_dirty_ = false;
+    }
+    return sprite_table_.lines[line];
+  }
+
+  // Renders the whole line from the state at its dot 256, so writes take
+  // effect on the next line rather than mid-line
+  auto renderLine(uint32_t line) -> void {
+    uint8_t* out = &frame_buffer_[line * ppu_timing::SCREEN_WIDTH];
+    const uint8_t color_mask = (state_.mask & 0x01) ? 0x30 : 0x3F;
+    emphasis_[line] = state_.mask >> 5;
+    if(!renderingEnabled()) {
+      std::memset(out, state_.palette[0] & color_mask, ppu_timing::SCREEN_WIDTH);
+      return;
+    }
+    buildBackground();
+    buildSprites(line);
+    const compositor::Line input{&layers_.background[state_.x], layers_.sprites.data(), layers_.behind.data(),
+                                 layers_.sprite0.data(), state_.palette.data(), color_mask};
+    // The hit the compositor reports is ignored: timing only ever comes from
+    // predictSprites, so skipping or deferring frames can't change emulation
+    compositor::compose(input, out);
+  }
+
+  // 33 tiles of background starting at v's coarse x, fine x is applied by
+  // starting the composite at layers_.background[x]
+  auto buildBackground() -> void {
+    uint8_t* bg = layers_.background.data();
+    if(!(state_.mask & 0x08)) {
+      std::memset(bg, 0, layers_.background.size());
+      return;
+    }
+    const uint16_t v = state_.v;
+    const uint16_t coarse_y = (v >> 5) & 0x1F;
+    const uint16_t fine_y = (v >> 12) & 0x07;
+    const uint16_t pattern_base = ((state_.ctrl & 0x10) ? 0x1000 : 0) + fine_y;
+    for(uint32_t i = 0; i < 33; i++) {
+      uint32_t coarse_x = (v & 0x1F) + i;
+      const uint8_t* nametable = nametables_[((v >> 10) & 0x03) ^ ((coarse_x & 0x20) ? 0x01 : 0)];
+      coarse_x &= 0x1F;
+      const uint8_t tile = nametable[(coarse_y << 5) | coarse_x];
+      const uint8_t attribute = nametable[0x03C0 | ((coarse_y >> 2) << 3) | (coarse_x >> 2)];
+      const uint8_t palette = (attribute >> (((coarse_y & 0x02) << 1) | (coarse_x & 0x02))) & 0x03;
+      uint64_t pixels;
+      std::memcpy(&pixels, chrRow(mapper_.chrOffset(pattern_base + tile * 16), false), 8);
+      pixels |= (palette << 2) * 0x0101010101010101ULL;
+      std::memcpy(bg + i * 8, &pixels, 8);
+    }
+    if(!(state_.mask & 0x02)) {
+      std::memset(bg + state_.x, 0, 8);
+    }
+  }
+
+  // First 8 sprites in range, in OAM order. An earlier sprite keeps its pixel
+  // even when it is behind the background, like the hardware's priority mux.
+  auto buildSprites(uint32_t line) -> void {
+    std::memset(layers_.sprites.data(), 0, layers_.sprites.size());
+    std::memset(layers_.behind.data(), 0, layers_.behind.size());
+    std::memset(layers_.sprite0.data(), 0, layers_.sprite0.size());
+    if(!(state_.mask & 0x10)) {
+      return;
+    }
+    const SpriteLine sprites = lineSprites(line);
+    for(uint32_t n = 0; n < sprites.count; n++) {
+      const uint32_t i = sprites.index[n];
+      const uint8_t* entry = &state_.oam[i * 4];
+      const uint32_t top = entry[0] + 1u;
+      const uint8_t* pixels = spriteRow(i, line - top);
+      const uint8_t palette = 0x10 | ((entry[2] & 0x03) << 2);
+      const uint8_t behind = (entry[2] & 0x20) ? 0xFF : 0x00;
+      for(uint32_t p = 0; p < 8; p++) {
+        const uint32_t x = entry[3] + p;
+        if(x >= ppu_timing::SCREEN_WIDTH) {
+          break;
+        }
+        if(pixels[p] == 0 || (layers_.sprites[x] & 0x03)) {
+          continue;
+        }
+        layers_.sprites[x] = palette | pixels[p];
+        layers_.behind[x] = behind;
+        layers_.sprite0[x] = i == 0 ? 0xFF : 0x00;
+      }
+    }
+    if(!(state_.mask & 0x04)) {
+      std::memset(layers_.sprites.data(), 0, 8);
+    }
+  }
+
+  // Works out when sprite 0 hit and sprite overflow will go up, assuming
+  // nothing is written before the next pre-render line. Covers the rest of the
+  // current frame, or the whole next one when called on the pre-render line.
+  auto predictSprites() -> void {
+    using namespace ppu_timing;
+    state_.sprites_dirty = 0;
+    const uint32_t line = state_.scanline;
+    const uint32_t dot = state_.dot;
+    const uint64_t now = state_.dot_clock;
+    // Flags that already went up stay up until pre-render, the rest is redone
+    const bool keep_hit = state_.sprite0_hit_at <= now;
+    const bool keep_overflow = state_.overflow_at <= now;
+    if(!keep_hit) {
+      state_.sprite0_hit_at = NEVER;
+    }
+    if(!keep_overflow) {
+      state_.overflow_at = NEVER;
+    }
+    if((keep_hit && keep_overflow) || !renderingEnabled() ||
+       (line >= VISIBLE_LINES && line != PRERENDER_LINE)) {
+      return;
+    }
+
+    // v as the first predicted line sees it, then stepped line by line
+    uint16_t v = state_.v;
+    uint32_t first;
+    uint64_t first_clock;
+    uint32_t min_x = 0;
+    if(line == PRERENDER_LINE) {
+      if(dot < 2) {
+        return;
+      }
+      if(dot <= 256) {
+        incrementY(v);
+      }
+      if(dot <= 257) {
+        v = (v & ~0x041F) | (state_.t & 0x041F);
+      }
+      if(dot <= 280) {
+        v = (v & ~0x7BE0) | (state_.t & 0x7BE0);
+      }
+      first = 0;
+      first_clock = now - dot + lineLength();
+    }
+    else if(dot > 256) {
+      if(dot == 257) {
+        v = (v & ~0x041F) | (state_.t & 0x041F);
+      }
+      first = line + 1;
+      first_clock = now - dot + DOTS_PER_LINE;
+    }
+    else {
+      // Pixel x is drawn at dot x + 1, anything before the current dot is done
+      first = line;
+      first_clock = now - dot;
+      min_x = dot > 0 ? dot - 1 : 0;
+    }
+    auto lineClock = [&](uint32_t l) { return first_clock + uint64_t(l - first) * DOTS_PER_LINE; };
+
+    const uint32_t height = (state_.ctrl & 0x20) ? 16 : 8;
+    if(!keep_overflow) {
+      // Overflow is a plain count of more than 8 sprites in range. The
+      // hardware's buggy evaluation after the eighth sprite (the diagonal OAM
+      // walk behind its false positives and negatives) isn't modelled.
+      // Evaluation for line l happens at its start, the current line is already evaluated
+      for(uint32_t l = (first == line && dot > 0) ? first + 1 : first; l < VISIBLE_LINES; l++) {
+        if(lineSprites(l).in_range > 8) {
+          state_.overflow_at = lineClock(l);
+          break;
+        }
+      }
+    }
+
+    if(!keep_hit && (state_.mask & 0x18) == 0x18) {
+      const uint32_t top = state_.oam[0] + 1u;
+      for(uint32_t l = first; l < VISIBLE_LINES && l < top + height; l++) {
+        if(l >= top) {
+          int32_t hit = sprite0HitX(l - top, v, l == first ? min_x : 0);
+          if(hit >= 0) {
+            state_.sprite0_hit_at = lineClock(l) + hit + 2;
+            break;
+          }
+        }
+        incrementY(v);
+        v = (v & ~0x041F) | (state_.t & 0x041F);
+      }
+    }
+  }
+
+  // First x >= min_x where row `row` of sprite 0 and the background under
+  // scroll v are both opaque
+  auto sprite0HitX(uint32_t row, uint16_t v, uint32_t min_x) -> int32_t {
+    const uint8_t* pixels = spriteRow(0, row);
+    const uint8_t sprite_x = state_.oam[3];
+    const bool clip_left = (state_.mask & 0x06) != 0x06;
+    for(uint32_t i = 0; i < 8; i++) {
+      uint32_t x = sprite_x + i;
+      if(x >= 255) {
+        break;
+      }
+      if(x < min_x || (clip_left && x < 8)) {
+        continue;
+      }
+      if(pixels[i] != 0 && backgroundPixel(v, x) != 0) {
+        return static_cast<int32_t>(x);
+      }
+    }
+    return -1;
+  }
+
+  // 2-bit pattern values of one row of a sprite, already flipped
+  auto spriteRow(uint32_t sprite, uint32_t row) -> const uint8_t* {
+    const uint8_t* entry = &state_.oam[sprite * 4];
+    const uint8_t attributes = entry[2];
+    const bool tall = state_.ctrl & 0x20;
+    const uint32_t height = tall ? 16 : 8;
+    if(attributes & 0x80) {
+      row = height - 1 - row;
+    }
+    uint16_t pattern;
+    if(tall) {
+      pattern = ((entry[1] & 0x01) ? 0x1000 : 0) + (entry[1] & 0xFE) * 16 + (row >= 8 ? 16 : 0) + (row & 7);
+    } else {
+      pattern = ((state_.ctrl & 0x08) ? 0x1000 : 0) + entry[1] * 16 + row;
+    }
+    return chrRow(mapper_.chrOffset(pattern), attributes & 0x40);
+  }
+
+  // 2-bit pattern value of the background at screen x, for a line starting at scroll v
+  auto backgroundPixel(uint16_t v, uint32_t screen_x) -> uint8_t {
+    const uint32_t pos = state_.x + screen_x;
+    uint32_t coarse_x = (v & 0x1F) + pos / 8;
+    const uint8_t* nametable = nametables_[((v >> 10) & 0x03) ^ ((coarse_x & 0x20) ? 0x01 : 0)];
+    coarse_x &= 0x1F;
+    const uint16_t coarse_y = (v >> 5) & 0x1F;
+    const uint16_t fine_y = (v >> 12) & 0x07;
+    uint8_t tile = nametable[(coarse_y << 5) | coarse_x];
+    uint16_t pattern = ((state_.ctrl & 0x10) ? 0x1000 : 0) + tile * 16 + fine_y;
+    return chrRow(mapper_.chrOffset(pattern), false)[pos & 7];
+  }
+
+  auto chrRow(uint32_t offset, bool flip) -> const uint8_t* {
+    return use_shared_chr_ ? shared_chr_->decodedRow(offset, flip) : chr_cache_->row(offset, flip);
+  }
+
+  static auto incrementY(uint16_t& v) -> void {
+    if((v & 0x7000) != 0x7000) {
+      v += 0x1000;
+      return;
+    }
+    v &= ~0x7000;
+    uint16_t y = (v & 0x03E0) >> 5;
+    if(y == 29) {
+      y = 0;
+      v ^= 0x0800;
+    } else if(y == 31) {
+      y = 0;
+    } else {
+      y++;
+    }
+    v = (v & ~0x03E0) | (y << 5);
+  }
+
+  // Points the four 1KB nametable slots at their pages. Runs only when the
+  // arrangement can change (mapper writes, restores), so $2007 and the
+  // renderer just index the table. A mapper with its own nametable RAM
+  // provides nametables(ciram), which returns the four pages given the
+  // console's 2KB (4KB with four-screen boards) of CIRAM.
+  auto updateNametables() -> void {
+    uint8_t* ciram = state_.vram.data();
+    if constexpr (requires { mapper_.nametables(ciram); }) {
+      nametables_ = mapper_.nametables(ciram);
+    } else {
+      uint8_t* lower = ciram;
+      uint8_t* upper = ciram + 0x400;
+      switch(mapper_.mirroring()) {
+        case cores::mos6502::Mirroring::HORIZONTAL:
+          nametables_ = {lower, lower, upper, upper};
+          break;
+        case cores::mos6502::Mirroring::VERTICAL:
+          nametables_ = {lower, upper, lower, upper};
+          break;
+        case cores::mos6502::Mirroring::SINGLE_SCREEN_LOWER:
+          nametables_ = {lower, lower, lower, lower};
+          break;
+        case cores::mos6502::Mirroring::SINGLE_SCREEN_UPPER:
+          nametables_ = {upper, upper, upper, upper};
+          break;
+        case cores::mos6502::Mirroring::FOUR_SCREEN:
+          nametables_ = {ciram, ciram + 0x400, ciram + 0x800, ciram + 0xC00};
+          break;
+      }
+    }
+  }
+
+  static auto paletteIndex(uint16_t address) -> uint16_t {
+    uint16_t index = address & 0x1F;
+    // $3F10/$3F14/$3F18/$3F1C mirror the background entries
+    if((index & 0x13) == 0x10) {
+      index &= 0x0F;
+    }
+    return index;
+  }
+
+  auto readPalette(uint16_t address) const -> uint8_t {
+    return state_.palette[paletteIndex(address)];
+  }
+
+  // Places the VBlank and pre-render timestamps relative to the current dot
+  // and picks the next sync point. An event at dot d is visible once the PPU
+  // has run past it, hence the + 2 for the dot 1 events.
+  auto predictVblank() -> void {
+    using namespace ppu_timing;
+    const uint64_t position = state_.scanline * DOTS_PER_LINE + state_.dot;
+    const uint64_t set = VBLANK_LINE * DOTS_PER_LINE + 2;
+    const uint64_t clear = PRERENDER_LINE * DOTS_PER_LINE + 2;
+    const uint64_t line_start = state_.dot_clock - state_.dot;
+    uint64_t vblank_at = state_.vblank_at;
+    if(position < set) {
+      vblank_at = state_.dot_clock + set - position;
+    }
+    else if(position >= clear) {
+      vblank_at = line_start + lineLength() + set;
+    }
+    if(vblank_at != state_.vblank_at) {
+      state_.vblank_at = vblank_at;
+      state_.vblank_clear_at = vblank_at + (clear - set);
+    }
+    state_.prerender_at = state_.vblank_at + (clear - set);
+    const uint64_t next = state_.vblank_at > state_.dot_clock ? state_.vblank_at : state_.prerender_at;
+    state_.next_sync_cycle = (next + DOTS_PER_CPU_CYCLE - 1) / DOTS_PER_CPU_CYCLE;
+  }
+
+  PpuState& state_;
+  Mapper& mapper_;
+  const uint64_t& cpu_clock_;
+  const uint8_t* chr_;
+  uint8_t* chr_ram_;
+  size_t chr_size_;
+  const ChrCache* shared_chr_;
+  bool use_shared_chr_ = shared_chr_ != nullptr;
+  std::optional<ChrCache> chr_cache_;  // Own decoded tiles, unused while reading the shared ones
+  std::array<uint8_t*, 4> nametables_{};
+  ScanlineLayers layers_;
+  SpriteTable sprite_table_;
+  bool sprite_table_dirty_ = true;
+  bool use_sprite_table_ = true;
+  PpuFrameListener* listener_ = nullptr;
+  uint32_t skip_interval_ = 1;
+  bool render_next_ = false;
+  bool render_frame_ = true;
+  uint32_t render_first_ = 0;
+  uint32_t render_last_ = ppu_timing::VISIBLE_LINES;
+  std::vector<uint8_t> frame_buffer_;
+  std::array<uint8_t, ppu_timing::VISIBLE_LINES> emphasis_{};
+};
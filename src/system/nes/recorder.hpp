@@ -0,0 +1,453 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "audio_ring.hpp"
+#include "pixel_format.hpp"
+
+class RecorderException : public std::runtime_error {
+public:
+  explicit RecorderException(const std::string& message) : std::runtime_error(message) {}
+};
+
+// How frames are stored in the video stream:
+//   Y4M      YUV4MPEG2, 4:4:4 planes, plays in ffmpeg/mpv directly
+//   RGBA     headerless RGBA8888 frames (ffmpeg -f rawvideo -pix_fmt rgba -s 256x240)
+//   INDICES  headerless, per frame 256x240 palette indices then 240 emphasis bytes
+enum class VideoFormat : uint8_t { Y4M, RGBA, INDICES };
+
+namespace recording {
+  // Everything reaches the kernel in whole blocks from a page aligned buffer,
+  // which is what O_DIRECT needs and keeps write(2) calls down to about one
+  // per 5 frames of Y4M
+  inline constexpr size_t BLOCK_SIZE = 1 << 20;
+  inline constexpr size_t ALIGNMENT = 4096;
+
+  // 2C02 NTSC frame rate, 236250000 / 11 / 12 / 29780.5 = 60.0988 as a ratio
+  inline constexpr const char* Y4M_HEADER = "YUV4MPEG2 W256 H240 F39375000:655171 Ip A8:7 C444\n";
+  inline constexpr const char* Y4M_FRAME = "FRAME\n";
+
+  inline constexpr size_t WAV_HEADER_SIZE = 44;
+  // RIFF and data sizes are patched on close, pipes keep the streaming value
+  inline constexpr uint32_t WAV_UNKNOWN_SIZE = 0xFFFFFFFF;
+
+  inline auto putLe(uint8_t* out, uint32_t value, size_t bytes) -> void {
+    for(size_t i = 0; i < bytes; i++) {
+      out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+  }
+
+  // Mono 16 bit PCM
+  inline auto wavHeader(uint32_t sample_rate, uint32_t data_size) -> std::array<uint8_t, WAV_HEADER_SIZE> {
+    std::array<uint8_t, WAV_HEADER_SIZE> header{};
+    std::memcpy(&header[0], "RIFF", 4);
+    putLe(&header[4], data_size == WAV_UNKNOWN_SIZE ? data_size : data_size + 36, 4);
+    std::memcpy(&header[8], "WAVEfmt ", 8);
+    putLe(&header[16], 16, 4);
+    putLe(&header[20], 1, 2);
+    putLe(&header[22], 1, 2);
+    putLe(&header[24], sample_rate, 4);
+    putLe(&header[28], sample_rate * 2, 4);
+    putLe(&header[32], 2, 2);
+    putLe(&header[34], 16, 2);
+    std::memcpy(&header[36], "data", 4);
+    putLe(&header[40], data_size, 4);
+    return header;
+  }
+
+  // A file or pipe ("-" is stdout) written in BLOCK_SIZE chunks. With direct
+  // set, regular files are opened with O_DIRECT so long recordings don't push
+  // everything else out of the page cache; filesystems that refuse it get a
+  // normal descriptor. Not thread safe, it belongs to the writer thread.
+  class BlockFile {
+  public:
+    BlockFile(const std::filesystem::path& path, bool direct)
+      : buffer_(static_cast<uint8_t*>(std::aligned_alloc(ALIGNMENT, BLOCK_SIZE))) {
+      if(!buffer_) {
+        throw RecorderException("Out of memory for the write buffer of " + path.string());
+      }
+      if(path == "-") {
+        fd_ = STDOUT_FILENO;
+        owned_ = false;
+        return;
+      }
+      const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+      if(direct) {
+        fd_ = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        direct_ = fd_ >= 0;
+      }
+#endif
+      if(fd_ < 0) {
+        fd_ = ::open(path.c_str(), flags, 0644);
+      }
+      if(fd_ < 0) {
+        throw RecorderException("Can't open " + path.string() + " for recording");
+      }
+    }
+
+    ~BlockFile() {
+      if(owned_ && fd_ >= 0) {
+        ::close(fd_);
+      }
+    }
+
+    BlockFile(const BlockFile&) = delete;
+    auto operator=(const BlockFile&) -> BlockFile& = delete;
+
+    auto append(const void* data, size_t size) -> void {
+      const auto* bytes = static_cast<const uint8_t*>(data);
+      while(size > 0) {
+        const size_t chunk = std::min(size, BLOCK_SIZE - used_);
+        std::memcpy(buffer_.get() + used_, bytes, chunk);
+        used_ += chunk;
+        bytes += chunk;
+        size -= chunk;
+        if(used_ == BLOCK_SIZE) {
+          writeAll(buffer_.get(), BLOCK_SIZE);
+          used_ = 0;
+        }
+      }
+    }
+
+    // Writes the partial last block. O_DIRECT is dropped first since the tail
+    // is rarely a whole number of sectors.
+    auto flush() -> void {
+#ifdef O_DIRECT
+      if(direct_) {
+        ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) & ~O_DIRECT);
+        direct_ = false;
+      }
+#endif
+      writeAll(buffer_.get(), used_);
+      used_ = 0;
+    }
+
+    // Overwrites already flushed bytes. Returns false for pipes, where the
+    // data is gone.
+    auto patch(uint64_t offset, std::span<const uint8_t> bytes) -> bool {
+      struct stat info{};
+      if(::fstat(fd_, &info) != 0 || !S_ISREG(info.st_mode)) {
+        return false;
+      }
+      return ::pwrite(fd_, bytes.data(), bytes.size(), static_cast<off_t>(offset)) ==
+             static_cast<ssize_t>(bytes.size());
+    }
+
+    auto bytesWritten() const -> uint64_t { return written_ + used_; }
+    auto direct() const -> bool { return direct_; }
+
+  private:
+    struct Free {
+      auto operator()(uint8_t* p) const -> void { std::free(p); }
+    };
+
+    auto writeAll(const uint8_t* data, size_t size) -> void {
+      while(size > 0) {
+        const ssize_t done = ::write(fd_, data, size);
+        if(done < 0 && errno == EINTR) {
+          continue;
+        }
+        if(done <= 0) {
+          throw RecorderException(std::string("Recording write failed: ") + std::strerror(errno));
+        }
+        data += done;
+        size -= static_cast<size_t>(done);
+        written_ += static_cast<uint64_t>(done);
+      }
+    }
+
+    std::unique_ptr<uint8_t, Free> buffer_;
+    size_t used_ = 0;
+    uint64_t written_ = 0;
+    int fd_ = -1;
+    bool owned_ = true;
+    bool direct_ = false;
+  };
+}
+
+// Streams finished frames and PCM samples to disk or a pipe from a dedicated
+// writer thread. The emulation thread only copies into preallocated rings:
+// pushFrame() is a 60KB memcpy and never blocks. When the writer falls behind
+// and the frame ring is full the frame is dropped and counted, likewise for
+// audio samples, so a recording with holes is always reported as such.
+// Conversion to the output format and all I/O happen on the writer thread.
+class Recorder {
+public:
+  struct Options {
+    std::filesystem::path video;  // empty for no video, "-" for stdout
+    VideoFormat format = VideoFormat::Y4M;
+    std::filesystem::path audio;  // WAV, empty for no audio
+    uint32_t sample_rate = 48000;
+    size_t queue_frames = 8;
+    bool direct_io = false;
+  };
+
+  explicit Recorder(const Options& options)
+    : options_(options), records_video_(!options.video.empty()), records_audio_(!options.audio.empty()),
+      frames_(std::max<size_t>(options.queue_frames, 1)),
+      samples_(std::max<size_t>(options.sample_rate, 1024)) {
+    if(records_video_) {
+      video_ = std::make_unique<recording::BlockFile>(options_.video, options_.direct_io);
+      if(options_.format == VideoFormat::Y4M) {
+        video_->append(recording::Y4M_HEADER, std::strlen(recording::Y4M_HEADER));
+      }
+    }
+    if(records_audio_) {
+      audio_ = std::make_unique<recording::BlockFile>(options_.audio, options_.direct_io);
+      const auto header = recording::wavHeader(options_.sample_rate, recording::WAV_UNKNOWN_SIZE);
+      audio_->append(header.data(), header.size());
+    }
+    writer_ = std::thread([this] { writerLoop(); });
+  }
+
+  ~Recorder() {
+    stop();
+  }
+
+  Recorder(const Recorder&) = delete;
+  auto operator=(const Recorder&) -> Recorder& = delete;
+
+  // Returns false if the frame had to be dropped
+  auto pushFrame(const FrameView& frame) -> bool {
+    if(!records_video_) {
+      return false;
+    }
+    const uint64_t tail = frame_tail_.load(std::memory_order_relaxed);
+    if(tail - frame_head_.load(std::memory_order_acquire) == frames_.size()) {
+      dropped_frames_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    Frame& slot = frames_[tail % frames_.size()];
+    std::memcpy(slot.indices.data(), frame.indices.data(), slot.indices.size());
+    std::memcpy(slot.emphasis.data(), frame.emphasis.data(), slot.emphasis.size());
+    frame_tail_.store(tail + 1, std::memory_order_release);
+    wake();
+    return true;
+  }
+
+  // Mono samples at Options::sample_rate. Returns how many were queued, the
+  // rest are counted as dropped.
+  auto pushAudio(std::span<const int16_t> samples) -> size_t {
+    if(!records_audio_) {
+      return 0;
+    }
+    const size_t count = samples_.write(samples);
+    dropped_samples_.fetch_add(samples.size() - count, std::memory_order_relaxed);
+    wake();
+    return count;
+  }
+
+  // Writes everything still queued, fixes up the WAV header and stops the
+  // writer. Throws if any write failed along the way.
+  auto finish() -> void {
+    stop();
+    std::lock_guard lock(mutex_);
+    if(!error_.empty()) {
+      throw RecorderException(error_);
+    }
+  }
+
+  auto framesWritten() const -> uint64_t { return frames_written_.load(std::memory_order_relaxed); }
+  auto droppedFrames() const -> uint64_t { return dropped_frames_.load(std::memory_order_relaxed); }
+  auto droppedSamples() const -> uint64_t { return dropped_samples_.load(std::memory_order_relaxed); }
+
+  // Frame size in the video stream, not counting the Y4M header
+  static auto frameBytes(VideoFormat format) -> size_t {
+    constexpr size_t pixels = FrameView::WIDTH * FrameView::HEIGHT;
+    switch(format) {
+      case VideoFormat::Y4M:
+        return std::strlen(recording::Y4M_FRAME) + pixels * 3;
+      case VideoFormat::RGBA:
+        return pixels * 4;
+      default:
+        return pixels + FrameView::HEIGHT;
+    }
+  }
+
+private:
+  struct Frame {
+    std::array<uint8_t, FrameView::WIDTH * FrameView::HEIGHT> indices{};
+    std::array<uint8_t, FrameView::HEIGHT> emphasis{};
+  };
+
+  // Locking around the notify means the writer can't miss a push between
+  // checking the rings and going to sleep
+  auto wake() -> void {
+    std::lock_guard lock(mutex_);
+    wake_.notify_one();
+  }
+
+  auto pending() const -> bool {
+    return frame_head_.load(std::memory_order_relaxed) != frame_tail_.load(std::memory_order_acquire) ||
+           samples_.size() > 0;
+  }
+
+  auto stop() -> void {
+    if(!writer_.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard lock(mutex_);
+      stopping_ = true;
+      wake_.notify_one();
+    }
+    writer_.join();
+  }
+
+  auto writerLoop() -> void {
+    bool failed = false;
+    while(true) {
+      bool stopping = false;
+      {
+        std::unique_lock lock(mutex_);
+        wake_.wait(lock, [this] { return stopping_ || pending(); });
+        stopping = stopping_;
+      }
+      if(failed) {
+        // Keep emptying the rings so the emulation side sees drops rather
+        // than a writer that silently stopped
+        discard();
+      } else {
+        try {
+          drainAudio();
+          drainFrames();
+          if(stopping && !pending()) {
+            close();
+          }
+        } catch(const RecorderException& e) {
+          std::lock_guard lock(mutex_);
+          error_ = e.what();
+          failed = true;
+          discard();
+        }
+      }
+      if(stopping && !pending()) {
+        video_.reset();
+        audio_.reset();
+        return;
+      }
+    }
+  }
+
+  auto drainFrames() -> void {
+    uint64_t head = frame_head_.load(std::memory_order_relaxed);
+    const uint64_t tail = frame_tail_.load(std::memory_order_acquire);
+    for(; head != tail; head++) {
+      writeFrame(frames_[head % frames_.size()]);
+      frame_head_.store(head + 1, std::memory_order_release);
+      frames_written_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  auto writeFrame(const Frame& frame) -> void {
+    using namespace pixel_format;
+    constexpr uint32_t width = FrameView::WIDTH;
+    switch(options_.format) {
+      case VideoFormat::Y4M:
+        video_->append(recording::Y4M_FRAME, std::strlen(recording::Y4M_FRAME));
+        for(Plane plane : {Y, U, V}) {
+          for(uint32_t y = 0; y < FrameView::HEIGHT; y++) {
+            const auto& table = PLANES[plane][frame.emphasis[y] & 0x07];
+            const uint8_t* in = &frame.indices[y * width];
+            for(uint32_t x = 0; x < width; x++) {
+              line_[x] = table[in[x] & 0x3F];
+            }
+            video_->append(line_.data(), width);
+          }
+        }
+        break;
+      case VideoFormat::RGBA:
+        for(uint32_t y = 0; y < FrameView::HEIGHT; y++) {
+          convert_(PixelFormat::RGBA8888, &frame.indices[y * width], frame.emphasis[y], line_.data());
+          video_->append(line_.data(), width * 4);
+        }
+        break;
+      case VideoFormat::INDICES:
+        video_->append(frame.indices.data(), frame.indices.size());
+        video_->append(frame.emphasis.data(), frame.emphasis.size());
+        break;
+    }
+  }
+
+  auto drainAudio() -> void {
+    for(auto chunk = samples_.readable(); !chunk.empty(); chunk = samples_.readable()) {
+      if constexpr(std::endian::native == std::endian::little) {
+        audio_->append(chunk.data(), chunk.size_bytes());
+      } else {
+        for(int16_t sample : chunk) {
+          uint8_t le[2];
+          recording::putLe(le, static_cast<uint16_t>(sample), 2);
+          audio_->append(le, 2);
+        }
+      }
+      samples_.consume(chunk.size());
+    }
+  }
+
+  // Drops whatever is queued, after a write error
+  auto discard() -> void {
+    const uint64_t frames = frame_tail_.load(std::memory_order_acquire);
+    dropped_frames_.fetch_add(frames - frame_head_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    frame_head_.store(frames, std::memory_order_release);
+    dropped_samples_.fetch_add(samples_.discard(), std::memory_order_relaxed);
+  }
+
+  auto close() -> void {
+    if(video_) {
+      video_->flush();
+    }
+    if(audio_) {
+      audio_->flush();
+      const uint64_t data = audio_->bytesWritten() - recording::WAV_HEADER_SIZE;
+      const auto header = recording::wavHeader(
+          options_.sample_rate, static_cast<uint32_t>(std::min<uint64_t>(data, recording::WAV_UNKNOWN_SIZE - 36)));
+      audio_->patch(0, header);
+    }
+  }
+
+  Options options_;
+  const bool records_video_;
+  const bool records_audio_;
+  // Writer thread only
+  std::unique_ptr<recording::BlockFile> video_;
+  std::unique_ptr<recording::BlockFile> audio_;
+
+  // Single producer (emulation thread), single consumer (writer thread)
+  std::vector<Frame> frames_;
+  std::atomic<uint64_t> frame_head_{0};
+  std::atomic<uint64_t> frame_tail_{0};
+  AudioRing samples_;
+
+  std::atomic<uint64_t> frames_written_{0};
+  std::atomic<uint64_t> dropped_frames_{0};
+  std::atomic<uint64_t> dropped_samples_{0};
+
+  std::array<uint8_t, FrameView::WIDTH * 4> line_{};
+  pixel_format::ConvertFn convert_ = pixel_format::bestConvertLine();
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  std::string error_;
+  std::thread writer_;
+};
@@ -0,0 +1,185 @@
+#pragma once
+#include <utils/cpu_features.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numbers>
+#include <span>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TWIX_RESAMPLE_X86 1
+#endif
+
+// Windowed-sinc polyphase resampling, for taking the APU's samples to
+// whatever rate the consumer runs at. The kernel is tabulated at PHASES
+// fractional positions; an output sample between two of them takes the dot
+// product of the input window with both and blends the results, so any
+// ratio works, including one that changes from call to call.
+namespace resample {
+  constexpr uint32_t PHASE_BITS = 8;
+  constexpr uint32_t PHASES = 1 << PHASE_BITS;
+  // Kernels are padded to whole AVX registers
+  constexpr uint32_t TAP_MULTIPLE = 8;
+
+  // Dot products of the taps input samples at x with the kernel phases h0
+  // and h1, blended by frac (0 is all h0)
+  using BlendFn = float (*)(const float* x, const float* h0, const float* h1, uint32_t taps, float frac);
+
+  inline auto blendScalar(const float* x, const float* h0, const float* h1, uint32_t taps, float frac) -> float {
+    float a = 0;
+    float b = 0;
+    for(uint32_t i = 0; i < taps; i++) {
+      a += x[i] * h0[i];
+      b += x[i] * h1[i];
+    }
+    return a + frac * (b - a);
+  }
+
+#ifdef TWIX_RESAMPLE_X86
+  __attribute__((target("sse2")))
+  inline auto horizontalSum(__m128 v) -> float {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 0x55));
+    return _mm_cvtss_f32(v);
+  }
+
+  __attribute__((target("sse2")))
+  inline auto blendSse2(const float* x, const float* h0, const float* h1, uint32_t taps, float frac) -> float {
+    __m128 a = _mm_setzero_ps();
+    __m128 b = _mm_setzero_ps();
+    for(uint32_t i = 0; i < taps; i += 4) {
+      const __m128 in = _mm_loadu_ps(x + i);
+      a = _mm_add_ps(a, _mm_mul_ps(in, _mm_loadu_ps(h0 + i)));
+      b = _mm_add_ps(b, _mm_mul_ps(in, _mm_loadu_ps(h1 + i)));
+    }
+    const float sa = horizontalSum(a);
+    return sa + frac * (horizontalSum(b) - sa);
+  }
+
+  __attribute__((target("avx2,fma")))
+  inline auto blendAvx2(const float* x, const float* h0, const float* h1, uint32_t taps, float frac) -> float {
+    __m256 a = _mm256_setzero_ps();
+    __m256 b = _mm256_setzero_ps();
+    for(uint32_t i = 0; i < taps; i += 8) {
+      const __m256 in = _mm256_loadu_ps(x + i);
+      a = _mm256_fmadd_ps(in, _mm256_loadu_ps(h0 + i), a);
+      b = _mm256_fmadd_ps(in, _mm256_loadu_ps(h1 + i), b);
+    }
+    // Blending the sums costs one FMA instead of blending every tap
+    const __m256 f = _mm256_set1_ps(frac);
+    const __m256 v = _mm256_fmadd_ps(f, _mm256_sub_ps(b, a), a);
+    return horizontalSum(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+  }
+#endif
+
+  inline auto bestBlend() -> BlendFn {
+#ifdef TWIX_RESAMPLE_X86
+    const auto& cpu = Components::cpuFeatures();
+    static const BlendFn best = cpu.avx2 && cpu.fma ? blendAvx2 : cpu.sse2 ? blendSse2 : blendScalar;
+    return best;
+#else
+    return blendScalar;
+#endif
+  }
+}
+
+// Streaming resampler: push() input as it comes, pull() output as far as
+// the input goes. The ratio can be moved up to MAX_ADJUST either side of the
+// rates it was built for, enough to keep a consumer's queue level against
+// clock drift; the kernel's cutoff stays where those rates put it.
+class Resampler {
+public:
+  static constexpr double MAX_ADJUST = 0.05;
+
+  // taps is the kernel length when upsampling; downsampling widens it by the
+  // ratio to keep the same transition band at the lower cutoff
+  Resampler(double input_rate, double output_rate, uint32_t taps = 32, resample::BlendFn blend = resample::bestBlend())
+    : input_rate_(input_rate), nominal_ratio_(output_rate / input_rate), blend_(blend) {
+    using namespace resample;
+    const double widen = std::max(1.0, 1.0 / nominal_ratio_);
+    taps_ = static_cast<uint32_t>(std::ceil(taps * widen / TAP_MULTIPLE)) * TAP_MULTIPLE;
+    buildKernels(0.45 * std::min(1.0, nominal_ratio_));
+    setRatio(nominal_ratio_);
+    // The first window is centred on the first sample pushed
+    input_.assign(taps_ / 2 - 1, 0.0f);
+    position_ = uint64_t(taps_ / 2 - 1) << 32;
+  }
+
+  auto taps() const -> uint32_t { return taps_; }
+  auto nominalRatio() const -> double { return nominal_ratio_; }
+  auto ratio() const -> double { return 4294967296.0 / step_; }
+
+  // Output samples per input sample, clamped to MAX_ADJUST of the nominal
+  auto setRatio(double ratio) -> void {
+    ratio = std::clamp(ratio, nominal_ratio_ * (1 - MAX_ADJUST), nominal_ratio_ * (1 + MAX_ADJUST));
+    step_ = static_cast<uint64_t>(std::llround(4294967296.0 / ratio));
+  }
+
+  // What the filter adds to latency: an output sample needs input up to
+  // half a kernel ahead of it
+  auto delay() const -> double {
+    return (taps_ / 2) / input_rate_;
+  }
+
+  auto push(std::span<const int16_t> in) -> void {
+    input_.insert(input_.end(), in.begin(), in.end());
+  }
+
+  // Returns how many samples were written to out
+  auto pull(std::span<int16_t> out) -> size_t {
+    using namespace resample;
+    constexpr uint32_t frac_bits = 32 - PHASE_BITS;
+    const uint32_t lead = taps_ / 2 - 1;
+    size_t count = 0;
+    for(; count < out.size(); count++) {
+      const uint64_t n = position_ >> 32;
+      if(n + taps_ / 2 >= input_.size()) {
+        break;
+      }
+      const uint32_t fraction = static_cast<uint32_t>(position_);
+      const float* h0 = &kernels_[(fraction >> frac_bits) * taps_];
+      const float frac = (fraction & ((1u << frac_bits) - 1)) * (1.0f / (1u << frac_bits));
+      const float value = blend_(&input_[n - lead], h0, h0 + taps_, taps_, frac);
+      out[count] = static_cast<int16_t>(std::clamp(std::lrint(value), -32768L, 32767L));
+      position_ += step_;
+    }
+    // Drop the input no window reaches back to anymore
+    const size_t used = std::min<size_t>((position_ >> 32) - lead, input_.size());
+    input_.erase(input_.begin(), input_.begin() + used);
+    position_ -= uint64_t(used) << 32;
+    return count;
+  }
+
+private:
+  // Blackman-windowed sinc, PHASES + 1 rows so the blend always has a row
+  // above. Each row sums to 1, constant input comes out unchanged.
+  auto buildKernels(double cutoff) -> void {
+    using namespace resample;
+    constexpr double pi = std::numbers::pi;
+    kernels_.assign(size_t(PHASES + 1) * taps_, 0.0f);
+    for(uint32_t phase = 0; phase <= PHASES; phase++) {
+      std::vector<double> row(taps_);
+      double sum = 0;
+      for(uint32_t i = 0; i < taps_; i++) {
+        const double x = i - double(taps_ / 2 - 1) - double(phase) / PHASES;
+        const double sinc = x == 0 ? 2 * cutoff : std::sin(2 * pi * cutoff * x) / (pi * x);
+        const double w = std::clamp((x + taps_ / 2.0) / taps_, 0.0, 1.0);
+        row[i] = sinc * (0.42 - 0.5 * std::cos(2 * pi * w) + 0.08 * std::cos(4 * pi * w));
+        sum += row[i];
+      }
+      for(uint32_t i = 0; i < taps_; i++) {
+        kernels_[phase * taps_ + i] = static_cast<float>(row[i] / sum);
+      }
+    }
+  }
+
+  double input_rate_;
+  double nominal_ratio_;
+  resample::BlendFn blend_;
+  uint32_t taps_;
+  std::vector<float> kernels_;
+  std::vector<float> input_;  // Samples still in reach of a window
+  uint64_t position_;         // Next output's position in input_, 32.32
+  uint64_t step_;             // Input samples per output sample, 32.32
+};
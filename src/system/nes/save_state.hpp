@@ -0,0 +1,171 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+class SaveStateException : public std::runtime_error {
+public:
+  explicit SaveStateException(const std::string& message) : std::runtime_error(message) {}
+};
+
+// Save state layout: a fixed header with a directory of tagged blocks, then
+// the blocks themselves, each a raw copy of one trivially copyable state
+// struct at a 64-byte aligned offset. Nothing is serialised field by field:
+// saving and loading are one memcpy per block plus the header checks.
+//
+// A reader finds blocks by tag and refuses one whose size isn't the size of
+// the struct it would be copied into, so a layout change in any block is
+// caught even when VERSION wasn't bumped. The header also names the ROM
+// (PRG+CHR CRC32 and mapper number) the state belongs to. Multi-byte fields
+// are in host byte order.
+namespace save_state {
+  inline constexpr std::array<char, 8> MAGIC = {'T', 'W', 'I', 'X', 'S', 'A', 'V', 'E'};
+  // Bumped whenever a block's meaning changes without its size changing
+  inline constexpr uint32_t VERSION = 2;
+  inline constexpr uint32_t ALIGNMENT = 64;
+  inline constexpr uint32_t MAX_BLOCKS = 8;
+
+  // Four characters, readable in a hex dump
+  constexpr auto tag(const char (&name)[5]) -> uint32_t {
+    return uint32_t(uint8_t(name[0])) | uint32_t(uint8_t(name[1])) << 8 | uint32_t(uint8_t(name[2])) << 16 |
+           uint32_t(uint8_t(name[3])) << 24;
+  }
+
+  inline constexpr uint32_t CPU = tag("CPU ");
+  inline constexpr uint32_t RAM = tag("RAM ");
+  inline constexpr uint32_t MAPPER = tag("MAPR");
+  inline constexpr uint32_t PPU = tag("PPU ");
+  inline constexpr uint32_t APU = tag("APU ");
+  inline constexpr uint32_t BATTERY = tag("BATT");  // Battery RAM kept outside the arena
+
+  struct Block {
+    uint32_t tag;
+    uint32_t size;
+    uint32_t offset;  // From the start of the header
+    uint32_t reserved;
+  };
+
+  struct alignas(ALIGNMENT) Header {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t total_size;
+    uint32_t block_count;
+    uint32_t rom_crc32;
+    uint16_t mapper;
+    uint16_t reserved;
+    std::array<Block, MAX_BLOCKS> blocks;
+  };
+  static_assert(std::is_trivially_copyable_v<Header>);
+
+  // The cartridge a state was saved from
+  struct RomId {
+    uint32_t crc32;
+    uint16_t mapper;
+  };
+
+  // A block to write: where its bytes are now
+  struct Source {
+    uint32_t tag;
+    const void* data;
+    uint32_t size;
+  };
+
+  constexpr auto aligned(uint32_t size) -> uint32_t {
+    return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  }
+
+  inline auto totalSize(std::span<const Source> blocks) -> size_t {
+    uint32_t size = sizeof(Header);
+    for(const Source& block : blocks) {
+      size += aligned(block.size);
+    }
+    return size;
+  }
+
+  // Writes the header and blocks to out, which must hold totalSize(blocks).
+  // Returns the bytes used.
+  inline auto write(std::span<uint8_t> out, std::span<const Source> blocks, RomId rom) -> size_t {
+    const size_t total = totalSize(blocks);
+    if(out.size() < total || blocks.size() > MAX_BLOCKS) {
+      throw SaveStateException("save state buffer too small");
+    }
+    Header header{};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.header_size = sizeof(Header);
+    header.total_size = static_cast<uint32_t>(total);
+    header.block_count = static_cast<uint32_t>(blocks.size());
+    header.rom_crc32 = rom.crc32;
+    header.mapper = rom.mapper;
+    uint32_t offset = sizeof(Header);
+    for(size_t i = 0; i < blocks.size(); i++) {
+      header.blocks[i] = {blocks[i].tag, blocks[i].size, offset, 0};
+      std::memcpy(out.data() + offset, blocks[i].data, blocks[i].size);
+      // Padding is zeroed so equal states give equal bytes
+      std::memset(out.data() + offset + blocks[i].size, 0, aligned(blocks[i].size) - blocks[i].size);
+      offset += aligned(blocks[i].size);
+    }
+    std::memcpy(out.data(), &header, sizeof(Header));
+    return total;
+  }
+
+  // Checks the header and directory against in and returns them
+  inline auto readHeader(std::span<const uint8_t> in) -> Header {
+    Header header;
+    if(in.size() < sizeof(Header)) {
+      throw SaveStateException("save state truncated");
+    }
+    std::memcpy(&header, in.data(), sizeof(Header));
+    if(header.magic != MAGIC) {
+      throw SaveStateException("not a save state");
+    }
+    if(header.version != VERSION || header.header_size != sizeof(Header)) {
+      throw SaveStateException("save state version " + std::to_string(header.version) + ", expected " +
+                               std::to_string(VERSION));
+    }
+    if(header.total_size > in.size() || header.block_count > MAX_BLOCKS) {
+      throw SaveStateException("save state truncated");
+    }
+    for(uint32_t i = 0; i < header.block_count; i++) {
+      const Block& block = header.blocks[i];
+      if(block.offset < sizeof(Header) || uint64_t(block.offset) + block.size > header.total_size) {
+        throw SaveStateException("save state block out of range");
+      }
+    }
+    return header;
+  }
+
+  // Refuses a state saved from another cartridge
+  inline auto requireRom(const Header& header, RomId rom) -> void {
+    if(header.rom_crc32 != rom.crc32 || header.mapper != rom.mapper) {
+      throw SaveStateException("save state is for another ROM (CRC32 " + std::to_string(header.rom_crc32) +
+                               ", mapper " + std::to_string(header.mapper) + ")");
+    }
+  }
+
+  // The block with tag, null if there is none
+  inline auto find(const Header& header, uint32_t tag) -> const Block* {
+    const auto end = header.blocks.begin() + header.block_count;
+    const auto it = std::find_if(header.blocks.begin(), end, [&](const Block& block) { return block.tag == tag; });
+    return it == end ? nullptr : &*it;
+  }
+
+  // The block with tag, which must be exactly size bytes
+  inline auto require(const Header& header, uint32_t tag, size_t size) -> const Block& {
+    const Block* block = find(header, tag);
+    if(!block) {
+      throw SaveStateException("save state has no block " + std::string(reinterpret_cast<const char*>(&tag), 4));
+    }
+    if(block->size != size) {
+      throw SaveStateException("save state block " + std::string(reinterpret_cast<const char*>(&tag), 4) +
+                               " is " + std::to_string(block->size) + " bytes, expected " + std::to_string(size));
+    }
+    return *block;
+  }
+}
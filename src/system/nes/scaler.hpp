@@ -0,0 +1,549 @@
+#pragma once
+#include <utils/cpu_features.hpp>
+#include <utils/thread_pool.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <vector>
+#include "frame_stage.hpp"
+#include "pixel_format.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TWIX_SCALER_X86 1
+#endif
+
+// Pixel art upscaling of PPU frames into RGBA8888. The edge rules run on the
+// color indices, where "same color" is a byte compare, and the result goes
+// through the pixel_format tables with each source line's emphasis.
+//
+// Every filter has a base factor (nearest 1, Scale2x 2, Scale3x 3, xBR 2).
+// Any multiple of it up to MAX_FACTOR is allowed, the rest is nearest
+// neighbour, e.g. Scale2x at 4 is Scale2x with every pixel doubled.
+enum class ScaleFilter : uint8_t {
+  NEAREST,
+  SCALE2X,  // EPX / AdvMAME2x
+  SCALE3X,  // AdvMAME3x
+  XBR,      // 2xBR level 1: the edge corner of each pixel blends halfway to its neighbour
+};
+
+namespace scaler {
+  constexpr size_t WIDTH = FrameView::WIDTH;
+  constexpr size_t HEIGHT = FrameView::HEIGHT;
+  constexpr uint32_t MAX_FACTOR = 6;
+  constexpr size_t BORDER = 2;                        // Replicated edge pixels around the source
+  constexpr size_t PADDED_WIDTH = WIDTH + 2 * BORDER;
+  constexpr size_t PADDED_HEIGHT = HEIGHT + 2 * BORDER;
+
+  constexpr auto baseFactor(ScaleFilter filter) -> uint32_t {
+    switch(filter) {
+      case ScaleFilter::SCALE2X:
+      case ScaleFilter::XBR:
+        return 2;
+      case ScaleFilter::SCALE3X:
+        return 3;
+      default:
+        return 1;
+    }
+  }
+
+  // Luma and chroma of the emphasis-free palette for xBR's color distance
+  struct Yuv {
+    std::array<uint8_t, 64> y, u, v;
+  };
+
+  constexpr auto makeYuv() -> Yuv {
+    Yuv yuv{};
+    for(uint32_t i = 0; i < 64; i++) {
+      const int32_t r = pixel_format::COLORS[0][i].r;
+      const int32_t g = pixel_format::COLORS[0][i].g;
+      const int32_t b = pixel_format::COLORS[0][i].b;
+      yuv.y[i] = static_cast<uint8_t>((77 * r + 150 * g + 29 * b) >> 8);
+      yuv.u[i] = static_cast<uint8_t>(((-43 * r - 85 * g + 128 * b) >> 8) + 128);
+      yuv.v[i] = static_cast<uint8_t>(((128 * r - 107 * g - 21 * b) >> 8) + 128);
+    }
+    return yuv;
+  }
+
+  inline constexpr Yuv YUV = makeYuv();
+
+  // Luma weighs 6 times chroma, close to xBR's 48:7:6 and small enough that
+  // a rule's weighted sum of 8 distances fits int16
+  inline auto distance(uint8_t a, uint8_t b) -> int32_t {
+    return 6 * std::abs(YUV.y[a] - YUV.y[b]) + std::abs(YUV.u[a] - YUV.u[b]) + std::abs(YUV.v[a] - YUV.v[b]);
+  }
+
+  // Per-band scratch, sized once for MAX_FACTOR so scaling never allocates
+  struct Workspace {
+    std::vector<uint8_t> padded = std::vector<uint8_t>(PADDED_WIDTH * PADDED_HEIGHT);
+    std::array<std::vector<uint8_t>, 3> planes;             // Y, U, V of padded, for xBR
+    std::vector<uint8_t> rows = std::vector<uint8_t>(2 * 3 * WIDTH * 3);  // Filter output, up to 2 sets of 3 rows
+    std::vector<uint8_t> wide = std::vector<uint8_t>(WIDTH * MAX_FACTOR);
+    std::vector<uint8_t> blend = std::vector<uint8_t>(WIDTH * MAX_FACTOR * 4);
+
+    Workspace() {
+      for(auto& plane : planes) {
+        plane.resize(PADDED_WIDTH * PADDED_HEIGHT);
+      }
+    }
+  };
+
+  // Row operations. Source pointers point at x = 0 of a row in Workspace::padded,
+  // so everything up to BORDER pixels or rows away is readable.
+  struct Kernels {
+    void (*expand)(const uint8_t* in, size_t width, uint32_t factor, uint8_t* out);
+    void (*scale2x)(const uint8_t* row, uint8_t* out0, uint8_t* out1);
+    void (*scale3x)(const uint8_t* row, uint8_t* out0, uint8_t* out1, uint8_t* out2);
+    void (*xbr)(const Workspace& ws, size_t offset, uint8_t* out0, uint8_t* out1);
+    void (*average)(const uint8_t* a, const uint8_t* b, size_t bytes, uint8_t* out);
+    pixel_format::ConvertFn convert;
+  };
+
+  inline auto expandScalar(const uint8_t* in, size_t width, uint32_t factor, uint8_t* out) -> void {
+    for(size_t x = 0; x < width; x++) {
+      std::memset(out + x * factor, in[x], factor);
+    }
+  }
+
+  inline auto scale2xScalar(const uint8_t* row, uint8_t* out0, uint8_t* out1) -> void {
+    for(size_t x = 0; x < WIDTH; x++) {
+      const uint8_t* p = row + x;
+      const uint8_t b = p[-ptrdiff_t(PADDED_WIDTH)], d = p[-1], e = p[0], f = p[1], h = p[PADDED_WIDTH];
+      const bool active = b != h && d != f;
+      out0[x * 2] = active && d == b ? d : e;
+      out0[x * 2 + 1] = active && b == f ? f : e;
+      out1[x * 2] = active && d == h ? d : e;
+      out1[x * 2 + 1] = active && h == f ? f : e;
+    }
+  }
+
+  inline auto scale3xScalar(const uint8_t* row, uint8_t* out0, uint8_t* out1, uint8_t* out2) -> void {
+    constexpr ptrdiff_t up = -ptrdiff_t(PADDED_WIDTH);
+    constexpr ptrdiff_t down = PADDED_WIDTH;
+    for(size_t x = 0; x < WIDTH; x++) {
+      const uint8_t* p = row + x;
+      const uint8_t a = p[up - 1], b = p[up], c = p[up + 1];
+      const uint8_t d = p[-1], e = p[0], f = p[1];
+      const uint8_t g = p[down - 1], h = p[down], i = p[down + 1];
+      uint8_t* o0 = out0 + x * 3;
+      uint8_t* o1 = out1 + x * 3;
+      uint8_t* o2 = out2 + x * 3;
+      std::memset(o0, e, 3);
+      std::memset(o1, e, 3);
+      std::memset(o2, e, 3);
+      if(b == h || d == f) {
+        continue;
+      }
+      o0[0] = d == b ? d : e;
+      o0[1] = (d == b && e != c) || (b == f && e != a) ? b : e;
+      o0[2] = b == f ? f : e;
+      o1[0] = (d == b && e != g) || (d == h && e != a) ? d : e;
+      o1[2] = (b == f && e != i) || (h == f && e != c) ? f : e;
+      o2[0] = d == h ? d : e;
+      o2[1] = (d == h && e != i) || (h == f && e != g) ? h : e;
+      o2[2] = h == f ? f : e;
+    }
+  }
+
+  // One corner of a pixel. u points from E toward the corner vertically, v
+  // horizontally; the names are the usual xBR ones for the bottom right corner:
+  //
+  //        B  C
+  //     D  E  F  F4
+  //     G  H  I  I4
+  //        H5 I5
+  //
+  // Returns the index to blend halfway with E, E itself when there's no edge.
+  inline auto xbrCorner(const uint8_t* p, ptrdiff_t u, ptrdiff_t v) -> uint8_t {
+    const uint8_t e = p[0], h = p[u], f = p[v], i = p[u + v], b = p[-u], d = p[-v];
+    const uint8_t c = p[v - u], g = p[u - v], h5 = p[2 * u], f4 = p[2 * v], i4 = p[u + 2 * v], i5 = p[2 * u + v];
+    if(e == h || e == f) {
+      return e;
+    }
+    const int32_t along = distance(e, c) + distance(e, g) + distance(i, h5) + distance(i, f4) + 4 * distance(h, f);
+    const int32_t across = distance(h, d) + distance(h, i5) + distance(f, i4) + distance(f, b) + 4 * distance(e, i);
+    if(along >= across) {
+      return e;
+    }
+    return distance(e, f) <= distance(e, h) ? f : h;
+  }
+
+  inline auto xbrScalar(const Workspace& ws, size_t offset, uint8_t* out0, uint8_t* out1) -> void {
+    constexpr ptrdiff_t row = PADDED_WIDTH;
+    for(size_t x = 0; x < WIDTH; x++) {
+      const uint8_t* p = ws.padded.data() + offset + x;
+      out0[x * 2] = xbrCorner(p, -row, -1);
+      out0[x * 2 + 1] = xbrCorner(p, -row, 1);
+      out1[x * 2] = xbrCorner(p, row, -1);
+      out1[x * 2 + 1] = xbrCorner(p, row, 1);
+    }
+  }
+
+  inline auto averageScalar(const uint8_t* a, const uint8_t* b, size_t bytes, uint8_t* out) -> void {
+    for(size_t i = 0; i < bytes; i++) {
+      out[i] = static_cast<uint8_t>((a[i] + b[i] + 1) >> 1);
+    }
+  }
+
+  inline constexpr Kernels SCALAR_KERNELS = {expandScalar, scale2xScalar, scale3xScalar, xbrScalar, averageScalar,
+                                             pixel_format::convertLineScalar};
+
+#ifdef TWIX_SCALER_X86
+  // 16 source pixels become factor * 16 bytes, one pshufb per output register
+  __attribute__((target("sse4.1")))
+  inline auto expandSse41(const uint8_t* in, size_t width, uint32_t factor, uint8_t* out) -> void {
+    if(factor == 1) {
+      std::memcpy(out, in, width);
+      return;
+    }
+    __m128i masks[MAX_FACTOR];
+    for(uint32_t k = 0; k < factor; k++) {
+      alignas(16) uint8_t bytes[16];
+      for(uint32_t i = 0; i < 16; i++) {
+        bytes[i] = static_cast<uint8_t>((k * 16 + i) / factor);
+      }
+      masks[k] = _mm_load_si128(reinterpret_cast<const __m128i*>(bytes));
+    }
+    for(size_t x = 0; x < width; x += 16) {
+      const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x));
+      for(uint32_t k = 0; k < factor; k++) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * factor + k * 16), _mm_shuffle_epi8(pixels, masks[k]));
+      }
+    }
+  }
+
+  __attribute__((target("sse4.1")))
+  inline auto loadRow(const uint8_t* p) -> __m128i {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  }
+
+  __attribute__((target("sse4.1")))
+  inline auto storeRow(uint8_t* p, __m128i value) -> void {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), value);
+  }
+
+  // pick where condition is set, e elsewhere
+  __attribute__((target("sse4.1")))
+  inline auto pickIf(__m128i condition, __m128i pick, __m128i e) -> __m128i {
+    return _mm_blendv_epi8(e, pick, condition);
+  }
+
+  // The scalar rules on 16 pixels, the two outputs per row are interleaved
+  // with unpacks
+  __attribute__((target("sse4.1")))
+  inline auto scale2xSse41(const uint8_t* row, uint8_t* out0, uint8_t* out1) -> void {
+    const __m128i ones = _mm_set1_epi8(-1);
+    for(size_t x = 0; x < WIDTH; x += 16) {
+      const uint8_t* p = row + x;
+      const __m128i b = loadRow(p - PADDED_WIDTH), d = loadRow(p - 1), e = loadRow(p), f = loadRow(p + 1),
+                    h = loadRow(p + PADDED_WIDTH);
+      const __m128i active = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(b, h), _mm_cmpeq_epi8(d, f)), ones);
+      const __m128i e0 = pickIf(_mm_and_si128(active, _mm_cmpeq_epi8(d, b)), d, e);
+      const __m128i e1 = pickIf(_mm_and_si128(active, _mm_cmpeq_epi8(b, f)), f, e);
+      const __m128i e2 = pickIf(_mm_and_si128(active, _mm_cmpeq_epi8(d, h)), d, e);
+      const __m128i e3 = pickIf(_mm_and_si128(active, _mm_cmpeq_epi8(h, f)), f, e);
+      storeRow(out0 + x * 2, _mm_unpacklo_epi8(e0, e1));
+      storeRow(out0 + x * 2 + 16, _mm_unpackhi_epi8(e0, e1));
+      storeRow(out1 + x * 2, _mm_unpacklo_epi8(e2, e3));
+      storeRow(out1 + x * 2 + 16, _mm_unpackhi_epi8(e2, e3));
+    }
+  }
+
+  // pshufb masks interleaving three registers a, b, c into 48 bytes a0 b0 c0
+  // a1 b1 c1 ...: [output register][source]
+  constexpr auto makeInterleave3() -> std::array<std::array<std::array<int8_t, 16>, 3>, 3> {
+    std::array<std::array<std::array<int8_t, 16>, 3>, 3> masks{};
+    for(uint32_t k = 0; k < 3; k++) {
+      for(uint32_t i = 0; i < 16; i++) {
+        const uint32_t n = k * 16 + i;
+        for(uint32_t s = 0; s < 3; s++) {
+          masks[k][s][i] = n % 3 == s ? static_cast<int8_t>(n / 3) : -1;
+        }
+      }
+    }
+    return masks;
+  }
+
+  inline constexpr auto INTERLEAVE3 = makeInterleave3();
+
+  __attribute__((target("sse4.1")))
+  inline auto storeInterleaved3(uint8_t* out, __m128i a, __m128i b, __m128i c) -> void {
+    for(uint32_t k = 0; k < 3; k++) {
+      const __m128i mixed = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(a, loadRow(reinterpret_cast<const uint8_t*>(INTERLEAVE3[k][0].data()))),
+                     _mm_shuffle_epi8(b, loadRow(reinterpret_cast<const uint8_t*>(INTERLEAVE3[k][1].data())))),
+        _mm_shuffle_epi8(c, loadRow(reinterpret_cast<const uint8_t*>(INTERLEAVE3[k][2].data()))));
+      storeRow(out + k * 16, mixed);
+    }
+  }
+
+  __attribute__((target("sse4.1")))
+  inline auto scale3xSse41(const uint8_t* row, uint8_t* out0, uint8_t* out1, uint8_t* out2) -> void {
+    const __m128i ones = _mm_set1_epi8(-1);
+    for(size_t x = 0; x < WIDTH; x += 16) {
+      const uint8_t* p = row + x;
+      const uint8_t* above = p - PADDED_WIDTH;
+      const uint8_t* below = p + PADDED_WIDTH;
+      const __m128i a = loadRow(above - 1), b = loadRow(above), c = loadRow(above + 1);
+      const __m128i d = loadRow(p - 1), e = loadRow(p), f = loadRow(p + 1);
+      const __m128i g = loadRow(below - 1), h = loadRow(below), i = loadRow(below + 1);
+      const __m128i active = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(b, h), _mm_cmpeq_epi8(d, f)), ones);
+      const __m128i db = _mm_and_si128(active, _mm_cmpeq_epi8(d, b));
+      const __m128i bf = _mm_and_si128(active, _mm_cmpeq_epi8(b, f));
+      const __m128i dh = _mm_and_si128(active, _mm_cmpeq_epi8(d, h));
+      const __m128i hf = _mm_and_si128(active, _mm_cmpeq_epi8(h, f));
+      const __m128i ne_a = _mm_xor_si128(_mm_cmpeq_epi8(e, a), ones);
+      const __m128i ne_c = _mm_xor_si128(_mm_cmpeq_epi8(e, c), ones);
+      const __m128i ne_g = _mm_xor_si128(_mm_cmpeq_epi8(e, g), ones);
+      const __m128i ne_i = _mm_xor_si128(_mm_cmpeq_epi8(e, i), ones);
+      const __m128i e0 = pickIf(db, d, e);
+      const __m128i e1 = pickIf(_mm_or_si128(_mm_and_si128(db, ne_c), _mm_and_si128(bf, ne_a)), b, e);
+      const __m128i e2 = pickIf(bf, f, e);
+      const __m128i e3 = pickIf(_mm_or_si128(_mm_and_si128(db, ne_g), _mm_and_si128(dh, ne_a)), d, e);
+      const __m128i e5 = pickIf(_mm_or_si128(_mm_and_si128(bf, ne_i), _mm_and_si128(hf, ne_c)), f, e);
+      const __m128i e6 = pickIf(dh, d, e);
+      const __m128i e7 = pickIf(_mm_or_si128(_mm_and_si128(dh, ne_i), _mm_and_si128(hf, ne_g)), h, e);
+      const __m128i e8 = pickIf(hf, f, e);
+      storeInterleaved3(out0 + x * 3, e0, e1, e2);
+      storeInterleaved3(out1 + x * 3, e3, e, e5);
+      storeInterleaved3(out2 + x * 3, e6, e7, e8);
+    }
+  }
+
+  __attribute__((target("sse4.1")))
+  inline auto averageSse41(const uint8_t* a, const uint8_t* b, size_t bytes, uint8_t* out) -> void {
+    size_t i = 0;
+    for(; i + 16 <= bytes; i += 16) {
+      storeRow(out + i, _mm_avg_epu8(loadRow(a + i), loadRow(b + i)));
+    }
+    averageScalar(a + i, b + i, bytes - i, out + i);
+  }
+
+  // 16 pixels of one plane at a padded offset, widened to int16
+  __attribute__((target("avx2")))
+  inline auto loadWide(const std::vector<uint8_t>& plane, size_t offset) -> __m256i {
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(plane.data() + offset)));
+  }
+
+  __attribute__((target("avx2")))
+  inline auto distance256(const Workspace& ws, size_t a, size_t b) -> __m256i {
+    const __m256i dy = _mm256_abs_epi16(_mm256_sub_epi16(loadWide(ws.planes[0], a), loadWide(ws.planes[0], b)));
+    const __m256i du = _mm256_abs_epi16(_mm256_sub_epi16(loadWide(ws.planes[1], a), loadWide(ws.planes[1], b)));
+    const __m256i dv = _mm256_abs_epi16(_mm256_sub_epi16(loadWide(ws.planes[2], a), loadWide(ws.planes[2], b)));
+    return _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(dy, _mm256_set1_epi16(6)), du), dv);
+  }
+
+  // xbrCorner on 16 pixels in int16 lanes, returned as 16 bytes
+  __attribute__((target("avx2")))
+  inline auto xbrCorner256(const Workspace& ws, size_t p, ptrdiff_t u, ptrdiff_t v) -> __m128i {
+    auto at = [p](ptrdiff_t delta) { return static_cast<size_t>(static_cast<ptrdiff_t>(p) + delta); };
+    const __m256i e = loadWide(ws.padded, p);
+    const __m256i h = loadWide(ws.padded, at(u));
+    const __m256i f = loadWide(ws.padded, at(v));
+    const __m256i edge = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi16(e, h), _mm256_cmpeq_epi16(e, f)),
+                                             _mm256_set1_epi16(-1));
+    const __m256i along = _mm256_add_epi16(
+      _mm256_add_epi16(_mm256_add_epi16(distance256(ws, p, at(v - u)), distance256(ws, p, at(u - v))),
+                       _mm256_add_epi16(distance256(ws, at(u + v), at(2 * u)), distance256(ws, at(u + v), at(2 * v)))),
+      _mm256_slli_epi16(distance256(ws, at(u), at(v)), 2));
+    const __m256i across = _mm256_add_epi16(
+      _mm256_add_epi16(_mm256_add_epi16(distance256(ws, at(u), at(-v)), distance256(ws, at(u), at(2 * u + v))),
+                       _mm256_add_epi16(distance256(ws, at(v), at(u + 2 * v)), distance256(ws, at(v), at(-u)))),
+      _mm256_slli_epi16(distance256(ws, p, at(u + v)), 2));
+    const __m256i take = _mm256_and_si256(edge, _mm256_cmpgt_epi16(across, along));
+    const __m256i use_h = _mm256_cmpgt_epi16(distance256(ws, p, at(v)), distance256(ws, p, at(u)));
+    const __m256i result = _mm256_blendv_epi8(e, _mm256_blendv_epi8(f, h, use_h), take);
+    return _mm_packus_epi16(_mm256_castsi256_si128(result), _mm256_extracti128_si256(result, 1));
+  }
+
+  __attribute__((target("avx2")))
+  inline auto xbrAvx2(const Workspace& ws, size_t offset, uint8_t* out0, uint8_t* out1) -> void {
+    constexpr ptrdiff_t row = PADDED_WIDTH;
+    for(size_t x = 0; x < WIDTH; x += 16) {
+      const size_t p = offset + x;
+      const __m128i e0 = xbrCorner256(ws, p, -row, -1);
+      const __m128i e1 = xbrCorner256(ws, p, -row, 1);
+      const __m128i e2 = xbrCorner256(ws, p, row, -1);
+      const __m128i e3 = xbrCorner256(ws, p, row, 1);
+      storeRow(out0 + x * 2, _mm_unpacklo_epi8(e0, e1));
+      storeRow(out0 + x * 2 + 16, _mm_unpackhi_epi8(e0, e1));
+      storeRow(out1 + x * 2, _mm_unpacklo_epi8(e2, e3));
+      storeRow(out1 + x * 2 + 16, _mm_unpackhi_epi8(e2, e3));
+    }
+  }
+
+  __attribute__((target("avx2")))
+  inline auto averageAvx2(const uint8_t* a, const uint8_t* b, size_t bytes, uint8_t* out) -> void {
+    size_t i = 0;
+    for(; i + 32 <= bytes; i += 32) {
+      const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+      const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_avg_epu8(x, y));
+    }
+    averageScalar(a + i, b + i, bytes - i, out + i);
+  }
+
+  inline constexpr Kernels SSE41_KERNELS = {expandSse41, scale2xSse41, scale3xSse41, xbrScalar, averageSse41,
+                                            pixel_format::convertLineSse41};
+  inline constexpr Kernels AVX2_KERNELS = {expandSse41, scale2xSse41, scale3xSse41, xbrAvx2, averageAvx2,
+                                           pixel_format::convertLineAvx2};
+#endif
+
+  // Widest set this CPU runs
+  inline auto bestKernels() -> const Kernels& {
+#ifdef TWIX_SCALER_X86
+    const auto& cpu = Components::cpuFeatures();
+    return cpu.avx2 ? AVX2_KERNELS : cpu.sse41 ? SSE41_KERNELS : SCALAR_KERNELS;
+#else
+    return SCALAR_KERNELS;
+#endif
+  }
+
+  // Copies source rows [first - BORDER, last + BORDER) into the padded
+  // frame, clamping at the frame edges, plus their YUV planes for xBR
+  inline auto pad(const FrameView& frame, uint32_t first, uint32_t last, bool yuv, Workspace& ws) -> void {
+    for(int32_t y = int32_t(first) - int32_t(BORDER); y < int32_t(last + BORDER); y++) {
+      const uint8_t* src = frame.indices.data() + std::clamp<int32_t>(y, 0, HEIGHT - 1) * WIDTH;
+      uint8_t* dst = ws.padded.data() + size_t(y + BORDER) * PADDED_WIDTH;
+      std::memset(dst, src[0] & 0x3F, BORDER);
+      for(size_t x = 0; x < WIDTH; x++) {
+        dst[BORDER + x] = src[x] & 0x3F;
+      }
+      std::memset(dst + BORDER + WIDTH, src[WIDTH - 1] & 0x3F, BORDER);
+      if(yuv) {
+        const size_t offset = size_t(y + BORDER) * PADDED_WIDTH;
+        for(size_t x = 0; x < PADDED_WIDTH; x++) {
+          const uint8_t index = dst[x];
+          ws.planes[0][offset + x] = YUV.y[index];
+          ws.planes[1][offset + x] = YUV.u[index];
+          ws.planes[2][offset + x] = YUV.v[index];
+        }
+      }
+    }
+  }
+
+  // Scales source lines [first, last) into output rows [first * factor,
+  // last * factor) of out, pitch bytes apart. Throws std::invalid_argument
+  // for a factor the filter can't do and std::length_error if out is too small.
+  inline auto scale(const FrameView& frame, ScaleFilter filter, uint32_t factor, uint32_t first, uint32_t last,
+                    std::span<uint8_t> out, size_t pitch, Workspace& ws,
+                    const Kernels& kernels = bestKernels()) -> void {
+    const uint32_t base = baseFactor(filter);
+    if(factor == 0 || factor > MAX_FACTOR || factor % base != 0) {
+      throw std::invalid_argument("Unsupported scale factor for this filter");
+    }
+    const size_t out_width = WIDTH * factor;
+    if(pitch < out_width * 4 || out.size() < pitch * (HEIGHT * factor - 1) + out_width * 4) {
+      throw std::length_error("Scaled frame doesn't fit the output buffer");
+    }
+    const uint32_t repeat = factor / base;
+    const size_t base_width = WIDTH * base;
+    pad(frame, first, last, filter == ScaleFilter::XBR, ws);
+
+    for(uint32_t y = first; y < last; y++) {
+      const size_t offset = (y + BORDER) * PADDED_WIDTH + BORDER;
+      const uint8_t* source = ws.padded.data() + offset;
+      // base rows of base_width indices, and for xBR the rows to blend with
+      const uint8_t* rows[3] = {source, nullptr, nullptr};
+      const uint8_t* blend_rows[2] = {nullptr, nullptr};
+      uint8_t* scratch = ws.rows.data();
+      switch(filter) {
+        case ScaleFilter::NEAREST:
+          break;
+        case ScaleFilter::SCALE2X:
+          kernels.scale2x(source, scratch, scratch + base_width);
+          rows[0] = scratch;
+          rows[1] = scratch + base_width;
+          break;
+        case ScaleFilter::SCALE3X:
+          kernels.scale3x(source, scratch, scratch + base_width, scratch + 2 * base_width);
+          rows[0] = scratch;
+          rows[1] = scratch + base_width;
+          rows[2] = scratch + 2 * base_width;
+          break;
+        case ScaleFilter::XBR: {
+          uint8_t* plain = scratch + 2 * base_width;
+          kernels.expand(source, WIDTH, 2, plain);
+          kernels.xbr(ws, offset, scratch, scratch + base_width);
+          rows[0] = plain;
+          rows[1] = plain;
+          blend_rows[0] = scratch;
+          blend_rows[1] = scratch + base_width;
+          break;
+        }
+      }
+      const uint8_t emphasis = frame.emphasis[y] & 0x07;
+      for(uint32_t sub = 0; sub < base; sub++) {
+        uint8_t* dst = out.data() + (size_t(y) * factor + sub * repeat) * pitch;
+        auto toRgba = [&](const uint8_t* indices, uint8_t* rgba) {
+          const uint8_t* wide = indices;
+          if(repeat > 1) {
+            kernels.expand(indices, base_width, repeat, ws.wide.data());
+            wide = ws.wide.data();
+          }
+          for(size_t chunk = 0; chunk < out_width; chunk += WIDTH) {
+            kernels.convert(PixelFormat::RGBA8888, wide + chunk, emphasis, rgba + chunk * 4);
+          }
+        };
+        toRgba(rows[sub], dst);
+        if(blend_rows[0]) {
+          toRgba(blend_rows[sub], ws.blend.data());
+          kernels.average(dst, ws.blend.data(), out_width * 4, dst);
+        }
+        for(uint32_t copy = 1; copy < repeat; copy++) {
+          std::memcpy(dst + copy * pitch, dst, out_width * 4);
+        }
+      }
+    }
+  }
+}
+
+// Scales frames on the thread pool through a FrameStage, the emulation
+// thread only copies the index frame. Each band has its own workspace, so
+// nothing is allocated after construction.
+class FrameScaler {
+public:
+  FrameScaler(Components::ThreadPool& pool, ScaleFilter filter, uint32_t factor, size_t bands)
+    : filter_(filter), factor_(factor), workspaces_(std::clamp<size_t>(bands, 1, FrameView::HEIGHT)),
+      stage_(pool, bands, pitch() * height(),
+             [this](size_t band, const FrameView& frame, uint64_t, uint32_t first, uint32_t last, uint8_t* out) {
+               scaler::scale(frame, filter_, factor_, first, last, {out, pitch() * height()}, pitch(),
+                             workspaces_[band]);
+             }) {
+    const uint32_t base = scaler::baseFactor(filter);
+    if(factor == 0 || factor > scaler::MAX_FACTOR || factor % base != 0) {
+      throw std::invalid_argument("Unsupported scale factor for this filter");
+    }
+  }
+
+  auto width() const -> size_t { return FrameView::WIDTH * factor_; }
+  auto height() const -> size_t { return FrameView::HEIGHT * factor_; }
+  auto pitch() const -> size_t { return width() * 4; }
+
+  auto submit(const FrameView& frame, uint64_t frame_number) -> void {
+    stage_.submit(frame, frame_number);
+  }
+
+  // Copies the newest scaled frame (RGBA8888, pitch() bytes per row) and
+  // returns its frame number, 0 if nothing has been scaled yet
+  auto latestFrame(std::span<uint8_t> out) const -> uint64_t {
+    return stage_.latestFrame(out);
+  }
+
+  auto droppedFrames() const -> uint64_t {
+    return stage_.droppedFrames();
+  }
+
+  auto waitIdle() -> void {
+    stage_.waitIdle();
+  }
+
+private:
+  ScaleFilter filter_;
+  uint32_t factor_;
+  std::vector<scaler::Workspace> workspaces_;
+  FrameStage stage_;  // Last, so it's drained before the workspaces go away
+};
@@ -0,0 +1,58 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+// Things the system has to stop the CPU for. Each has one slot, a later
+// schedule() of the same event replaces the earlier one.
+enum class SystemEvent : uint32_t {
+  PPU_SYNC,    // VBlank (NMI, end of frame) or the pre-render clear
+  APU,         // Frame IRQ or DMC sample fetch
+  MAPPER_IRQ,  // Scanline or cycle counter IRQ, for mappers that have one
+  DMA,         // OAM or DMC DMA to run once the instruction is done
+  NMI,         // Raised by a register write, taken straight after it
+  RUN_END,     // Where the caller asked the run to stop
+  COUNT,
+};
+
+// Fixed-slot calendar on the CPU clock. With a handful of events a flat
+// array beats a heap: scheduling rescans six timestamps and the CPU's batch
+// loop only ever compares against next(), which lives at a fixed address so
+// an event scheduled mid-batch (a register write enabling NMI, say) ends the
+// batch after the instruction that made it.
+class Scheduler {
+public:
+  static constexpr uint64_t NEVER = ~0ull;
+  static constexpr uint32_t SLOTS = static_cast<uint32_t>(SystemEvent::COUNT);
+
+  auto schedule(SystemEvent event, uint64_t cycle) -> void {
+    at_[static_cast<uint32_t>(event)] = cycle;
+    next_ = *std::min_element(at_.begin(), at_.end());
+  }
+
+  auto cancel(SystemEvent event) -> void {
+    schedule(event, NEVER);
+  }
+
+  auto at(SystemEvent event) const -> uint64_t {
+    return at_[static_cast<uint32_t>(event)];
+  }
+
+  auto due(SystemEvent event, uint64_t now) const -> bool {
+    return at(event) <= now;
+  }
+
+  // Earliest scheduled cycle. The reference stays valid and follows every
+  // schedule(), the CPU runs until it.
+  auto next() const -> const uint64_t& {
+    return next_;
+  }
+
+private:
+  std::array<uint64_t, SLOTS> at_ = [] {
+    std::array<uint64_t, SLOTS> at{};
+    at.fill(NEVER);
+    return at;
+  }();
+  uint64_t next_ = NEVER;
+};
@@ -0,0 +1,116 @@
+#pragma once
+#include <utils/cpu_features.hpp>
+#include <array>
+#include <bit>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TWIX_SPRITE_EVAL_X86 1
+#endif
+
+// Sprite evaluation: which of the 64 OAM entries cover a scanline. A sprite
+// with OAM y covers lines y + 1 to y + height, so y = 239-255 never shows.
+namespace sprite_eval {
+  inline auto inRangeScalar(const uint8_t* oam, uint32_t line, uint32_t height) -> uint64_t {
+    uint64_t mask = 0;
+    for(uint32_t i = 0; i < 64; i++) {
+      const uint32_t top = oam[i * 4] + 1u;
+      if(line >= top && line < top + height) {
+        mask |= uint64_t(1) << i;
+      }
+    }
+    return mask;
+  }
+
+#ifdef TWIX_SPRITE_EVAL_X86
+  // 16 sprites per step: four pshufb gather the y bytes of 64 OAM bytes into
+  // one register, then two unsigned compares and a movemask
+  __attribute__((target("sse4.1")))
+  inline auto inRangeSse41(const uint8_t* oam, uint32_t line, uint32_t height) -> uint64_t {
+    if(line == 0) {
+      return 0;
+    }
+    const __m128i gather[4] = {
+      _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+      _mm_setr_epi8(-1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1),
+      _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1),
+      _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12),
+    };
+    const __m128i last_above = _mm_set1_epi8(static_cast<char>(line - 1));
+    const __m128i current = _mm_set1_epi8(static_cast<char>(line));
+    const __m128i tall = _mm_set1_epi8(static_cast<char>(height));
+    uint64_t mask = 0;
+    for(uint32_t group = 0; group < 4; group++) {
+      __m128i y = _mm_setzero_si128();
+      for(uint32_t part = 0; part < 4; part++) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(oam + group * 64 + part * 16));
+        y = _mm_or_si128(y, _mm_shuffle_epi8(bytes, gather[part]));
+      }
+      // y <= line - 1, then line - y <= height without wrapping
+      const __m128i above = _mm_cmpeq_epi8(_mm_min_epu8(y, last_above), y);
+      const __m128i distance = _mm_sub_epi8(current, y);
+      const __m128i close = _mm_cmpeq_epi8(_mm_min_epu8(distance, tall), distance);
+      const uint32_t bits = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(above, close)));
+      mask |= uint64_t(bits) << (group * 16);
+    }
+    return mask;
+  }
+#endif
+
+  using InRangeFn = uint64_t (*)(const uint8_t*, uint32_t, uint32_t);
+
+  inline auto bestInRange() -> InRangeFn {
+#ifdef TWIX_SPRITE_EVAL_X86
+    static const InRangeFn best = Components::cpuFeatures().sse41 ? inRangeSse41 : inRangeScalar;
+    return best;
+#else
+    return inRangeScalar;
+#endif
+  }
+
+  // Bit i set when sprite i covers the line
+  inline auto inRange(const uint8_t* oam, uint32_t line, uint32_t height) -> uint64_t {
+    return bestInRange()(oam, line, height);
+  }
+}
+
+// The sprites the PPU draws on one line: the first 8 in range, in OAM order,
+// and how many were in range in total (more than 8 sets overflow)
+struct SpriteLine {
+  std::array<uint8_t, 8> index;
+  uint8_t count;
+  uint8_t in_range;
+
+  static auto fromMask(uint64_t mask) -> SpriteLine {
+    SpriteLine result{};
+    result.in_range = static_cast<uint8_t>(std::popcount(mask));
+    while(mask && result.count < 8) {
+      result.index[result.count++] = static_cast<uint8_t>(std::countr_zero(mask));
+      mask &= mask - 1;
+    }
+    return result;
+  }
+};
+
+// SpriteLine for every visible line at once. Building it walks each sprite's
+// rows instead of each line's sprites, so it costs about as much as
+// evaluating a handful of lines and only has to be redone when OAM or the
+// sprite height changes, usually once per frame after the OAM DMA.
+struct SpriteTable {
+  static constexpr uint32_t LINES = 240;
+  std::array<SpriteLine, LINES> lines;
+
+  auto build(const uint8_t* oam, uint32_t height) -> void {
+    lines = {};
+    for(uint32_t i = 0; i < 64; i++) {
+      const uint32_t top = oam[i * 4] + 1u;
+      for(uint32_t line = top; line < top + height && line < LINES; line++) {
+        SpriteLine& entry = lines[line];
+        entry.in_range++;
+        if(entry.count < 8) {
+          entry.index[entry.count++] = static_cast<uint8_t>(i);
+        }
+      }
+    }
+  }
+};
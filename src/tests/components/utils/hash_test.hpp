@@ -0,0 +1,44 @@
+#include <utils/hash.hpp>
+#include <framework/testing.hpp>
+#include <string>
+#include <vector>
+
+namespace {
+auto bytes(const std::string& text) -> std::span<const uint8_t> {
+  return {reinterpret_cast<const uint8_t*>(text.data()), text.size()};
+}
+
+auto hex(const Components::Sha1Digest& digest) -> std::string {
+  static constexpr char digits[] = "0123456789abcdef";
+  std::string out;
+  for(auto b : digest) {
+    out += digits[b >> 4];
+    out += digits[b & 0xF];
+  }
+  return out;
+}
+}
+
+TEST_CASE("CRC32 check value") {
+  REQUIRE_SAME(0xCBF43926u, Components::crc32(bytes("123456789")));
+  REQUIRE_SAME(0u, Components::crc32({}));
+}
+
+TEST_CASE("CRC32 slice-by-8 matches incremental bytes") {
+  std::vector<uint8_t> data(1000);
+  for(size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<uint8_t>(i * 31 + 7);
+  }
+  uint32_t crc = 0;
+  for(auto b : data) {
+    crc = Components::crc32({&b, 1}, crc);
+  }
+  REQUIRE_SAME(crc, Components::crc32(data));
+}
+
+TEST_CASE("SHA-1 test vectors") {
+  REQUIRE_SAME(std::string("a9993e364706816aba3e25717850c26c9cd0d89d"), hex(Components::sha1(bytes("abc"))));
+  REQUIRE_SAME(std::string("da39a3ee5e6b4b0d3255bfef95601890afd80709"), hex(Components::sha1({})));
+  REQUIRE_SAME(std::string("84983e441c3bd26ebaae4aa1f95129e5e54670f1"),
+               hex(Components::sha1(bytes("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"))));
+}
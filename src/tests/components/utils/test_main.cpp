@@ -0,0 +1,3 @@
+#include <framework/testing.hpp>
+#include "hash_test.hpp"
+#include "thread_pool_test.hpp"
@@ -0,0 +1,45 @@
+#include <utils/thread_pool.hpp>
+#include <framework/testing.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+
+TEST_CASE("ThreadPool wait() covers tasks submitted by tasks") {
+  Components::ThreadPool pool{4};
+  std::atomic<size_t> done{0};
+  // A binary tree of depth 10, every node but the leaves submits two more
+  std::function<void(int)> node = [&](int depth) {
+    done.fetch_add(1, std::memory_order_relaxed);
+    if(depth > 0) {
+      pool.submit([&node, depth] { node(depth - 1); });
+      pool.submit([&node, depth] { node(depth - 1); });
+    }
+  };
+  pool.submit([&node] { node(10); });
+  pool.wait();
+  REQUIRE_SAME(size_t{2047}, done.load());
+  // And returns straight away with nothing queued
+  pool.wait();
+  REQUIRE_SAME(size_t{2047}, done.load());
+}
+
+TEST_CASE("ThreadPool idle workers steal from a busy one") {
+  Components::ThreadPool pool{4};
+  std::mutex mutex;
+  std::set<std::thread::id> threads;
+  // All children land in the deque of the worker that runs the parent
+  pool.submit([&] {
+    for(int i = 0; i < 64; i++) {
+      pool.submit([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::lock_guard lock(mutex);
+        threads.insert(std::this_thread::get_id());
+      });
+    }
+  });
+  pool.wait();
+  REQUIRE_TRUE(threads.size() > 1);
+}
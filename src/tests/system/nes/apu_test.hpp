@@ -0,0 +1,232 @@
+#include <nes/apu.hpp>
+#include <nes/nes.hpp>
+#include <framework/testing.hpp>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "test_rom.hpp"
+
+namespace {
+// DMC sample memory that records what was fetched
+struct SampleMemory {
+  uint8_t value = 0xFF;
+  std::vector<uint16_t> reads;
+
+  auto read(uint16_t address) -> uint8_t {
+    reads.push_back(address);
+    return value;
+  }
+};
+
+template<typename Audio = BandLimitedAudio>
+struct TestApu {
+  ApuState state{};
+  SampleMemory memory;
+  uint64_t clock = 0;
+  Apu<SampleMemory, Audio> apu{state, memory, clock};
+
+  auto write(uint16_t address, uint8_t data) -> void { apu.writeRegister(address, data); }
+  auto runTo(uint64_t cycle) -> void {
+    clock = cycle;
+    apu.sync();
+  }
+};
+}
+
+TEST_CASE("APU length counters show in $4015 and run down on half frames") {
+  TestApu<> t;
+  // Noise isn't enabled, its length load is ignored
+  t.write(0x4015, 0x01);
+  t.write(0x4000, 0x1F);
+  t.write(0x4003, 0x18);
+  t.write(0x400F, 0x18);
+  REQUIRE_SAME(0x01, t.apu.readStatus() & 0x0F);
+  // Length 2: the half frames at 14913 and 29829 take it to zero
+  t.runTo(14913);
+  REQUIRE_SAME(0x01, t.apu.readStatus() & 0x0F);
+  t.runTo(29829);
+  REQUIRE_SAME(0x00, t.apu.readStatus() & 0x0F);
+  // Halted counters stay put, disabling clears them anyway
+  t.write(0x4000, 0x3F);
+  t.write(0x4003, 0x18);
+  t.runTo(100000);
+  REQUIRE_SAME(0x01, t.apu.readStatus() & 0x0F);
+  t.write(0x4015, 0x00);
+  REQUIRE_SAME(0x00, t.apu.readStatus() & 0x0F);
+}
+
+TEST_CASE("APU frame IRQ in 4-step mode, inhibited by $4017") {
+  TestApu<> t;
+  REQUIRE_SAME(29829, t.apu.nextEventCycle());
+  t.runTo(29828);
+  REQUIRE_TRUE(!t.apu.irq());
+  t.runTo(29829);
+  REQUIRE_TRUE(t.apu.irq());
+  // Reading $4015 reports and acknowledges it
+  REQUIRE_SAME(0x40, t.apu.readStatus() & 0x40);
+  REQUIRE_TRUE(!t.apu.irq());
+  REQUIRE_SAME(29829 + apu_timing::PERIOD_4, t.apu.nextEventCycle());
+
+  t.write(0x4017, 0x40);
+  REQUIRE_SAME(apu_timing::NEVER, t.apu.nextEventCycle());
+  t.runTo(200000);
+  REQUIRE_TRUE(!t.apu.irq());
+  // 5-step mode never raises it
+  t.write(0x4017, 0x80);
+  t.runTo(400000);
+  REQUIRE_TRUE(!t.apu.irq());
+}
+
+TEST_CASE("APU DMC fetches a sample and raises its IRQ at the end") {
+  TestApu<> t;
+  t.write(0x4017, 0x40);
+  // IRQ on, fastest rate, 17 bytes from $C040
+  t.write(0x4010, 0x8F);
+  t.write(0x4012, 0x01);
+  t.write(0x4013, 0x01);
+  t.write(0x4015, 0x10);
+  // The first byte is fetched as soon as the channel is enabled
+  REQUIRE_SAME(1, t.memory.reads.size());
+  REQUIRE_SAME(0x10, t.apu.readStatus() & 0x10);
+  // Every later fetch is an event the system catches up for
+  while(!t.apu.irq()) {
+    REQUIRE_TRUE(t.apu.nextEventCycle() != apu_timing::NEVER);
+    t.runTo(t.apu.nextEventCycle());
+  }
+  REQUIRE_SAME(17, t.memory.reads.size());
+  REQUIRE_SAME(0xC040, t.memory.reads.front());
+  REQUIRE_SAME(0xC050, t.memory.reads.back());
+  REQUIRE_SAME(0x80, t.apu.readStatus() & 0x90);
+  // All-ones samples ramp the output up two steps per bit
+  REQUIRE_TRUE(t.state.dmc.level > 100);
+  // Disabling the channel acknowledges the IRQ
+  t.write(0x4015, 0x00);
+  REQUIRE_TRUE(!t.apu.irq());
+}
+
+TEST_CASE("APU synthesises a band-limited square wave") {
+  TestApu<> t;
+  t.write(0x4017, 0x40);
+  // 50% duty, constant volume 15, halted length, period 253: 440Hz
+  t.write(0x4015, 0x01);
+  t.write(0x4000, 0xBF);
+  t.write(0x4002, 253);
+  t.write(0x4003, 0x08);
+  std::vector<int16_t> samples;
+  std::vector<int16_t> chunk(4096);
+  // One second in frames
+  for(uint64_t frame = 1; frame <= 60; frame++) {
+    t.clock = static_cast<uint64_t>(apu_timing::CPU_CLOCK * frame / 60);
+    t.apu.endFrame();
+    const size_t count = t.apu.readSamples(chunk);
+    samples.insert(samples.end(), chunk.begin(), chunk.begin() + count);
+  }
+  REQUIRE_TRUE(std::abs(int(samples.size()) - 48000) <= 1);
+
+  // Skip the high-pass settling in, then count zero crossings and peaks
+  uint32_t crossings = 0;
+  int32_t peak = 0;
+  for(size_t i = 4800; i < samples.size(); i++) {
+    crossings += (samples[i - 1] < 0) != (samples[i] < 0);
+    peak = std::max<int32_t>(peak, std::abs(samples[i]));
+  }
+  const double seconds = (samples.size() - 4800) / 48000.0;
+  const double frequency = crossings / 2 / seconds;
+  REQUIRE_TRUE(std::abs(frequency - 440.4) < 3);
+  // Half of 15 * 246 either side of zero, plus the band limit's overshoot
+  REQUIRE_TRUE(peak > 1800 && peak < 2600);
+}
+
+TEST_CASE("APU frame IRQ reaches the CPU through the IRQ vector") {
+  //   $C000: CLI ; loop: JMP loop
+  //   $C010: INC $10 ; LDA $4015 ; RTI
+  std::vector<uint8_t> prg(0x4000, 0xEA);
+  const std::vector<uint8_t> main = {0x58, 0x4C, 0x01, 0xC0};
+  const std::vector<uint8_t> handler = {0xE6, 0x10, 0xAD, 0x15, 0x40, 0x40};
+  std::copy(main.begin(), main.end(), prg.begin());
+  std::copy(handler.begin(), handler.end(), prg.begin() + 0x10);
+  prg[0x3FFE] = 0x10;
+  prg[0x3FFF] = 0xC0;
+  cores::mos6502::NesRom rom{makeTestRom("apu_irq", 0, prg, 1, 0)};
+  Nes<Mapper0> nes{rom};
+  nes.cpu().setPC(0xC000);
+  while(nes.arena().cpu.Cycles < 29829 * 3 + 100) {
+    nes.runCycle();
+  }
+  // One IRQ per sequence, each acknowledged by the handler's $4015 read
+  REQUIRE_SAME(3, nes.bus().load(0x0010));
+  REQUIRE_TRUE(!nes.apu().irq());
+}
+
+TEST_CASE("Timing-only APU sees the same IRQs, status and DMC fetches") {
+  // Random register traffic, both APUs caught up at the same points the
+  // system would: on access and at their next event
+  constexpr std::array<uint16_t, 22> registers = {
+    0x4000, 0x4001, 0x4002, 0x4003, 0x4004, 0x4005, 0x4006, 0x4007, 0x4008, 0x400A, 0x400B,
+    0x400C, 0x400E, 0x400F, 0x4010, 0x4011, 0x4012, 0x4013, 0x4015, 0x4015, 0x4015, 0x4017,
+  };
+  std::mt19937 rng{43};
+  TestApu<> full;
+  TestApu<TimingOnlyAudio> timing;
+  uint32_t irqs = 0;
+  for(uint32_t i = 0; i < 20000; i++) {
+    const uint64_t target = full.clock + rng() % 4000;
+    while(full.apu.nextEventCycle() <= target) {
+      REQUIRE_SAME(full.apu.nextEventCycle(), timing.apu.nextEventCycle());
+      full.runTo(full.apu.nextEventCycle());
+      timing.runTo(timing.apu.nextEventCycle());
+      REQUIRE_TRUE(full.apu.irq() == timing.apu.irq());
+      irqs += full.apu.irq();
+    }
+    full.runTo(target);
+    timing.runTo(target);
+    if(rng() % 3 == 0) {
+      REQUIRE_SAME(full.apu.readStatus(), timing.apu.readStatus());
+    } else {
+      const uint16_t address = registers[rng() % registers.size()];
+      // Mostly short samples, so they end and loop often
+      const uint8_t data = static_cast<uint8_t>(address == 0x4013 ? rng() % 4 : rng());
+      full.write(address, data);
+      timing.write(address, data);
+    }
+    REQUIRE_TRUE(full.apu.irq() == timing.apu.irq());
+    REQUIRE_SAME(full.apu.nextEventCycle(), timing.apu.nextEventCycle());
+  }
+  REQUIRE_TRUE(irqs > 100);
+  REQUIRE_TRUE(full.memory.reads.size() > 1000);
+  REQUIRE_TRUE(full.memory.reads == timing.memory.reads);
+  REQUIRE_SAME(0, timing.apu.samplesAvailable());
+}
+
+TEST_CASE("Timing-only APU runs a program cycle for cycle like the full one") {
+  //   $C000: CLI ; DMC IRQ at the fastest rate, 17 bytes ; enable everything
+  //          pulse 1 length 2 ; loop: LDA $4015 ; STA $11 ; JMP loop
+  //   $C040: INC $10 ; LDA $4015 ; LDX $10 ; STA $0200,X ; restart DMC ; RTI
+  std::vector<uint8_t> prg(0x4000, 0xEA);
+  const std::vector<uint8_t> main = {
+    0x58, 0xA9, 0x8F, 0x8D, 0x10, 0x40, 0xA9, 0x01, 0x8D, 0x13, 0x40, 0xA9, 0x1F, 0x8D, 0x15, 0x40,
+    0xA9, 0x18, 0x8D, 0x03, 0x40, 0xAD, 0x15, 0x40, 0x85, 0x11, 0x4C, 0x15, 0xC0,
+  };
+  const std::vector<uint8_t> handler = {
+    0xE6, 0x10, 0xAD, 0x15, 0x40, 0xA6, 0x10, 0x9D, 0x00, 0x02, 0xA9, 0x1F, 0x8D, 0x15, 0x40, 0x40,
+  };
+  std::copy(main.begin(), main.end(), prg.begin());
+  std::copy(handler.begin(), handler.end(), prg.begin() + 0x40);
+  prg[0x3FFE] = 0x40;
+  prg[0x3FFF] = 0xC0;
+  cores::mos6502::NesRom rom{makeTestRom("apu_timing", 0, prg, 1, 0)};
+  Nes<Mapper0> full{rom};
+  Nes<Mapper0, TimingOnlyAudio> timing{rom};
+  full.cpu().setPC(0xC000);
+  timing.cpu().setPC(0xC000);
+  // Ten frames, instruction by instruction
+  while(full.arena().cpu.Cycles < 300000) {
+    full.runCycle();
+    timing.runCycle();
+    REQUIRE_SAME(full.arena().cpu.Cycles, timing.arena().cpu.Cycles);
+    REQUIRE_SAME(full.arena().cpu.PC, timing.arena().cpu.PC);
+  }
+  REQUIRE_TRUE(full.bus().load(0x0010) > 20);
+  REQUIRE_TRUE(full.arena().ram.internal_ram == timing.arena().ram.internal_ram);
+  REQUIRE_TRUE(full.apu().samplesAvailable() > 0);
+}
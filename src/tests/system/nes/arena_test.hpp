@@ -0,0 +1,72 @@
+#include <nes/nes.hpp>
+#include <framework/testing.hpp>
+#include "test_rom.hpp"
+
+TEST_CASE("Arena reset restores power-on state") {
+  // LDA #$42 ; STA $10 ; STA $6000
+  cores::mos6502::NesRom rom{makeTestRom("arena_reset", 1, {0xA9, 0x42, 0x85, 0x10, 0x8D, 0x00, 0x60}, 2)};
+  Nes<Mapper1> nes{rom};
+  nes.cpu().setPC(0x8000);
+  nes.savePowerOnState();
+
+  nes.runCycle();
+  nes.runCycle();
+  nes.runCycle();
+  REQUIRE_SAME(0x42, nes.bus().load(0x0010));
+  REQUIRE_SAME(0x42, nes.bus().load(0x6000));
+  // Switch MMC1 to 32KB mode, five writes to the control register
+  for(int i = 0; i < 5; i++) {
+    nes.bus().store(0x8000, 0x00);
+  }
+  REQUIRE_SAME(0x00, nes.arena().mapper.control);
+
+  nes.reset();
+  REQUIRE_SAME(0x00, nes.bus().load(0x0010));
+  REQUIRE_SAME(0x00, nes.bus().load(0x6000));
+  REQUIRE_SAME(0x0C, nes.arena().mapper.control);
+  REQUIRE_SAME(0x8000, nes.arena().cpu.PC);
+  REQUIRE_SAME(0x00, nes.cpu().getAcc());
+}
+
+TEST_CASE("Arena checkpoint round trip") {
+  // LDA #$42 ; STA $10 ; LDA #$07 ; STA $10
+  cores::mos6502::NesRom rom{makeTestRom("arena_checkpoint", 0, {0xA9, 0x42, 0x85, 0x10, 0xA9, 0x07, 0x85, 0x10})};
+  Nes<Mapper0> nes{rom};
+  nes.cpu().setPC(0x8000);
+  nes.runCycle();
+  nes.runCycle();
+
+  Nes<Mapper0>::Arena saved{};
+  nes.checkpoint(saved);
+  nes.runCycle();
+  nes.runCycle();
+  REQUIRE_SAME(0x07, nes.bus().load(0x0010));
+
+  nes.restore(saved);
+  REQUIRE_SAME(0x42, nes.bus().load(0x0010));
+  REQUIRE_SAME(0x42, nes.cpu().getAcc());
+  nes.runCycle();
+  REQUIRE_SAME(0x07, nes.cpu().getAcc());
+}
+
+TEST_CASE("Battery-backed PRG RAM persists through the save file") {
+  // LDA #$5A ; STA $6000
+  auto rom_path = makeTestRom("battery", 1, {0xA9, 0x5A, 0x8D, 0x00, 0x60}, 2, 1, 0x02);
+  auto save_path = std::filesystem::path(rom_path).replace_extension(".sav");
+  std::filesystem::remove(save_path);
+  cores::mos6502::NesRom rom{rom_path};
+  {
+    Nes<Mapper1> nes{rom, save_path};
+    REQUIRE_TRUE(nes.bus().hasSaveFile());
+    nes.cpu().setPC(0x8000);
+    nes.runCycle();
+    nes.runCycle();
+    nes.flushSaveRam();
+    // Battery RAM is not part of the arena, reset keeps it like a power cycle would
+    nes.reset();
+    REQUIRE_SAME(0x5A, nes.bus().load(0x6000));
+  }
+  REQUIRE_SAME(0x2000, std::filesystem::file_size(save_path));
+  Nes<Mapper1> nes{rom, save_path};
+  REQUIRE_SAME(0x5A, nes.bus().load(0x6000));
+}
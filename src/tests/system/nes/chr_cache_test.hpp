@@ -0,0 +1,35 @@
+#include <nes/chr_cache.hpp>
+#include <framework/testing.hpp>
+
+TEST_CASE("CHR cache decodes tiles and their horizontal flip") {
+  // Tile 1 row 0: low plane 0b10000001, high plane 0b11000000
+  std::array<uint8_t, 32> chr{};
+  chr[16] = 0x81;
+  chr[24] = 0xC0;
+  ChrCache cache{chr, false};
+  const uint8_t* row = cache.row(16, false);
+  std::array<uint8_t, 8> expected{3, 2, 0, 0, 0, 0, 0, 1};
+  for(size_t i = 0; i < 8; i++) {
+    REQUIRE_SAME(expected[i], row[i]);
+  }
+  const uint8_t* flipped = cache.row(16, true);
+  for(size_t i = 0; i < 8; i++) {
+    REQUIRE_SAME(expected[7 - i], flipped[i]);
+  }
+}
+
+TEST_CASE("CHR cache re-decodes a tile only after it's invalidated") {
+  std::array<uint8_t, 32> chr{};
+  ChrCache cache{chr, true};
+  REQUIRE_SAME(0, cache.row(3, false)[0]);
+  REQUIRE_SAME(0, cache.row(16 + 3, false)[0]);
+  // Row 3 of tile 0 and row 3 of tile 1
+  chr[3] = 0x80;
+  chr[16 + 3] = 0x80;
+  REQUIRE_SAME(0, cache.row(3, false)[0]);
+  cache.invalidate(3);
+  REQUIRE_SAME(1, cache.row(3, false)[0]);
+  REQUIRE_SAME(0, cache.row(16 + 3, false)[0]);
+  cache.invalidateAll();
+  REQUIRE_SAME(1, cache.row(16 + 3, false)[0]);
+}
@@ -0,0 +1,85 @@
+#include <nes/compositor.hpp>
+#include <framework/testing.hpp>
+#include <random>
+#include <vector>
+
+namespace {
+// Random layers with the invariants the PPU keeps: masks are 0 or 0xFF, and
+// sprite flags only where there is a sprite pixel
+auto randomLayers(std::mt19937& rng, ScanlineLayers& layers, std::array<uint8_t, 32>& palette) -> void {
+  for(auto& p : layers.background) {
+    p = rng() & 0x0F;
+  }
+  for(size_t x = 0; x < ScanlineLayers::WIDTH; x++) {
+    bool has_sprite = rng() & 1;
+    layers.sprites[x] = has_sprite ? 0x10 | (rng() & 0x0F) : 0;
+    layers.behind[x] = has_sprite && (rng() & 1) ? 0xFF : 0x00;
+    layers.sprite0[x] = has_sprite && (rng() % 8 == 0) ? 0xFF : 0x00;
+  }
+  for(auto& c : palette) {
+    c = rng() & 0x3F;
+  }
+}
+
+template<typename Fn>
+auto matchesScalar(Fn fn) -> bool {
+  std::mt19937 rng{1234};
+  ScanlineLayers layers{};
+  std::array<uint8_t, 32> palette{};
+  for(int round = 0; round < 500; round++) {
+    randomLayers(rng, layers, palette);
+    const uint8_t fine_x = rng() & 7;
+    const compositor::Line line{&layers.background[fine_x], layers.sprites.data(), layers.behind.data(),
+                                layers.sprite0.data(), palette.data(), static_cast<uint8_t>(round & 1 ? 0x30 : 0x3F)};
+    std::array<uint8_t, ScanlineLayers::WIDTH> expected{};
+    std::array<uint8_t, ScanlineLayers::WIDTH> actual{};
+    if(compositor::composeScalar(line, expected.data()) != fn(line, actual.data()) || expected != actual) {
+      return false;
+    }
+  }
+  return true;
+}
+}
+
+TEST_CASE("Compositor priority rules") {
+  ScanlineLayers layers{};
+  std::array<uint8_t, 32> palette{};
+  for(size_t i = 0; i < palette.size(); i++) {
+    palette[i] = static_cast<uint8_t>(i);
+  }
+  // x 0: nothing, x 1: background, x 2: sprite in front, x 3: sprite behind,
+  // x 4: sprite behind a clear background, x 5: sprite 0 hit
+  layers.background = {};
+  layers.background[1] = 0x05;
+  layers.background[2] = 0x05;
+  layers.background[3] = 0x05;
+  layers.background[4] = 0x04;
+  layers.background[5] = 0x01;
+  layers.sprites[2] = 0x1A;
+  layers.sprites[3] = 0x1A;
+  layers.behind[3] = 0xFF;
+  layers.sprites[4] = 0x1A;
+  layers.behind[4] = 0xFF;
+  layers.sprites[5] = 0x13;
+  layers.sprite0[5] = 0xFF;
+  const compositor::Line line{layers.background.data(), layers.sprites.data(), layers.behind.data(),
+                              layers.sprite0.data(), palette.data(), 0x3F};
+  std::array<uint8_t, ScanlineLayers::WIDTH> out{};
+  REQUIRE_SAME(5, compositor::compose(line, out.data()));
+  std::array<uint8_t, 6> expected{0x00, 0x05, 0x1A, 0x05, 0x1A, 0x13};
+  for(size_t x = 0; x < expected.size(); x++) {
+    REQUIRE_SAME(expected[x], out[x]);
+  }
+}
+
+TEST_CASE("Compositor SIMD versions match the scalar reference") {
+  REQUIRE_TRUE(matchesScalar(compositor::compose));
+#ifdef TWIX_COMPOSITOR_X86
+  if(Components::cpuFeatures().sse41) {
+    REQUIRE_TRUE(matchesScalar(compositor::composeSse41));
+  }
+  if(Components::cpuFeatures().avx2) {
+    REQUIRE_TRUE(matchesScalar(compositor::composeAvx2));
+  }
+#endif
+}
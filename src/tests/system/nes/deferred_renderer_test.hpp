@@ -0,0 +1,126 @@
+#include <nes/nes.hpp>
+#include <framework/testing.hpp>
+#include <utils/thread_pool.hpp>
+#include "test_rom.hpp"
+
+namespace {
+// Runs until the PPU has synced at the start of the given frame's VBlank
+template<typename System>
+auto runToVblank(System& nes, uint64_t frame) -> void {
+  while(!(nes.ppu().frame() == frame && nes.ppu().scanline() >= ppu_timing::VBLANK_LINE)) {
+    nes.runCycle();
+  }
+}
+
+// Busy pattern tables, nametables, palette and sprites, then rendering on
+template<typename System>
+auto fillPpu(System& nes) -> void {
+  nes.bus().store(0x2006, 0x00);
+  nes.bus().store(0x2006, 0x00);
+  for(uint32_t i = 0; i < 0x3000; i++) {
+    nes.bus().store(0x2007, static_cast<uint8_t>(i * 7 + (i >> 8)));
+  }
+  nes.bus().store(0x2006, 0x3F);
+  nes.bus().store(0x2006, 0x00);
+  for(uint32_t i = 0; i < 32; i++) {
+    nes.bus().store(0x2007, static_cast<uint8_t>(i * 3));
+  }
+  nes.bus().store(0x2003, 0x00);
+  for(uint32_t i = 0; i < 256; i++) {
+    nes.bus().store(0x2004, static_cast<uint8_t>(i * 29 + 5));
+  }
+  nes.bus().store(0x2001, 0x1E);
+}
+}
+
+TEST_CASE("Deferred rendering matches the serial renderer") {
+  // Rewrites scroll, a nametable byte and reads $2002 all through the frame:
+  //   LDX #0 ; loop: INX ; STX $2005 ; STX $2005 ; LDA #$21 ; STA $2006
+  //   STX $2006 ; STX $2007 ; BIT $2002 ; JMP loop
+  std::vector<uint8_t> prg = {0xA2, 0x00, 0xE8, 0x8E, 0x05, 0x20, 0x8E, 0x05, 0x20, 0xA9, 0x21,
+                              0x8D, 0x06, 0x20, 0x8E, 0x06, 0x20, 0x8E, 0x07, 0x20, 0x2C, 0x02,
+                              0x20, 0x4C, 0x02, 0x80};
+  prg.resize(0x4000, 0xEA);
+  cores::mos6502::NesRom rom{makeTestRom("deferred_render", 0, prg, 1, 0)};
+  Nes<Mapper0> serial{rom};
+  Nes<Mapper0> deferred{rom};
+  for(auto* nes : {&serial, &deferred}) {
+    fillPpu(*nes);
+    nes->cpu().setPC(0x8000);
+  }
+
+  Components::ThreadPool pool(3);
+  auto& renderer = deferred.renderDeferred(pool, 4);
+  std::vector<uint8_t> frame(ppu_timing::SCREEN_WIDTH * ppu_timing::VISIBLE_LINES);
+  for(uint64_t f = 1; f <= 4; f++) {
+    runToVblank(serial, f);
+    runToVblank(deferred, f);
+    renderer.waitIdle();
+    REQUIRE_SAME(f, renderer.latestFrame(frame));
+    auto expected = serial.ppu().frameBuffer();
+    REQUIRE_TRUE(std::equal(expected.begin(), expected.end(), frame.begin()));
+    REQUIRE_TRUE(std::count(frame.begin(), frame.end(), frame[0]) < static_cast<long>(frame.size()));
+  }
+  REQUIRE_SAME(0, renderer.droppedFrames());
+}
+
+TEST_CASE("Deferred rendering replays OAM DMA") {
+  // Moves sprites and copies them in every few scanlines:
+  //   loop: INC $0203 ; INC $0208 ; LDA #$02 ; STA $4014 ; JMP loop
+  std::vector<uint8_t> prg = {0xEE, 0x03, 0x02, 0xEE, 0x08, 0x02, 0xA9, 0x02,
+                              0x8D, 0x14, 0x40, 0x4C, 0x00, 0x80};
+  prg.resize(0x4000, 0xEA);
+  cores::mos6502::NesRom rom{makeTestRom("deferred_oam_dma", 0, prg, 1, 0)};
+  Nes<Mapper0> serial{rom};
+  Nes<Mapper0> deferred{rom};
+  for(auto* nes : {&serial, &deferred}) {
+    fillPpu(*nes);
+    for(uint32_t i = 0; i < 256; i++) {
+      nes->bus().store(static_cast<uint16_t>(0x0200 + i), static_cast<uint8_t>(i * 13 + 7));
+    }
+    nes->cpu().setPC(0x8000);
+  }
+
+  Components::ThreadPool pool(3);
+  auto& renderer = deferred.renderDeferred(pool, 4);
+  std::vector<uint8_t> frame(ppu_timing::SCREEN_WIDTH * ppu_timing::VISIBLE_LINES);
+  for(uint64_t f = 1; f <= 3; f++) {
+    runToVblank(serial, f);
+    runToVblank(deferred, f);
+    renderer.waitIdle();
+    REQUIRE_SAME(f, renderer.latestFrame(frame));
+    auto expected = serial.ppu().frameBuffer();
+    REQUIRE_TRUE(std::equal(expected.begin(), expected.end(), frame.begin()));
+  }
+}
+
+TEST_CASE("Deferred rendering follows CHR RAM writes made mid-frame") {
+  // The bands start from one shared decode of CHR RAM; this rewrites the
+  // first 16 tiles all through the frame, with a new value every pass, so
+  // each band has to leave it:
+  //   LDX #0 ; loop: INX ; BNE +2 ; INC $10 ; LDA #$00 ; STA $2006 ; STX $2006
+  //   LDA $10 ; STA $2007 ; STX $2005 ; STX $2005 ; JMP loop
+  std::vector<uint8_t> prg = {0xA2, 0x00, 0xE8, 0xD0, 0x02, 0xE6, 0x10, 0xA9, 0x00, 0x8D, 0x06, 0x20,
+                              0x8E, 0x06, 0x20, 0xA5, 0x10, 0x8D, 0x07, 0x20, 0x8E, 0x05, 0x20,
+                              0x8E, 0x05, 0x20, 0x4C, 0x02, 0x80};
+  prg.resize(0x4000, 0xEA);
+  cores::mos6502::NesRom rom{makeTestRom("deferred_chr_ram", 0, prg, 1, 0)};
+  Nes<Mapper0> serial{rom};
+  Nes<Mapper0> deferred{rom};
+  for(auto* nes : {&serial, &deferred}) {
+    fillPpu(*nes);
+    nes->cpu().setPC(0x8000);
+  }
+
+  Components::ThreadPool pool(3);
+  auto& renderer = deferred.renderDeferred(pool, 8);
+  std::vector<uint8_t> frame(ppu_timing::SCREEN_WIDTH * ppu_timing::VISIBLE_LINES);
+  for(uint64_t f = 1; f <= 3; f++) {
+    runToVblank(serial, f);
+    runToVblank(deferred, f);
+    renderer.waitIdle();
+    REQUIRE_SAME(f, renderer.latestFrame(frame));
+    auto expected = serial.ppu().frameBuffer();
+    REQUIRE_TRUE(std::equal(expected.begin(), expected.end(), frame.begin()));
+  }
+}
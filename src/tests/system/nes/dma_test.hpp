@@ -0,0 +1,81 @@
+#include <nes/nes.hpp>
+#include <framework/testing.hpp>
+#include <vector>
+#include "test_rom.hpp"
+
+TEST_CASE("OAM DMA copies a RAM page from OAMADDR on and halts the CPU 513 or 514 cycles") {
+  //   $C000: LDA #$02 ; loop: STA $4014 ; LDX $00 ; JMP loop
+  std::vector<uint8_t> prg = {0xA9, 0x02, 0x8D, 0x14, 0x40, 0xA6, 0x00, 0x4C, 0x02, 0xC0};
+  cores::mos6502::NesRom rom{makeTestRom("oam_dma", 0, prg, 1, 0)};
+  Nes<Mapper0> nes{rom};
+  for(uint32_t i = 0; i < 256; i++) {
+    nes.bus().store(static_cast<uint16_t>(0x0200 + i), static_cast<uint8_t>(i ^ 0x5A));
+  }
+  nes.bus().store(0x2003, 0x10);
+  nes.cpu().setPC(0xC000);
+  nes.runCycle();
+
+  uint32_t odd = 0;
+  uint32_t even = 0;
+  for(uint32_t i = 0; i < 8; i++) {
+    const uint64_t before = nes.arena().cpu.Cycles;
+    nes.runCycle();
+    // The DMA starts on the cycle after the 4-cycle store
+    const uint64_t start = before + 4;
+    REQUIRE_SAME(4 + 513 + (start & 1), nes.arena().cpu.Cycles - before);
+    (start & 1 ? odd : even)++;
+    nes.runCycle();
+    nes.runCycle();
+  }
+  REQUIRE_TRUE(odd > 0 && even > 0);
+  // Written through $2004, so starting at OAMADDR and wrapping round to it
+  const auto& oam = nes.arena().ppu.oam;
+  REQUIRE_SAME(0x5A, oam[0x10]);
+  REQUIRE_SAME(0xFF ^ 0x5A, oam[0x0F]);
+  REQUIRE_SAME(0x10, nes.arena().ppu.oam_addr);
+}
+
+TEST_CASE("OAM DMA reads ROM pages in place and register pages byte by byte") {
+  //   $C000: LDA #$C1 ; STA $4014 ; LDA #$40 ; STA $4014
+  std::vector<uint8_t> prg = {0xA9, 0xC1, 0x8D, 0x14, 0x40, 0xA9, 0x40, 0x8D, 0x14, 0x40};
+  prg.resize(0x4000, 0xEA);
+  for(uint32_t i = 0; i < 256; i++) {
+    prg[0x100 + i] = static_cast<uint8_t>(255 - i);
+  }
+  cores::mos6502::NesRom rom{makeTestRom("oam_dma_rom", 0, prg, 1, 0)};
+  Nes<Mapper0> nes{rom};
+  nes.cpu().setPC(0xC000);
+  nes.runCycle();
+  nes.runCycle();
+  REQUIRE_SAME(255, nes.arena().ppu.oam[0]);
+  REQUIRE_SAME(0, nes.arena().ppu.oam[255]);
+  // $4000-$40FF is write-only or open bus here, all zero
+  nes.runCycle();
+  nes.runCycle();
+  REQUIRE_SAME(0, nes.arena().ppu.oam[0]);
+  REQUIRE_SAME(0, nes.arena().ppu.oam[255]);
+}
+
+TEST_CASE("DMC sample fetches halt the CPU 4 cycles each") {
+  // The same NOP slide with and without a 17-byte sample playing:
+  //   $C000: LDA #$0F ; STA $4010 ; LDA #$01 ; STA $4013 ; LDA #n ; STA $4015
+  auto program = [](uint8_t enable) {
+    std::vector<uint8_t> prg = {0xA9, 0x0F, 0x8D, 0x10, 0x40, 0xA9, 0x01, 0x8D, 0x13, 0x40,
+                                0xA9, enable, 0x8D, 0x15, 0x40};
+    prg.resize(0x4000, 0xEA);
+    return prg;
+  };
+  cores::mos6502::NesRom silent_rom{makeTestRom("dmc_dma_off", 0, program(0x00), 1, 0)};
+  cores::mos6502::NesRom playing_rom{makeTestRom("dmc_dma_on", 0, program(0x10), 1, 0)};
+  Nes<Mapper0> silent{silent_rom};
+  Nes<Mapper0> playing{playing_rom};
+  silent.cpu().setPC(0xC000);
+  playing.cpu().setPC(0xC000);
+  // Well past the end of the sample: 17 bytes of 8 bits, 54 cycles a bit
+  for(uint32_t i = 0; i < 6000; i++) {
+    silent.runCycle();
+    playing.runCycle();
+  }
+  REQUIRE_SAME(silent.arena().cpu.PC, playing.arena().cpu.PC);
+  REQUIRE_SAME(17 * apu_timing::DMC_DMA_CYCLES, playing.arena().cpu.Cycles - silent.arena().cpu.Cycles);
+}
@@ -0,0 +1,100 @@
+#include <nes/nes.hpp>
+#include <framework/testing.hpp>
+#include "test_rom.hpp"
+
+namespace {
+// NROM board with 2KB of nametable RAM on the cartridge for $2800-$2FFF
+struct CartVramMapper {
+  struct State {
+    std::array<uint8_t, 0x800> vram;
+  };
+
+  CartVramMapper(cores::mos6502::NesRom& rom, State& state, std::span<uint8_t> prg_ram)
+    : state_(state), nrom_(rom, nrom_state_, prg_ram) {}
+
+  auto chrOffset(uint16_t address) const -> uint32_t { return nrom_.chrOffset(address); }
+  auto mirroring() const -> cores::mos6502::Mirroring { return nrom_.mirroring(); }
+  auto read(uint16_t address) -> uint8_t { return nrom_.read(address); }
+  auto write(uint16_t address, uint8_t data) -> void { nrom_.write(address, data); }
+
+  auto nametables(uint8_t* ciram) -> std::array<uint8_t*, 4> {
+    return {ciram, ciram + 0x400, state_.vram.data(), state_.vram.data() + 0x400};
+  }
+
+  State& state_;
+  Mapper0::State nrom_state_;
+  Mapper0 nrom_;
+};
+
+template<typename System>
+auto peekNametable(System& nes, uint16_t address) -> uint8_t {
+  nes.bus().store(0x2006, address >> 8);
+  nes.bus().store(0x2006, address & 0xFF);
+  nes.bus().load(0x2007);
+  return nes.bus().load(0x2007);
+}
+
+template<typename System>
+auto pokeNametable(System& nes, uint16_t address, uint8_t data) -> void {
+  nes.bus().store(0x2006, address >> 8);
+  nes.bus().store(0x2006, address & 0xFF);
+  nes.bus().store(0x2007, data);
+}
+
+// MMC1 takes register writes one bit at a time, LSB first
+template<typename System>
+auto mmc1Write(System& nes, uint16_t address, uint8_t value) -> void {
+  for(int bit = 0; bit < 5; bit++) {
+    nes.bus().store(address, (value >> bit) & 1);
+  }
+}
+}
+
+TEST_CASE("Nametable mirroring from the header") {
+  cores::mos6502::NesRom horizontal_rom{makeTestRom("nt_horizontal", 0, {}, 1, 1, 0x00)};
+  Nes<Mapper0> horizontal{horizontal_rom};
+  pokeNametable(horizontal, 0x2010, 0x11);
+  pokeNametable(horizontal, 0x2810, 0x22);
+  REQUIRE_SAME(0x11, peekNametable(horizontal, 0x2410));
+  REQUIRE_SAME(0x22, peekNametable(horizontal, 0x2C10));
+  // $3000-$3EFF mirrors $2000-$2EFF
+  REQUIRE_SAME(0x22, peekNametable(horizontal, 0x3810));
+
+  cores::mos6502::NesRom vertical_rom{makeTestRom("nt_vertical", 0, {}, 1, 1, 0x01)};
+  Nes<Mapper0> vertical{vertical_rom};
+  pokeNametable(vertical, 0x2010, 0x11);
+  pokeNametable(vertical, 0x2410, 0x22);
+  REQUIRE_SAME(0x11, peekNametable(vertical, 0x2810));
+  REQUIRE_SAME(0x22, peekNametable(vertical, 0x2C10));
+}
+
+TEST_CASE("Nametable pages follow MMC1 mirroring switches") {
+  cores::mos6502::NesRom rom{makeTestRom("nt_mmc1", 1, {}, 2, 1)};
+  Nes<Mapper1> nes{rom};
+  // Vertical, then single screen upper page
+  mmc1Write(nes, 0x8000, 0x0E);
+  pokeNametable(nes, 0x2400, 0x33);
+  REQUIRE_SAME(0x33, peekNametable(nes, 0x2C00));
+  mmc1Write(nes, 0x8000, 0x0D);
+  REQUIRE_SAME(0x33, peekNametable(nes, 0x2000));
+  REQUIRE_SAME(0x33, peekNametable(nes, 0x2800));
+  // Horizontal, then back to the power-on single screen lower page by reset
+  mmc1Write(nes, 0x8000, 0x0F);
+  REQUIRE_SAME(0x33, peekNametable(nes, 0x2800));
+  nes.reset();
+  pokeNametable(nes, 0x2000, 0x44);
+  REQUIRE_SAME(0x44, peekNametable(nes, 0x2800));
+}
+
+TEST_CASE("Nametable pages supplied by the mapper") {
+  cores::mos6502::NesRom rom{makeTestRom("nt_cart_vram", 0, {}, 1, 1, 0x01)};
+  Nes<CartVramMapper> nes{rom};
+  pokeNametable(nes, 0x2000, 0x11);
+  pokeNametable(nes, 0x2400, 0x22);
+  pokeNametable(nes, 0x2800, 0x33);
+  pokeNametable(nes, 0x2C00, 0x44);
+  REQUIRE_SAME(0x11, peekNametable(nes, 0x2000));
+  REQUIRE_SAME(0x22, peekNametable(nes, 0x2400));
+  REQUIRE_SAME(0x33, nes.arena().mapper.vram[0x000]);
+  REQUIRE_SAME(0x44, nes.arena().mapper.vram[0x400]);
+}
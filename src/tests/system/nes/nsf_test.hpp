@@ -0,0 +1,102 @@
+#include <nes/nsf.hpp>
+#include <framework/testing.hpp>
+#include <cstring>
+#include <vector>
+
+namespace {
+// NSF file bytes: header with banks (all zero for a plain tune) and data
+auto makeNsf(uint16_t load, uint16_t init, uint16_t play, uint8_t songs,
+             const std::array<uint8_t, 8>& banks, const std::vector<uint8_t>& data) -> std::vector<uint8_t> {
+  std::vector<uint8_t> bytes(NsfFile::HEADER_SIZE, 0);
+  std::memcpy(bytes.data(), "NESM\x1A", 5);
+  bytes[0x05] = 1;
+  bytes[0x06] = songs;
+  bytes[0x07] = 2;
+  auto put16 = [&](size_t offset, uint16_t value) {
+    bytes[offset] = value & 0xFF;
+    bytes[offset + 1] = value >> 8;
+  };
+  put16(0x08, load);
+  put16(0x0A, init);
+  put16(0x0C, play);
+  std::memcpy(&bytes[0x0E], "Test Tune", 9);
+  std::memcpy(&bytes[0x2E], "Nobody", 6);
+  std::copy(banks.begin(), banks.end(), bytes.begin() + 0x70);
+  bytes.insert(bytes.end(), data.begin(), data.end());
+  return bytes;
+}
+}
+
+TEST_CASE("NSF header parses and anything else is refused") {
+  const auto bytes = makeNsf(0x8000, 0x8000, 0x8003, 3, {}, {0x60, 0x60, 0x60, 0x60});
+  const NsfFile file = NsfFile::parse(bytes);
+  REQUIRE_SAME(3, file.songs);
+  REQUIRE_SAME(1, file.first_song);
+  REQUIRE_SAME(0x8003, file.play_address);
+  REQUIRE_TRUE(file.name == "Test Tune");
+  REQUIRE_TRUE(file.artist == "Nobody");
+  REQUIRE_SAME(NsfFile::DEFAULT_PERIOD_US, file.play_period_us);
+  REQUIRE_TRUE(!file.bankswitched);
+  REQUIRE_SAME(4, file.data.size());
+
+  auto bad = bytes;
+  bad[0] = 'X';
+  bool refused = false;
+  try {
+    NsfFile::parse(bad);
+  } catch(const NsfException&) {
+    refused = true;
+  }
+  REQUIRE_TRUE(refused);
+}
+
+TEST_CASE("NSF player runs INIT with the track and PLAY at the frame rate") {
+  //   $8000 INIT: STA $00 ; LDA #$1F ; STA $4015 ; LDA #$BF ; STA $4000
+  //               LDA #$FD ; STA $4002 ; LDA #$08 ; STA $4003 ; RTS
+  //   $8020 PLAY: INC $01 ; RTS
+  std::vector<uint8_t> code = {
+    0x85, 0x00, 0xA9, 0x1F, 0x8D, 0x15, 0x40, 0xA9, 0xBF, 0x8D, 0x00, 0x40,
+    0xA9, 0xFD, 0x8D, 0x02, 0x40, 0xA9, 0x08, 0x8D, 0x03, 0x40, 0x60,
+  };
+  code.resize(0x20, 0xEA);
+  code.insert(code.end(), {0xE6, 0x01, 0x60});
+  const NsfFile file = NsfFile::parse(makeNsf(0x8000, 0x8000, 0x8020, 3, {}, code));
+  NsfPlayer<> player{file, 48000};
+  player.startTrack(2);
+  REQUIRE_SAME(2, player.bus().ram[0]);
+
+  std::vector<int16_t> samples(48000);
+  REQUIRE_SAME(48000, player.render(samples));
+  // One second is 60.1 PLAY calls, the last frame may run over
+  REQUIRE_TRUE(player.bus().ram[1] >= 60 && player.bus().ram[1] <= 62);
+  int32_t low = 0;
+  int32_t high = 0;
+  for(int16_t sample : samples) {
+    low = std::min<int32_t>(low, sample);
+    high = std::max<int32_t>(high, sample);
+  }
+  REQUIRE_TRUE(high - low > 1000);
+
+  // A new track starts over
+  player.startTrack(0);
+  REQUIRE_SAME(0, player.bus().ram[0]);
+  REQUIRE_SAME(0, player.bus().ram[1]);
+}
+
+TEST_CASE("NSF bankswitching maps 4KB banks from the header and $5FF8-$5FFF") {
+  // Loaded at $8100, so bank 0 starts with $100 bytes of padding. Each bank
+  // ends in its own number at $xFFF.
+  //   $8100 INIT: LDA $9FFF ; STA $00 ; LDA #$02 ; STA $5FF9 ; LDA $9FFF ; STA $01 ; RTS
+  std::vector<uint8_t> data = {0xAD, 0xFF, 0x9F, 0x85, 0x00, 0xA9, 0x02, 0x8D, 0xF9, 0x5F,
+                               0xAD, 0xFF, 0x9F, 0x85, 0x01, 0x60};
+  data.resize(3 * NsfFile::BANK_SIZE - 0x100, 0);
+  for(uint8_t bank = 0; bank < 3; bank++) {
+    data[(bank + 1) * NsfFile::BANK_SIZE - 0x101] = bank;
+  }
+  const NsfFile file = NsfFile::parse(makeNsf(0x8100, 0x8100, 0x810F, 1, {0, 1, 0, 0, 0, 0, 0, 0}, data));
+  REQUIRE_TRUE(file.bankswitched);
+  NsfPlayer<> player{file};
+  player.startTrack(0);
+  REQUIRE_SAME(1, player.bus().ram[0]);
+  REQUIRE_SAME(2, player.bus().ram[1]);
+}
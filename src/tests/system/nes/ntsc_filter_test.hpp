@@ -0,0 +1,76 @@
+#include <nes/ntsc_filter.hpp>
+#include <framework/testing.hpp>
+#include <utils/thread_pool.hpp>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace {
+struct TestFrame {
+  std::vector<uint8_t> indices = std::vector<uint8_t>(ntsc::IN_WIDTH * ntsc::HEIGHT);
+  std::array<uint8_t, ntsc::HEIGHT> emphasis{};
+
+  auto view() const -> FrameView { return {indices, emphasis}; }
+};
+
+auto randomFrame(uint32_t seed) -> TestFrame {
+  std::mt19937 rng{seed};
+  TestFrame frame;
+  for(auto& index : frame.indices) {
+    index = rng() & 0x3F;
+  }
+  for(auto& e : frame.emphasis) {
+    e = rng() & 0x07;
+  }
+  return frame;
+}
+
+auto filtered(const TestFrame& frame, uint64_t number, ntsc::FilterFn line) -> std::vector<uint8_t> {
+  std::vector<uint8_t> out(NtscFilter::PITCH * NtscFilter::HEIGHT);
+  ntsc::filterLines(frame.view(), number, 0, ntsc::HEIGHT, out.data(), NtscFilter::PITCH, line);
+  return out;
+}
+}
+
+TEST_CASE("NTSC filter reproduces the palette on flat fields") {
+  for(uint8_t color : {0x0F, 0x16, 0x21, 0x2A, 0x12, 0x30, 0x00}) {
+    TestFrame frame;
+    std::fill(frame.indices.begin(), frame.indices.end(), color);
+    for(uint64_t number : {0, 1, 2}) {
+      auto out = filtered(frame, number, ntsc::filterLineScalar);
+      const uint8_t* pixel = &out[100 * NtscFilter::PITCH + 300 * 4];
+      const uint32_t expected = pixel_format::NTSC_PALETTE[color];
+      REQUIRE_TRUE(std::abs(pixel[0] - int(expected >> 16 & 0xFF)) <= 4);
+      REQUIRE_TRUE(std::abs(pixel[1] - int(expected >> 8 & 0xFF)) <= 4);
+      REQUIRE_TRUE(std::abs(pixel[2] - int(expected & 0xFF)) <= 4);
+      REQUIRE_SAME(0xFF, pixel[3]);
+    }
+  }
+}
+
+TEST_CASE("NTSC filter SIMD version matches the scalar reference") {
+  const TestFrame frame = randomFrame(39);
+  for(uint64_t number : {0, 1, 2}) {
+    REQUIRE_TRUE(filtered(frame, number, ntsc::filterLineScalar) == filtered(frame, number, ntsc::bestFilterLine()));
+  }
+}
+
+TEST_CASE("NTSC filter on the thread pool matches a direct run") {
+  Components::ThreadPool pool{4};
+  NtscFilter filter{pool, 6};
+  std::vector<uint8_t> out(NtscFilter::PITCH * NtscFilter::HEIGHT);
+  REQUIRE_SAME(0, filter.latestFrame(out));
+  std::vector<TestFrame> frames;
+  for(uint32_t i = 0; i < 5; i++) {
+    frames.push_back(randomFrame(100 + i));
+  }
+  // Submitting never blocks, frames that can't be filtered in time are dropped
+  for(uint32_t i = 0; i < frames.size(); i++) {
+    filter.submit(frames[i].view(), i + 1);
+  }
+  filter.waitIdle();
+  REQUIRE_TRUE(filter.droppedFrames() < frames.size());
+  // The last frame submitted is always filtered
+  REQUIRE_SAME(frames.size(), filter.latestFrame(out));
+  REQUIRE_TRUE(out == filtered(frames.back(), frames.size(), ntsc::bestFilterLine()));
+}
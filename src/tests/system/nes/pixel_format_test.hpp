@@ -0,0 +1,93 @@
+#include <nes/pixel_format.hpp>
+#include <framework/testing.hpp>
+#include <random>
+#include <vector>
+
+namespace {
+constexpr std::array<PixelFormat, 5> ALL_FORMATS = {PixelFormat::INDICES, PixelFormat::RGBA8888,
+                                                     PixelFormat::BGRA8888, PixelFormat::RGB565, PixelFormat::GRAY8};
+
+auto converted(const FrameView& frame, PixelFormat format, pixel_format::ConvertFn line) -> std::vector<uint8_t> {
+  std::vector<uint8_t> out(FrameView::WIDTH * FrameView::HEIGHT * bytesPerPixel(format));
+  pixel_format::convert(frame, format, out, 0, line);
+  return out;
+}
+
+// Every color under every emphasis, plus stray high bits the conversion must ignore
+auto matchesScalar(pixel_format::ConvertFn line) -> bool {
+  std::mt19937 rng{38};
+  std::vector<uint8_t> indices(FrameView::WIDTH * FrameView::HEIGHT);
+  std::array<uint8_t, FrameView::HEIGHT> emphasis{};
+  for(auto& index : indices) {
+    index = static_cast<uint8_t>(rng());
+  }
+  for(size_t y = 0; y < emphasis.size(); y++) {
+    emphasis[y] = static_cast<uint8_t>(y);
+  }
+  const FrameView frame{indices, emphasis};
+  for(PixelFormat format : ALL_FORMATS) {
+    if(converted(frame, format, pixel_format::convertLineScalar) != converted(frame, format, line)) {
+      return false;
+    }
+  }
+  return true;
+}
+}
+
+TEST_CASE("Pixel formats lay out channels as documented") {
+  std::vector<uint8_t> indices(FrameView::WIDTH * FrameView::HEIGHT, 0x16);
+  std::array<uint8_t, FrameView::HEIGHT> emphasis{};
+  emphasis[1] = 0x01;
+  const FrameView frame{indices, emphasis};
+  // 0x16 is 0xB53120
+  auto rgba = converted(frame, PixelFormat::RGBA8888, pixel_format::bestConvertLine());
+  REQUIRE_SAME(0xB5, rgba[0]);
+  REQUIRE_SAME(0x31, rgba[1]);
+  REQUIRE_SAME(0x20, rgba[2]);
+  REQUIRE_SAME(0xFF, rgba[3]);
+  auto bgra = converted(frame, PixelFormat::BGRA8888, pixel_format::bestConvertLine());
+  REQUIRE_SAME(0x20, bgra[0]);
+  REQUIRE_SAME(0xB5, bgra[2]);
+  uint16_t rgb565 = 0;
+  std::memcpy(&rgb565, converted(frame, PixelFormat::RGB565, pixel_format::bestConvertLine()).data(), 2);
+  REQUIRE_SAME((0xB5 >> 3) << 11 | (0x31 >> 2) << 5 | (0x20 >> 3), rgb565);
+  // Red emphasis on line 1 keeps red and darkens green and blue
+  const size_t line1 = FrameView::WIDTH * 4;
+  REQUIRE_SAME(0xB5, rgba[line1]);
+  REQUIRE_TRUE(rgba[line1 + 1] < 0x31);
+  REQUIRE_TRUE(rgba[line1 + 2] < 0x20);
+  auto raw = converted(frame, PixelFormat::INDICES, pixel_format::bestConvertLine());
+  REQUIRE_TRUE(raw == indices);
+}
+
+TEST_CASE("Pixel format conversion honours pitch and buffer size") {
+  std::vector<uint8_t> indices(FrameView::WIDTH * FrameView::HEIGHT, 0x20);
+  std::array<uint8_t, FrameView::HEIGHT> emphasis{};
+  const FrameView frame{indices, emphasis};
+  const size_t pitch = FrameView::WIDTH + 8;
+  std::vector<uint8_t> out(pitch * FrameView::HEIGHT, 0x55);
+  pixel_format::convert(frame, PixelFormat::GRAY8, out, pitch);
+  REQUIRE_SAME(0xFE, out[pitch - 9]);
+  REQUIRE_SAME(0x55, out[pitch - 8]);
+  REQUIRE_SAME(0xFE, out[pitch]);
+  bool threw = false;
+  try {
+    std::vector<uint8_t> small(FrameView::WIDTH * FrameView::HEIGHT * 4 - 1);
+    pixel_format::convert(frame, PixelFormat::RGBA8888, small);
+  } catch(const std::length_error&) {
+    threw = true;
+  }
+  REQUIRE_TRUE(threw);
+}
+
+TEST_CASE("Pixel format SIMD versions match the scalar reference") {
+  REQUIRE_TRUE(matchesScalar(pixel_format::bestConvertLine()));
+#ifdef TWIX_PIXEL_FORMAT_X86
+  if(Components::cpuFeatures().sse41) {
+    REQUIRE_TRUE(matchesScalar(pixel_format::convertLineSse41));
+  }
+  if(Components::cpuFeatures().avx2) {
+    REQUIRE_TRUE(matchesScalar(pixel_format::convertLineAvx2));
+  }
+#endif
+}
@@ -0,0 +1,311 @@
+#include <nes/nes.hpp>
+#include <framework/testing.hpp>
+#include "test_rom.hpp"
+
+namespace {
+// Puts the PPU address register at addr and writes bytes through $2007
+template<typename System>
+auto ppuPoke(System& nes, uint16_t addr, std::vector<uint8_t> bytes) -> void {
+  nes.bus().store(0x2006, addr >> 8);
+  nes.bus().store(0x2006, addr & 0xFF);
+  for(auto b : bytes) {
+    nes.bus().store(0x2007, b);
+  }
+}
+
+// First CPU cycle at which the PPU has reached (scanline, dot) of frame 0,
+// an event at dot d has happened once the PPU is at d + 1
+constexpr auto cycleAt(uint32_t scanline, uint32_t dot) -> uint64_t {
+  return (scanline * ppu_timing::DOTS_PER_LINE + dot + 2) / ppu_timing::DOTS_PER_CPU_CYCLE;
+}
+
+// Moves the CPU clock without running anything, the PPU is left behind
+template<typename System>
+auto setCycles(System& nes, uint64_t cycles) -> void {
+  auto arena = nes.arena();
+  arena.cpu.Cycles = cycles;
+  nes.restore(arena);
+}
+
+// Tile 1 opaque in CHR RAM, background tile 1 at row 1 column 2 (pixels
+// x 16-23, y 8-15) and sprite 0 on tile 1 at x = 12 drawn from line 10
+template<typename System>
+auto setupSprite0(System& nes) -> void {
+  ppuPoke(nes, 0x0010, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF});
+  ppuPoke(nes, 0x2000 + 32 + 2, {0x01});
+  nes.bus().store(0x2003, 0x00);
+  for(uint8_t b : {9, 1, 0, 12}) {
+    nes.bus().store(0x2004, b);
+  }
+  nes.bus().store(0x2006, 0x00);
+  nes.bus().store(0x2006, 0x00);
+  nes.bus().store(0x2001, 0x1E);
+}
+}
+
+TEST_CASE("PPU VBlank flag timing and $2002 read clear") {
+  cores::mos6502::NesRom rom{makeTestRom("ppu_vblank", 0, {})};
+  Nes<Mapper0> nes{rom};
+  auto& ppu = nes.ppu();
+  REQUIRE_SAME(cycleAt(241, 2), ppu.nextSyncCycle());
+
+  setCycles(nes, cycleAt(241, 1) - 1);
+  REQUIRE_SAME(0x00, nes.bus().load(0x2002) & 0x80);
+  setCycles(nes, cycleAt(241, 3));
+  REQUIRE_SAME(0x80, nes.bus().load(0x2002) & 0x80);
+  // Answered from the prediction, the PPU hasn't moved
+  REQUIRE_SAME(0, ppu.state().dot_clock);
+  // Reading the status clears the flag
+  REQUIRE_SAME(0x00, nes.bus().load(0x2002) & 0x80);
+
+  // Catching up later must not bring the flag back
+  ppu.catchUp(cycleAt(250, 0));
+  REQUIRE_SAME(0x00, nes.bus().load(0x2002) & 0x80);
+  // Next sync points are pre-render, then the following frame's VBlank
+  REQUIRE_SAME(cycleAt(261, 2), ppu.nextSyncCycle());
+  ppu.catchUp(cycleAt(262, 5));
+  REQUIRE_SAME(1, ppu.frame());
+  REQUIRE_SAME(cycleAt(262 + 241, 2), ppu.nextSyncCycle());
+}
+
+TEST_CASE("PPU $2002 read just before VBlank suppresses the flag and NMI") {
+  cores::mos6502::NesRom rom{makeTestRom("ppu_vblank_race", 0, {})};
+  Nes<Mapper0> nes{rom};
+  auto& ppu = nes.ppu();
+  nes.bus().store(0x2000, 0x80);
+  // The flag goes up at dot clock 241 * 341 + 2, cycle 27394 is one dot before
+  const uint64_t race = 27394;
+  REQUIRE_SAME(race * 3 + 1, ppu.state().vblank_at);
+  setCycles(nes, race);
+  REQUIRE_SAME(0x00, nes.bus().load(0x2002) & 0x80);
+  setCycles(nes, race + 1);
+  REQUIRE_SAME(0x00, nes.bus().load(0x2002) & 0x80);
+  ppu.sync();
+  REQUIRE_TRUE(!ppu.takeNmi());
+}
+
+TEST_CASE("PPU $2002 race at every dot phase of the VBlank flag") {
+  cores::mos6502::NesRom rom{makeTestRom("ppu_vblank_phase", 0, {})};
+  Nes<Mapper0> nes{rom};
+  auto& ppu = nes.ppu();
+  nes.bus().store(0x2000, 0x80);
+  // Frames are 89342 dots with rendering off, not a multiple of 3, so the
+  // flag goes up one, zero and two dots into a CPU cycle in frames 0-2
+  const uint64_t phases[] = {1, 0, 2};
+  for(uint64_t frame = 0; frame < 3; frame++) {
+    setCycles(nes, cycleAt(262 * frame + 200, 0));
+    ppu.sync();
+    ppu.takeNmi();
+    const uint64_t vblank_at = ppu.state().vblank_at;
+    REQUIRE_SAME(phases[frame], vblank_at % 3);
+    const uint64_t race = vblank_at / 3;
+    setCycles(nes, race);
+    if(vblank_at % 3 == 0) {
+      // Read on the dot it goes up: seen and cleared, no NMI
+      REQUIRE_SAME(0x80, nes.bus().load(0x2002) & 0x80);
+    } else {
+      // Read a dot or two before: never seen, no NMI
+      REQUIRE_SAME(0x00, nes.bus().load(0x2002) & 0x80);
+    }
+    setCycles(nes, race + 1);
+    REQUIRE_SAME(0x00, nes.bus().load(0x2002) & 0x80);
+    ppu.sync();
+    REQUIRE_TRUE(!ppu.takeNmi());
+  }
+}
+
+TEST_CASE("PPU sees a CPU read on its bus cycle") {
+  // $8000: LDA $2002, the read is the instruction's fourth cycle
+  cores::mos6502::NesRom rom{makeTestRom("ppu_bus_cycle", 0, {0xAD, 0x02, 0x20})};
+  Nes<Mapper0> nes{rom};
+  const uint64_t visible = (nes.ppu().state().vblank_at + 2) / 3;
+  nes.cpu().setPC(0x8000);
+  setCycles(nes, visible - 3);
+  nes.runCycle();
+  REQUIRE_SAME(0x80, nes.cpu().getAcc() & 0x80);
+  REQUIRE_SAME(visible + 1, nes.cpu().getCycles());
+}
+
+TEST_CASE("PPU VRAM, palette and read buffer") {
+  cores::mos6502::NesRom rom{makeTestRom("ppu_vram", 0, {}, 1, 1, 0x01)};  // Vertical mirroring
+  Nes<Mapper0> nes{rom};
+  ppuPoke(nes, 0x2005, {0xAB, 0xCD});
+  // Vertical mirroring: $2800 mirrors $2000
+  nes.bus().store(0x2006, 0x28);
+  nes.bus().store(0x2006, 0x05);
+  nes.bus().load(0x2007);  // Buffered, returns stale data
+  REQUIRE_SAME(0xAB, nes.bus().load(0x2007));
+  REQUIRE_SAME(0xCD, nes.bus().load(0x2007));
+
+  // $3F10 mirrors $3F00 and palette reads aren't buffered
+  ppuPoke(nes, 0x3F10, {0x21});
+  nes.bus().store(0x2006, 0x3F);
+  nes.bus().store(0x2006, 0x00);
+  REQUIRE_SAME(0x21, nes.bus().load(0x2007));
+}
+
+TEST_CASE("PPU NMI reaches the CPU at VBlank") {
+  // $8000: JMP $8000, NMI handler at $8100: LDA #$99 ; JMP $8102
+  std::vector<uint8_t> prg(0x4000, 0xEA);
+  uint8_t main_loop[] = {0x4C, 0x00, 0x80};
+  uint8_t handler[] = {0xA9, 0x99, 0x4C, 0x02, 0x81};
+  std::copy(std::begin(main_loop), std::end(main_loop), prg.begin());
+  std::copy(std::begin(handler), std::end(handler), prg.begin() + 0x100);
+  prg[0x3FFA] = 0x00;
+  prg[0x3FFB] = 0x81;
+  cores::mos6502::NesRom rom{makeTestRom("ppu_nmi", 0, prg)};
+  Nes<Mapper0> nes{rom};
+  nes.cpu().setPC(0x8000);
+  nes.bus().store(0x2000, 0x80);
+  while(nes.cpu().getCycles() < cycleAt(241, 2)) {
+    nes.runCycle();
+    REQUIRE_SAME(0x00, nes.cpu().getAcc());
+  }
+  nes.runCycle();
+  REQUIRE_SAME(0x99, nes.cpu().getAcc());
+  REQUIRE_SAME(1, nes.cpu().getInt());
+}
+
+TEST_CASE("PPU sprite 0 hit") {
+  // No CHR ROM, so pattern tables are CHR RAM we can write through $2007
+  cores::mos6502::NesRom rom{makeTestRom("ppu_sprite0", 0, {}, 1, 0)};
+  Nes<Mapper0> nes{rom};
+  setupSprite0(nes);
+
+  auto& ppu = nes.ppu();
+  // Overlap starts at x = 16 on line 10
+  setCycles(nes, cycleAt(10, 16 + 1) - 1);
+  REQUIRE_SAME(0x00, nes.bus().load(0x2002) & 0x40);
+  setCycles(nes, cycleAt(10, 16 + 2));
+  REQUIRE_SAME(0x40, nes.bus().load(0x2002) & 0x40);
+  REQUIRE_SAME(0, ppu.state().dot_clock);
+  // Cleared at the pre-render line, then predicted again for the next frame
+  setCycles(nes, cycleAt(261, 2));
+  REQUIRE_SAME(0x00, nes.bus().load(0x2002) & 0x40);
+  setCycles(nes, cycleAt(262 + 10, 16 + 2));
+  REQUIRE_SAME(0x40, nes.bus().load(0x2002) & 0x40);
+
+  // Moving the sprite off the background during the frame cancels the hit
+  setCycles(nes, cycleAt(262 + 5, 0));
+  ppu.sync();
+  nes.bus().store(0x2003, 0x03);
+  nes.bus().store(0x2004, 100);
+  setCycles(nes, cycleAt(262 + 20, 0));
+  REQUIRE_SAME(0x00, nes.bus().load(0x2002) & 0x40);
+}
+
+TEST_CASE("PPU sprite 0 polling loop runs without catch-up") {
+  // $8000: BIT $2002 ; BVC $8000 ; JMP $8005
+  std::vector<uint8_t> prg(0x4000, 0xEA);
+  uint8_t loop[] = {0x2C, 0x02, 0x20, 0x50, 0xFB, 0x4C, 0x05, 0x80};
+  std::copy(std::begin(loop), std::end(loop), prg.begin());
+  cores::mos6502::NesRom rom{makeTestRom("ppu_sprite0_poll", 0, prg, 1, 0)};
+  Nes<Mapper0> nes{rom};
+  setupSprite0(nes);
+  nes.cpu().setPC(0x8000);
+  while(nes.arena().cpu.PC < 0x8005) {
+    nes.runCycle();
+  }
+  // One BIT + BVC iteration is 7 cycles
+  REQUIRE_TRUE(nes.cpu().getCycles() >= cycleAt(10, 16 + 2));
+  REQUIRE_TRUE(nes.cpu().getCycles() < cycleAt(10, 16 + 2) + 7 + 4);
+  REQUIRE_SAME(0, nes.ppu().state().dot_clock);
+}
+
+TEST_CASE("PPU renders background and sprites into the frame buffer") {
+  cores::mos6502::NesRom rom{makeTestRom("ppu_render", 0, {}, 1, 0)};
+  Nes<Mapper0> nes{rom};
+  setupSprite0(nes);
+  // Backdrop, background palette 0 color 1, sprite palette 0 color 1
+  ppuPoke(nes, 0x3F00, {0x0F, 0x21});
+  ppuPoke(nes, 0x3F11, {0x16});
+  nes.bus().store(0x2006, 0x00);
+  nes.bus().store(0x2006, 0x00);
+  nes.ppu().catchUp(cycleAt(240, 0));
+  auto frame = nes.ppu().frameBuffer();
+  auto pixel = [&](uint32_t x, uint32_t y) { return frame[y * ppu_timing::SCREEN_WIDTH + x]; };
+  REQUIRE_SAME(0x0F, pixel(0, 0));
+  REQUIRE_SAME(0x21, pixel(16, 8));
+  REQUIRE_SAME(0x21, pixel(23, 15));
+  REQUIRE_SAME(0x0F, pixel(24, 8));
+  // Sprite 0 is in front and overlaps the tile from x = 16
+  REQUIRE_SAME(0x16, pixel(12, 10));
+  REQUIRE_SAME(0x16, pixel(16, 10));
+  REQUIRE_SAME(0x0F, pixel(12, 9));
+}
+
+TEST_CASE("PPU records the emphasis bits of each line") {
+  cores::mos6502::NesRom rom{makeTestRom("ppu_emphasis", 0, {}, 1, 0)};
+  Nes<Mapper0> nes{rom};
+  nes.bus().store(0x2001, 0xA0);
+  setCycles(nes, cycleAt(100, 0));
+  nes.bus().store(0x2001, 0x00);
+  nes.ppu().catchUp(cycleAt(240, 0));
+  const FrameView view = nes.ppu().frameView();
+  REQUIRE_TRUE(view.indices.data() == nes.ppu().frameBuffer().data());
+  REQUIRE_SAME(0x05, view.emphasis[0]);
+  REQUIRE_SAME(0x05, view.emphasis[99]);
+  REQUIRE_SAME(0x00, view.emphasis[100]);
+  REQUIRE_SAME(0x00, view.emphasis[239]);
+}
+
+TEST_CASE("PPU sprite overflow with and without the sprite table") {
+  for(bool table : {true, false}) {
+    cores::mos6502::NesRom rom{makeTestRom("ppu_overflow", 0, {})};
+    Nes<Mapper0> nes{rom};
+    nes.ppu().useSpriteTable(table);
+    // Everything off screen, then 9 sprites on lines 50-57
+    nes.bus().store(0x2003, 0x00);
+    for(uint32_t i = 0; i < 64; i++) {
+      for(uint8_t b : {uint8_t(i < 9 ? 49 : 0xF0), uint8_t(0), uint8_t(0), uint8_t(0)}) {
+        nes.bus().store(0x2004, b);
+      }
+    }
+    nes.bus().store(0x2001, 0x18);
+    setCycles(nes, cycleAt(50, 0) - 1);
+    REQUIRE_SAME(0x00, nes.bus().load(0x2002) & 0x20);
+    setCycles(nes, cycleAt(50, 0) + 1);
+    REQUIRE_SAME(0x20, nes.bus().load(0x2002) & 0x20);
+  }
+}
+
+TEST_CASE("PPU frame skip leaves emulation state untouched") {
+  // Polls $2002 for sprite 0, then pokes scroll, forever:
+  //   loop: BIT $2002 ; BVC loop ; INX ; STX $2005 ; STX $2005 ; JMP loop
+  std::vector<uint8_t> prg = {0x2C, 0x02, 0x20, 0x50, 0xFB, 0xE8, 0x8E, 0x05, 0x20,
+                              0x8E, 0x05, 0x20, 0x4C, 0x00, 0x80};
+  prg.resize(0x4000, 0xEA);
+  cores::mos6502::NesRom rom{makeTestRom("ppu_frame_skip", 0, prg, 1, 0)};
+  Nes<Mapper0> rendered{rom};
+  Nes<Mapper0> skipped{rom};
+  for(auto* nes : {&rendered, &skipped}) {
+    setupSprite0(*nes);
+    ppuPoke(*nes, 0x3F00, {0x0F, 0x21});
+    ppuPoke(*nes, 0x3F11, {0x16});
+    nes->cpu().setPC(0x8000);
+  }
+  skipped.ppu().setFrameSkip(0);
+
+  auto runTo = [](Nes<Mapper0>& nes, uint64_t frame) {
+    while(!(nes.ppu().frame() == frame && nes.ppu().scanline() >= ppu_timing::VBLANK_LINE)) {
+      nes.runCycle();
+    }
+  };
+  // Frame 0 was already underway when the policy changed and still renders
+  runTo(skipped, 0);
+  const std::vector<uint8_t> last(skipped.ppu().frameBuffer().begin(), skipped.ppu().frameBuffer().end());
+  for(uint64_t frame = 1; frame <= 3; frame++) {
+    runTo(rendered, frame);
+    runTo(skipped, frame);
+    REQUIRE_TRUE(std::memcmp(&rendered.arena(), &skipped.arena(), sizeof(rendered.arena())) == 0);
+  }
+  REQUIRE_TRUE(std::equal(last.begin(), last.end(), skipped.ppu().frameBuffer().begin()));
+
+  // On demand, the next frame is drawn exactly like the always-rendering run
+  skipped.ppu().renderNextFrame();
+  runTo(rendered, 4);
+  runTo(skipped, 4);
+  auto expected = rendered.ppu().frameBuffer();
+  REQUIRE_TRUE(std::equal(expected.begin(), expected.end(), skipped.ppu().frameBuffer().begin()));
+  REQUIRE_TRUE(std::count(expected.begin(), expected.end(), expected[0]) < static_cast<long>(expected.size()));
+}
@@ -0,0 +1,106 @@
+#include <nes/recorder.hpp>
+#include <framework/testing.hpp>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+auto readFile(const std::filesystem::path& path) -> std::vector<uint8_t> {
+  std::ifstream in(path, std::ios::binary);
+  return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+auto le32(const std::vector<uint8_t>& bytes, size_t offset) -> uint32_t {
+  return bytes[offset] | bytes[offset + 1] << 8 | bytes[offset + 2] << 16 | uint32_t(bytes[offset + 3]) << 24;
+}
+}
+
+TEST_CASE("Recorder writes Y4M frames and a WAV with its sizes filled in") {
+  const auto dir = std::filesystem::temp_directory_path();
+  Recorder::Options options;
+  options.video = dir / "twix_recording.y4m";
+  options.audio = dir / "twix_recording.wav";
+  options.sample_rate = 44100;
+  options.direct_io = true;
+
+  std::vector<uint8_t> indices(FrameView::WIDTH * FrameView::HEIGHT, 0x16);
+  std::array<uint8_t, FrameView::HEIGHT> emphasis{};
+  emphasis[1] = 0x01;
+  std::vector<int16_t> samples(1000);
+  for(size_t i = 0; i < samples.size(); i++) {
+    samples[i] = static_cast<int16_t>(i * 31 - 15000);
+  }
+  {
+    Recorder recorder{options};
+    for(uint32_t i = 0; i < 3; i++) {
+      REQUIRE_TRUE(recorder.pushFrame({indices, emphasis}));
+      REQUIRE_SAME(samples.size(), recorder.pushAudio(samples));
+    }
+    recorder.finish();
+    REQUIRE_SAME(3, recorder.framesWritten());
+    REQUIRE_SAME(0, recorder.droppedFrames());
+  }
+
+  const auto video = readFile(options.video);
+  const std::string header = recording::Y4M_HEADER;
+  REQUIRE_SAME(header.size() + 3 * Recorder::frameBytes(VideoFormat::Y4M), video.size());
+  REQUIRE_TRUE(std::equal(header.begin(), header.end(), video.begin()));
+  // Plays at the NTSC frame rate
+  const size_t rate = header.find(" F") + 2;
+  const size_t colon = header.find(':', rate);
+  const double fps = std::stod(header.substr(rate, colon - rate)) / std::stod(header.substr(colon + 1));
+  REQUIRE_TRUE(fps > 60.098 && fps < 60.0995);
+  // Line 1 is emphasized, line 0 isn't
+  const size_t y_plane = header.size() + std::strlen(recording::Y4M_FRAME);
+  REQUIRE_SAME(pixel_format::PLANES[pixel_format::Y][0][0x16], video[y_plane]);
+  REQUIRE_SAME(pixel_format::PLANES[pixel_format::Y][1][0x16], video[y_plane + FrameView::WIDTH]);
+  const size_t v_plane = y_plane + 2 * FrameView::WIDTH * FrameView::HEIGHT;
+  REQUIRE_SAME(pixel_format::PLANES[pixel_format::V][0][0x16], video[v_plane]);
+
+  const auto audio = readFile(options.audio);
+  const uint32_t data = 3 * samples.size() * 2;
+  REQUIRE_SAME(recording::WAV_HEADER_SIZE + data, audio.size());
+  REQUIRE_SAME(data + 36, le32(audio, 4));
+  REQUIRE_SAME(44100, le32(audio, 24));
+  REQUIRE_SAME(data, le32(audio, 40));
+  REQUIRE_SAME(static_cast<uint16_t>(samples[1]), audio[46] | audio[47] << 8);
+}
+
+TEST_CASE("Recorder counts the frames it drops behind a stalled pipe") {
+  int fds[2];
+  REQUIRE_SAME(0, ::pipe(fds));
+  Recorder::Options options;
+  options.video = "/dev/fd/" + std::to_string(fds[1]);
+  options.format = VideoFormat::INDICES;
+  options.queue_frames = 2;
+  Recorder recorder{options};
+  ::close(fds[1]);
+
+  // Nobody reads the pipe yet, so the writer blocks on its first block and
+  // the ring fills up
+  std::vector<uint8_t> indices(FrameView::WIDTH * FrameView::HEIGHT, 0x21);
+  std::array<uint8_t, FrameView::HEIGHT> emphasis{};
+  constexpr uint64_t pushed = 60;
+  for(uint64_t i = 0; i < pushed; i++) {
+    recorder.pushFrame({indices, emphasis});
+  }
+  REQUIRE_TRUE(recorder.droppedFrames() > 0);
+
+  uint64_t received = 0;
+  std::thread reader([&] {
+    char buffer[65536];
+    ssize_t got = 0;
+    while((got = ::read(fds[0], buffer, sizeof(buffer))) > 0) {
+      received += static_cast<uint64_t>(got);
+    }
+  });
+  // The reader sees end of file once the writer has flushed and closed
+  recorder.finish();
+  reader.join();
+  ::close(fds[0]);
+  REQUIRE_SAME(pushed, recorder.framesWritten() + recorder.droppedFrames());
+  REQUIRE_SAME(recorder.framesWritten() * Recorder::frameBytes(VideoFormat::INDICES), received);
+}
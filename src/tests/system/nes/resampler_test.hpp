@@ -0,0 +1,150 @@
+#include <nes/audio_ring.hpp>
+#include <nes/resampler.hpp>
+#include <framework/testing.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <numbers>
+#include <thread>
+#include <vector>
+
+namespace {
+auto sine(double frequency, double rate, size_t count, double amplitude) -> std::vector<int16_t> {
+  std::vector<int16_t> samples(count);
+  for(size_t i = 0; i < count; i++) {
+    samples[i] = static_cast<int16_t>(std::lround(amplitude * std::sin(2 * std::numbers::pi * frequency * i / rate)));
+  }
+  return samples;
+}
+
+// Pushes in in chunks the size of a frame and pulls everything out
+auto resampleAll(Resampler& resampler, const std::vector<int16_t>& in, size_t chunk) -> std::vector<int16_t> {
+  std::vector<int16_t> out;
+  std::vector<int16_t> buffer(chunk * 2);
+  for(size_t i = 0; i < in.size(); i += chunk) {
+    resampler.push(std::span(in).subspan(i, std::min(chunk, in.size() - i)));
+    const size_t count = resampler.pull(buffer);
+    out.insert(out.end(), buffer.begin(), buffer.begin() + count);
+  }
+  return out;
+}
+}
+
+TEST_CASE("Resampler keeps a tone's pitch and level from 48kHz to 44.1kHz") {
+  Resampler resampler{48000, 44100};
+  const auto in = sine(1000, 48000, 48000, 16000);
+  const auto out = resampleAll(resampler, in, 800);
+  // Everything but the last half kernel of input comes out
+  REQUIRE_TRUE(std::abs(int(out.size()) - int(44100 - resampler.taps() / 2 * 44100 / 48000)) <= 2);
+
+  uint32_t crossings = 0;
+  int32_t peak = 0;
+  for(size_t i = 1000; i < out.size(); i++) {
+    crossings += (out[i - 1] < 0) != (out[i] < 0);
+    peak = std::max<int32_t>(peak, std::abs(out[i]));
+  }
+  const double frequency = crossings / 2.0 / ((out.size() - 1000) / 44100.0);
+  REQUIRE_TRUE(std::abs(frequency - 1000) < 2);
+  REQUIRE_TRUE(std::abs(peak - 16000) < 160);
+}
+
+TEST_CASE("Resampler SIMD blends match the scalar one") {
+  const auto in = sine(3000, 48000, 9600, 30000);
+  Resampler reference{48000, 44100, 32, resample::blendScalar};
+  const auto expected = resampleAll(reference, in, 800);
+  // Downsampling widens the kernel, 72 taps here
+  Resampler down_reference{48000, 22050, 32, resample::blendScalar};
+  const auto expected_down = resampleAll(down_reference, in, 800);
+  std::vector<resample::BlendFn> blends = {resample::bestBlend()};
+#ifdef TWIX_RESAMPLE_X86
+  blends.push_back(resample::blendSse2);
+#endif
+  for(auto blend : blends) {
+    Resampler resampler{48000, 44100, 32, blend};
+    const auto out = resampleAll(resampler, in, 800);
+    REQUIRE_SAME(expected.size(), out.size());
+    for(size_t i = 0; i < out.size(); i++) {
+      REQUIRE_TRUE(std::abs(out[i] - expected[i]) <= 1);
+    }
+    Resampler down{48000, 22050, 32, blend};
+    const auto out_down = resampleAll(down, in, 800);
+    REQUIRE_SAME(expected_down.size(), out_down.size());
+    for(size_t i = 0; i < out_down.size(); i++) {
+      REQUIRE_TRUE(std::abs(out_down[i] - expected_down[i]) <= 1);
+    }
+  }
+}
+
+TEST_CASE("Resampler ratio moves within its adjustment range") {
+  const auto in = sine(440, 48000, 48000, 8000);
+  Resampler faster{48000, 48000};
+  faster.setRatio(1.01);
+  REQUIRE_TRUE(std::abs(faster.ratio() - 1.01) < 1e-6);
+  const auto out = resampleAll(faster, in, 800);
+  REQUIRE_TRUE(std::abs(double(out.size()) - (48000 - faster.taps() / 2) * 1.01) < 3);
+  // Clamped to MAX_ADJUST
+  faster.setRatio(2.0);
+  REQUIRE_TRUE(std::abs(faster.ratio() - (1 + Resampler::MAX_ADJUST)) < 1e-6);
+}
+
+TEST_CASE("AudioRing wraps, fills up and drains in order") {
+  AudioRing ring{100};
+  REQUIRE_SAME(128, ring.capacity());
+  std::vector<int16_t> in(100);
+  std::vector<int16_t> out(100);
+  for(int16_t round = 0; round < 5; round++) {
+    for(size_t i = 0; i < in.size(); i++) {
+      in[i] = static_cast<int16_t>(round * 100 + i);
+    }
+    REQUIRE_SAME(100, ring.write(in));
+    REQUIRE_SAME(100, ring.read(out));
+    REQUIRE_TRUE(in == out);
+  }
+  // Only what fits is queued
+  REQUIRE_SAME(100, ring.write(in));
+  REQUIRE_SAME(28, ring.write(in));
+  REQUIRE_SAME(128, ring.size());
+  REQUIRE_SAME(128, ring.discard());
+  REQUIRE_SAME(0, ring.size());
+  // A vector that never allocated, as the timing-only audio path hands over
+  REQUIRE_SAME(0, ring.write(std::vector<int16_t>{}));
+  REQUIRE_SAME(0, ring.size());
+}
+
+TEST_CASE("AudioRing hands samples across threads without losing any") {
+  AudioRing ring{256};
+  constexpr uint32_t total = 1 << 20;
+  bool ordered = true;
+  std::thread consumer([&] {
+    std::vector<int16_t> out(100);
+    uint32_t next = 0;
+    while(next < total) {
+      const size_t count = ring.read(out);
+      if(count == 0) {
+        std::this_thread::yield();
+      }
+      for(size_t i = 0; i < count; i++, next++) {
+        ordered &= out[i] == static_cast<int16_t>(next);
+      }
+    }
+  });
+  std::vector<int16_t> in(77);
+  uint32_t sent = 0;
+  while(sent < total) {
+    const size_t count = std::min<size_t>(in.size(), total - sent);
+    for(size_t i = 0; i < count; i++) {
+      in[i] = static_cast<int16_t>(sent + i);
+    }
+    size_t done = 0;
+    while(done < count) {
+      const size_t written = ring.write(std::span(in).subspan(done, count - done));
+      if(written == 0) {
+        std::this_thread::yield();
+      }
+      done += written;
+    }
+    sent += count;
+  }
+  consumer.join();
+  REQUIRE_TRUE(ordered);
+  REQUIRE_SAME(0, ring.size());
+}
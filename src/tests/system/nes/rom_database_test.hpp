@@ -0,0 +1,52 @@
+#include <cores/mos6502/romDatabase.hpp>
+#include <framework/testing.hpp>
+#include "test_rom.hpp"
+
+TEST_CASE("ROM database corrects a known bad header") {
+  auto rom_path = makeTestRom("db_known", 0, {0xA9, 0x01});
+  cores::mos6502::NesRom rom{rom_path};
+  REQUIRE_SAME(0, rom.getMapperNumber());
+  REQUIRE_TRUE(rom.getMirroring() == cores::mos6502::Mirroring::HORIZONTAL);
+
+  std::vector<cores::mos6502::RomDatabaseEntry> entries;
+  // Some unrelated records around the one we care about
+  for(uint32_t i = 0; i < 16; i++) {
+    cores::mos6502::RomDatabaseEntry other{};
+    other.crc32 = i * 0x10000001u;
+    entries.push_back(other);
+  }
+  cores::mos6502::RomDatabaseEntry known{};
+  known.crc32 = rom.getCrc32();
+  std::memcpy(known.sha1, rom.getSha1().data(), 20);
+  known.fix.mapper = 1;
+  known.fix.mirroring = static_cast<uint8_t>(cores::mos6502::Mirroring::VERTICAL);
+  known.fix.prg_ram_size = 0x2000;
+  known.fix.battery = 1;
+  entries.push_back(known);
+
+  auto db_path = std::filesystem::temp_directory_path() / "twix_romdb.bin";
+  cores::mos6502::RomDatabase::write(db_path, entries);
+  cores::mos6502::RomDatabase db{db_path};
+  REQUIRE_SAME(17, db.size());
+  REQUIRE_TRUE(db.correct(rom));
+  REQUIRE_SAME(1, rom.getMapperNumber());
+  REQUIRE_TRUE(rom.getMirroring() == cores::mos6502::Mirroring::VERTICAL);
+  REQUIRE_TRUE(rom.hasBatteryBackedRAM());
+
+  // Unknown dumps keep their header values
+  cores::mos6502::NesRom other{makeTestRom("db_unknown", 0, {0xA9, 0x02})};
+  REQUIRE_TRUE(!db.correct(other));
+  REQUIRE_TRUE(!other.hasOverride());
+
+  // A record with a mirroring value outside the enum is refused
+  cores::mos6502::HeaderOverride bad = known.fix;
+  bad.mirroring = 7;
+  bool threw = false;
+  try {
+    other.applyOverride(bad);
+  } catch(const cores::mos6502::NesRomException&) {
+    threw = true;
+  }
+  REQUIRE_TRUE(threw);
+  REQUIRE_TRUE(!other.hasOverride());
+}
@@ -0,0 +1,136 @@
+#include <nes/nes.hpp>
+#include <framework/testing.hpp>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include "test_rom.hpp"
+
+namespace {
+// loop: INC $10 ; LDA $10 ; STA $6000 ; JMP loop
+const std::vector<uint8_t> COUNTER_PRG = {0xE6, 0x10, 0xA5, 0x10, 0x8D, 0x00, 0x60, 0x4C, 0x00, 0x80};
+
+auto runTo(Nes<Mapper1>& nes, uint64_t cycle) -> void {
+  while(nes.arena().cpu.Cycles < cycle) {
+    nes.runCycle();
+  }
+}
+
+auto sameArena(const Nes<Mapper1>& a, const Nes<Mapper1>& b) -> bool {
+  return std::memcmp(&a.arena(), &b.arena(), sizeof(a.arena())) == 0;
+}
+}
+
+TEST_CASE("Save state round trip replays identically") {
+  cores::mos6502::NesRom rom{makeTestRom("save_state_round_trip", 1, COUNTER_PRG, 2)};
+  Nes<Mapper1> nes{rom};
+  nes.cpu().setPC(0x8000);
+  runTo(nes, 10000);
+
+  std::vector<uint8_t> state(nes.stateSize());
+  REQUIRE_SAME(state.size(), nes.saveState(state));
+  REQUIRE_SAME(0, state.size() % save_state::ALIGNMENT);
+  runTo(nes, 50000);
+  const auto expected = nes.arena();
+
+  nes.loadState(state);
+  REQUIRE_TRUE(nes.arena().cpu.Cycles < 50000);
+  runTo(nes, 50000);
+  REQUIRE_TRUE(std::memcmp(&expected, &nes.arena(), sizeof(expected)) == 0);
+
+  // Another instance of the same mapper takes the state as is
+  Nes<Mapper1> other{rom};
+  other.loadState(state);
+  runTo(other, 50000);
+  REQUIRE_TRUE(sameArena(nes, other));
+}
+
+TEST_CASE("A bad save state is refused and changes nothing") {
+  cores::mos6502::NesRom rom{makeTestRom("save_state_bad", 1, COUNTER_PRG, 2)};
+  Nes<Mapper1> nes{rom};
+  nes.cpu().setPC(0x8000);
+  runTo(nes, 5000);
+  std::vector<uint8_t> good(nes.stateSize());
+  nes.saveState(good);
+  runTo(nes, 20000);
+  const auto before = nes.arena();
+
+  auto refused = [&](const std::vector<uint8_t>& state) {
+    try {
+      nes.loadState(state);
+    } catch(const SaveStateException&) {
+      return std::memcmp(&before, &nes.arena(), sizeof(before)) == 0;
+    }
+    return false;
+  };
+  auto bad_magic = good;
+  bad_magic[0] = 'X';
+  REQUIRE_TRUE(refused(bad_magic));
+  auto bad_version = good;
+  bad_version[offsetof(save_state::Header, version)]++;
+  REQUIRE_TRUE(refused(bad_version));
+  REQUIRE_TRUE(refused(std::vector<uint8_t>(good.begin(), good.end() - 1)));
+  // A block whose struct has changed size: the last one, so it is still in range
+  auto resized = good;
+  save_state::Header header;
+  std::memcpy(&header, resized.data(), sizeof(header));
+  header.blocks[header.block_count - 1].size -= 1;
+  std::memcpy(resized.data(), &header, sizeof(header));
+  REQUIRE_TRUE(refused(resized));
+
+  nes.loadState(good);
+  REQUIRE_TRUE(nes.arena().cpu.Cycles < 20000);
+}
+
+TEST_CASE("A save state only loads into the ROM it was saved from") {
+  // NROM has no mapper state, only the header tells two games apart
+  cores::mos6502::NesRom rom{makeTestRom("save_state_rom_a", 0, {0xE6, 0x10, 0x4C, 0x00, 0x80})};
+  cores::mos6502::NesRom other_rom{makeTestRom("save_state_rom_b", 0, {0xE6, 0x11, 0x4C, 0x00, 0x80})};
+  Nes<Mapper0> nes{rom};
+  Nes<Mapper0> other{other_rom};
+  std::vector<uint8_t> state(nes.stateSize());
+  nes.saveState(state);
+  REQUIRE_SAME(nes.stateSize(), other.stateSize());
+  bool refused = false;
+  try {
+    other.loadState(state);
+  } catch(const SaveStateException&) {
+    refused = true;
+  }
+  REQUIRE_TRUE(refused);
+}
+
+TEST_CASE("Save states carry battery RAM kept in the save file") {
+  // LDA #$5A ; STA $6000
+  auto rom_path = makeTestRom("save_state_battery", 1, {0xA9, 0x5A, 0x8D, 0x00, 0x60}, 2, 1, 0x02);
+  auto save_path = std::filesystem::path(rom_path).replace_extension(".sav");
+  std::filesystem::remove(save_path);
+  cores::mos6502::NesRom rom{rom_path};
+  Nes<Mapper1> nes{rom, save_path};
+  REQUIRE_TRUE(nes.bus().hasSaveFile());
+  nes.cpu().setPC(0x8000);
+  nes.runCycle();
+  nes.runCycle();
+  std::vector<uint8_t> state(nes.stateSize());
+  nes.saveState(state);
+  REQUIRE_TRUE(save_state::find(save_state::readHeader(state), save_state::BATTERY) != nullptr);
+
+  nes.bus().store(0x6000, 0x11);
+  nes.loadState(state);
+  REQUIRE_SAME(0x5A, nes.bus().load(0x6000));
+
+  // Battery RAM has to be in the state exactly when there is a save file
+  Nes<Mapper1> without_file{rom};
+  REQUIRE_TRUE(!without_file.bus().hasSaveFile());
+  std::vector<uint8_t> plain(without_file.stateSize());
+  without_file.saveState(plain);
+  auto refused = [](auto& system, const std::vector<uint8_t>& in) {
+    try {
+      system.loadState(in);
+    } catch(const SaveStateException&) {
+      return true;
+    }
+    return false;
+  };
+  REQUIRE_TRUE(refused(without_file, state));
+  REQUIRE_TRUE(refused(nes, plain));
+}
@@ -0,0 +1,136 @@
+#include <nes/scaler.hpp>
+#include <framework/testing.hpp>
+#include <utils/thread_pool.hpp>
+#include <random>
+#include <vector>
+
+namespace {
+struct ScalerFrame {
+  std::vector<uint8_t> indices = std::vector<uint8_t>(FrameView::WIDTH * FrameView::HEIGHT);
+  std::array<uint8_t, FrameView::HEIGHT> emphasis{};
+
+  auto view() const -> FrameView { return {indices, emphasis}; }
+  auto at(uint32_t x, uint32_t y) -> uint8_t& { return indices[y * FrameView::WIDTH + x]; }
+};
+
+// Few colors in small runs, so the edge rules actually fire
+auto blockyFrame(uint32_t seed) -> ScalerFrame {
+  std::mt19937 rng{seed};
+  ScalerFrame frame;
+  const uint8_t colors[4] = {0x0F, 0x16, 0x21, 0x30};
+  for(auto& index : frame.indices) {
+    index = colors[rng() % 4];
+  }
+  for(auto& e : frame.emphasis) {
+    e = rng() & 0x07;
+  }
+  return frame;
+}
+
+auto scaled(const ScalerFrame& frame, ScaleFilter filter, uint32_t factor,
+            const scaler::Kernels& kernels = scaler::bestKernels()) -> std::vector<uint8_t> {
+  scaler::Workspace ws;
+  const size_t pitch = FrameView::WIDTH * factor * 4;
+  std::vector<uint8_t> out(pitch * FrameView::HEIGHT * factor);
+  scaler::scale(frame.view(), filter, factor, 0, FrameView::HEIGHT, out, pitch, ws, kernels);
+  return out;
+}
+
+auto rgbaOf(uint8_t index) -> uint32_t {
+  return pixel_format::RGBA_WORDS[0][index];
+}
+
+auto pixelAt(const std::vector<uint8_t>& out, uint32_t factor, uint32_t x, uint32_t y) -> uint32_t {
+  uint32_t pixel = 0;
+  std::memcpy(&pixel, &out[(size_t(y) * FrameView::WIDTH * factor + x) * 4], 4);
+  return pixel;
+}
+}
+
+TEST_CASE("Nearest scaling repeats every pixel") {
+  ScalerFrame frame = blockyFrame(40);
+  std::fill(frame.emphasis.begin(), frame.emphasis.end(), 0);
+  auto out = scaled(frame, ScaleFilter::NEAREST, 3);
+  for(uint32_t y : {0u, 100u, 239u}) {
+    for(uint32_t x : {0u, 17u, 255u}) {
+      for(uint32_t sub = 0; sub < 9; sub++) {
+        REQUIRE_SAME(rgbaOf(frame.at(x, y)), pixelAt(out, 3, x * 3 + sub % 3, y * 3 + sub / 3));
+      }
+    }
+  }
+}
+
+TEST_CASE("Scale2x and xBR round a diagonal edge") {
+  // A staircase: color 0x16 above the diagonal, 0x0F below
+  ScalerFrame frame;
+  for(uint32_t y = 0; y < FrameView::HEIGHT; y++) {
+    for(uint32_t x = 0; x < FrameView::WIDTH; x++) {
+      frame.at(x, y) = x > y ? 0x16 : 0x0F;
+    }
+  }
+  // Pixel (11, 10) is 0x16 with 0x0F left and below: its bottom left corner
+  // takes the other color in Scale2x and is blended halfway in xBR
+  auto epx = scaled(frame, ScaleFilter::SCALE2X, 2);
+  REQUIRE_SAME(rgbaOf(0x0F), pixelAt(epx, 2, 22, 21));
+  REQUIRE_SAME(rgbaOf(0x16), pixelAt(epx, 2, 23, 20));
+  auto xbr = scaled(frame, ScaleFilter::XBR, 2);
+  const uint32_t corner = pixelAt(xbr, 2, 22, 21);
+  REQUIRE_TRUE(corner != rgbaOf(0x0F) && corner != rgbaOf(0x16));
+  REQUIRE_SAME(rgbaOf(0x16), pixelAt(xbr, 2, 23, 20));
+  // Flat areas are left alone
+  REQUIRE_SAME(rgbaOf(0x0F), pixelAt(xbr, 2, 0, 200));
+}
+
+TEST_CASE("Scaler SIMD kernels match the scalar reference") {
+  const ScalerFrame frame = blockyFrame(41);
+  const std::pair<ScaleFilter, uint32_t> configs[] = {
+    {ScaleFilter::NEAREST, 1}, {ScaleFilter::NEAREST, 4}, {ScaleFilter::SCALE2X, 2}, {ScaleFilter::SCALE2X, 4},
+    {ScaleFilter::SCALE3X, 3}, {ScaleFilter::XBR, 2}, {ScaleFilter::XBR, 4},
+  };
+  for(auto [filter, factor] : configs) {
+    REQUIRE_TRUE(scaled(frame, filter, factor, scaler::SCALAR_KERNELS) == scaled(frame, filter, factor));
+  }
+}
+
+TEST_CASE("Scaler rejects factors the filter can't do") {
+  ScalerFrame frame;
+  scaler::Workspace ws;
+  std::vector<uint8_t> out(FrameView::WIDTH * 3 * FrameView::HEIGHT * 3 * 4);
+  bool threw = false;
+  try {
+    scaler::scale(frame.view(), ScaleFilter::SCALE2X, 3, 0, FrameView::HEIGHT, out, FrameView::WIDTH * 3 * 4, ws);
+  } catch(const std::invalid_argument&) {
+    threw = true;
+  }
+  REQUIRE_TRUE(threw);
+}
+
+TEST_CASE("Frame scaler on the thread pool matches a direct run") {
+  Components::ThreadPool pool{4};
+  FrameScaler frame_scaler{pool, ScaleFilter::XBR, 4, 5};
+  const ScalerFrame frame = blockyFrame(42);
+  std::vector<uint8_t> out(frame_scaler.pitch() * frame_scaler.height());
+  frame_scaler.submit(frame.view(), 7);
+  frame_scaler.waitIdle();
+  REQUIRE_SAME(7, frame_scaler.latestFrame(out));
+  REQUIRE_TRUE(out == scaled(frame, ScaleFilter::XBR, 4));
+}
+
+TEST_CASE("Frame scaler keeps returning the newest frame across reads") {
+  Components::ThreadPool pool{4};
+  FrameScaler frame_scaler{pool, ScaleFilter::NEAREST, 2, 3};
+  const ScalerFrame first = blockyFrame(1);
+  const ScalerFrame second = blockyFrame(2);
+  std::vector<uint8_t> out(frame_scaler.pitch() * frame_scaler.height());
+  // Each read hands the reader a different buffer, a repeat read must still
+  // see the same image
+  for(auto [frame, number] : {std::pair{&first, 1}, std::pair{&second, 2}, std::pair{&first, 3}}) {
+    frame_scaler.submit(frame->view(), number);
+    frame_scaler.waitIdle();
+    for(int read = 0; read < 2; read++) {
+      std::fill(out.begin(), out.end(), 0);
+      REQUIRE_SAME(number, frame_scaler.latestFrame(out));
+      REQUIRE_TRUE(out == scaled(*frame, ScaleFilter::NEAREST, 2));
+    }
+  }
+}
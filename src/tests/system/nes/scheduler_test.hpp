@@ -0,0 +1,203 @@
+#include <nes/cooperative.hpp>
+#include <nes/nes.hpp>
+#include <framework/testing.hpp>
+#include <cstring>
+#include <vector>
+#include "test_rom.hpp"
+
+namespace {
+// $C000: SEI ; frame IRQ off ; DMC 65 bytes at rate 15 if dmc ; NMI on
+//        loop: LDA $2002 ; INC $00 ; JMP loop
+// $C080 NMI: INC $01 ; OAM DMA from $0200 ; pulse 1 timer = $01 ; restart DMC ; RTI
+auto schedulerRom(const std::string& name, bool dmc) -> std::filesystem::path {
+  std::vector<uint8_t> prg(0x4000, 0xEA);
+  const std::vector<uint8_t> main = {
+    0x78, 0xA9, 0x40, 0x8D, 0x17, 0x40, 0xA9, 0x04, 0x8D, 0x13, 0x40, 0xA9, 0x0F, 0x8D, 0x10, 0x40,
+    0xA9, static_cast<uint8_t>(dmc ? 0x10 : 0x00), 0x8D, 0x15, 0x40, 0xA9, 0x80, 0x8D, 0x00, 0x20,
+    0xAD, 0x02, 0x20, 0xE6, 0x00, 0x4C, 0x1A, 0xC0,
+  };
+  const std::vector<uint8_t> nmi = {
+    0xE6, 0x01, 0xA9, 0x02, 0x8D, 0x14, 0x40, 0xA5, 0x01, 0x8D, 0x02, 0x40,
+    0xA9, static_cast<uint8_t>(dmc ? 0x10 : 0x00), 0x8D, 0x15, 0x40, 0x40,
+  };
+  std::copy(main.begin(), main.end(), prg.begin());
+  std::copy(nmi.begin(), nmi.end(), prg.begin() + 0x80);
+  prg[0x3FFA] = 0x80;
+  prg[0x3FFB] = 0xC0;
+  return makeTestRom(name, 0, prg, 1, 0);
+}
+}
+
+TEST_CASE("Scheduler next follows the earliest slot") {
+  Scheduler scheduler;
+  const uint64_t& next = scheduler.next();
+  REQUIRE_SAME(Scheduler::NEVER, next);
+  scheduler.schedule(SystemEvent::PPU_SYNC, 1000);
+  scheduler.schedule(SystemEvent::APU, 500);
+  REQUIRE_SAME(500, next);
+  // Rescheduling a slot replaces it, later or earlier
+  scheduler.schedule(SystemEvent::APU, 2000);
+  REQUIRE_SAME(1000, next);
+  REQUIRE_TRUE(scheduler.due(SystemEvent::PPU_SYNC, 1000));
+  REQUIRE_TRUE(!scheduler.due(SystemEvent::APU, 1000));
+  scheduler.cancel(SystemEvent::PPU_SYNC);
+  REQUIRE_SAME(2000, next);
+}
+
+TEST_CASE("Batched runs match running instruction by instruction") {
+  cores::mos6502::NesRom rom{schedulerRom("scheduler_dmc", true)};
+  Nes<Mapper0> stepped{rom};
+  Nes<Mapper0> batched{rom};
+  stepped.cpu().setPC(0xC000);
+  batched.cpu().setPC(0xC000);
+  // Ten frames in uneven pieces, so run ends fall anywhere
+  constexpr uint64_t end = 300000;
+  for(uint64_t until = 12345; until < end + 12345; until += 12345) {
+    batched.runUntil(std::min(until, end));
+  }
+  while(stepped.arena().cpu.Cycles < end) {
+    stepped.runCycle();
+  }
+  REQUIRE_SAME(stepped.arena().cpu.Cycles, batched.arena().cpu.Cycles);
+  REQUIRE_SAME(stepped.arena().cpu.PC, batched.arena().cpu.PC);
+  REQUIRE_TRUE(batched.bus().load(0x0001) >= 9);
+  REQUIRE_TRUE(std::memcmp(&stepped.arena(), &batched.arena(), sizeof(stepped.arena())) == 0);
+}
+
+TEST_CASE("A frame with NMI and OAM DMA takes a handful of batches") {
+  cores::mos6502::NesRom rom{schedulerRom("scheduler_quiet", false)};
+  Nes<Mapper0> nes{rom};
+  nes.cpu().setPC(0xC000);
+  nes.runUntil(29781);
+  const uint64_t before = nes.batches();
+  nes.runUntil(29781 * 11);
+  // The $2002 polling can suppress one now and then
+  REQUIRE_TRUE(nes.bus().load(0x0001) >= 9);
+  // VBlank, pre-render, the DMA and the odd run end
+  REQUIRE_TRUE(nes.batches() - before <= 10 * 4);
+}
+
+TEST_CASE("Cooperative threads always resume the one furthest behind") {
+  Components::CoScheduler scheduler;
+  std::vector<int> order;
+  auto thread = [&](int name, uint64_t ticks) -> Components::CoThread {
+    for(;;) {
+      order.push_back(name);
+      co_await scheduler.step(name, ticks);
+    }
+  };
+  scheduler.add(thread(0, 3));
+  scheduler.add(thread(1, 2));
+  scheduler.runUntil(6);
+  // Clocks 0/0, 3/0, 3/2, 3/4, 6/4, 6/6; ties go to thread 0
+  REQUIRE_TRUE(order == std::vector<int>({0, 1, 1, 0, 1}));
+  REQUIRE_SAME(6, scheduler.clock(0));
+  REQUIRE_SAME(6, scheduler.clock(1));
+}
+
+TEST_CASE("Cooperative mode matches the batched model") {
+  cores::mos6502::NesRom rom{schedulerRom("scheduler_cooperative", true)};
+  Nes<Mapper0> batched{rom};
+  CooperativeNes<Mapper0> cooperative{rom};
+  batched.cpu().setPC(0xC000);
+  cooperative.nes().cpu().setPC(0xC000);
+  batched.runUntil(100000);
+  cooperative.runUntil(100000);
+  // The PPU and APU threads have visited every cycle
+  REQUIRE_SAME(100000, cooperative.scheduler().clock(decltype(cooperative)::PPU));
+  REQUIRE_SAME(100000, cooperative.scheduler().clock(decltype(cooperative)::APU));
+  // The CPU stops at the first instruction boundary past the end either way.
+  // The batched PPU and APU lag behind it until synchronised.
+  for(auto* nes : {&batched, &cooperative.nes()}) {
+    nes->ppu().sync();
+    nes->apu().endFrame();
+  }
+  const auto& arena = cooperative.nes().arena();
+  REQUIRE_SAME(batched.arena().cpu.Cycles, arena.cpu.Cycles);
+  REQUIRE_TRUE(std::memcmp(&batched.arena(), &arena, sizeof(arena)) == 0);
+  std::vector<int16_t> expected(batched.apu().samplesAvailable());
+  std::vector<int16_t> samples(cooperative.nes().apu().samplesAvailable());
+  REQUIRE_SAME(expected.size(), samples.size());
+  batched.apu().readSamples(expected);
+  cooperative.nes().apu().readSamples(samples);
+  REQUIRE_TRUE(expected == samples);
+}
+
+TEST_CASE("runFrame stops at each VBlank, batched or traced") {
+  cores::mos6502::NesRom rom{schedulerRom("scheduler_frames", true)};
+  Nes<Mapper0> batched{rom};
+  Nes<Mapper0> traced{rom};
+  batched.cpu().setPC(0xC000);
+  traced.cpu().setPC(0xC000);
+  uint64_t traced_instructions = 0;
+  for(uint64_t frame = 0; frame < 5; frame++) {
+    batched.runFrame();
+    traced.runFrame([&](auto&) { traced_instructions++; });
+    REQUIRE_SAME(frame, batched.ppu().frame());
+    REQUIRE_TRUE(batched.ppu().scanline() >= ppu_timing::VBLANK_LINE);
+    REQUIRE_SAME(batched.arena().cpu.Cycles, traced.arena().cpu.Cycles);
+  }
+  REQUIRE_SAME(traced_instructions, traced.instructions());
+  REQUIRE_SAME(batched.instructions(), traced.instructions());
+}
+
+TEST_CASE("A masked IRQ doesn't break up batches") {
+  // $C000: SEI ; frame IRQ on ; count $00 round 64 times into $02 ; CLI
+  //        loop: INC $03 ; JMP loop
+  // $C080 IRQ: INC $01 ; LDA $4015 ; RTI
+  std::vector<uint8_t> prg(0x4000, 0xEA);
+  const std::vector<uint8_t> main = {
+    0x78, 0xA9, 0x00, 0x8D, 0x17, 0x40, 0xE6, 0x00, 0xD0, 0xFC, 0xE6, 0x02, 0xA5, 0x02, 0xC9, 0x40,
+    0xD0, 0xF4, 0x58, 0xE6, 0x03, 0x4C, 0x13, 0xC0,
+  };
+  const std::vector<uint8_t> irq = {0xE6, 0x01, 0xAD, 0x15, 0x40, 0x40};
+  std::copy(main.begin(), main.end(), prg.begin());
+  std::copy(irq.begin(), irq.end(), prg.begin() + 0x80);
+  prg[0x3FFE] = 0x80;
+  prg[0x3FFF] = 0xC0;
+  cores::mos6502::NesRom rom{makeTestRom("scheduler_masked_irq", 0, prg, 1, 0)};
+  Nes<Mapper0> stepped{rom};
+  Nes<Mapper0> batched{rom};
+  stepped.cpu().setPC(0xC000);
+  batched.cpu().setPC(0xC000);
+  // The frame IRQ is up from the end of the first frame, and masked
+  constexpr uint64_t masked_end = 29781 * 4;
+  batched.runUntil(masked_end);
+  REQUIRE_TRUE(batched.bus().irq());
+  REQUIRE_SAME(0, batched.bus().load(0x0001));
+  REQUIRE_TRUE(batched.batches() <= 4 * 4);
+  // Once CLI runs it is taken at the same instruction as when stepping
+  constexpr uint64_t end = 29781 * 10;
+  batched.runUntil(end);
+  while(stepped.arena().cpu.Cycles < end) {
+    stepped.runCycle();
+  }
+  REQUIRE_TRUE(batched.bus().load(0x0001) > 0);
+  REQUIRE_SAME(stepped.arena().cpu.Cycles, batched.arena().cpu.Cycles);
+  REQUIRE_TRUE(std::memcmp(&stepped.arena(), &batched.arena(), sizeof(stepped.arena())) == 0);
+}
+
+TEST_CASE("Restoring a checkpoint reschedules events on its timeline") {
+  cores::mos6502::NesRom rom{schedulerRom("scheduler_restore", true)};
+  Nes<Mapper0> fresh{rom};
+  Nes<Mapper0> restored{rom};
+  fresh.cpu().setPC(0xC000);
+  restored.cpu().setPC(0xC000);
+  Nes<Mapper0>::Arena start{};
+  restored.checkpoint(start);
+  fresh.bus().reschedule();
+  // Into the middle of the second frame, past the first NMI
+  restored.runUntil(29781 + 15000);
+  restored.restore(start);
+  for(auto event : {SystemEvent::PPU_SYNC, SystemEvent::APU, SystemEvent::MAPPER_IRQ, SystemEvent::DMA}) {
+    REQUIRE_SAME(fresh.bus().scheduler().at(event), restored.bus().scheduler().at(event));
+  }
+  // NMIs come on the same cycles as in a run that never went ahead
+  for(uint64_t frame = 1; frame <= 3; frame++) {
+    fresh.runFrame();
+    restored.runFrame();
+    REQUIRE_SAME(fresh.arena().cpu.Cycles, restored.arena().cpu.Cycles);
+    REQUIRE_SAME(fresh.bus().load(0x0001), restored.bus().load(0x0001));
+  }
+  REQUIRE_TRUE(std::memcmp(&fresh.arena(), &restored.arena(), sizeof(fresh.arena())) == 0);
+}
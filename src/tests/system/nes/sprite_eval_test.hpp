@@ -0,0 +1,56 @@
+#include <nes/sprite_eval.hpp>
+#include <framework/testing.hpp>
+#include <random>
+
+TEST_CASE("Sprite evaluation SIMD mask matches the scalar scan") {
+  std::mt19937 rng{42};
+  std::array<uint8_t, 256> oam{};
+  for(int round = 0; round < 50; round++) {
+    for(auto& b : oam) {
+      b = rng() & 0xFF;
+    }
+    // Edge rows: top of screen, last visible line and the hidden y values
+    oam[0] = 0;
+    oam[4] = 238;
+    oam[8] = 239;
+    oam[12] = 255;
+    for(uint32_t height : {8u, 16u}) {
+      for(uint32_t line = 0; line < 240; line++) {
+        const uint64_t expected = sprite_eval::inRangeScalar(oam.data(), line, height);
+        REQUIRE_SAME(expected, sprite_eval::inRange(oam.data(), line, height));
+#ifdef TWIX_SPRITE_EVAL_X86
+        if(Components::cpuFeatures().sse41) {
+          REQUIRE_SAME(expected, sprite_eval::inRangeSse41(oam.data(), line, height));
+        }
+#endif
+      }
+    }
+  }
+}
+
+TEST_CASE("Sprite table agrees with per-line evaluation") {
+  std::mt19937 rng{7};
+  std::array<uint8_t, 256> oam{};
+  for(auto& b : oam) {
+    b = rng() & 0xFF;
+  }
+  // Crowd lines 100-107 so the 8 sprite limit and overflow count kick in
+  for(uint32_t i = 10; i < 22; i++) {
+    oam[i * 4] = 99;
+  }
+  SpriteTable table;
+  for(uint32_t height : {8u, 16u}) {
+    table.build(oam.data(), height);
+    for(uint32_t line = 0; line < 240; line++) {
+      const SpriteLine expected = SpriteLine::fromMask(sprite_eval::inRangeScalar(oam.data(), line, height));
+      const SpriteLine& actual = table.lines[line];
+      REQUIRE_SAME(expected.in_range, actual.in_range);
+      REQUIRE_SAME(expected.count, actual.count);
+      for(uint32_t n = 0; n < expected.count; n++) {
+        REQUIRE_SAME(expected.index[n], actual.index[n]);
+      }
+    }
+  }
+  REQUIRE_TRUE(table.lines[100].in_range >= 12);
+  REQUIRE_SAME(8, table.lines[100].count);
+}
@@ -0,0 +1,19 @@
+#include <framework/testing.hpp>
+#include "arena_test.hpp"
+#include "rom_database_test.hpp"
+#include "chr_cache_test.hpp"
+#include "compositor_test.hpp"
+#include "pixel_format_test.hpp"
+#include "ntsc_filter_test.hpp"
+#include "scaler_test.hpp"
+#include "recorder_test.hpp"
+#include "apu_test.hpp"
+#include "resampler_test.hpp"
+#include "dma_test.hpp"
+#include "nsf_test.hpp"
+#include "scheduler_test.hpp"
+#include "save_state_test.hpp"
+#include "sprite_eval_test.hpp"
+#include "deferred_renderer_test.hpp"
+#include "nametable_test.hpp"
+#include "ppu_test.hpp"
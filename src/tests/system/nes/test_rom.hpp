@@ -0,0 +1,25 @@
+#pragma once
+#include <cores/mos6502/nesRom.hpp>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Writes a minimal iNES image to the temp directory so the system can be built
+// from a real NesRom. PRG is padded to whole 16KB banks, CHR is zero filled.
+inline auto makeTestRom(const std::string& name, uint8_t mapper, std::vector<uint8_t> prg,
+                        uint8_t prg_banks = 1, uint8_t chr_banks = 1, uint8_t flags6 = 0)
+    -> std::filesystem::path {
+  auto path = std::filesystem::temp_directory_path() / ("twix_" + name + ".nes");
+  prg.resize(prg_banks * 16384, 0xEA);
+  std::vector<uint8_t> chr(chr_banks * 8192, 0);
+  uint8_t header[16] = {'N', 'E', 'S', 0x1A, prg_banks, chr_banks,
+                        static_cast<uint8_t>(flags6 | ((mapper & 0x0F) << 4)),
+                        static_cast<uint8_t>(mapper & 0xF0), 0, 0, 0, 0, 0, 0, 0, 0};
+  std::ofstream out(path, std::ios::binary);
+  out.write(reinterpret_cast<const char*>(header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(prg.data()), prg.size());
+  out.write(reinterpret_cast<const char*>(chr.data()), chr.size());
+  return path;
+}
@@ -0,0 +1,91 @@
+// Times the APU with band-limited synthesis and with TimingOnlyAudio on the
+// same register traffic: music on the four tone channels with a looping DMC
+// sample, a few writes and a $4015 poll per frame. Prints the mean time per
+// emulated frame for each.
+#include <nes/apu.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr uint64_t FRAME_CYCLES = 29781;
+
+struct SampleRom {
+    auto read(uint16_t address) -> uint8_t {
+        return static_cast<uint8_t>(address * 37);
+    }
+};
+
+template<typename Audio>
+auto run(int frames, uint64_t& checksum) -> double {
+    ApuState state{};
+    SampleRom rom;
+    uint64_t clock = 0;
+    Apu<SampleRom, Audio> apu{state, rom, clock};
+    std::mt19937 rng{2026};
+    std::vector<int16_t> samples(4096);
+
+    const auto write = [&](uint16_t address, uint8_t data) { apu.writeRegister(address, data); };
+    write(0x4017, 0x00);
+    write(0x4015, 0x1F);
+    write(0x4000, 0xBF);
+    write(0x4004, 0x7F);
+    write(0x4008, 0xFF);
+    write(0x400C, 0x3F);
+    write(0x4010, 0x4C);  // Looping, rate 12
+    write(0x4012, 0x00);
+    write(0x4013, 0x20);
+    write(0x4015, 0x1F);
+
+    const auto start = std::chrono::steady_clock::now();
+    for(int frame = 0; frame < frames; frame++) {
+        const uint64_t frame_start = clock;
+        // A new note on every channel now and then, like a music driver
+        for(uint16_t channel : {0x4000, 0x4004, 0x4008, 0x400C}) {
+            clock = frame_start + rng() % 2000;
+            write(channel + 2, static_cast<uint8_t>(rng()));
+            if(rng() % 8 == 0) {
+                write(channel + 3, static_cast<uint8_t>(rng() & 0xF9));
+            }
+        }
+        clock = frame_start + 2500;
+        checksum += apu.readStatus();
+        // The system catches up at every event, then at frame end
+        while(apu.nextEventCycle() < frame_start + FRAME_CYCLES) {
+            clock = apu.nextEventCycle();
+            apu.sync();
+            checksum += apu.irq();
+            if(apu.irq()) {
+                checksum += apu.readStatus();
+            }
+        }
+        clock = frame_start + FRAME_CYCLES;
+        apu.endFrame();
+        checksum += apu.readSamples(samples);
+    }
+    const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / frames;
+}
+
+}
+
+auto main(int argc, char** argv) -> int {
+    const int frames = argc > 1 ? std::atoi(argv[1]) : 3000;
+    uint64_t checksum = 0;
+    // Best of a few runs, the first one also warms up the kernel tables
+    double synthesis = 1e9;
+    double timing = 1e9;
+    for(int i = 0; i < 5; i++) {
+        synthesis = std::min(synthesis, run<BandLimitedAudio>(frames, checksum));
+        timing = std::min(timing, run<TimingOnlyAudio>(frames, checksum));
+    }
+    std::cout << "band-limited: " << synthesis << " us/frame\n"
+              << "timing only: " << timing << " us/frame (" << synthesis / timing << "x)\n"
+              << "checksum " << checksum << "\n";
+    return 0;
+}
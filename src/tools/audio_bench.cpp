@@ -0,0 +1,182 @@
+// Audio path from the APU to a 44.1kHz consumer. First times the resampler
+// on ten seconds of APU output with every blend this CPU can run, then runs
+// the whole path in real time: the emulation side produces a frame of
+// samples every 1/60s, resamples them into an AudioRing with the ratio
+// steering the queue towards a target, and a consumer thread standing in
+// for an audio device drains it in 10ms periods on a clock 0.2% fast.
+// Prints the CPU cost per second of audio and the latency along the way.
+#include <nes/apu.hpp>
+#include <nes/audio_ring.hpp>
+#include <nes/resampler.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr double INPUT_RATE = 48000;
+constexpr double OUTPUT_RATE = 44100;
+constexpr double FRAME_RATE = apu_timing::CPU_CLOCK / 29780.5;
+
+struct SampleRom {
+    auto read(uint16_t address) -> uint8_t {
+        return static_cast<uint8_t>(address * 37);
+    }
+};
+
+// Some APU output to work on: a chord on the pulses and triangle over a
+// looping DMC sample
+struct Source {
+    ApuState state{};
+    SampleRom rom;
+    uint64_t clock = 0;
+    Apu<SampleRom> apu{state, rom, clock, static_cast<uint32_t>(INPUT_RATE)};
+    uint64_t frame = 0;
+
+    Source() {
+        const uint8_t writes[][2] = {
+            {0x15, 0x1F}, {0x00, 0xBF}, {0x02, 0xFD}, {0x03, 0x08}, {0x04, 0x7A}, {0x06, 0xA9},
+            {0x07, 0x08}, {0x08, 0xFF}, {0x0A, 0x7E}, {0x0B, 0x09}, {0x10, 0x4C}, {0x13, 0x20}, {0x15, 0x1F},
+        };
+        for(const auto& write : writes) {
+            apu.writeRegister(0x4000 | write[0], write[1]);
+        }
+    }
+
+    auto nextFrame(std::vector<int16_t>& out) -> void {
+        frame++;
+        clock = static_cast<uint64_t>(frame * apu_timing::CPU_CLOCK / FRAME_RATE);
+        apu.endFrame();
+        out.resize(apu.samplesAvailable());
+        out.resize(apu.readSamples(out));
+    }
+};
+
+struct Blend {
+    std::string name;
+    resample::BlendFn fn;
+};
+
+auto blends() -> std::vector<Blend> {
+    std::vector<Blend> list{{"scalar", resample::blendScalar}};
+#ifdef TWIX_RESAMPLE_X86
+    list.push_back({"sse2", resample::blendSse2});
+    if(Components::cpuFeatures().avx2 && Components::cpuFeatures().fma) {
+        list.push_back({"avx2", resample::blendAvx2});
+    }
+#endif
+    return list;
+}
+
+auto timeResampler(const std::vector<int16_t>& input) -> void {
+    const double seconds = input.size() / INPUT_RATE;
+    std::vector<int16_t> out(4096);
+    for(const Blend& blend : blends()) {
+        double best = 1e9;
+        for(int run = 0; run < 3; run++) {
+            Resampler resampler{INPUT_RATE, OUTPUT_RATE, 32, blend.fn};
+            const auto start = std::chrono::steady_clock::now();
+            for(size_t i = 0; i < input.size(); i += 800) {
+                resampler.push(std::span(input).subspan(i, std::min<size_t>(800, input.size() - i)));
+                resampler.pull(out);
+            }
+            const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        std::cout << "resample " << blend.name << ": " << best / seconds << " us per second of audio ("
+                  << seconds * 1e6 / best << "x real time)\n";
+    }
+}
+
+auto runRealTime(double seconds) -> void {
+    using clock = std::chrono::steady_clock;
+    constexpr size_t PERIOD = 441;
+    constexpr double TARGET_MS = 30;
+    AudioRing ring{static_cast<size_t>(OUTPUT_RATE / 5)};
+    Resampler resampler{INPUT_RATE, OUTPUT_RATE};
+    Source source;
+
+    std::atomic<bool> running{true};
+    // Device thread only, read after it has been joined
+    uint64_t underruns = 0;
+    uint64_t periods = 0;
+    uint64_t queued_total = 0;
+    size_t queued_max = 0;
+    // Wait for the queue to reach its target before playing, like a device
+    // would be started
+    std::thread device([&] {
+        std::vector<int16_t> out(PERIOD);
+        while(running.load() && ring.size() < TARGET_MS * OUTPUT_RATE / 1000) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        const auto period = std::chrono::duration<double>(PERIOD / (OUTPUT_RATE * 1.002));
+        auto next = clock::now();
+        while(running.load()) {
+            const size_t queued = ring.size();
+            queued_total += queued;
+            queued_max = std::max(queued_max, queued);
+            if(ring.read(out) < PERIOD) {
+                underruns++;
+            }
+            periods++;
+            next += std::chrono::duration_cast<clock::duration>(period);
+            std::this_thread::sleep_until(next);
+        }
+    });
+
+    std::vector<int16_t> frame;
+    std::vector<int16_t> out(2048);
+    uint64_t dropped = 0;
+    double ratio_min = resampler.nominalRatio();
+    double ratio_max = ratio_min;
+    const auto frame_period = std::chrono::duration<double>(1 / FRAME_RATE);
+    const auto start = clock::now();
+    auto next = start;
+    for(uint64_t frames = 0; frames < seconds * FRAME_RATE; frames++) {
+        source.nextFrame(frame);
+        // Steer the queue towards its target, half a percent at most
+        const double error = (TARGET_MS - ring.size() * 1000 / OUTPUT_RATE) / TARGET_MS;
+        resampler.setRatio(resampler.nominalRatio() * (1 + 0.005 * std::clamp(error, -1.0, 1.0)));
+        ratio_min = std::min(ratio_min, resampler.ratio());
+        ratio_max = std::max(ratio_max, resampler.ratio());
+        resampler.push(frame);
+        const size_t count = resampler.pull(out);
+        dropped += count - ring.write(std::span(out.data(), count));
+        next += std::chrono::duration_cast<clock::duration>(frame_period);
+        std::this_thread::sleep_until(next);
+    }
+    running.store(false);
+    device.join();
+
+    const double blip_ms = BlipBuffer::TAPS / 2 * 1000 / INPUT_RATE;
+    const double filter_ms = resampler.delay() * 1000;
+    const double queue_ms = periods ? queued_total * 1000 / OUTPUT_RATE / periods : 0;
+    std::cout << "real time " << seconds << "s, device 0.2% fast: " << periods << " periods, "
+              << underruns << " underruns, " << dropped << " samples dropped\n"
+              << "latency: band limit " << blip_ms << "ms + resampler " << filter_ms << "ms + queue "
+              << queue_ms << "ms mean (" << queued_max * 1000 / OUTPUT_RATE << "ms max) + one "
+              << PERIOD * 1000 / OUTPUT_RATE << "ms period\n"
+              << "ratio " << ratio_min / resampler.nominalRatio() << " to "
+              << ratio_max / resampler.nominalRatio() << " of nominal\n";
+}
+
+}
+
+auto main(int argc, char** argv) -> int {
+    const double seconds = argc > 1 ? std::atof(argv[1]) : 3;
+    Source source;
+    std::vector<int16_t> input;
+    std::vector<int16_t> frame;
+    while(input.size() < 10 * INPUT_RATE) {
+        source.nextFrame(frame);
+        input.insert(input.end(), frame.begin(), frame.end());
+    }
+    timeResampler(input);
+    runRealTime(seconds);
+    return 0;
+}
@@ -0,0 +1,103 @@
+// Times each compositor version on a frame's worth of full scanlines, each
+// with 8 sprites over a scrolled background. Prints the mean time per
+// scanline, the budget is well under 1 us.
+#include <nes/compositor.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t LINES = 240;
+constexpr uint32_t SPRITES_PER_LINE = 8;
+
+struct Path {
+    std::string name;
+    compositor::ComposeFn fn;
+    bool supported;
+};
+
+// Fills one line the way the PPU would: a background with runs of a few
+// colors, 8 sprites of 8 pixels at random positions with some behind the
+// background, the first of them sprite 0
+auto fillLine(ScanlineLayers& layers, std::mt19937& rng) -> void {
+    for(size_t x = 0; x < layers.background.size(); x++) {
+        layers.background[x] = (x % 5 == 0) ? rng() % 16 : layers.background[x - 1];
+    }
+    layers.sprites.fill(0);
+    layers.behind.fill(0);
+    layers.sprite0.fill(0);
+    for(uint32_t sprite = 0; sprite < SPRITES_PER_LINE; sprite++) {
+        const uint32_t left = rng() % ScanlineLayers::WIDTH;
+        const uint8_t palette = 0x10 | (rng() % 4) << 2;
+        const uint8_t behind = rng() % 4 == 0 ? 0xFF : 0x00;
+        for(uint32_t x = left; x < left + 8 && x < ScanlineLayers::WIDTH; x++) {
+            // Lower sprites win, the first opaque pixel stays
+            if(layers.sprites[x] & 0x03) {
+                continue;
+            }
+            layers.sprites[x] = palette | (rng() % 4);
+            layers.behind[x] = behind;
+            layers.sprite0[x] = sprite == 0 ? 0xFF : 0x00;
+        }
+    }
+}
+
+}
+
+auto main(int argc, char** argv) -> int {
+    const int frames = argc > 1 ? std::atoi(argv[1]) : 2000;
+    std::mt19937 rng{2026};
+    std::vector<ScanlineLayers> layers(LINES);
+    std::vector<compositor::Line> lines;
+    std::array<uint8_t, 32> palette;
+    for(uint8_t& color : palette) {
+        color = rng() % 64;
+    }
+    for(uint32_t y = 0; y < LINES; y++) {
+        fillLine(layers[y], rng);
+        lines.push_back({&layers[y].background[y % 8], layers[y].sprites.data(), layers[y].behind.data(),
+                         layers[y].sprite0.data(), palette.data(), 0x3F});
+    }
+
+    std::vector<Path> paths{{"scalar", compositor::composeScalar, true}};
+#ifdef TWIX_COMPOSITOR_X86
+    paths.push_back({"sse4.1", compositor::composeSse41, Components::cpuFeatures().sse41});
+    paths.push_back({"avx2", compositor::composeAvx2, Components::cpuFeatures().avx2});
+#endif
+
+    std::vector<uint8_t> expected(LINES * ScanlineLayers::WIDTH);
+    std::vector<int32_t> expected_hits(LINES);
+    for(uint32_t y = 0; y < LINES; y++) {
+        expected_hits[y] = compositor::composeScalar(lines[y], &expected[y * ScanlineLayers::WIDTH]);
+    }
+    std::vector<uint8_t> out(LINES * ScanlineLayers::WIDTH);
+    for(const Path& path : paths) {
+        if(!path.supported) {
+            std::cout << path.name << ": not supported on this CPU\n";
+            continue;
+        }
+        bool matches = true;
+        for(uint32_t y = 0; y < LINES; y++) {
+            matches &= path.fn(lines[y], &out[y * ScanlineLayers::WIDTH]) == expected_hits[y];
+        }
+        matches &= out == expected;
+
+        // Summed so the calls can't be dropped
+        int64_t hits = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < frames; i++) {
+            for(uint32_t y = 0; y < LINES; y++) {
+                hits += path.fn(lines[y], &out[y * ScanlineLayers::WIDTH]);
+            }
+        }
+        const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << path.name << ": " << elapsed.count() / (static_cast<double>(frames) * LINES) << " ns/scanline, "
+                  << elapsed.count() / frames / 1000 << " us/frame" << (matches ? "" : ", DOES NOT MATCH scalar")
+                  << " (" << hits << ")\n";
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+// Runs the same frames three ways and prints the time per frame of each:
+// instruction by instruction (runCycle), in batches between scheduled
+// events (runUntil), and as cooperative CPU/PPU/APU threads stepping every
+// cycle. Also checks that all three end up in the same state.
+//   cothread_bench [rom.nes] [frames]
+// Without a ROM a built-in program is used: NMI every frame doing OAM DMA
+// and APU writes, a DMC sample playing and a main loop polling $2002.
+#include <nes/cooperative.hpp>
+#include <nes/nes.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr uint64_t FRAME_CYCLES = 29781;
+
+// The built-in program as a one-bank NROM image in the temp directory
+auto writeBuiltinRom() -> std::filesystem::path {
+    std::vector<uint8_t> prg(0x4000, 0xEA);
+    //   $C000: SEI ; frame IRQ off ; DMC 65 bytes at rate 15 ; enable ; NMI on
+    //          loop: LDA $2002 ; INC $00 ; JMP loop
+    //   $C080 NMI: INC $01 ; OAM DMA from $0200 ; pulse 1 timer = $01 ; restart DMC ; RTI
+    const std::vector<uint8_t> main = {
+        0x78, 0xA9, 0x40, 0x8D, 0x17, 0x40, 0xA9, 0x04, 0x8D, 0x13, 0x40, 0xA9, 0x0F, 0x8D, 0x10, 0x40,
+        0xA9, 0x10, 0x8D, 0x15, 0x40, 0xA9, 0x80, 0x8D, 0x00, 0x20, 0xAD, 0x02, 0x20, 0xE6, 0x00, 0x4C,
+        0x1A, 0xC0,
+    };
+    const std::vector<uint8_t> nmi = {
+        0xE6, 0x01, 0xA9, 0x02, 0x8D, 0x14, 0x40, 0xA5, 0x01, 0x8D, 0x02, 0x40, 0xA9, 0x10, 0x8D, 0x15,
+        0x40, 0x40,
+    };
+    std::copy(main.begin(), main.end(), prg.begin());
+    std::copy(nmi.begin(), nmi.end(), prg.begin() + 0x80);
+    prg[0x3FFA] = 0x80;
+    prg[0x3FFB] = 0xC0;
+    prg[0x3FFC] = 0x00;
+    prg[0x3FFD] = 0xC0;
+    const uint8_t header[16] = {'N', 'E', 'S', 0x1A, 1, 0};
+    const auto path = std::filesystem::temp_directory_path() / "twix_cothread_bench.nes";
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(prg.data()), prg.size());
+    return path;
+}
+
+auto start(Nes<Mapper0>& nes) -> void {
+    const uint16_t reset = nes.bus().load(0xFFFC) | nes.bus().load(0xFFFD) << 8;
+    nes.cpu().setPC(reset);
+}
+
+template<typename Fn>
+auto time(uint64_t frames, Fn&& run) -> double {
+    const auto begin = std::chrono::steady_clock::now();
+    run();
+    const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - begin;
+    return elapsed.count() / frames;
+}
+
+// Brings the lagging PPU and APU up to the CPU so the states compare
+auto settle(Nes<Mapper0>& nes) -> void {
+    nes.ppu().sync();
+    nes.apu().endFrame();
+}
+
+}
+
+auto main(int argc, char** argv) -> int {
+    const std::filesystem::path rom_path = argc > 1 ? std::filesystem::path(argv[1]) : writeBuiltinRom();
+    const uint64_t frames = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 600;
+    const uint64_t end = frames * FRAME_CYCLES;
+    cores::mos6502::NesRom rom{rom_path};
+
+    Nes<Mapper0> stepped{rom};
+    start(stepped);
+    const double stepped_us = time(frames, [&] {
+        while(stepped.arena().cpu.Cycles < end) {
+            stepped.runCycle();
+        }
+    });
+
+    Nes<Mapper0> batched{rom};
+    start(batched);
+    const double batched_us = time(frames, [&] {
+        for(uint64_t frame = 1; frame <= frames; frame++) {
+            batched.runUntil(frame * FRAME_CYCLES);
+        }
+    });
+
+    CooperativeNes<Mapper0> cooperative{rom};
+    start(cooperative.nes());
+    const double cooperative_us = time(frames, [&] {
+        for(uint64_t frame = 1; frame <= frames; frame++) {
+            cooperative.runUntil(frame * FRAME_CYCLES);
+        }
+    });
+
+    settle(stepped);
+    settle(batched);
+    settle(cooperative.nes());
+    const auto same = [&](const Nes<Mapper0>& other) {
+        return std::memcmp(&stepped.arena(), &other.arena(), sizeof(stepped.arena())) == 0;
+    };
+    std::cout << frames << " frames\n"
+              << "stepped:     " << stepped_us << " us/frame\n"
+              << "batched:     " << batched_us << " us/frame, " << double(batched.batches()) / frames
+              << " batches/frame\n"
+              << "cooperative: " << cooperative_us << " us/frame, "
+              << double(cooperative.scheduler().switches()) / frames << " switches/frame\n"
+              << "states " << (same(batched) && same(cooperative.nes()) ? "match" : "DIFFER") << "\n";
+    return same(batched) && same(cooperative.nes()) ? 0 : 1;
+}
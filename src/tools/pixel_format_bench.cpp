@@ -0,0 +1,74 @@
+// Times pixel_format::convert for every output format and every line
+// converter this CPU can run, on a frame of random colors with emphasis
+// changing every line. Prints the mean time per 256x240 frame.
+#include <nes/pixel_format.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Converter {
+    std::string name;
+    pixel_format::ConvertFn fn;
+};
+
+auto converters() -> std::vector<Converter> {
+    std::vector<Converter> list{{"scalar", pixel_format::convertLineScalar}};
+#ifdef TWIX_PIXEL_FORMAT_X86
+    if(Components::cpuFeatures().sse41) {
+        list.push_back({"sse4.1", pixel_format::convertLineSse41});
+    }
+    if(Components::cpuFeatures().avx2) {
+        list.push_back({"avx2", pixel_format::convertLineAvx2});
+    }
+#endif
+    return list;
+}
+
+auto formatName(PixelFormat format) -> std::string {
+    switch(format) {
+        case PixelFormat::INDICES: return "indices";
+        case PixelFormat::RGBA8888: return "rgba8888";
+        case PixelFormat::BGRA8888: return "bgra8888";
+        case PixelFormat::RGB565: return "rgb565";
+        case PixelFormat::GRAY8: return "gray8";
+    }
+    return "?";
+}
+
+}
+
+auto main(int argc, char** argv) -> int {
+    const int frames = argc > 1 ? std::atoi(argv[1]) : 2000;
+    std::mt19937 rng{2026};
+    std::vector<uint8_t> indices(FrameView::WIDTH * FrameView::HEIGHT);
+    std::vector<uint8_t> emphasis(FrameView::HEIGHT);
+    for(auto& index : indices) {
+        index = rng() & 0x3F;
+    }
+    for(size_t y = 0; y < emphasis.size(); y++) {
+        emphasis[y] = y & 0x07;
+    }
+    const FrameView frame{indices, emphasis};
+    std::vector<uint8_t> out(FrameView::WIDTH * FrameView::HEIGHT * 4);
+
+    for(PixelFormat format : {PixelFormat::INDICES, PixelFormat::RGBA8888, PixelFormat::BGRA8888,
+                              PixelFormat::RGB565, PixelFormat::GRAY8}) {
+        for(const Converter& converter : converters()) {
+            pixel_format::convert(frame, format, out, 0, converter.fn);
+            const auto start = std::chrono::steady_clock::now();
+            for(int i = 0; i < frames; i++) {
+                pixel_format::convert(frame, format, out, 0, converter.fn);
+                asm volatile("" : : "r"(out.data()) : "memory");
+            }
+            const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+            std::cout << formatName(format) << " " << converter.name << ": "
+                      << elapsed.count() / frames << " us/frame\n";
+        }
+    }
+    return 0;
+}
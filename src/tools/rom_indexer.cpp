@@ -0,0 +1,356 @@
+// Indexes a ROM library: walks a directory tree on a work-stealing pool, maps
+// each image, validates it through INesHeader, hashes PRG+CHR and writes one
+// CSV row per file. Images are handed out in small batches, so a flat library
+// spreads over every worker as well as a deep tree does. Rows from a previous
+// index are reused when a file's mtime and size are unchanged, so re-runs
+// only touch new or modified images. With --db, known bad headers are
+// indexed with the database's corrections; reused rows are not looked up
+// again, re-index from scratch after changing the database.
+#include <cores/mos6502/nesRom.hpp>
+#include <cores/mos6502/romDatabase.hpp>
+#include <utils/hash.hpp>
+#include <utils/mapped_file.hpp>
+#include <utils/thread_pool.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct IndexRecord {
+    int64_t mtime_ns = 0;
+    uint64_t size = 0;
+    std::string status;  // "ok" or why the file was rejected
+    std::string version;
+    uint16_t mapper = 0;
+    uint8_t submapper = 0;
+    size_t prg_rom = 0;
+    size_t chr_rom = 0;
+    size_t prg_ram = 0;
+    size_t chr_ram = 0;
+    std::string mirroring;
+    bool battery = false;
+    bool trainer = false;
+    bool corrected = false;  // Header fields come from the ROM database
+    uint32_t crc32 = 0;
+    std::string sha1;
+    std::string path;
+};
+
+constexpr const char* CSV_HEADER =
+    "mtime_ns,size,status,version,mapper,submapper,prg_rom,chr_rom,prg_ram,chr_ram,"
+    "mirroring,battery,trainer,corrected,crc32,sha1,path";
+
+auto toCsv(const IndexRecord& r) -> std::string {
+    // path goes last so it may contain commas
+    return std::format("{},{},{},{},{},{},{},{},{},{},{},{},{},{},{:08x},{},{}",
+        r.mtime_ns, r.size, r.status, r.version, r.mapper, r.submapper, r.prg_rom, r.chr_rom,
+        r.prg_ram, r.chr_ram, r.mirroring, r.battery ? 1 : 0, r.trainer ? 1 : 0, r.corrected ? 1 : 0,
+        r.crc32, r.sha1, r.path);
+}
+
+auto fromCsv(const std::string& line, IndexRecord& r) -> bool {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (fields.size() < 16) {
+        size_t comma = line.find(',', start);
+        if (comma == std::string::npos) {
+            return false;
+        }
+        fields.push_back(line.substr(start, comma - start));
+        start = comma + 1;
+    }
+    try {
+        r.mtime_ns = std::stoll(fields[0]);
+        r.size = std::stoull(fields[1]);
+        r.status = fields[2];
+        r.version = fields[3];
+        r.mapper = static_cast<uint16_t>(std::stoul(fields[4]));
+        r.submapper = static_cast<uint8_t>(std::stoul(fields[5]));
+        r.prg_rom = std::stoull(fields[6]);
+        r.chr_rom = std::stoull(fields[7]);
+        r.prg_ram = std::stoull(fields[8]);
+        r.chr_ram = std::stoull(fields[9]);
+        r.mirroring = fields[10];
+        r.battery = fields[11] == "1";
+        r.trainer = fields[12] == "1";
+        r.corrected = fields[13] == "1";
+        r.crc32 = static_cast<uint32_t>(std::stoul(fields[14], nullptr, 16));
+        r.sha1 = fields[15];
+    } catch (const std::exception&) {
+        return false;
+    }
+    r.path = line.substr(start);
+    return true;
+}
+
+auto toHex(const Components::Sha1Digest& digest) -> std::string {
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(40);
+    for (auto b : digest) {
+        out += digits[b >> 4];
+        out += digits[b & 0xF];
+    }
+    return out;
+}
+
+auto mirroringName(cores::mos6502::Mirroring m) -> const char* {
+    switch (m) {
+        case cores::mos6502::Mirroring::HORIZONTAL: return "horizontal";
+        case cores::mos6502::Mirroring::VERTICAL: return "vertical";
+        case cores::mos6502::Mirroring::FOUR_SCREEN: return "four-screen";
+        case cores::mos6502::Mirroring::SINGLE_SCREEN_LOWER: return "single-lower";
+        case cores::mos6502::Mirroring::SINGLE_SCREEN_UPPER: return "single-upper";
+    }
+    return "unknown";
+}
+
+// Same checks NesRom::loadRom does, but on the mapped bytes so nothing is copied
+auto indexRom(IndexRecord& r, const cores::mos6502::RomDatabase* database) -> void {
+    auto file = Components::MappedFile::openReadOnly(r.path);
+    auto bytes = file.bytes();
+    cores::mos6502::INesHeader header{};
+    if (bytes.size() < sizeof(header)) {
+        r.status = "too-small";
+        return;
+    }
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (!header.isValid()) {
+        r.status = "bad-magic";
+        return;
+    }
+    auto version = header.getVersion();
+    if (version == cores::mos6502::INesVersion::UNKNOWN) {
+        r.status = "bad-version";
+        return;
+    }
+    size_t trainer = header.hasTrainer() ? 512 : 0;
+    size_t contents = header.getPrgRomSize() + header.getChrRomSize();
+    if (bytes.size() < sizeof(header) + trainer + contents) {
+        r.status = "truncated";
+        return;
+    }
+    auto data = bytes.subspan(sizeof(header) + trainer, contents);
+    r.status = "ok";
+    r.version = version == cores::mos6502::INesVersion::INES_2_0 ? "2.0" : "1.0";
+    r.mapper = header.getMapperNumber();
+    r.submapper = header.getSubmapperNumber();
+    r.prg_rom = header.getPrgRomSize();
+    r.chr_rom = header.getChrRomSize();
+    r.prg_ram = header.getPrgRamSize();
+    r.chr_ram = header.getChrRamSize();
+    r.mirroring = mirroringName(header.getMirroring());
+    r.battery = header.hasBatteryBackedRAM();
+    r.trainer = header.hasTrainer();
+    r.crc32 = Components::crc32(data);
+    const auto sha1 = Components::sha1(data);
+    r.sha1 = toHex(sha1);
+    // The same correction NesRom::applyOverride makes at load time
+    const auto* entry = database ? database->find(r.crc32, sha1) : nullptr;
+    if (entry) {
+        const auto& fix = entry->fix;
+        if (fix.mirroring > static_cast<uint8_t>(cores::mos6502::Mirroring::SINGLE_SCREEN_UPPER)) {
+            r.status = "bad-override";
+            return;
+        }
+        r.corrected = true;
+        r.mapper = fix.mapper;
+        r.submapper = fix.submapper;
+        r.prg_ram = fix.prg_ram_size;
+        r.chr_ram = fix.chr_ram_size;
+        r.mirroring = mirroringName(static_cast<cores::mos6502::Mirroring>(fix.mirroring));
+        r.battery = fix.battery != 0;
+    }
+}
+
+struct Indexer {
+    // Files per task: enough to amortise the submit, few enough that a flat
+    // directory of thousands of images spreads over every worker
+    static constexpr size_t FILE_BATCH = 32;
+
+    Components::ThreadPool& pool;
+    const cores::mos6502::RomDatabase* database = nullptr;
+    std::unordered_map<std::string, IndexRecord> previous;
+    std::mutex results_mutex;
+    std::vector<IndexRecord> results;
+    std::atomic<size_t> reused{0};
+    std::atomic<size_t> indexed{0};
+
+    explicit Indexer(Components::ThreadPool& pool) : pool(pool) {}
+
+    // Indexes everything under root and returns once this indexer's own
+    // tasks are done, whatever else the pool is running
+    auto run(const fs::path& root) -> void {
+        spawn([this, root] { walk(root); });
+        std::unique_lock lock(done_mutex_);
+        done_.wait(lock, [this] { return outstanding_.load(std::memory_order_acquire) == 0; });
+    }
+
+private:
+    template<typename Fn>
+    auto spawn(Fn&& task) -> void {
+        outstanding_.fetch_add(1, std::memory_order_relaxed);
+        pool.submit([this, task = std::forward<Fn>(task)] {
+            task();
+            if (outstanding_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard lock(done_mutex_);
+                done_.notify_all();
+            }
+        });
+    }
+
+    // Lists one directory: subdirectories fan out as new walks, images go
+    // out in batches of FILE_BATCH
+    auto walk(const fs::path& dir) -> void {
+        std::vector<fs::path> batch;
+        std::error_code ec;
+        for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            const auto& entry = *it;
+            if (entry.is_directory(ec)) {
+                // A linked directory can point back up the tree, only real
+                // subdirectories are walked
+                if (!entry.is_symlink(ec)) {
+                    spawn([this, sub = entry.path()] { walk(sub); });
+                }
+                continue;
+            }
+            auto ext = entry.path().extension().string();
+            std::transform(ext.begin(), ext.end(), ext.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            if (!entry.is_regular_file(ec) || ext != ".nes") {
+                continue;
+            }
+            batch.push_back(entry.path());
+            if (batch.size() == FILE_BATCH) {
+                spawn([this, files = std::move(batch)] { indexFiles(files); });
+                batch.clear();
+            }
+        }
+        if (!batch.empty()) {
+            spawn([this, files = std::move(batch)] { indexFiles(files); });
+        }
+    }
+
+    auto indexFiles(const std::vector<fs::path>& files) -> void {
+        std::vector<IndexRecord> local;
+        local.reserve(files.size());
+        for (const auto& path : files) {
+            struct stat st{};
+            if (::stat(path.c_str(), &st) != 0) {
+                continue;
+            }
+            IndexRecord r;
+            r.path = path.string();
+            r.size = static_cast<uint64_t>(st.st_size);
+            r.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+            auto old = previous.find(r.path);
+            if (old != previous.end() && old->second.size == r.size && old->second.mtime_ns == r.mtime_ns) {
+                local.push_back(old->second);
+                reused++;
+                continue;
+            }
+            try {
+                indexRom(r, database);
+            } catch (const std::exception&) {
+                r.status = "unreadable";
+            }
+            local.push_back(std::move(r));
+            indexed++;
+        }
+        std::lock_guard lock(results_mutex);
+        std::move(local.begin(), local.end(), std::back_inserter(results));
+    }
+
+    std::atomic<size_t> outstanding_{0};
+    std::mutex done_mutex_;
+    std::condition_variable done_;
+};
+
+auto loadIndex(const fs::path& path) -> std::unordered_map<std::string, IndexRecord> {
+    std::unordered_map<std::string, IndexRecord> index;
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line) || line != CSV_HEADER) {
+        return index;
+    }
+    while (std::getline(in, line)) {
+        IndexRecord r;
+        if (fromCsv(line, r)) {
+            index.emplace(r.path, std::move(r));
+        }
+    }
+    return index;
+}
+
+auto writeIndex(const fs::path& path, std::vector<IndexRecord>& records) -> void {
+    std::sort(records.begin(), records.end(), [](const auto& a, const auto& b) { return a.path < b.path; });
+    // Write next to the target and rename, a crash never leaves half an index
+    auto tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        out << CSV_HEADER << "\n";
+        for (const auto& r : records) {
+            out << toCsv(r) << "\n";
+        }
+        if (!out) {
+            throw std::runtime_error("Failed to write " + tmp.string());
+        }
+    }
+    fs::rename(tmp, path);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> args;
+    std::optional<cores::mos6502::RomDatabase> database;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--db" && i + 1 < argc) {
+            database.emplace(argv[++i]);
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.size() < 2) {
+        std::cout << "Usage: " << argv[0] << " <rom_directory> <index.csv> [threads] [--db <rom database>]\n";
+        return 1;
+    }
+    fs::path root = args[0];
+    fs::path index_path = args[1];
+    size_t threads = args.size() > 2 ? std::stoul(args[2]) : std::thread::hardware_concurrency();
+
+    auto start = std::chrono::steady_clock::now();
+    Components::ThreadPool pool(threads);
+    Indexer indexer(pool);
+    indexer.database = database ? &*database : nullptr;
+    indexer.previous = loadIndex(index_path);
+    indexer.run(root);
+
+    try {
+        writeIndex(index_path, indexer.results);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::format("Indexed {} ROMs ({} unchanged) in {:.3f}s on {} threads\n",
+        indexer.indexed.load(), indexer.reused.load(), elapsed, pool.size());
+    return 0;
+}
@@ -0,0 +1,60 @@
+// Times saveState() and loadState() on a running system and prints the
+// average of each and the state size.
+//   save_state_bench [rom.nes] [iterations]
+// Without a ROM an NROM image that just loops is used; the state size only
+// depends on the mapper and whether there is battery RAM.
+#include <nes/nes.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+auto writeBuiltinRom() -> std::filesystem::path {
+    // $C000: INC $00 ; JMP $C000
+    std::vector<uint8_t> prg(0x4000, 0xEA);
+    const std::vector<uint8_t> loop = {0xE6, 0x00, 0x4C, 0x00, 0xC0};
+    std::copy(loop.begin(), loop.end(), prg.begin());
+    prg[0x3FFC] = 0x00;
+    prg[0x3FFD] = 0xC0;
+    const uint8_t header[16] = {'N', 'E', 'S', 0x1A, 1, 0};
+    const auto path = std::filesystem::temp_directory_path() / "twix_save_state_bench.nes";
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(prg.data()), prg.size());
+    return path;
+}
+
+template<typename Fn>
+auto time(uint64_t iterations, Fn&& run) -> double {
+    const auto begin = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < iterations; i++) {
+        run();
+    }
+    const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - begin;
+    return elapsed.count() / iterations;
+}
+
+}
+
+auto main(int argc, char** argv) -> int {
+    const std::filesystem::path rom_path = argc > 1 ? std::filesystem::path(argv[1]) : writeBuiltinRom();
+    const uint64_t iterations = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100000;
+    cores::mos6502::NesRom rom{rom_path};
+    Nes<Mapper0> nes{rom};
+    nes.cpu().setPC(nes.bus().load(0xFFFC) | nes.bus().load(0xFFFD) << 8);
+    nes.runFrame();
+
+    // Allocated once, saving and loading never allocate
+    std::vector<uint8_t> state(nes.stateSize());
+    const double save_us = time(iterations, [&] { nes.saveState(state); });
+    const double load_us = time(iterations, [&] { nes.loadState(state); });
+    std::cout << "state:  " << state.size() << " bytes\n"
+              << "save:   " << save_us << " us\n"
+              << "load:   " << load_us << " us\n"
+              << "round trip: " << save_us + load_us << " us\n";
+    return 0;
+}
@@ -0,0 +1,64 @@
+// Times each scaler at the largest factor that fits a 1080p screen, on one
+// thread and through a FrameScaler on the thread pool. Prints the mean time
+// per frame and the pool's throughput.
+#include <nes/scaler.hpp>
+#include <utils/thread_pool.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Config {
+    std::string name;
+    ScaleFilter filter;
+    uint32_t factor;
+};
+
+}
+
+auto main(int argc, char** argv) -> int {
+    const int frames = argc > 1 ? std::atoi(argv[1]) : 200;
+    std::mt19937 rng{2026};
+    std::vector<uint8_t> indices(FrameView::WIDTH * FrameView::HEIGHT);
+    std::vector<uint8_t> emphasis(FrameView::HEIGHT);
+    // Runs of a few colors, closer to game graphics than noise
+    for(size_t i = 0; i < indices.size(); i++) {
+        indices[i] = (i % 7 == 0 || i == 0) ? rng() % 8 : indices[i - 1];
+    }
+    const FrameView frame{indices, emphasis};
+
+    const Config configs[] = {
+        {"nearest 4x", ScaleFilter::NEAREST, 4},
+        {"scale2x 4x", ScaleFilter::SCALE2X, 4},
+        {"scale3x 3x", ScaleFilter::SCALE3X, 3},
+        {"xbr 4x", ScaleFilter::XBR, 4},
+    };
+    Components::ThreadPool pool;
+    for(const Config& config : configs) {
+        const size_t pitch = FrameView::WIDTH * config.factor * 4;
+        std::vector<uint8_t> out(pitch * FrameView::HEIGHT * config.factor);
+        scaler::Workspace ws;
+        scaler::scale(frame, config.filter, config.factor, 0, FrameView::HEIGHT, out, pitch, ws);
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < frames; i++) {
+            scaler::scale(frame, config.filter, config.factor, 0, FrameView::HEIGHT, out, pitch, ws);
+        }
+        const std::chrono::duration<double, std::micro> single = std::chrono::steady_clock::now() - start;
+
+        FrameScaler pooled{pool, config.filter, config.factor, pool.size() * 2};
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < frames; i++) {
+            pooled.submit(frame, i + 1);
+            pooled.waitIdle();
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << config.name << " (" << FrameView::WIDTH * config.factor << "x"
+                  << FrameView::HEIGHT * config.factor << "): " << single.count() / frames << " us/frame, "
+                  << frames / elapsed.count() << " fps on " << pool.size() << " threads\n";
+    }
+    return 0;
+}